@@ -0,0 +1,24 @@
+#version 460
+
+// One instance per box drawn as 24 line vertices
+layout(location = 0) in vec3 boxMin;
+layout(location = 1) in vec3 boxMax;
+layout(location = 2) in vec3 color;
+
+uniform mat4 VP;
+
+out vec3 vColor;
+
+// Corners are numbered by bit 0 = x, bit 1 = y, bit 2 = z at the max side
+const int EDGES[24] = int[](
+   0, 1, 1, 5, 5, 4, 4, 0,
+   2, 3, 3, 7, 7, 6, 6, 2,
+   0, 2, 1, 3, 5, 7, 4, 6
+);
+
+void main() {
+   int corner = EDGES[gl_VertexID];
+   vec3 t = vec3(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1);
+   gl_Position = VP * vec4(mix(boxMin, boxMax, t), 1.0f);
+   vColor = color;
+}
\ No newline at end of file
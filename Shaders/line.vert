@@ -1,13 +1,17 @@
 #version 460
 
-layout(location = 0) in vec3 position;
-layout(location = 1) in vec3 color;
+// One instance per line, gl_VertexID picks the endpoint
+layout(location = 0) in vec3 p0;
+layout(location = 1) in vec3 c0;
+layout(location = 2) in vec3 p1;
+layout(location = 3) in vec3 c1;
 
 uniform mat4 VP;
 
 out vec3 vColor;
 
 void main() {
-   gl_Position = VP * vec4(position, 1.0f);
-   vColor = color;
+   bool second = gl_VertexID == 1;
+   gl_Position = VP * vec4(second ? p1 : p0, 1.0f);
+   vColor = second ? c1 : c0;
 }
\ No newline at end of file
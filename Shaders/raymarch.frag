@@ -11,23 +11,47 @@ void swap(inout float a, inout float b) {
 }
 
 const float PI = 3.141592;
+const float GOLDEN_RATIO_CONJUGATE = 0.618034;
 
 uniform vec2 uRadius;
 
+#ifdef MULTI_VIEW
+// Batched views, the matrices of the view this fragment belongs to are copied
+// out of the arrays at the start of main so the rest of the shader is shared
+#define MAX_VIEWS 8
+uniform mat4 uViewInvP[MAX_VIEWS];
+uniform mat4 uViewInvV[MAX_VIEWS];
+uniform vec3 uViewCamPos[MAX_VIEWS];
+flat in int vViewIndex;
+
+mat4 uInvP;
+mat4 uInvV;
+vec3 uCamPos;
+#else
 uniform mat4 uInvP;
 uniform mat4 uInvV;
 uniform vec3 uCamPos;
+#endif
 uniform float uCloudScale;
 uniform vec3 uCloudOffset;
+// Wind scroll of the evolving noise, zero while the volume tiles
+uniform vec3 uNoiseScroll;
+// Edge of the evolving window over xz in tile coordinates, blended away by SampleNoise1()
+uniform int uEvolveSeamBlend;
+uniform vec2 uEvolveSeam;
+#define EVOLVE_SEAM_BAND 0.125f
 uniform float uDensityMultiplier;
 uniform float uDensityThreshold;
 uniform vec2 uLightAbsorption;
 
 uniform sampler3D uNoiseTex1;
 uniform sampler3D uNoiseTex2;
-uniform sampler2D uBlueNoiseTex;
+// Spatiotemporal blue noise, one slice per frame
+uniform sampler2DArray uBlueNoiseTex;
+uniform int uFrameIndex;
 uniform sampler2D uDepthTexture;
 uniform sampler2D uSceneTexture;
+uniform sampler2D uWeatherTex;
 
 uniform vec3 uLightDirection;
 uniform vec4 uLightColor;
@@ -35,8 +59,82 @@ uniform vec4 uLayerContribution;
 uniform float uPhaseG;
 uniform int uSugarPowder;
 
-const int MAX_RAYMARCH_STEP = 32;
-const int MAX_LIGHTMARCH_STEP = 6;
+// Explicit LOD selection for the noise volumes
+uniform int uUseLod;
+uniform float uLodBias;
+uniform float uLodStepFactor;
+uniform float uHighFreqCutoff;
+
+// Weather map, R - coverage, G - cloud type, B - precipitation
+uniform int uUseWeatherMap;
+uniform float uWeatherScale;
+uniform float uPrecipitationDensity;
+
+#define RENDER_MODE_COMPOSITE 0
+#define RENDER_MODE_FAR_FIELD 1
+
+uniform int uRenderMode;
+uniform vec2 uDepthRange;
+uniform float uViewportHeight;
+
+// Distant clouds, rgb radiance and alpha transmittance past uFarFieldDistance
+uniform samplerCube uPanoramaTex;
+uniform int uUsePanorama;
+uniform float uFarFieldDistance;
+uniform float uPanoramaAmbient;
+uniform float uPanoramaMaxLod;
+
+// Precomputed atmosphere, both tables are indexed by the cosine of the sun
+// zenith angle and sqrt of the normalized altitude, values per unit sun
+uniform int uUseAtmosphere;
+uniform sampler2D uTransmittanceLUT;
+uniform sampler2D uSkyAmbientLUT;
+uniform float uSkyAmbientStrength;
+uniform float uAtmosphereHeight;
+
+uniform int uRaymarchSteps;
+uniform int uLightmarchSteps;
+
+// Virtual noise volume, the first noise volume paged in 32^3 bricks over a
+// domain that repeats every uVirtualDomainBricks * 32 texels. The indirection
+// holds the atlas slot of every brick and alpha 1 when it is resident, slots
+// are 34^3 with a one texel border. See VirtualNoiseVolume.
+#define MAX_VIRTUAL_LEVELS 8
+#define VIRTUAL_BRICK_SIZE 32.0f
+#define VIRTUAL_SLOT_SIZE 34.0f
+uniform int uUseVirtualNoise;
+uniform usampler3D uNoiseIndirection;
+uniform sampler3D uNoiseAtlas;
+uniform int uVirtualDomainBricks;
+uniform int uVirtualLevels;
+uniform int uVirtualLevelOffset[MAX_VIRTUAL_LEVELS];
+
+// One bit per brick of every level, set for the bricks the march wanted
+layout(std430, binding = 0) buffer VirtualNoiseFeedback {
+   uint uRequestedBricks[];
+};
+
+// Authored sparse volume in the world box uAuthoredMin - uAuthoredMax, see
+// SparseVolume. The table holds a top level grid of 4^3 brick cells, 0 when
+// empty or 1 + page, followed by the pages of 64 atlas slots.
+#define AUTHORED_ADD 0
+#define AUTHORED_REPLACE 1
+#define AUTHORED_CELL_BRICKS 4
+#define AUTHORED_EMPTY_SLOT 0xffffffffu
+uniform int uUseAuthored;
+uniform int uAuthoredMode;
+uniform float uAuthoredDensity;
+uniform vec3 uAuthoredMin;
+uniform vec3 uAuthoredMax;
+uniform ivec3 uAuthoredGrid;
+uniform ivec3 uAuthoredCellGrid;
+uniform ivec3 uAuthoredAtlasSlots;
+uniform int uAuthoredBrickSize;
+uniform sampler3D uAuthoredAtlas;
+
+layout(std430, binding = 1) readonly buffer AuthoredBrickTable {
+   uint uAuthoredTable[];
+};
 
 
 float Remap(in float val, in float inMin, in float inMax, in float outMin, in float outMax) {
@@ -56,6 +154,44 @@ float GetHeightFraction(vec3 p)
   return (p.y - uRadius.x) / (uRadius.y - uRadius.x);
 }
 
+float GetShellHeightFraction(vec3 p)
+{
+  return clamp((length(p) - uRadius.x) / (uRadius.y - uRadius.x), 0.0f, 1.0f);
+}
+
+// Height profiles for stratus, stratocumulus and cumulus blended by cloud type
+float GetDensityHeightGradient(float heightFraction, float cloudType)
+{
+  const vec4 stratus = vec4(0.0f, 0.1f, 0.2f, 0.3f);
+  const vec4 stratocumulus = vec4(0.02f, 0.2f, 0.48f, 0.625f);
+  const vec4 cumulus = vec4(0.0f, 0.1625f, 0.88f, 0.98f);
+  vec4 gradient = mix(mix(stratus, stratocumulus, clamp(cloudType * 2.0f, 0.0f, 1.0f)),
+                      cumulus, clamp(cloudType * 2.0f - 1.0f, 0.0f, 1.0f));
+  return smoothstep(gradient.x, gradient.y, heightFraction) - smoothstep(gradient.z, gradient.w, heightFraction);
+}
+
+vec3 SampleWeather(vec3 p)
+{
+  return textureLod(uWeatherTex, p.xz / uWeatherScale + 0.5f, 0.0f).rgb;
+}
+
+// The LUTs store the value at the edges of the uv range in the first and last texel
+vec2 LutUV(sampler2D lut, vec2 uv) {
+   vec2 size = vec2(textureSize(lut, 0));
+   return (uv * (size - 1.0f) + 0.5f) / size;
+}
+
+vec3 SampleAtmosphereLUT(sampler2D lut, float altitude, float cosSunZenith) {
+   float h = clamp(altitude / uAtmosphereHeight, 0.0f, 1.0f);
+   return textureLod(lut, LutUV(lut, vec2(cosSunZenith * 0.5f + 0.5f, sqrt(h))), 0.0f).rgb;
+}
+
+// Scene units are meters and the LUTs are in km
+vec3 GetSunColor(vec3 p) {
+   if(uUseAtmosphere == 0) return vec3(1.0f);
+   return SampleAtmosphereLUT(uTransmittanceLUT, length(p) * 0.001f, uLightDirection.y);
+}
+
 float SampleDepth(vec2 uv) {
    return texture(uDepthTexture, uv).r;
 }
@@ -64,20 +200,162 @@ float LinearizeDepth(float d, float zNear, float zFar) {
    return zNear * zFar / (zFar + d * (zNear - zFar));
 }
 
-float SampleDensity(vec3 p, float coverage) {
-   p = p * 0.001 * uCloudScale + uCloudOffset;
-   vec4 lowFreqNoise = texture(uNoiseTex1, p);
+// World space size of the region a sample stands for, the larger of the
+// pixel footprint at that distance and a fraction of the march step
+float SampleFootprint(float dist, float stepSize) {
+   float pixelAngle = 2.0 * uInvP[1][1] / uViewportHeight;
+   return max(dist * pixelAngle, stepSize * uLodStepFactor);
+}
+
+float ComputeLod(sampler3D tex, float footprint, float coordScale) {
+   float texelsPerUnit = float(textureSize(tex, 0).x) * coordScale;
+   return max(log2(footprint * texelsPerUnit) + uLodBias, 0.0f);
+}
+
+void RequestBrick(int level, ivec3 brick) {
+   int size = max(uVirtualDomainBricks >> level, 1);
+   uint index = uint(uVirtualLevelOffset[level] + (brick.z * size + brick.y) * size + brick.x);
+   uint bit = 1u << (index & 31u);
+   // Most samples find the bit already set and skip the atomic
+   if((uRequestedBricks[index >> 5] & bit) == 0u)
+      atomicOr(uRequestedBricks[index >> 5], bit);
+}
+
+// p in units of the tiling volume, lod in its texels. The brick of the wanted
+// level is requested and the finest resident level at or above it is sampled.
+vec4 SampleVirtualNoise(vec3 p, float lod) {
+   vec3 texel = mod(p * float(textureSize(uNoiseTex1, 0).x), float(uVirtualDomainBricks) * VIRTUAL_BRICK_SIZE);
+   int level = clamp(int(lod), 0, uVirtualLevels - 1);
+   for(int i = level; i < uVirtualLevels; ++i) {
+      vec3 levelTexel = texel * exp2(float(-i));
+      ivec3 brick = min(ivec3(levelTexel / VIRTUAL_BRICK_SIZE), ivec3(max(uVirtualDomainBricks >> i, 1) - 1));
+      if(i == level)
+         RequestBrick(i, brick);
+
+      uvec4 entry = texelFetch(uNoiseIndirection, brick, i);
+      if(entry.a != 0u) {
+         vec3 atlasTexel = vec3(entry.xyz) * VIRTUAL_SLOT_SIZE + 1.0f + (levelTexel - vec3(brick) * VIRTUAL_BRICK_SIZE);
+         return textureLod(uNoiseAtlas, atlasTexel / vec3(textureSize(uNoiseAtlas, 0)), 0.0f);
+      }
+   }
+   return vec4(0.0f);
+}
+
+uint GetAuthoredCell(ivec3 cell) {
+   return uAuthoredTable[(cell.z * uAuthoredCellGrid.y + cell.y) * uAuthoredCellGrid.x + cell.x];
+}
+
+float SampleAuthoredDensity(vec3 p) {
+   vec3 local = (p - uAuthoredMin) / (uAuthoredMax - uAuthoredMin);
+   if(any(lessThan(local, vec3(0.0f))) || any(greaterThanEqual(local, vec3(1.0f))))
+      return 0.0f;
+
+   // Empty top level cells are a single read
+   vec3 brickPos = local * vec3(uAuthoredGrid);
+   ivec3 brick = min(ivec3(brickPos), uAuthoredGrid - 1);
+   ivec3 cell = brick / AUTHORED_CELL_BRICKS;
+   uint page = GetAuthoredCell(cell);
+   if(page == 0u) return 0.0f;
+
+   ivec3 inCell = brick - cell * AUTHORED_CELL_BRICKS;
+   uint numCells = uint(uAuthoredCellGrid.x * uAuthoredCellGrid.y * uAuthoredCellGrid.z);
+   uint slot = uAuthoredTable[numCells + (page - 1u) * 64u + uint((inCell.z * AUTHORED_CELL_BRICKS + inCell.y) * AUTHORED_CELL_BRICKS + inCell.x)];
+   if(slot == AUTHORED_EMPTY_SLOT) return 0.0f;
+
+   // Slots have a one texel apron, the brick starts at texel 1
+   uvec3 slots = uvec3(uAuthoredAtlasSlots);
+   vec3 slotCoord = vec3(slot % slots.x, (slot / slots.x) % slots.y, slot / (slots.x * slots.y));
+   vec3 atlasTexel = slotCoord * float(uAuthoredBrickSize + 2) + 1.0f + (brickPos - vec3(brick)) * float(uAuthoredBrickSize);
+   return textureLod(uAuthoredAtlas, atlasTexel / vec3(textureSize(uAuthoredAtlas, 0)), 0.0f).r * uAuthoredDensity;
+}
+
+// Distance along rd to the far side of the top level cell around p when that
+// cell is empty, 0 when it is occupied or p is outside of the volume
+float GetAuthoredEmptySkip(vec3 p, vec3 rd) {
+   vec3 cellSize = (uAuthoredMax - uAuthoredMin) * float(AUTHORED_CELL_BRICKS) / vec3(uAuthoredGrid);
+   ivec3 cell = ivec3(floor((p - uAuthoredMin) / cellSize));
+   if(any(lessThan(cell, ivec3(0))) || any(greaterThanEqual(cell, uAuthoredCellGrid)) || GetAuthoredCell(cell) != 0u)
+      return 0.0f;
+
+   vec3 cellMin = uAuthoredMin + vec3(cell) * cellSize;
+   vec3 exit = (cellMin + step(0.0f, rd) * cellSize - p) / rd;
+   return max(min(min(exit.x, exit.y), exit.z), 0.0f);
+}
+
+// While the first noise volume holds the evolving window its tiles don't line up:
+// where a sample crosses the window's edge it jumps from one end of the window to
+// the other. Within a band around the edge the sample is blended with the ones
+// half a tile away along x and z, whose own edges are in the middle of the
+// window, so every sample fades out before it reaches its seam.
+vec4 SampleNoise1(vec3 p, float lod) {
+   vec4 noise = textureLod(uNoiseTex1, p, lod);
+   if(uEvolveSeamBlend == 0) return noise;
+
+   vec2 f = fract(p.xz - uEvolveSeam);
+   vec2 w = 1.0f - smoothstep(0.0f, EVOLVE_SEAM_BAND, min(f, 1.0f - f));
+   if(w.x > 0.0f)
+      noise = mix(noise, textureLod(uNoiseTex1, p + vec3(0.5f, 0.0f, 0.0f), lod), w.x);
+   if(w.y > 0.0f) {
+      vec4 shifted = textureLod(uNoiseTex1, p + vec3(0.0f, 0.0f, 0.5f), lod);
+      if(w.x > 0.0f)
+         shifted = mix(shifted, textureLod(uNoiseTex1, p + vec3(0.5f, 0.0f, 0.5f), lod), w.x);
+      noise = mix(noise, shifted, w.y);
+   }
+   return noise;
+}
+
+float SampleProceduralDensity(vec3 p, float coverage, float dist, float stepSize) {
+   float heightProfile = 1.0f;
+   float weatherDensity = 1.0f;
+   if(uUseWeatherMap == 1) {
+      vec3 weather = SampleWeather(p);
+      // Clear sky, none of the 3D noise has to be fetched
+      if(weather.r <= 0.0f) return 0.0f;
+
+      heightProfile = GetDensityHeightGradient(GetShellHeightFraction(p), weather.g);
+      if(heightProfile <= 0.0f) return 0.0f;
+
+      coverage = mix(1.0f, coverage, weather.r);
+      weatherDensity = 1.0f + weather.b * uPrecipitationDensity;
+   }
+
+   float noiseScale = 0.001 * uCloudScale;
+   p = p * noiseScale + uCloudOffset + uNoiseScroll;
+
+   float footprint = SampleFootprint(dist, stepSize);
+   float lod1 = uUseLod == 1 ? ComputeLod(uNoiseTex1, footprint, noiseScale) : 0.0f;
+   vec4 lowFreqNoise = uUseVirtualNoise == 1 ? SampleVirtualNoise(p, lod1) : SampleNoise1(p, lod1);
    float lowFeqFBM = dot(lowFreqNoise.gba, uLayerContribution.gba); 
    float baseCloud = Remap(lowFreqNoise.r,  -(1.0 - lowFeqFBM), 1.0, 0.0, 1.0);
    
-   vec3 highFreqNoise = texture(uNoiseTex2, p * 0.4).rgb;
-   float highFreqFBM = dot(highFreqNoise, uLayerContribution.gba);
+   // Detail noise fades out towards the cutoff and isn't fetched past it
+   float highFreqFBM = 0.0f;
+   float highFreqWeight = 1.0f - smoothstep(uHighFreqCutoff * 0.75f, uHighFreqCutoff, dist);
+   if(uUseLod == 0 || highFreqWeight > 0.0f) {
+      float lod2 = uUseLod == 1 ? ComputeLod(uNoiseTex2, footprint, noiseScale * 0.4) : 0.0f;
+      vec3 highFreqNoise = textureLod(uNoiseTex2, p * 0.4, lod2).rgb;
+      highFreqFBM = dot(highFreqNoise, uLayerContribution.gba);
+      if(uUseLod == 1)
+         highFreqFBM *= highFreqWeight;
+   }
 
    float heightGradient = GetHeightFraction(p);
    float highFreqNoiseModifier = mix(highFreqFBM, 1.0 - highFreqFBM, clamp(heightGradient, 0.0f, 1.0f));
    
    baseCloud = Remap(baseCloud, highFreqNoiseModifier * 0.2, 1.0, 0.0, 1.0);
-   return max(baseCloud - coverage, 0.0f) * uDensityMultiplier;
+   baseCloud *= heightProfile;
+   return max(baseCloud - coverage, 0.0f) * uDensityMultiplier * weatherDensity;
+}
+
+// Procedural clouds with the authored volume added on top or in their place
+float SampleDensity(vec3 p, float coverage, float dist, float stepSize) {
+   if(uUseAuthored == 0)
+      return SampleProceduralDensity(p, coverage, dist, stepSize);
+
+   float authored = SampleAuthoredDensity(p);
+   if(uAuthoredMode == AUTHORED_REPLACE)
+      return authored;
+   return authored + SampleProceduralDensity(p, coverage, dist, stepSize);
 }
 
 vec2 RaySphereIntersection( in vec3 ro, in vec3 rd, in vec3 ce, float ra )
@@ -90,7 +368,6 @@ vec2 RaySphereIntersection( in vec3 ro, in vec3 rd, in vec3 ce, float ra )
     h = sqrt( h );
     return vec2( -b-h, -b+h );
 }
-/*
 bool RayBoxIntersection(vec3 aabbMin, vec3 aabbMax, vec3 r0, vec3 rd, out vec2 t) 
 {
    vec3 invRayDir = 1.0f / rd;
@@ -108,7 +385,6 @@ bool RayBoxIntersection(vec3 aabbMin, vec3 aabbMax, vec3 r0, vec3 rd, out vec2 t
    if(dstB < dstA || dstB < 0.0f) return false;
    return true;
 }
-*/
 
 vec3 GetRayDir(vec2 ndcCoord) {
   vec4 ndc = vec4(ndcCoord, -1.0f, 1.0f);
@@ -132,49 +408,78 @@ float sugarPowder(float opticalDepth) {
 
 float lightMarch(vec3 r0, vec3 rd) {
   vec2 t = RaySphereIntersection(r0, rd, vec3(0.0f), uRadius.y);
-  float stepSize = ceil(t.y) / float(MAX_LIGHTMARCH_STEP);
+  float stepSize = ceil(t.y) / float(uLightmarchSteps);
 
   float opticalDepth = 0.0f;
   vec3 rayStep = rd * stepSize;
-  for(int i = 0; i < MAX_LIGHTMARCH_STEP; ++i) {
+  for(int i = 0; i < uLightmarchSteps; ++i) {
      r0 += rayStep;
-     opticalDepth += max(SampleDensity(r0, uDensityThreshold), 0.0f);
+     opticalDepth += max(SampleDensity(r0, uDensityThreshold, distance(r0, uCamPos), stepSize), 0.0f);
   }
 
   return max(exp(-opticalDepth * uLightAbsorption.y * stepSize), 0.1);
 }
 
-void main() {
-
-   vec3 r0 = uCamPos;
-   vec2 uv01 = uv * 0.5f + 0.5f;
-   float linearDepth = LinearizeDepth(SampleDepth(uv01), 0.5f, uRadius.y);
-
-   vec3 rd = GetRayDir(uv);
-
-   vec3 color = texture(uSceneTexture, uv01).rgb;
-   vec2 t = vec2(0.0f);
+// Start and end distance of the ray inside the cloud shell, end <= start if it misses
+vec2 GetShellInterval(vec3 r0, vec3 rd) {
+   vec2 tInner = RaySphereIntersection(r0, rd, vec3(0.0f), uRadius.x);
+   vec2 tOuter = RaySphereIntersection(r0, rd, vec3(0.0f), uRadius.y);
+   if(tOuter.y < 0.0f) return vec2(0.0f, -1.0f);
 
-   vec2 t0 = RaySphereIntersection(r0, rd, vec3(0.0f), uRadius.x);
-   vec2 t1 = RaySphereIntersection(r0, rd, vec3(0.0f), uRadius.y);
+   if(length(r0) < uRadius.x)
+      return vec2(tInner.y, tOuter.y);
 
-   float dstToBox = t0.y;
-   if(dstToBox < linearDepth) {
-   float dstInsideBox =	ceil(t1.y - t0.y);
-   float stepSize =	dstInsideBox / float(MAX_RAYMARCH_STEP);
+   // Inside or above the shell the march stops where the ray enters the inner sphere
+   float start = max(tOuter.x, 0.0f);
+   float end = tInner.x > 0.0f ? tInner.x : tOuter.y;
+   return vec2(start, end);
+}
 
-   float noiseOffset = texture(uBlueNoiseTex, uv).r;
-   vec3	p =	r0 + (t.x +	noiseOffset) * rd;
+// Marches the clouds between tStart and tEnd, returns the in-scattered
+// radiance in rgb and the transmittance of the segment in alpha. noiseOffset
+// in [0, 1) moves the samples by that fraction of a step.
+vec4 MarchClouds(vec3 r0, vec3 rd, float tStart, float tEnd, float noiseOffset) {
+   // Without the procedural layer only the box of the authored volume has density,
+   // the steps are spent there and empty cells inside it are stepped over
+   bool skipEmpty = uUseAuthored == 1 && uAuthoredMode == AUTHORED_REPLACE;
+   if(skipEmpty) {
+      vec2 box;
+      if(!RayBoxIntersection(uAuthoredMin, uAuthoredMax, r0, rd, box))
+         return vec4(0.0f, 0.0f, 0.0f, 1.0f);
+      tStart = max(tStart, box.x);
+      tEnd = min(tEnd, box.y);
+      if(tEnd <= tStart)
+         return vec4(0.0f, 0.0f, 0.0f, 1.0f);
+   }
+
+   float dstInsideBox =	ceil(tEnd - tStart);
+   float stepSize =	dstInsideBox / float(uRaymarchSteps);
+
+   float t = tStart + noiseOffset * stepSize;
+   vec3	p =	r0 + t * rd;
 
    float transmittance = 1.0f;
-   float totalEnergy = 0.0f;
+   vec3 totalEnergy = vec3(0.0f);
+   float ambientEnergy = 0.0f;
 
    float cosTheta = dot(uLightDirection, normalize(-rd));
    float tau = stepSize * uLightAbsorption.x;
 
    vec3 rayStep = rd * stepSize;
-   for(int i = 0; i < MAX_RAYMARCH_STEP; ++i) {
-      float density = SampleDensity(p,	uDensityThreshold);
+   for(int i = 0; i < uRaymarchSteps; ++i) {
+      if(skipEmpty) {
+         // Whole steps, so the samples after the skip stay where they would have been
+         float skip = GetAuthoredEmptySkip(p, rd);
+         if(skip > 0.0f) {
+            float numSteps = ceil(skip / stepSize);
+            p += rayStep * numSteps;
+            t += stepSize * numSteps;
+            if(t > tEnd) break;
+            continue;
+         }
+      }
+
+      float density = SampleDensity(p,	uDensityThreshold, distance(p, uCamPos), stepSize);
 	  if(density >	0.0f) {
     	  float	lightTransmittance = lightMarch(p, uLightDirection);
 
@@ -182,16 +487,76 @@ void main() {
 		  if(uSugarPowder == 1)
     		  inscattProb =	sugarPowder(density	* tau);
 
-		  totalEnergy += lightTransmittance	* henyeyGreenstein(cosTheta, uPhaseG) *	inscattProb	* transmittance;
+		  totalEnergy += GetSunColor(p) * lightTransmittance * henyeyGreenstein(cosTheta, uPhaseG) * inscattProb * transmittance;
+		  ambientEnergy += inscattProb * transmittance;
 		  transmittance	*= exp(-density	* tau);
 	  }
    	  if(transmittance < 0.001f) break;
 	  p	+= rayStep;
-  }
-  vec3 cloudColor	= totalEnergy *	uLightColor.xyz	* uLightColor.w;
-  color	= transmittance * color + cloudColor;
-	}
-  color /=(1.0 + color);
-  color	= pow(color, vec3(0.4545));
-  fragColor	= vec4(color, 1.0f);
-}
\ No newline at end of file
+	  t += stepSize;
+   }
+
+   vec3 cloudColor = totalEnergy * uLightColor.xyz * uLightColor.w;
+   // Sky light fetched once per ray at the middle of the shell
+   if(uUseAtmosphere == 1 && uSkyAmbientStrength > 0.0f) {
+      vec3 skyAmbient = SampleAtmosphereLUT(uSkyAmbientLUT, (uRadius.x + uRadius.y) * 0.0005f, uLightDirection.y);
+      cloudColor += ambientEnergy * uSkyAmbientStrength * skyAmbient * uLightColor.xyz * uLightColor.w;
+   }
+   // The panorama is sampled as a blurry environment light from above, never while it is being rendered
+   if(uRenderMode == RENDER_MODE_COMPOSITE && uPanoramaAmbient > 0.0f)
+      cloudColor += ambientEnergy * uPanoramaAmbient * textureLod(uPanoramaTex, vec3(0.0f, 1.0f, 0.0f), uPanoramaMaxLod).rgb;
+   return vec4(cloudColor, transmittance);
+}
+
+void main() {
+#ifdef MULTI_VIEW
+   uInvP = uViewInvP[vViewIndex];
+   uInvV = uViewInvV[vViewIndex];
+   uCamPos = uViewCamPos[vViewIndex];
+#endif
+
+   vec3 r0 = uCamPos;
+   vec3 rd = GetRayDir(uv);
+   vec2 shell = GetShellInterval(r0, rd);
+   // Blue noise by pixel and frame, so the banding of few steps turns into noise that
+   // averages out over frames. Every pass over the slices is shifted by the golden
+   // ratio so the sequence doesn't repeat after the last one.
+   ivec3 noiseSize = textureSize(uBlueNoiseTex, 0);
+   ivec3 noiseTexel = ivec3(ivec2(gl_FragCoord.xy) % noiseSize.xy, uFrameIndex % noiseSize.z);
+   float noiseOffset = texelFetch(uBlueNoiseTex, noiseTexel, 0).r;
+   noiseOffset = fract(noiseOffset + float(uFrameIndex / noiseSize.z) * GOLDEN_RATIO_CONJUGATE);
+
+   if(uRenderMode == RENDER_MODE_FAR_FIELD) {
+      // Panorama face, only the part of the ray past the far field distance
+      vec4 farField = vec4(0.0f, 0.0f, 0.0f, 1.0f);
+      float start = max(shell.x, uFarFieldDistance);
+      if(shell.y > start)
+         farField = MarchClouds(r0, rd, start, shell.y, noiseOffset);
+      fragColor = farField;
+      return;
+   }
+
+   vec2 uv01 = uv * 0.5f + 0.5f;
+   float depth = SampleDepth(uv01);
+   // Sky pixels don't limit the march
+   float linearDepth = depth < 1.0f ? LinearizeDepth(depth, uDepthRange.x, uDepthRange.y) : 1e30f;
+
+   vec3 color = texture(uSceneTexture, uv01).rgb;
+   float tEnd = min(shell.y, linearDepth);
+
+   // Far field comes from the panorama, only the near part is marched
+   if(uUsePanorama == 1 && depth >= 1.0f && tEnd > uFarFieldDistance) {
+      vec4 farField = textureLod(uPanoramaTex, rd, 0.0f);
+      color = farField.a * color + farField.rgb;
+      tEnd = uFarFieldDistance;
+   }
+
+   if(tEnd > shell.x) {
+      vec4 clouds = MarchClouds(r0, rd, shell.x, tEnd, noiseOffset);
+      color = clouds.a * color + clouds.rgb;
+   }
+
+   color /=(1.0 + color);
+   color	= pow(color, vec3(0.4545));
+   fragColor	= vec4(color, 1.0f);
+}
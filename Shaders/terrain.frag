@@ -4,15 +4,31 @@ layout(location = 0) out vec4 fragColor;
 
 in vec3 vNormal;
 in vec2 vUV;
+in vec3 vWorldPos;
 
 uniform sampler2D uDiffuseMap;
+uniform vec3 uLightDirection;
 
-vec3 lightDir = normalize(vec3(0.1, 0.5, 0.1));
+// Optical depth of the clouds along the light, stored for the y = 0 plane
+uniform int uUseCloudShadow;
+uniform sampler2D uCloudShadowMap;
+uniform float uCloudShadowExtent;
+uniform float uCloudShadowAbsorption;
+uniform float uCloudShadowStrength;
+
+float CloudShadow(vec3 p) {
+   if(uUseCloudShadow == 0) return 1.0f;
+   // Slide the point down the light ray onto the plane the map was made for
+   vec3 onPlane = p - uLightDirection * (p.y / max(uLightDirection.y, 0.01f));
+   vec2 uv = onPlane.xz / uCloudShadowExtent + 0.5f;
+   float opticalDepth = texture(uCloudShadowMap, uv).r;
+   return mix(1.0f, exp(-opticalDepth * uCloudShadowAbsorption), uCloudShadowStrength);
+}
 
 void main() {
    vec3 terrainColor = texture(uDiffuseMap, vUV).rgb;
 
-   float diffuse = max(dot(vNormal, lightDir), 0.0f);
+   float diffuse = max(dot(vNormal, uLightDirection), 0.0f) * CloudShadow(vWorldPos);
    vec3 col = diffuse * vec3(1.28, 1.20, 0.99);
    col += (vNormal.y * 0.5 + 0.5) * vec3(0.16, 0.20, 0.28);
    col *= terrainColor;
@@ -3,11 +3,13 @@
 layout(location = 0) in vec2 position;
 
 uniform mat4 uVP;
+uniform mat4 uModel;
 uniform sampler2D uHeightMap;
 uniform vec2 uInvTerrainSize;
 
 out vec3 vNormal;
 out vec2 vUV;
+out vec3 vWorldPos;
 
 vec2 GetUV(vec2 p) {
    return p * uInvTerrainSize;
@@ -29,6 +31,7 @@ void main() {
 
     vNormal = normalize(vec3(hRight - hLeft, 1.0f, hTop - hBottom));
     vUV = uv;
+    vWorldPos = (uModel * vec4(position.x, height, position.y, 1.0f)).xyz;
 
     gl_Position = uVP * vec4(position.x, height, position.y, 1.0f);
 }
\ No newline at end of file
@@ -0,0 +1,290 @@
+#include "atmosphere.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static const float PI = 3.14159265f;
+
+bool AtmosphereParams::operator==(const AtmosphereParams& other) const
+{
+	// Plain floats only, no padding
+	return std::memcmp(this, &other, sizeof(AtmosphereParams)) == 0;
+}
+
+glm::vec3 AtmosphereLUT::Sample(glm::vec2 uv) const
+{
+	float x = std::clamp(uv.x, 0.0f, 1.0f) * float(width - 1);
+	float y = std::clamp(uv.y, 0.0f, 1.0f) * float(height - 1);
+	uint32_t x0 = static_cast<uint32_t>(x);
+	uint32_t y0 = static_cast<uint32_t>(y);
+	uint32_t x1 = std::min(x0 + 1, width - 1);
+	uint32_t y1 = std::min(y0 + 1, height - 1);
+	float fx = x - float(x0);
+	float fy = y - float(y0);
+
+	glm::vec3 v00 = glm::vec3(data[y0 * width + x0]);
+	glm::vec3 v10 = glm::vec3(data[y0 * width + x1]);
+	glm::vec3 v01 = glm::vec3(data[y1 * width + x0]);
+	glm::vec3 v11 = glm::vec3(data[y1 * width + x1]);
+	return glm::mix(glm::mix(v00, v10, fx), glm::mix(v01, v11, fx), fy);
+}
+
+namespace Atmosphere {
+
+	struct MediumSample {
+		glm::vec3 rayleighScattering;
+		float mieScattering;
+		glm::vec3 scattering;
+		glm::vec3 extinction;
+	};
+
+	static MediumSample SampleMedium(const AtmosphereParams& params, float altitude)
+	{
+		float rayleighDensity = std::exp(-altitude / params.rayleighScaleHeight);
+		float mieDensity = std::exp(-altitude / params.mieScaleHeight);
+		float ozoneDensity = std::max(0.0f, 1.0f - std::abs(altitude - params.ozoneCenter) / (params.ozoneWidth * 0.5f));
+
+		MediumSample medium;
+		medium.rayleighScattering = params.rayleighScattering * rayleighDensity;
+		medium.mieScattering = params.mieScattering * mieDensity;
+		medium.scattering = medium.rayleighScattering + glm::vec3(medium.mieScattering);
+		medium.extinction = medium.scattering +
+			glm::vec3(params.mieAbsorption * mieDensity) +
+			params.ozoneAbsorption * ozoneDensity;
+		return medium;
+	}
+
+	// Distance to the closest hit in front of the ray, -1 if there is none
+	static float IntersectSphere(const glm::vec3& ro, const glm::vec3& rd, float radius)
+	{
+		float b = glm::dot(ro, rd);
+		float c = glm::dot(ro, ro) - radius * radius;
+		float h = b * b - c;
+		if (h < 0.0f) return -1.0f;
+		h = std::sqrt(h);
+		if (-b - h > 0.0f) return -b - h;
+		if (-b + h > 0.0f) return -b + h;
+		return -1.0f;
+	}
+
+	static float RayleighPhase(float cosTheta)
+	{
+		return 3.0f / (16.0f * PI) * (1.0f + cosTheta * cosTheta);
+	}
+
+	static float MiePhase(float cosTheta, float g)
+	{
+		float g2 = g * g;
+		float denom = std::pow(1.0f + g2 - 2.0f * g * cosTheta, 1.5f);
+		return 3.0f / (8.0f * PI) * ((1.0f - g2) * (1.0f + cosTheta * cosTheta)) / ((2.0f + g2) * denom);
+	}
+
+	static glm::vec3 DirectionFromZenith(float cosZenith)
+	{
+		return glm::vec3(std::sqrt(std::max(0.0f, 1.0f - cosZenith * cosZenith)), cosZenith, 0.0f);
+	}
+
+	static glm::vec3 Exp(const glm::vec3& v)
+	{
+		return glm::vec3(std::exp(v.x), std::exp(v.y), std::exp(v.z));
+	}
+
+	static glm::vec3 SunTransmittanceAt(const AtmosphereParams& params, const AtmosphereLUT& transmittance, const glm::vec3& position, const glm::vec3& sunDir)
+	{
+		float r = glm::length(position);
+		float cosSunZenith = glm::dot(position / r, sunDir);
+		return transmittance.Sample(TransmittanceUV(params, r - params.groundRadius, cosSunZenith));
+	}
+
+	glm::vec2 TransmittanceUV(const AtmosphereParams& params, float altitude, float cosZenith)
+	{
+		float h = std::clamp(altitude / (params.topRadius - params.groundRadius), 0.0f, 1.0f);
+		return glm::vec2(cosZenith * 0.5f + 0.5f, std::sqrt(h));
+	}
+
+	glm::vec2 MultiScatteringUV(const AtmosphereParams& params, float altitude, float cosSunZenith)
+	{
+		float h = std::clamp(altitude / (params.topRadius - params.groundRadius), 0.0f, 1.0f);
+		return glm::vec2(cosSunZenith * 0.5f + 0.5f, h);
+	}
+
+	glm::vec2 SkyAmbientUV(const AtmosphereParams& params, float altitude, float cosSunZenith)
+	{
+		return TransmittanceUV(params, altitude, cosSunZenith);
+	}
+
+	void ComputeTransmittanceLUT(const AtmosphereParams& params, AtmosphereLUT& lut, uint32_t width, uint32_t height)
+	{
+		const int numSteps = 40;
+		const float atmosphereHeight = params.topRadius - params.groundRadius;
+
+		lut.width = width;
+		lut.height = height;
+		lut.data.resize(width * height);
+
+		for (uint32_t j = 0; j < height; ++j) {
+			float v = float(j) / float(height - 1);
+			float altitude = v * v * atmosphereHeight;
+			glm::vec3 ro{ 0.0f, params.groundRadius + altitude, 0.0f };
+
+			for (uint32_t i = 0; i < width; ++i) {
+				float cosZenith = float(i) / float(width - 1) * 2.0f - 1.0f;
+				glm::vec3 rd = DirectionFromZenith(cosZenith);
+
+				glm::vec3 transmittance{ 0.0f };
+				if (IntersectSphere(ro, rd, params.groundRadius) < 0.0f) {
+					float tMax = std::max(IntersectSphere(ro, rd, params.topRadius), 0.0f);
+					float dt = tMax / float(numSteps);
+
+					glm::vec3 opticalDepth{ 0.0f };
+					for (int step = 0; step < numSteps; ++step) {
+						glm::vec3 p = ro + rd * ((float(step) + 0.5f) * dt);
+						opticalDepth += SampleMedium(params, glm::length(p) - params.groundRadius).extinction * dt;
+					}
+					transmittance = Exp(-opticalDepth);
+				}
+				lut.data[j * width + i] = glm::vec4(transmittance, 1.0f);
+			}
+		}
+	}
+
+	void ComputeMultiScatteringLUT(const AtmosphereParams& params, const AtmosphereLUT& transmittance, AtmosphereLUT& lut, uint32_t width, uint32_t height)
+	{
+		const int numDirSqrt = 8;
+		const int numDirections = numDirSqrt * numDirSqrt;
+		const int numSteps = 20;
+		const float isotropicPhase = 1.0f / (4.0f * PI);
+		const float atmosphereHeight = params.topRadius - params.groundRadius;
+
+		lut.width = width;
+		lut.height = height;
+		lut.data.resize(width * height);
+
+		for (uint32_t j = 0; j < height; ++j) {
+			float altitude = std::max(float(j) / float(height - 1) * atmosphereHeight, 0.01f);
+			glm::vec3 ro{ 0.0f, params.groundRadius + altitude, 0.0f };
+
+			for (uint32_t i = 0; i < width; ++i) {
+				float cosSunZenith = float(i) / float(width - 1) * 2.0f - 1.0f;
+				glm::vec3 sunDir = DirectionFromZenith(cosSunZenith);
+
+				glm::vec3 luminance{ 0.0f };
+				glm::vec3 transfer{ 0.0f };
+
+				// Stratified directions over the whole sphere, each one weighted by 1 / numDirections
+				for (int a = 0; a < numDirSqrt; ++a) {
+					for (int b = 0; b < numDirSqrt; ++b) {
+						float cosTheta = 1.0f - 2.0f * (float(a) + 0.5f) / float(numDirSqrt);
+						float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+						float phi = 2.0f * PI * (float(b) + 0.5f) / float(numDirSqrt);
+						glm::vec3 rd{ sinTheta * std::cos(phi), cosTheta, sinTheta * std::sin(phi) };
+
+						float tGround = IntersectSphere(ro, rd, params.groundRadius);
+						float tMax = tGround > 0.0f ? tGround : std::max(IntersectSphere(ro, rd, params.topRadius), 0.0f);
+						float dt = tMax / float(numSteps);
+
+						glm::vec3 throughput{ 1.0f };
+						for (int step = 0; step < numSteps; ++step) {
+							glm::vec3 p = ro + rd * ((float(step) + 0.5f) * dt);
+							MediumSample medium = SampleMedium(params, glm::length(p) - params.groundRadius);
+							glm::vec3 extinction = glm::max(medium.extinction, glm::vec3(1e-9f));
+							glm::vec3 stepTransmittance = Exp(-extinction * dt);
+
+							glm::vec3 sunTransmittance = SunTransmittanceAt(params, transmittance, p, sunDir);
+							glm::vec3 inScattering = medium.scattering * isotropicPhase * sunTransmittance;
+
+							// Analytic integration over the step
+							luminance += throughput * (inScattering - inScattering * stepTransmittance) / extinction;
+							transfer += throughput * (medium.scattering - medium.scattering * stepTransmittance) / extinction;
+							throughput *= stepTransmittance;
+						}
+
+						if (tGround > 0.0f) {
+							glm::vec3 groundPos = ro + rd * tGround;
+							float cosGround = std::max(glm::dot(glm::normalize(groundPos), sunDir), 0.0f);
+							luminance += throughput * SunTransmittanceAt(params, transmittance, groundPos, sunDir) * cosGround * params.groundAlbedo / PI;
+						}
+					}
+				}
+
+				luminance /= float(numDirections);
+				transfer /= float(numDirections);
+
+				// Infinite number of bounces as a geometric series
+				glm::vec3 psi = luminance / (glm::vec3(1.0f) - transfer);
+				lut.data[j * width + i] = glm::vec4(psi, 1.0f);
+			}
+		}
+	}
+
+	void ComputeSkyAmbientLUT(const AtmosphereParams& params, const AtmosphereLUT& transmittance, const AtmosphereLUT& multiScattering, AtmosphereLUT& lut, uint32_t width, uint32_t height)
+	{
+		const int numDirSqrt = 8;
+		const int numDirections = numDirSqrt * numDirSqrt;
+		const int numSteps = 24;
+		const float atmosphereHeight = params.topRadius - params.groundRadius;
+
+		lut.width = width;
+		lut.height = height;
+		lut.data.resize(width * height);
+
+		for (uint32_t j = 0; j < height; ++j) {
+			float v = float(j) / float(height - 1);
+			float altitude = std::max(v * v * atmosphereHeight, 0.01f);
+			glm::vec3 ro{ 0.0f, params.groundRadius + altitude, 0.0f };
+
+			for (uint32_t i = 0; i < width; ++i) {
+				float cosSunZenith = float(i) / float(width - 1) * 2.0f - 1.0f;
+				glm::vec3 sunDir = DirectionFromZenith(cosSunZenith);
+
+				// Cosine weighted directions, so the mean radiance is irradiance / pi
+				glm::vec3 radiance{ 0.0f };
+				for (int a = 0; a < numDirSqrt; ++a) {
+					for (int b = 0; b < numDirSqrt; ++b) {
+						float u1 = (float(a) + 0.5f) / float(numDirSqrt);
+						float u2 = (float(b) + 0.5f) / float(numDirSqrt);
+						float r = std::sqrt(u1);
+						float phi = 2.0f * PI * u2;
+						glm::vec3 rd{ r * std::cos(phi), std::sqrt(1.0f - u1), r * std::sin(phi) };
+
+						float tGround = IntersectSphere(ro, rd, params.groundRadius);
+						float tMax = tGround > 0.0f ? tGround : std::max(IntersectSphere(ro, rd, params.topRadius), 0.0f);
+						float dt = tMax / float(numSteps);
+
+						float cosTheta = glm::dot(rd, sunDir);
+						float rayleighPhase = RayleighPhase(cosTheta);
+						float miePhase = MiePhase(cosTheta, params.miePhaseG);
+
+						glm::vec3 throughput{ 1.0f };
+						for (int step = 0; step < numSteps; ++step) {
+							glm::vec3 p = ro + rd * ((float(step) + 0.5f) * dt);
+							float r = glm::length(p);
+							float sampleAltitude = r - params.groundRadius;
+							MediumSample medium = SampleMedium(params, sampleAltitude);
+							glm::vec3 extinction = glm::max(medium.extinction, glm::vec3(1e-9f));
+							glm::vec3 stepTransmittance = Exp(-extinction * dt);
+
+							float cosSampleSun = glm::dot(p / r, sunDir);
+							glm::vec3 sunTransmittance = transmittance.Sample(TransmittanceUV(params, sampleAltitude, cosSampleSun));
+							glm::vec3 psi = multiScattering.Sample(MultiScatteringUV(params, sampleAltitude, cosSampleSun));
+
+							glm::vec3 inScattering = (medium.rayleighScattering * rayleighPhase + glm::vec3(medium.mieScattering * miePhase)) * sunTransmittance +
+								medium.scattering * psi;
+
+							radiance += throughput * (inScattering - inScattering * stepTransmittance) / extinction;
+							throughput *= stepTransmittance;
+						}
+					}
+				}
+
+				lut.data[j * width + i] = glm::vec4(radiance / float(numDirections), 1.0f);
+			}
+		}
+	}
+
+	glm::vec3 GetSunTransmittance(const AtmosphereParams& params, const AtmosphereLUT& transmittance, float altitude, float cosSunZenith)
+	{
+		return transmittance.Sample(TransmittanceUV(params, altitude, cosSunZenith));
+	}
+}
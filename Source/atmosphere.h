@@ -0,0 +1,67 @@
+#pragma once
+
+#include "glm-includes.h"
+
+#include <vector>
+#include <stdint.h>
+
+// Earth like atmosphere from "A Scalable and Production Ready Sky and
+// Atmosphere Rendering Technique" (Hillaire 2020). Distances are in km,
+// coefficients in 1/km.
+struct AtmosphereParams {
+	float groundRadius = 6360.0f;
+	float topRadius = 6460.0f;
+
+	glm::vec3 rayleighScattering{ 5.802e-3f, 13.558e-3f, 33.1e-3f };
+	float rayleighScaleHeight = 8.0f;
+
+	float mieScattering = 3.996e-3f;
+	float mieAbsorption = 4.4e-3f;
+	float mieScaleHeight = 1.2f;
+	float miePhaseG = 0.8f;
+
+	glm::vec3 ozoneAbsorption{ 0.650e-3f, 1.881e-3f, 0.085e-3f };
+	float ozoneCenter = 25.0f;
+	float ozoneWidth = 30.0f;
+
+	glm::vec3 groundAlbedo{ 0.3f };
+
+	bool operator==(const AtmosphereParams& other) const;
+	bool operator!=(const AtmosphereParams& other) const { return !(*this == other); }
+};
+
+// RGB lookup table, texel (i, j) stores the value at uv = (i / (width - 1), j / (height - 1))
+struct AtmosphereLUT {
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<glm::vec4> data;
+
+	glm::vec3 Sample(glm::vec2 uv) const;
+};
+
+// CPU only, nothing in here touches OpenGL so the tables can be built on
+// machines without a GPU. The uv mappings are mirrored in raymarch.frag.
+namespace Atmosphere {
+
+	// u - cosine of the view zenith angle, v - sqrt of the normalized altitude
+	glm::vec2 TransmittanceUV(const AtmosphereParams& params, float altitude, float cosZenith);
+
+	// u - cosine of the sun zenith angle, v - normalized altitude
+	glm::vec2 MultiScatteringUV(const AtmosphereParams& params, float altitude, float cosSunZenith);
+
+	// u - cosine of the sun zenith angle, v - sqrt of the normalized altitude
+	glm::vec2 SkyAmbientUV(const AtmosphereParams& params, float altitude, float cosSunZenith);
+
+	// Transmittance from a point to the top of the atmosphere, zero if the ground is in the way
+	void ComputeTransmittanceLUT(const AtmosphereParams& params, AtmosphereLUT& lut, uint32_t width = 256, uint32_t height = 64);
+
+	// Isotropic multiple scattering transfer (psi_ms) per unit sun illuminance
+	void ComputeMultiScatteringLUT(const AtmosphereParams& params, const AtmosphereLUT& transmittance, AtmosphereLUT& lut, uint32_t width = 32, uint32_t height = 32);
+
+	// Mean radiance of the upper hemisphere (irradiance / pi) per unit sun
+	// illuminance, used as the ambient sky term for the clouds
+	void ComputeSkyAmbientLUT(const AtmosphereParams& params, const AtmosphereLUT& transmittance, const AtmosphereLUT& multiScattering, AtmosphereLUT& lut, uint32_t width = 32, uint32_t height = 16);
+
+	// Sun color reaching the given altitude, per unit sun illuminance
+	glm::vec3 GetSunTransmittance(const AtmosphereParams& params, const AtmosphereLUT& transmittance, float altitude, float cosSunZenith);
+}
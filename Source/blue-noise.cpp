@@ -0,0 +1,426 @@
+#include "blue-noise.h"
+
+#include "logger.h"
+#include "thread-pool.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <numeric>
+#include <random>
+
+namespace BlueNoise
+{
+	static const uint32_t INVALID_INDEX = 0xffffffffu;
+
+	// Binary pattern with the energy of every pixel, a row is one y of one slice
+	class VoidAndCluster
+	{
+	public:
+		explicit VoidAndCluster(const BlueNoiseParams& params) :
+			mSize(params.size), mNumSlices(params.numSlices)
+		{
+			uint32_t count = mSize * mSize * mNumSlices;
+			mOnes.resize(count, 0);
+			mEnergy.resize(count, 0.0f);
+			mRows.resize(mSize * mNumSlices);
+			mDirty.resize(mRows.size(), 0);
+			mSlices.resize(mNumSlices);
+			mSliceDirty.resize(mNumSlices, 0);
+
+			// The footprint must not wrap onto itself
+			mRadius = std::min(int(std::ceil(3.0f * params.spatialSigma)), int(mSize - 1) / 2);
+			int side = 2 * mRadius + 1;
+			mSpatial.resize(side * side);
+			for (int dy = -mRadius; dy <= mRadius; ++dy) {
+				for (int dx = -mRadius; dx <= mRadius; ++dx)
+					mSpatial[(dy + mRadius) * side + dx + mRadius] = std::exp(-float(dx * dx + dy * dy) / (2.0f * params.spatialSigma * params.spatialSigma));
+			}
+
+			// Toroidal over the slices, the pixel itself is in the spatial term
+			mTemporal.resize(mNumSlices, 0.0f);
+			for (uint32_t dt = 1; dt < mNumSlices; ++dt) {
+				float d = float(std::min(dt, mNumSlices - dt));
+				mTemporal[dt] = std::exp(-d * d / (2.0f * params.temporalSigma * params.temporalSigma));
+			}
+		}
+
+		uint32_t GetCount() const { return uint32_t(mOnes.size()); }
+
+		// Sets a pixel without touching the energy, InitializeEnergy() has to follow
+		void SetInitial(uint32_t index) { mOnes[index] = 1; }
+
+		// Gathers the energy of every pixel from scratch, one slice per task
+		void InitializeEnergy(ThreadPool* pool)
+		{
+			auto initializeSlice = [this](uint32_t t, uint32_t) {
+				int side = 2 * mRadius + 1;
+				for (uint32_t y = 0; y < mSize; ++y) {
+					for (uint32_t x = 0; x < mSize; ++x) {
+						float energy = 0.0f;
+						for (int dy = -mRadius; dy <= mRadius; ++dy) {
+							uint32_t yy = Wrap(int(y) + dy);
+							for (int dx = -mRadius; dx <= mRadius; ++dx) {
+								if (mOnes[GetIndex(Wrap(int(x) + dx), yy, t)])
+									energy += mSpatial[(dy + mRadius) * side + dx + mRadius];
+							}
+						}
+						for (uint32_t dt = 1; dt < mNumSlices; ++dt) {
+							if (mOnes[GetIndex(x, y, (t + dt) % mNumSlices)])
+								energy += mTemporal[dt];
+						}
+						mEnergy[GetIndex(x, y, t)] = energy;
+					}
+				}
+			};
+
+			if (pool)
+				pool->ParallelFor(mNumSlices, initializeSlice);
+			else {
+				for (uint32_t t = 0; t < mNumSlices; ++t)
+					initializeSlice(t, 0);
+			}
+
+			mDirtyRows.clear();
+			mDirtySlices.clear();
+			for (uint32_t row = 0; row < mRows.size(); ++row)
+				RefreshRow(row);
+			for (uint32_t slice = 0; slice < mNumSlices; ++slice)
+				RefreshSlice(slice);
+			std::fill(mDirty.begin(), mDirty.end(), uint8_t(0));
+			std::fill(mSliceDirty.begin(), mSliceDirty.end(), uint8_t(0));
+		}
+
+		// Adds or removes the pixel's contribution to the energy of its footprint
+		void Set(uint32_t index, bool one)
+		{
+			if (bool(mOnes[index]) == one)
+				return;
+			mOnes[index] = uint8_t(one);
+
+			float sign = one ? 1.0f : -1.0f;
+			uint32_t x = index % mSize;
+			uint32_t y = (index / mSize) % mSize;
+			uint32_t t = index / (mSize * mSize);
+			int side = 2 * mRadius + 1;
+			MarkDirty(index / mSize);
+			for (int dy = -mRadius; dy <= mRadius; ++dy) {
+				uint32_t yy = Wrap(int(y) + dy);
+				for (int dx = -mRadius; dx <= mRadius; ++dx) {
+					uint32_t neighbour = GetIndex(Wrap(int(x) + dx), yy, t);
+					mEnergy[neighbour] += sign * mSpatial[(dy + mRadius) * side + dx + mRadius];
+					UpdateRow(neighbour);
+				}
+			}
+			for (uint32_t dt = 1; dt < mNumSlices; ++dt) {
+				uint32_t neighbour = GetIndex(x, y, (t + dt) % mNumSlices);
+				mEnergy[neighbour] += sign * mTemporal[dt];
+				UpdateRow(neighbour);
+			}
+		}
+
+		// The one with the highest energy
+		uint32_t FindTightestCluster()
+		{
+			RefreshDirty();
+			float best = -FLT_MAX;
+			uint32_t index = INVALID_INDEX;
+			for (const Row& row : mSlices) {
+				if (row.maxOneIndex != INVALID_INDEX && row.maxOne > best) {
+					best = row.maxOne;
+					index = row.maxOneIndex;
+				}
+			}
+			return index;
+		}
+
+		// The zero with the lowest energy
+		uint32_t FindLargestVoid()
+		{
+			RefreshDirty();
+			float best = FLT_MAX;
+			uint32_t index = INVALID_INDEX;
+			for (const Row& row : mSlices) {
+				if (row.minZeroIndex != INVALID_INDEX && row.minZero < best) {
+					best = row.minZero;
+					index = row.minZeroIndex;
+				}
+			}
+			return index;
+		}
+
+	private:
+		struct Row {
+			float maxOne = -FLT_MAX;
+			uint32_t maxOneIndex = INVALID_INDEX;
+			float minZero = FLT_MAX;
+			uint32_t minZeroIndex = INVALID_INDEX;
+		};
+
+		uint32_t GetIndex(uint32_t x, uint32_t y, uint32_t t) const { return (t * mSize + y) * mSize + x; }
+
+		uint32_t Wrap(int i) const { return uint32_t((i + int(mSize)) % int(mSize)); }
+
+		void MarkDirty(uint32_t row)
+		{
+			if (!mDirty[row]) {
+				mDirty[row] = 1;
+				mDirtyRows.push_back(row);
+			}
+		}
+
+		// Keeps the row's cached extremes after the energy of one pixel changed, the
+		// row is only rescanned when the pixel it points at got worse. Slices cache
+		// the extremes of their rows the same way.
+		void UpdateRow(uint32_t index)
+		{
+			uint32_t row = index / mSize;
+			if (mDirty[row])
+				return;
+
+			Row& summary = mRows[row];
+			float energy = mEnergy[index];
+			if (mOnes[index]) {
+				if (energy >= summary.maxOne) {
+					summary.maxOne = energy;
+					summary.maxOneIndex = index;
+					UpdateSlice(row);
+				}
+				else if (index == summary.maxOneIndex)
+					MarkDirty(row);
+			}
+			else {
+				if (energy <= summary.minZero) {
+					summary.minZero = energy;
+					summary.minZeroIndex = index;
+					UpdateSlice(row);
+				}
+				else if (index == summary.minZeroIndex)
+					MarkDirty(row);
+			}
+		}
+
+		void UpdateSlice(uint32_t row)
+		{
+			uint32_t slice = row / mSize;
+			if (mSliceDirty[slice])
+				return;
+
+			const Row& summary = mRows[row];
+			Row& sliceSummary = mSlices[slice];
+			bool dirty = false;
+			if (summary.maxOneIndex != INVALID_INDEX && summary.maxOne >= sliceSummary.maxOne) {
+				sliceSummary.maxOne = summary.maxOne;
+				sliceSummary.maxOneIndex = summary.maxOneIndex;
+			}
+			else if (sliceSummary.maxOneIndex != INVALID_INDEX && sliceSummary.maxOneIndex / mSize == row)
+				dirty = true;
+
+			if (summary.minZeroIndex != INVALID_INDEX && summary.minZero <= sliceSummary.minZero) {
+				sliceSummary.minZero = summary.minZero;
+				sliceSummary.minZeroIndex = summary.minZeroIndex;
+			}
+			else if (sliceSummary.minZeroIndex != INVALID_INDEX && sliceSummary.minZeroIndex / mSize == row)
+				dirty = true;
+
+			if (dirty) {
+				mSliceDirty[slice] = 1;
+				mDirtySlices.push_back(slice);
+			}
+		}
+
+		void RefreshRow(uint32_t row)
+		{
+			Row summary;
+			uint32_t begin = row * mSize;
+			for (uint32_t i = begin; i < begin + mSize; ++i) {
+				if (mOnes[i]) {
+					if (mEnergy[i] > summary.maxOne) {
+						summary.maxOne = mEnergy[i];
+						summary.maxOneIndex = i;
+					}
+				}
+				else if (mEnergy[i] < summary.minZero) {
+					summary.minZero = mEnergy[i];
+					summary.minZeroIndex = i;
+				}
+			}
+			mRows[row] = summary;
+		}
+
+		void RefreshSlice(uint32_t slice)
+		{
+			Row summary;
+			for (uint32_t row = slice * mSize; row < (slice + 1) * mSize; ++row) {
+				const Row& rowSummary = mRows[row];
+				if (rowSummary.maxOneIndex != INVALID_INDEX && rowSummary.maxOne > summary.maxOne) {
+					summary.maxOne = rowSummary.maxOne;
+					summary.maxOneIndex = rowSummary.maxOneIndex;
+				}
+				if (rowSummary.minZeroIndex != INVALID_INDEX && rowSummary.minZero < summary.minZero) {
+					summary.minZero = rowSummary.minZero;
+					summary.minZeroIndex = rowSummary.minZeroIndex;
+				}
+			}
+			mSlices[slice] = summary;
+		}
+
+		// Rescans the rows and then the slices whose cached pixel got worse
+		void RefreshDirty()
+		{
+			for (uint32_t row : mDirtyRows) {
+				RefreshRow(row);
+				mDirty[row] = 0;
+				UpdateSlice(row);
+			}
+			mDirtyRows.clear();
+
+			for (uint32_t slice : mDirtySlices) {
+				RefreshSlice(slice);
+				mSliceDirty[slice] = 0;
+			}
+			mDirtySlices.clear();
+		}
+
+		uint32_t mSize;
+		uint32_t mNumSlices;
+		int mRadius = 0;
+		std::vector<float> mSpatial;
+		std::vector<float> mTemporal;
+
+		std::vector<uint8_t> mOnes;
+		std::vector<float> mEnergy;
+		std::vector<Row> mRows;
+		std::vector<uint8_t> mDirty;
+		std::vector<uint32_t> mDirtyRows;
+		std::vector<Row> mSlices;
+		std::vector<uint8_t> mSliceDirty;
+		std::vector<uint32_t> mDirtySlices;
+	};
+
+	std::vector<uint8_t> Generate(const BlueNoiseParams& params, ThreadPool* pool)
+	{
+		auto startTime = std::chrono::high_resolution_clock::now();
+
+		VoidAndCluster prototype(params);
+		uint32_t count = prototype.GetCount();
+		uint32_t numOnes = std::clamp(uint32_t(float(count) * params.initialDensity), 1u, std::max(count / 2, 1u));
+
+		// Random initial pattern
+		std::vector<uint32_t> order(count);
+		std::iota(order.begin(), order.end(), 0u);
+		std::mt19937 rng(params.seed);
+		std::shuffle(order.begin(), order.end(), rng);
+		for (uint32_t i = 0; i < numOnes; ++i)
+			prototype.SetInitial(order[i]);
+		prototype.InitializeEnergy(pool);
+
+		// Moves the tightest cluster into the largest void until it lands where it was taken from
+		uint32_t swaps = 0;
+		for (; swaps < count; ++swaps) {
+			uint32_t cluster = prototype.FindTightestCluster();
+			prototype.Set(cluster, false);
+			uint32_t largestVoid = prototype.FindLargestVoid();
+			prototype.Set(largestVoid, true);
+			if (largestVoid == cluster)
+				break;
+		}
+
+		// Ranks below numOnes come from taking the ones away, the rest from filling the
+		// voids. The energy filter sums to the same value everywhere, so the zero with
+		// the lowest energy is also the tightest cluster of zeros and filling the voids
+		// covers the last phase too. Both phases write to different pixels.
+		std::vector<uint32_t> ranks(count);
+		auto rankPhase = [&](uint32_t phase, uint32_t) {
+			VoidAndCluster pattern = prototype;
+			if (phase == 0) {
+				for (uint32_t rank = numOnes; rank-- > 0;) {
+					uint32_t cluster = pattern.FindTightestCluster();
+					ranks[cluster] = rank;
+					pattern.Set(cluster, false);
+				}
+			}
+			else {
+				for (uint32_t rank = numOnes; rank < count; ++rank) {
+					uint32_t largestVoid = pattern.FindLargestVoid();
+					ranks[largestVoid] = rank;
+					pattern.Set(largestVoid, true);
+				}
+			}
+		};
+
+		if (pool)
+			pool->ParallelFor(2, rankPhase);
+		else {
+			rankPhase(0, 0);
+			rankPhase(1, 0);
+		}
+
+		std::vector<uint8_t> noise(count);
+		for (uint32_t i = 0; i < count; ++i)
+			noise[i] = uint8_t(uint64_t(ranks[i]) * 256 / count);
+
+		double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+		char buffer[256];
+		snprintf(buffer, sizeof(buffer), "Generated %ux%ux%u blue noise in %.2fs, %u initial swaps", params.size, params.size, params.numSlices, seconds, swaps);
+		logger::Debug(buffer);
+		return noise;
+	}
+
+	bool Save(const std::string& directory, uint32_t size, uint32_t numSlices, const std::vector<uint8_t>& data)
+	{
+		std::error_code error;
+		std::filesystem::create_directories(directory, error);
+
+		uint32_t sliceSize = size * size;
+		char filename[64];
+		for (uint32_t slice = 0; slice < numSlices; ++slice) {
+			snprintf(filename, sizeof(filename), "stbn_%02u.png", slice);
+			std::string path = (std::filesystem::path(directory) / filename).string();
+			if (!Utils::WriteImage(path.c_str(), size, size, 1, data.data() + slice * sliceSize))
+				return false;
+		}
+		logger::Debug("Wrote " + std::to_string(numSlices) + " blue noise slices to " + directory);
+		return true;
+	}
+
+	bool LoadSlice(const char* filename, uint32_t& width, uint32_t& height, std::vector<uint8_t>& data)
+	{
+		int imageWidth, imageHeight, nChannel;
+		unsigned char* image = Utils::LoadImage(filename, &imageWidth, &imageHeight, &nChannel);
+		if (image == nullptr)
+			return false;
+
+		bool valid = width == 0 || (uint32_t(imageWidth) == width && uint32_t(imageHeight) == height);
+		if (valid) {
+			width = imageWidth;
+			height = imageHeight;
+			uint32_t numPixels = width * height;
+			for (uint32_t i = 0; i < numPixels; ++i)
+				data.push_back(image[i * nChannel]);
+		}
+		else
+			logger::Warn("Blue noise slice " + std::string(filename) + " doesn't match the size of the first one");
+		Utils::FreeImage(image);
+		return valid;
+	}
+
+	uint32_t Load(const std::string& directory, uint32_t& width, uint32_t& height, std::vector<uint8_t>& data)
+	{
+		width = height = 0;
+		data.clear();
+
+		uint32_t numSlices = 0;
+		char filename[64];
+		for (;; ++numSlices) {
+			snprintf(filename, sizeof(filename), "stbn_%02u.png", numSlices);
+			std::filesystem::path path = std::filesystem::path(directory) / filename;
+			if (!std::filesystem::exists(path) || !LoadSlice(path.string().c_str(), width, height, data))
+				break;
+		}
+		return numSlices;
+	}
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+class ThreadPool;
+
+struct BlueNoiseParams {
+	uint32_t size = 64;
+	uint32_t numSlices = 32;
+	// Gaussian energy filter widths in pixels and in slices
+	float spatialSigma = 1.9f;
+	float temporalSigma = 1.9f;
+	// Share of the pixels in the initial binary pattern
+	float initialDensity = 0.1f;
+	uint32_t seed = 1;
+};
+
+// Spatiotemporal blue noise made with void and cluster. A pixel's energy only
+// comes from the ones in its own slice and from its own pixel in the other
+// slices, so every slice is blue noise over space and every pixel is blue noise
+// over the slices. Energies are updated around each toggled pixel instead of
+// being refiltered, and the highest and lowest energy of every row are cached
+// so a search only rescans the rows whose cached pixel got worse.
+namespace BlueNoise
+{
+	// Where the raymarch and the CPU renderer load the slices from
+	static const char* const DEFAULT_DIRECTORY = "Textures/STBN";
+
+	// size x size x numSlices ranks scaled to 0..255, x fastest then y then slice.
+	// The initial energy and the two ranking phases are spread over the pool.
+	std::vector<uint8_t> Generate(const BlueNoiseParams& params, ThreadPool* pool = nullptr);
+
+	// Writes every slice to <directory>/stbn_<slice>.png
+	bool Save(const std::string& directory, uint32_t size, uint32_t numSlices, const std::vector<uint8_t>& data);
+
+	// Appends the first channel of an image, false when it can't be read or its size differs from a non zero width x height
+	bool LoadSlice(const char* filename, uint32_t& width, uint32_t& height, std::vector<uint8_t>& data);
+
+	// Loads the slices Save() wrote, returns how many there were
+	uint32_t Load(const std::string& directory, uint32_t& width, uint32_t& height, std::vector<uint8_t>& data);
+}
@@ -6,9 +6,44 @@
 #include "logger.h"
 #include "utils.h"
 #include "camera.h"
+#include "weather-map.h"
+#include "noise-generator/noise-generator.h"
+#include "noise-generator/virtual-noise-volume.h"
+#include "sparse-volume.h"
+#include "blue-noise.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+
+// The jitter sequence restarts after this many frames, it stays exact in the shader's float math
+static const uint32_t BLUE_NOISE_FRAME_PERIOD = 1u << 16;
+
+// Width of the evolving domain along the wind in tiles of the first noise volume,
+// the pattern comes back once the wind has carried it this far
+static const float EVOLVE_PERIOD = 64.0f;
+
+CloudGenerator::CloudGenerator() = default;
+
+CloudGenerator::~CloudGenerator() = default;
+
+void CloudGenerator::GetDefaultNoiseParams(NoiseParams* tex1Params, NoiseParams* tex2Params)
+{
+	tex1Params[0] = { 1.0f, 1.0f, 1.0f, 0.5f, 7, glm::vec3(0.4f, 0.6, 0.5), NoiseType::Perlin };
+	tex1Params[1] = { 0.5f, 4.0f, 2.0f, 0.5f, 2, glm::vec3(1.4f, 1.593f, 1.539f) };
+	tex1Params[2] = { 0.5f, 8.0f, 2.0f, 0.5f, 4, glm::vec3(2.8f, 2.99f, 2.48f) };
+	tex1Params[3] = { 0.5f, 8.0f, 2.0f, 0.5f, 6, glm::vec3(4.8f, 5.f, 5.43f) };
+
+	tex2Params[0] = { 0.5f, 4.0f, 2.0f, 0.5f, 1, glm::vec3(29.4f, 25.6, 27.5) };
+	tex2Params[1] = { 0.5f, 5.0f, 2.0f, 0.5f, 2, glm::vec3(35.4f, 30.593f, 39.539f) };
+	tex2Params[2] = { 0.5f, 6.0f, 2.0f, 0.5f, 4, glm::vec3(40.8f, 44.99f, 45.48f) };
+}
 
 void CloudGenerator::Initialize()
 {
+	GLResourceScope scope("Clouds");
+
 	TextureCreateInfo createInfo = {
 	128, 128, 128, GL_RGBA,
 	GL_RGBA32F,
@@ -16,6 +51,9 @@ void CloudGenerator::Initialize()
 	GL_FLOAT
 	};
 	createInfo.wrapType = GL_REPEAT;
+	// Mip chains are rebuilt by the NoiseGenerator after every regeneration
+	createInfo.generateMipmap = true;
+	createInfo.minFilterType = GL_LINEAR_MIPMAP_LINEAR;
 
 	mTexture1 = std::make_unique<GLTexture>();
 	mTexture1->init(&createInfo);
@@ -24,41 +62,58 @@ void CloudGenerator::Initialize()
 	mTexture2 = std::make_unique<GLTexture>();
 	mTexture2->init(&createInfo);
 
+	// Slices made by --blue-noise, or the single static tile when they are missing
+	uint32_t width, height;
+	std::vector<uint8_t> noiseData;
+	uint32_t numSlices = BlueNoise::Load(BlueNoise::DEFAULT_DIRECTORY, width, height, noiseData);
+	if (numSlices == 0) {
+		logger::Warn(std::string("No blue noise slices in ") + BlueNoise::DEFAULT_DIRECTORY + ", falling back to Textures/BlueNoise64.png");
+		if (BlueNoise::LoadSlice("Textures/BlueNoise64.png", width, height, noiseData))
+			numSlices = 1;
+		else {
+			width = height = numSlices = 1;
+			noiseData.assign(1, 0);
+		}
+	}
+
 	mBlueNoiseTex = std::make_unique<GLTexture>();
-	int width, height, nChannel;
-	unsigned char* noiseData = Utils::LoadImage("Textures/BlueNoise64.png", &width, &height, &nChannel);
 	createInfo.width = width;
 	createInfo.height = height;
-	createInfo.internalFormat = GL_RGBA8;
+	createInfo.depth = numSlices;
+	createInfo.format = GL_RED;
+	createInfo.internalFormat = GL_R8;
 	createInfo.dataType = GL_UNSIGNED_BYTE;
-	createInfo.target = GL_TEXTURE_2D;
-	mBlueNoiseTex->init(&createInfo, noiseData);
+	createInfo.target = GL_TEXTURE_2D_ARRAY;
+	createInfo.generateMipmap = false;
+	createInfo.minFilterType = GL_NEAREST;
+	createInfo.magFilterType = GL_NEAREST;
+	// Rows of single bytes aren't 4 byte aligned for every size
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	mBlueNoiseTex->init(&createInfo, noiseData.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	mWeatherMap = std::make_unique<WeatherMap>();
+	mWeatherMap->Initialize(256);
 
-	Utils::FreeImage(noiseData);
+	mAuthoredVolume = std::make_unique<SparseVolume>();
 
-	mTex1Params[0] = { 1.0f, 1.0f, 1.0f, 0.5f, 7, glm::vec3(0.4f, 0.6, 0.5), NoiseType::Perlin };
-	mTex1Params[1] = { 0.5f, 4.0f, 2.0f, 0.5f, 2, glm::vec3(1.4f, 1.593f, 1.539f) };
-	mTex1Params[2] = { 0.5f, 8.0f, 2.0f, 0.5f, 4, glm::vec3(2.8f, 2.99f, 2.48f) };
-	mTex1Params[3] = { 0.5f, 8.0f, 2.0f, 0.5f, 6, glm::vec3(4.8f, 5.f, 5.43f) };
+	GetDefaultNoiseParams(mTex1Params, mTex2Params);
 
 	mNoiseGenerator = NoiseGenerator::GetInstance();
-	mNoiseGenerator->Generate(&mTex1Params[0], mTexture1.get(), 0);
-	mNoiseGenerator->Generate(&mTex1Params[1], mTexture1.get(), 1);
-	mNoiseGenerator->Generate(&mTex1Params[2], mTexture1.get(), 2);
-	mNoiseGenerator->Generate(&mTex1Params[3], mTexture1.get(), 3);
-
-	mTex2Params[0] = { 0.5f, 4.0f, 2.0f, 0.5f, 1, glm::vec3(29.4f, 25.6, 27.5) };
-	mTex2Params[1] = { 0.5f, 5.0f, 2.0f, 0.5f, 2, glm::vec3(35.4f, 30.593f, 39.539f) };
-	mTex2Params[2] = { 0.5f, 6.0f, 2.0f, 0.5f, 4, glm::vec3(40.8f, 44.99f, 45.48f) };
-	mNoiseGenerator->Generate(&mTex2Params[0], mTexture2.get(), 0);
-	mNoiseGenerator->Generate(&mTex2Params[1], mTexture2.get(), 1);
-	mNoiseGenerator->Generate(&mTex2Params[2], mTexture2.get(), 2);
+	mNoiseGenerator->GenerateBatch(mTex1Params, 4, mTexture1.get());
+	mNoiseGenerator->GenerateBatch(mTex2Params, 3, mTexture2.get());
 
 	GLShader rayMarchVS("Shaders/raymarch.vert");
 	GLShader rayMarchFS("Shaders/raymarch.frag");
 	mRayMarchProgram = std::make_unique<GLProgram>();
 	mRayMarchProgram->init(rayMarchVS, rayMarchFS);
 
+	GLShader multiViewVS("Shaders/raymarch.vert");
+	GLShader multiViewGS("Shaders/raymarch-multiview.geom");
+	GLShader multiViewFS("Shaders/raymarch.frag", "#define MULTI_VIEW\n");
+	mMultiViewProgram = std::make_unique<GLProgram>();
+	mMultiViewProgram->init(multiViewVS, multiViewGS, multiViewFS);
+
 	std::vector<glm::vec2> positions = {
 		glm::vec2(-1.0f, -1.0f),
 		glm::vec2(1.0f, 1.0f),
@@ -72,7 +127,46 @@ void CloudGenerator::Initialize()
 	uint32_t dataSize = static_cast<uint32_t>(positions.size() * sizeof(glm::vec2));
 	mQuadBuffer->init(positions.data(), dataSize, 0);
 
-	glGenQueries(1, &mGpuQuery);
+	// Tiling textures of the raymarch, trilinear where there is a mip chain
+	mRepeatSampler = std::make_unique<GLSampler>();
+	mRepeatSampler->init(GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR, GL_REPEAT);
+
+	glCreateVertexArrays(1, &mQuadVAO);
+	GLResources::track(GLResourceType::VertexArray, mQuadVAO);
+	glVertexArrayVertexBuffer(mQuadVAO, 0, mQuadBuffer->handle, 0, sizeof(glm::vec2));
+	glEnableVertexArrayAttrib(mQuadVAO, 0);
+	glVertexArrayAttribFormat(mQuadVAO, 0, 2, GL_FLOAT, GL_FALSE, 0);
+	glVertexArrayAttribBinding(mQuadVAO, 0, 0);
+
+	{
+		GLResourceScope panoramaScope("Panorama");
+		TextureCreateInfo panoramaInfo = { mPanoramaSize, mPanoramaSize, 1, GL_RGBA, GL_RGBA16F, GL_TEXTURE_CUBE_MAP, GL_FLOAT };
+		panoramaInfo.generateMipmap = true;
+		panoramaInfo.minFilterType = GL_LINEAR_MIPMAP_LINEAR;
+		mPanoramaTex = std::make_unique<GLTexture>();
+		mPanoramaTex->init(&panoramaInfo);
+	}
+
+	glCreateFramebuffers(1, &mMultiViewFBO);
+	GLResources::track(GLResourceType::Framebuffer, mMultiViewFBO);
+
+	{
+		GLResourceScope shadowScope("Cloud Shadow");
+		GLShader shadowCS("Shaders/cloud-shadow.comp");
+		mShadowProgram = std::make_unique<GLComputeProgram>();
+		mShadowProgram->init(shadowCS);
+
+		TextureCreateInfo shadowInfo = { mShadowMapSize, mShadowMapSize, 1, GL_RED, GL_R32F, GL_TEXTURE_2D, GL_FLOAT };
+		for (auto& texture : mShadowTex) {
+			texture = std::make_unique<GLTexture>();
+			texture->init(&shadowInfo);
+		}
+	}
+
+	UpdateAtmosphere();
+
+	glGenQueries(2, mGpuQuery);
+	glGenQueries(2, mPanoramaQuery);
 }
 
 static const char* CHANNELS_DROPDOWN[] = {
@@ -102,29 +196,41 @@ static bool CreateNoiseWidget(const char* name, NoiseParams* params) {
 void CloudGenerator::AddUI()
 {
 	ImGui::Text("Render Time: %.2fms", mRenderTime);
-	ImGui::DragFloat2("Radius", &mRadius[0], 10.0f);
+	if (mParams.usePanorama)
+		ImGui::Text("Panorama Time: %.2fms", mPanoramaTime);
+	ImGui::DragFloat2("Radius", &mParams.radius[0], 10.0f);
 	ImGui::Spacing();
 
-	ImGui::SliderFloat("CloudScale", &mCloudScale, 0.0f, 1.0f);
-	ImGui::DragFloat3("CloudOffset", &mCloudOffset[0], 0.1f);
-
-	ImGui::SliderFloat("DensityMultiplier", &mDensityMultiplier, 0.0f, 1.0f);
-	ImGui::SliderFloat("DensityThreshold", &mDensityThreshold, 0.0f, 1.0f);
-	ImGui::SliderFloat4("Layer Contribution", &mLayerContribution[0], 0.0f, 1.0f);
-
-	ImGui::ColorEdit3("Light Color", &mLightColor[0]);
-	ImGui::DragFloat("Light Intensity", &mLightColor.w, 0.1f);
-	ImGui::SliderFloat("PhaseG", &mPhaseG, 0.0f, 1.0f);
-	ImGui::SliderFloat("Light Absorption(Toward Camera)", &mLightAbsorption.x, 0.0f, 1.0f);
-	ImGui::SliderFloat("Light Absorption(Toward Sun)", &mLightAbsorption.y, 0.0f, 1.0f);
-	ImGui::Checkbox("Sugar Powder", &mSugarPowder);
+	ImGui::SliderFloat("CloudScale", &mParams.cloudScale, 0.0f, 1.0f);
+	ImGui::DragFloat3("CloudOffset", &mParams.cloudOffset[0], 0.1f);
+
+	ImGui::SliderFloat("DensityMultiplier", &mParams.densityMultiplier, 0.0f, 1.0f);
+	ImGui::SliderFloat("DensityThreshold", &mParams.densityThreshold, 0.0f, 1.0f);
+	ImGui::SliderFloat4("Layer Contribution", &mParams.layerContribution[0], 0.0f, 1.0f);
+
+	ImGui::ColorEdit3("Light Color", &mParams.lightColor[0]);
+	ImGui::DragFloat("Light Intensity", &mParams.lightColor.w, 0.1f);
+	ImGui::SliderFloat("PhaseG", &mParams.phaseG, 0.0f, 1.0f);
+	ImGui::SliderFloat("Light Absorption(Toward Camera)", &mParams.lightAbsorption.x, 0.0f, 1.0f);
+	ImGui::SliderFloat("Light Absorption(Toward Sun)", &mParams.lightAbsorption.y, 0.0f, 1.0f);
+	ImGui::Checkbox("Sugar Powder", &mParams.sugarPowder);
+	ImGui::SliderInt("Raymarch Steps", &mParams.raymarchSteps, 1, 256);
+	ImGui::Checkbox("Animate Jitter", &mParams.animateJitter);
+	ImGui::SameLine();
+	ImGui::Text("(%ux%ux%u blue noise)", mBlueNoiseTex->width, mBlueNoiseTex->height, mBlueNoiseTex->depth);
+	ImGui::SliderInt("Lightmarch Steps", &mParams.lightmarchSteps, 1, 32);
+
+	ImGui::Checkbox("Noise LOD", &mParams.useLod);
+	ImGui::SliderFloat("LOD Bias", &mParams.lodBias, -2.0f, 4.0f);
+	ImGui::SliderFloat("LOD Step Factor", &mParams.lodStepFactor, 0.0f, 1.0f);
+	ImGui::DragFloat("Detail Noise Cutoff", &mParams.highFreqCutoff, 10.0f, 0.0f, 20000.0f);
 
 	static float theta = glm::radians(90.0f), phi = 0.0f;
 	ImGui::Text("Light Direction");
 	bool changed = ImGui::SliderAngle("phi", &phi);
 	changed |= ImGui::SliderAngle("theta", &theta);
 	if (changed)
-		mLightDirection = glm::vec3{ sin(theta) * cos(phi), sin(theta) * sin(phi), cos(theta) };
+		mParams.lightDirection = glm::vec3{ sin(theta) * cos(phi), sin(theta) * sin(phi), cos(theta) };
 
 	ImGui::Spacing();
 	ImGui::Separator();
@@ -136,6 +242,10 @@ void CloudGenerator::AddUI()
 		SelectableTexture3D(mTexture1->handle, ImVec2{256, 256.0f}, &layer1, &channel1, 4);
 		if (CreateNoiseWidget("Noise Params", &mTex1Params[channel1])) {
 			mNoiseGenerator->Generate(&mTex1Params[channel1], mTexture1.get(), channel1);
+			if (mVirtualNoise)
+				mVirtualNoise->SetNoiseParams(mTex1Params);
+			mEvolveValid = false;
+			mShadowDirty = true;
 		}
 		ImGui::PopID();
 		ImGui::Separator();
@@ -147,15 +257,494 @@ void CloudGenerator::AddUI()
 		static float layer2 = 0;
 		static int channel2 = 0;
 		SelectableTexture3D(mTexture2->handle, ImVec2{64.0f, 64.0f}, &layer2, &channel2, 3);
-		if (CreateNoiseWidget("Noise Params", &mTex2Params[channel2]))
+		if (CreateNoiseWidget("Noise Params", &mTex2Params[channel2])) {
 			mNoiseGenerator->Generate(&mTex2Params[channel2], mTexture2.get(), channel2);
+			mShadowDirty = true;
+		}
 		ImGui::PopID();
 		ImGui::Separator();
 	}
 
-	ImGui::Text("Blue Noise Texture");
-	ImGui::Image((ImTextureID)(uint64_t)mBlueNoiseTex->handle, ImVec2 { 64, 64 });
+	if (ImGui::CollapsingHeader("Noise Generator")) {
+		bool useSharedKernels = mNoiseGenerator->GetUseSharedKernels();
+		if (ImGui::Checkbox("Shared Memory Kernels", &useSharedKernels))
+			mNoiseGenerator->SetUseSharedKernels(useSharedKernels);
+		if (ImGui::Button("Benchmark Kernels"))
+			mNoiseGenerator->Benchmark();
+		ImGui::Separator();
+	}
+
+	if (ImGui::CollapsingHeader("Virtual Noise")) {
+		ImGui::Checkbox("Use Virtual Noise", &mParams.useVirtualNoise);
+		ImGui::SliderInt("Domain Tiles", &mParams.virtualNoiseDomain, 1, 32);
+		ImGui::SliderInt("Bricks Per Frame", &mParams.virtualBricksPerFrame, 0, 64);
+		if (mVirtualNoise)
+			mVirtualNoise->AddUI();
+		ImGui::Separator();
+	}
+
+	if (ImGui::CollapsingHeader("Wind")) {
+		ImGui::Checkbox("Evolve Clouds", &mParams.evolveClouds);
+		ImGui::DragFloat2("Wind Velocity(m/s)", &mParams.windVelocity[0], 0.5f);
+		if (mParams.evolveClouds)
+			ImGui::Text("Regenerated: %u texels", mEvolveTexels);
+		ImGui::Separator();
+	}
+
+	if (ImGui::CollapsingHeader("Authored Volume")) {
+		ImGui::Checkbox("Use Authored Volume", &mParams.useAuthoredVolume);
+		ImGui::Combo("Blend", &mParams.authoredMode, "Add\0Replace\0");
+		ImGui::SliderFloat("Authored Density", &mParams.authoredDensity, 0.0f, 4.0f);
+		ImGui::DragFloat3("Authored Offset", &mParams.authoredOffset[0], 10.0f);
+		ImGui::SliderInt("Bricks Per Frame##Authored", &mParams.authoredBricksPerFrame, 1, 4096);
+		static char path[256] = "Volumes/cloud.sbm";
+		ImGui::InputText("Path##Authored", path, sizeof(path));
+		if (ImGui::Button("Load Volume"))
+			LoadAuthoredVolume(path);
+		mAuthoredVolume->AddUI();
+		ImGui::Separator();
+	}
+
+	if (ImGui::CollapsingHeader("Far Field Panorama")) {
+		ImGui::Checkbox("Use Panorama", &mParams.usePanorama);
+		ImGui::DragFloat("Far Field Distance", &mParams.farFieldDistance, 10.0f, 0.0f, 20000.0f);
+		ImGui::SliderInt("Faces Per Frame", &mParams.panoramaFacesPerFrame, 1, 6);
+		ImGui::SliderFloat("Environment Light", &mParams.panoramaAmbient, 0.0f, 4.0f);
+		if (ImGui::Button("Benchmark Multi-View"))
+			BenchmarkMultiView(6);
+		if (mBenchmarkViews > 0) {
+			ImGui::Text("Single View: %.3fms/view", mSingleViewTime / mBenchmarkViews);
+			ImGui::Text("Batched: %.3fms/view", mMultiViewTime / mBenchmarkViews);
+		}
+		ImGui::Separator();
+	}
+
+	if (ImGui::CollapsingHeader("Cloud Shadows")) {
+		ImGui::Checkbox("Use Cloud Shadows", &mParams.useCloudShadow);
+		ImGui::SliderFloat("Shadow Strength", &mParams.shadowStrength, 0.0f, 1.0f);
+		ImGui::DragFloat("Shadow Extent", &mParams.shadowExtent, 10.0f, 64.0f, 20000.0f);
+		ImGui::SliderInt("Shadow Steps", &mParams.shadowSteps, 4, 128);
+		ImGui::SliderInt("Rows Per Frame", &mParams.shadowRowsPerFrame, 1, int(mShadowMapSize));
+		ImGui::Image((ImTextureID)(uint64_t)mShadowTex[mShadowFront]->handle, ImVec2{ 128, 128 });
+		ImGui::Separator();
+	}
+
+	if (ImGui::CollapsingHeader("Atmosphere")) {
+		ImGui::Checkbox("Use Atmosphere", &mParams.useAtmosphere);
+		ImGui::SliderFloat("Sky Ambient", &mParams.skyAmbientStrength, 0.0f, 4.0f);
+		ImGui::Text("LUT Bake Time: %.2fms", mAtmosphereBakeTime);
+		// Edits are picked up by UpdateAtmosphere() on the next frame
+		ImGui::DragFloat("Ground Radius(km)", &mAtmosphereParams.groundRadius, 1.0f, 100.0f, 10000.0f);
+		ImGui::DragFloat("Top Radius(km)", &mAtmosphereParams.topRadius, 1.0f, mAtmosphereParams.groundRadius + 1.0f, 10100.0f);
+		ImGui::DragFloat3("Rayleigh Scattering", &mAtmosphereParams.rayleighScattering[0], 0.0001f, 0.0f, 0.1f, "%.4f");
+		ImGui::DragFloat("Rayleigh Scale Height", &mAtmosphereParams.rayleighScaleHeight, 0.1f, 0.1f, 20.0f);
+		ImGui::DragFloat("Mie Scattering", &mAtmosphereParams.mieScattering, 0.0001f, 0.0f, 0.1f, "%.4f");
+		ImGui::DragFloat("Mie Absorption", &mAtmosphereParams.mieAbsorption, 0.0001f, 0.0f, 0.1f, "%.4f");
+		ImGui::DragFloat("Mie Scale Height", &mAtmosphereParams.mieScaleHeight, 0.01f, 0.1f, 10.0f);
+		ImGui::SliderFloat("Mie PhaseG", &mAtmosphereParams.miePhaseG, 0.0f, 0.99f);
+		ImGui::DragFloat3("Ozone Absorption", &mAtmosphereParams.ozoneAbsorption[0], 0.0001f, 0.0f, 0.01f, "%.4f");
+		ImGui::ColorEdit3("Ground Albedo", &mAtmosphereParams.groundAlbedo[0]);
+		ImGui::Separator();
+	}
+
+	if (ImGui::CollapsingHeader("Weather Map")) {
+		ImGui::Checkbox("Use Weather Map", &mParams.useWeatherMap);
+		ImGui::DragFloat("Weather Scale", &mParams.weatherScale, 100.0f, 1000.0f, 100000.0f);
+		ImGui::SliderFloat("Precipitation Density", &mParams.precipitationDensity, 0.0f, 4.0f);
+		mWeatherMap->AddUI();
+		ImGui::Separator();
+	}
+}
+
+void CloudGenerator::SetupRaymarchProgram(GLProgram* program, glm::vec3 camPos, glm::mat4 invP, glm::mat4 invV, float viewportHeight)
+{
+	program->use();
+	program->setVec2("uRadius", &mParams.radius[0]);
+	program->setVec3("uCamPos", &camPos[0]);
+	program->setMat4("uInvP", &invP[0][0]);
+	program->setMat4("uInvV", &invV[0][0]);
+	program->setFloat("uViewportHeight", viewportHeight);
+
+	program->setTexture("uNoiseTex1", 0, mTexture1->handle, *mRepeatSampler);
+	program->setTexture("uNoiseTex2", 1, mTexture2->handle, *mRepeatSampler);
+	program->setTexture("uBlueNoiseTex", 2, mBlueNoiseTex->handle, *mRepeatSampler);
+	program->setInt("uFrameIndex", mParams.animateJitter ? int(mFrameIndex % BLUE_NOISE_FRAME_PERIOD) : 0);
+	program->setTexture("uWeatherTex", 5, mWeatherMap->GetTexture()->handle, *mRepeatSampler);
+	program->setTextureCube("uPanoramaTex", 6, mPanoramaTex->handle);
+
+	program->setVec3("uCloudOffset", &mParams.cloudOffset[0]);
+	glm::vec3 noiseScroll{ mNoiseScroll.x, 0.0f, mNoiseScroll.y };
+	program->setVec3("uNoiseScroll", &noiseScroll[0]);
+	glm::vec2 evolveSeam = GetEvolveSeam();
+	program->setInt("uEvolveSeamBlend", int(mEvolveValid));
+	program->setVec2("uEvolveSeam", &evolveSeam[0]);
+	program->setFloat("uCloudScale", mParams.cloudScale);
+	program->setFloat("uDensityMultiplier", mParams.densityMultiplier);
+	program->setFloat("uDensityThreshold", mParams.densityThreshold);
+	program->setVec3("uLightDirection", &mParams.lightDirection[0]);
+	program->setVec4("uLightColor", &mParams.lightColor[0]);
+	program->setVec4("uLayerContribution", &mParams.layerContribution[0]);
+	program->setFloat("uPhaseG", mParams.phaseG);
+	program->setVec2("uLightAbsorption", &mParams.lightAbsorption[0]);
+	program->setInt("uSugarPowder", int(mParams.sugarPowder));
+	program->setInt("uRaymarchSteps", mParams.raymarchSteps);
+	program->setInt("uLightmarchSteps", mParams.lightmarchSteps);
+	program->setInt("uUseLod", int(mParams.useLod));
+	program->setFloat("uLodBias", mParams.lodBias);
+	program->setFloat("uLodStepFactor", mParams.lodStepFactor);
+	program->setFloat("uHighFreqCutoff", mParams.highFreqCutoff);
+	program->setInt("uUseWeatherMap", int(mParams.useWeatherMap));
+	program->setFloat("uWeatherScale", mParams.weatherScale);
+	program->setFloat("uPrecipitationDensity", mParams.precipitationDensity);
+
+	program->setInt("uUsePanorama", int(mParams.usePanorama && mPanoramaValid));
+	program->setFloat("uFarFieldDistance", mParams.farFieldDistance);
+	program->setFloat("uPanoramaAmbient", mPanoramaValid ? mParams.panoramaAmbient : 0.0f);
+	program->setFloat("uPanoramaMaxLod", float(mPanoramaTex->levels - 1));
+
+	program->setInt("uUseAtmosphere", int(mParams.useAtmosphere));
+	program->setTexture("uTransmittanceLUT", 7, mTransmittanceTex->handle);
+	program->setTexture("uSkyAmbientLUT", 8, mSkyAmbientTex->handle);
+	program->setFloat("uSkyAmbientStrength", mParams.skyAmbientStrength);
+	program->setFloat("uAtmosphereHeight", mAtmosphereParams.topRadius - mAtmosphereParams.groundRadius);
+
+	// Own units even while unused, samplers of different types can't share a unit
+	bool useVirtualNoise = mParams.useVirtualNoise && mVirtualNoise;
+	program->setInt("uUseVirtualNoise", int(useVirtualNoise));
+	program->setInt("uNoiseIndirection", 9);
+	program->setInt("uNoiseAtlas", 10);
+	if (useVirtualNoise)
+		mVirtualNoise->Bind(program, 9, 10);
+
+	bool useAuthored = mParams.useAuthoredVolume && mAuthoredVolume->IsLoaded();
+	program->setInt("uUseAuthored", int(useAuthored));
+	program->setInt("uAuthoredMode", mParams.authoredMode);
+	program->setFloat("uAuthoredDensity", mParams.authoredDensity);
+	program->setInt("uAuthoredAtlas", 11);
+	if (useAuthored)
+		mAuthoredVolume->Bind(program, 11, mParams.authoredOffset);
+}
+
+bool CloudGenerator::LoadAuthoredVolume(const char* filename)
+{
+	if (!mAuthoredVolume->Load(filename))
+		return false;
+	mParams.useAuthoredVolume = true;
+	return true;
+}
+
+static void UploadLUT(std::unique_ptr<GLTexture>& texture, AtmosphereLUT& lut)
+{
+	if (texture && (texture->width != lut.width || texture->height != lut.height)) {
+		texture->destroy();
+		texture.reset();
+	}
+
+	if (!texture) {
+		GLResourceScope scope("Atmosphere");
+		TextureCreateInfo createInfo = { lut.width, lut.height, 1, GL_RGBA, GL_RGBA32F, GL_TEXTURE_2D, GL_FLOAT };
+		texture = std::make_unique<GLTexture>();
+		texture->init(&createInfo, lut.data.data());
+	}
+	else
+		glTextureSubImage2D(texture->handle, 0, 0, 0, lut.width, lut.height, GL_RGBA, GL_FLOAT, lut.data.data());
+}
+
+void CloudGenerator::UpdateAtmosphere()
+{
+	if (mAtmosphereBaked && mAtmosphereParams == mBakedAtmosphereParams)
+		return;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	Atmosphere::ComputeTransmittanceLUT(mAtmosphereParams, mTransmittanceLUT);
+	Atmosphere::ComputeMultiScatteringLUT(mAtmosphereParams, mTransmittanceLUT, mMultiScatteringLUT);
+	Atmosphere::ComputeSkyAmbientLUT(mAtmosphereParams, mTransmittanceLUT, mMultiScatteringLUT, mSkyAmbientLUT);
+	auto end = std::chrono::high_resolution_clock::now();
+	mAtmosphereBakeTime = std::chrono::duration<float, std::milli>(end - start).count();
+
+	// Only the two tables the march reads are uploaded, multi scattering is folded into the sky ambient
+	UploadLUT(mTransmittanceTex, mTransmittanceLUT);
+	UploadLUT(mSkyAmbientTex, mSkyAmbientLUT);
+
+	mBakedAtmosphereParams = mAtmosphereParams;
+	mAtmosphereBaked = true;
+}
+
+void CloudGenerator::UpdateVirtualNoise()
+{
+	if (!mParams.useVirtualNoise)
+		return;
+
+	uint32_t periodScale = uint32_t(std::max(mParams.virtualNoiseDomain, 1));
+	if (!mVirtualNoise) {
+		mVirtualNoise = std::make_unique<VirtualNoiseVolume>();
+		mVirtualNoise->Initialize(mNoiseGenerator, mTex1Params, periodScale);
+	}
+	else
+		mVirtualNoise->SetPeriodScale(periodScale);
+
+	mVirtualNoise->Update(uint32_t(std::max(mParams.virtualBricksPerFrame, 0)));
+}
+
+void CloudGenerator::GenerateNoiseWindow(const glm::ivec3& min, const glm::ivec3& size)
+{
+	// Up to two runs per axis, split where the box wraps around the edge of the volume
+	struct Run {
+		int first;
+		int texel;
+		int count;
+	};
+	const int volumeSize = int(mTexture1->width);
+	Run runs[3][2];
+	int numRuns[3];
+	for (int axis = 0; axis < 3; ++axis) {
+		int texel = ((min[axis] % volumeSize) + volumeSize) % volumeSize;
+		int count = std::min(size[axis], volumeSize - texel);
+		runs[axis][0] = { min[axis], texel, count };
+		runs[axis][1] = { min[axis] + count, 0, size[axis] - count };
+		numRuns[axis] = count < size[axis] ? 2 : 1;
+	}
+
+	NoiseRegion region;
+	region.tileSize = glm::vec3(float(volumeSize));
+	region.periodScale = glm::vec3(EVOLVE_PERIOD, 1.0f, EVOLVE_PERIOD);
+	for (int x = 0; x < numRuns[0]; ++x) {
+		for (int y = 0; y < numRuns[1]; ++y) {
+			for (int z = 0; z < numRuns[2]; ++z) {
+				const Run& rx = runs[0][x];
+				const Run& ry = runs[1][y];
+				const Run& rz = runs[2][z];
+				region.sampleOrigin = glm::vec3(float(rx.first), float(ry.first), float(rz.first));
+				region.outputOffset = glm::ivec3(rx.texel, ry.texel, rz.texel);
+				region.size = glm::ivec3(rx.count, ry.count, rz.count);
+				mNoiseGenerator->GenerateRegion(mTex1Params, 4, mTexture1.get(), region);
+			}
+		}
+	}
+	mEvolveTexels += uint32_t(size.x * size.y * size.z);
+}
+
+void CloudGenerator::UpdateEvolvingNoise(float dt)
+{
+	mEvolveTexels = 0;
+	if (!mParams.evolveClouds) {
+		// Back to the tiling volume and a sky that stays put
+		if (mEvolveValid) {
+			mNoiseGenerator->GenerateBatch(mTex1Params, 4, mTexture1.get());
+			mNoiseScroll = glm::vec2(0.0f);
+			mEvolveValid = false;
+			mShadowDirty = true;
+		}
+		return;
+	}
+
+	// Clouds drift downwind so the noise coordinates move the other way, wrapped
+	// to the domain the noise repeats over to keep the precision
+	mNoiseScroll -= mParams.windVelocity * (dt * 0.001f * mParams.cloudScale);
+	mNoiseScroll = glm::mod(mNoiseScroll, glm::vec2(EVOLVE_PERIOD));
+
+	// Samples of the tile at p read texels (p + scroll) * size, the window starts at the first of them
+	const int volumeSize = int(mTexture1->width);
+	const int periodTexels = int(EVOLVE_PERIOD) * volumeSize;
+	glm::ivec3 origin(int(std::floor(mNoiseScroll.x * volumeSize)), 0, int(std::floor(mNoiseScroll.y * volumeSize)));
+
+	glm::ivec3 delta = origin - mEvolveOrigin;
+	for (int axis : { 0, 2 }) {
+		if (delta[axis] >= periodTexels / 2) delta[axis] -= periodTexels;
+		else if (delta[axis] < -periodTexels / 2) delta[axis] += periodTexels;
+	}
+
+	if (!mEvolveValid || std::abs(delta.x) >= volumeSize || std::abs(delta.z) >= volumeSize) {
+		GenerateNoiseWindow(origin, glm::ivec3(volumeSize));
+		mEvolveValid = true;
+	}
+	else {
+		// The x slab spans the old z range and the z slab the new x range, so the
+		// corner that scrolled in along both is covered by the second
+		if (delta.x != 0) {
+			int first = delta.x > 0 ? mEvolveOrigin.x + volumeSize : mEvolveOrigin.x + delta.x;
+			GenerateNoiseWindow({ first, 0, mEvolveOrigin.z }, { std::abs(delta.x), volumeSize, volumeSize });
+		}
+		if (delta.z != 0) {
+			int first = delta.z > 0 ? mEvolveOrigin.z + volumeSize : mEvolveOrigin.z + delta.z;
+			GenerateNoiseWindow({ mEvolveOrigin.x + delta.x, 0, first }, { volumeSize, volumeSize, std::abs(delta.z) });
+		}
+	}
+	mEvolveOrigin = origin;
+
+	if (mEvolveTexels > 0) {
+		mNoiseGenerator->UpdateMipmaps(mTexture1.get());
+		mShadowDirty = true;
+	}
+}
+
+glm::vec2 CloudGenerator::GetEvolveSeam() const
+{
+	float volumeSize = float(mTexture1->width);
+	return glm::fract(glm::vec2(float(mEvolveOrigin.x), float(mEvolveOrigin.z)) / volumeSize);
+}
+
+void CloudGenerator::DrawQuad()
+{
+	GLState::bindVertexArray(mQuadVAO);
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+}
+
+// Matches the face orientation OpenGL uses to look up cube maps
+static glm::mat4 GetCubeFaceView(int face, const glm::vec3& center)
+{
+	static const glm::vec3 directions[6] = {
+		{ 1.0f, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f },
+		{ 0.0f, 1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f },
+		{ 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f, -1.0f },
+	};
+	static const glm::vec3 ups[6] = {
+		{ 0.0f, -1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f },
+		{ 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f, -1.0f },
+		{ 0.0f, -1.0f, 0.0f }, { 0.0f, -1.0f, 0.0f },
+	};
+	return glm::lookAt(center, center + directions[face], ups[face]);
+}
+
+void CloudGenerator::UpdatePanorama(const glm::vec3& center)
+{
+	// Every face of a cycle is rendered from the same center
+	if (mPanoramaFace == 0)
+		mPanoramaCenter = center;
+
+	glm::mat4 invP = glm::inverse(glm::perspective(glm::radians(90.0f), 1.0f, 0.5f, mParams.radius.y));
+
+	// The first cycle is done in one go so that the panorama is complete before it is used
+	int numFaces = mPanoramaValid ? mParams.panoramaFacesPerFrame : 6;
+	CloudView views[6];
+	uint32_t numViews = 0;
+	for (int i = 0; i < numFaces; ++i) {
+		views[numViews++] = { invP, glm::inverse(GetCubeFaceView(mPanoramaFace, mPanoramaCenter)), mPanoramaCenter, uint32_t(mPanoramaFace) };
+		mPanoramaFace = (mPanoramaFace + 1) % 6;
+		if (mPanoramaFace == 0)
+			break;
+	}
+
+	RenderViews(views, numViews, mPanoramaTex->handle, mPanoramaSize, mPanoramaSize, mParams.farFieldDistance);
+
+	if (mPanoramaFace == 0) {
+		// Prefiltered chain for the environment lighting
+		glGenerateTextureMipmap(mPanoramaTex->handle);
+		mPanoramaValid = true;
+	}
+}
+
+void CloudGenerator::RenderViews(const CloudView* views, uint32_t numViews, uint32_t targetTexture, uint32_t width, uint32_t height, float startDistance)
+{
+	if (numViews == 0) return;
+
+	GLuint prevFramebuffer = GLState::getFramebuffer();
+	GLint prevViewport[4];
+	glGetIntegerv(GL_VIEWPORT, prevViewport);
+
+	// Per view uniforms are the only thing that changes between the draws
+	SetupRaymarchProgram(mMultiViewProgram.get(), views[0].position, views[0].invProjection, views[0].invView, float(height));
+	mMultiViewProgram->setInt("uRenderMode", 1);
+	mMultiViewProgram->setFloat("uFarFieldDistance", startDistance);
+
+	// Layered attachment, gl_Layer from the geometry shader picks the layer
+	glNamedFramebufferTexture(mMultiViewFBO, GL_COLOR_ATTACHMENT0, targetTexture, 0);
+	GLState::bindFramebuffer(mMultiViewFBO);
+	glViewport(0, 0, width, height);
+
+	glm::mat4 invP[MAX_BATCH_VIEWS];
+	glm::mat4 invV[MAX_BATCH_VIEWS];
+	glm::vec3 positions[MAX_BATCH_VIEWS];
+	int layers[MAX_BATCH_VIEWS];
+	for (uint32_t first = 0; first < numViews; first += MAX_BATCH_VIEWS) {
+		int count = int(std::min(numViews - first, MAX_BATCH_VIEWS));
+		for (int i = 0; i < count; ++i) {
+			const CloudView& view = views[first + i];
+			invP[i] = view.invProjection;
+			invV[i] = view.invView;
+			positions[i] = view.position;
+			layers[i] = int(view.layer);
+		}
+
+		mMultiViewProgram->setInt("uNumViews", count);
+		mMultiViewProgram->setIntArray("uViewLayer", layers, count);
+		mMultiViewProgram->setMat4Array("uViewInvP", &invP[0][0][0], count);
+		mMultiViewProgram->setMat4Array("uViewInvV", &invV[0][0][0], count);
+		mMultiViewProgram->setVec3Array("uViewCamPos", &positions[0][0], count);
+		DrawQuad();
+	}
+
+	GLState::bindFramebuffer(prevFramebuffer);
+	glViewport(prevViewport[0], prevViewport[1], prevViewport[2], prevViewport[3]);
+}
+
+void CloudGenerator::BenchmarkMultiView(uint32_t numViews)
+{
+	numViews = std::max(numViews, 1u);
+
+	// Throwaway array target, the panorama is left alone
+	TextureCreateInfo createInfo = { mPanoramaSize, mPanoramaSize, numViews, GL_RGBA, GL_RGBA16F, GL_TEXTURE_2D_ARRAY, GL_FLOAT };
+	GLTexture target;
+	{
+		GLResourceScope scope("Benchmark");
+		target.init(&createInfo);
+	}
+
+	glm::mat4 invP = glm::inverse(glm::perspective(glm::radians(90.0f), 1.0f, 0.5f, mParams.radius.y));
+	std::vector<CloudView> views(numViews);
+	for (uint32_t i = 0; i < numViews; ++i)
+		views[i] = { invP, glm::inverse(GetCubeFaceView(i % 6, mPanoramaCenter)), mPanoramaCenter, i };
+
+	GLuint prevFramebuffer = GLState::getFramebuffer();
+	GLint prevViewport[4];
+	glGetIntegerv(GL_VIEWPORT, prevViewport);
+
+	GLuint query;
+	glGenQueries(1, &query);
+	auto timeGpu = [query](const std::function<void()>& fn) {
+		const int numRuns = 5;
+		fn();
+		uint64_t total = 0;
+		for (int i = 0; i < numRuns; ++i) {
+			glBeginQuery(GL_TIME_ELAPSED, query);
+			fn();
+			glEndQuery(GL_TIME_ELAPSED);
+			uint64_t elapsed = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+			total += elapsed;
+		}
+		return float(total / numRuns) * 0.000001f;
+	};
 
+	// What each view cost before batching, a whole setup and draw per view
+	mSingleViewTime = timeGpu([&]() {
+		for (const CloudView& view : views) {
+			SetupRaymarchProgram(mRayMarchProgram.get(), view.position, view.invProjection, view.invView, float(mPanoramaSize));
+			mRayMarchProgram->setInt("uRenderMode", 1);
+			mRayMarchProgram->setFloat("uFarFieldDistance", 0.0f);
+			glNamedFramebufferTextureLayer(mMultiViewFBO, GL_COLOR_ATTACHMENT0, target.handle, 0, view.layer);
+			GLState::bindFramebuffer(mMultiViewFBO);
+			glViewport(0, 0, mPanoramaSize, mPanoramaSize);
+			DrawQuad();
+		}
+	});
+
+	mMultiViewTime = timeGpu([&]() {
+		RenderViews(views.data(), numViews, target.handle, mPanoramaSize, mPanoramaSize, 0.0f);
+	});
+	mBenchmarkViews = numViews;
+
+	glDeleteQueries(1, &query);
+	// The persistent FBO would otherwise keep the target alive under a name that can be reused
+	glNamedFramebufferTexture(mMultiViewFBO, GL_COLOR_ATTACHMENT0, 0, 0);
+	target.destroy();
+	GLState::bindFramebuffer(prevFramebuffer);
+	glViewport(prevViewport[0], prevViewport[1], prevViewport[2], prevViewport[3]);
+
+	char buffer[256];
+	snprintf(buffer, sizeof(buffer), "%u views at %ux%u: single view %.3fms (%.3fms/view), batched %.3fms (%.3fms/view)",
+		numViews, mPanoramaSize, mPanoramaSize, mSingleViewTime, mSingleViewTime / numViews, mMultiViewTime, mMultiViewTime / numViews);
+	logger::Debug(buffer);
 }
 
 void CloudGenerator::Render(Camera* camera, float dt, uint32_t depthTexture, uint32_t colorAttachment)
@@ -164,54 +753,211 @@ void CloudGenerator::Render(Camera* camera, float dt, uint32_t depthTexture, uin
 	glm::mat4 invV = camera->GetInvViewMatrix();
 	glm::vec3 camPos = camera->GetPosition();
 
-	//mCloudOffset.x += dt * 0.1f;
-	glBeginQuery(GL_TIME_ELAPSED, mGpuQuery);
-	/**/
-	glUseProgram(0);
-	mRayMarchProgram->use();
-	mRayMarchProgram->setVec2("uRadius", &mRadius[0]);
-	mRayMarchProgram->setVec3("uCamPos", &camPos[0]);
-	mRayMarchProgram->setMat4("uInvP", &invP[0][0]);
-	mRayMarchProgram->setMat4("uInvV", &invV[0][0]);
-
-	mRayMarchProgram->setTexture("uNoiseTex1", 0, mTexture1->handle, true);
-	mRayMarchProgram->setTexture("uNoiseTex2", 1, mTexture2->handle, true);
-	mRayMarchProgram->setTexture("uBlueNoiseTex", 2, mBlueNoiseTex->handle);
+	UpdateEvolvingNoise(dt);
+	UpdateAtmosphere();
+	UpdateVirtualNoise();
+	if (mParams.useAuthoredVolume)
+		mAuthoredVolume->Update(uint32_t(std::max(mParams.authoredBricksPerFrame, 1)));
+
+	uint32_t query = mQueryFrame & 1;
+	mPanoramaQueryIssued[query] = mParams.usePanorama;
+	if (mParams.usePanorama) {
+		glBeginQuery(GL_TIME_ELAPSED, mPanoramaQuery[query]);
+		UpdatePanorama(camPos);
+		glEndQuery(GL_TIME_ELAPSED);
+	}
+
+	glBeginQuery(GL_TIME_ELAPSED, mGpuQuery[query]);
+	UpdateCloudShadow();
+
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	SetupRaymarchProgram(mRayMarchProgram.get(), camPos, invP, invV, float(viewport[3]));
+
+	glm::vec2 depthRange{ camera->GetNearPlane(), camera->GetFarPlane() };
+	mRayMarchProgram->setVec2("uDepthRange", &depthRange[0]);
+	mRayMarchProgram->setInt("uRenderMode", 0);
 	mRayMarchProgram->setTexture("uDepthTexture", 3, depthTexture);
 	mRayMarchProgram->setTexture("uSceneTexture", 4, colorAttachment);
 
-	mRayMarchProgram->setVec3("uCloudOffset", &mCloudOffset[0]);
-	mRayMarchProgram->setFloat("uCloudScale", mCloudScale);
-	mRayMarchProgram->setFloat("uDensityMultiplier", mDensityMultiplier);
-	mRayMarchProgram->setFloat("uDensityThreshold", mDensityThreshold);
-	mRayMarchProgram->setVec3("uLightDirection", &mLightDirection[0]);
-	mRayMarchProgram->setVec4("uLightColor", &mLightColor[0]);
-	mRayMarchProgram->setVec4("uLayerContribution", &mLayerContribution[0]);
-	mRayMarchProgram->setFloat("uPhaseG", mPhaseG);
-	mRayMarchProgram->setVec2("uLightAbsorption", &mLightAbsorption[0]);
-	mRayMarchProgram->setInt("uSugarPowder", int(mSugarPowder));
-
-	glBindBuffer(GL_ARRAY_BUFFER, mQuadBuffer->handle);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), 0);
+	DrawQuad();
 
-	glDrawArrays(GL_TRIANGLES, 0, 6);
+	if (mParams.useVirtualNoise && mVirtualNoise)
+		mVirtualNoise->EndFrame();
 
 	glEndQuery(GL_TIME_ELAPSED);
-	// Wait for query to be available (stalling)
-	int done = 0;
-	while (!done)
-		glGetQueryObjectiv(mGpuQuery, GL_QUERY_RESULT_AVAILABLE, &done);
+	mGpuQueryIssued[query] = true;
+
+	// Results of the previous frame, it has had a whole frame to finish so this
+	// rarely waits, and never on the work that was just submitted
+	uint32_t previous = query ^ 1;
+	if (mGpuQueryIssued[previous]) {
+		uint64_t renderTimeElapsed = 0;
+		glGetQueryObjectui64v(mGpuQuery[previous], GL_QUERY_RESULT, &renderTimeElapsed);
+		mRenderTime = renderTimeElapsed * 0.000001f;
+	}
+
+	mPanoramaTime = 0.0f;
+	if (mPanoramaQueryIssued[previous]) {
+		uint64_t panoramaTimeElapsed = 0;
+		glGetQueryObjectui64v(mPanoramaQuery[previous], GL_QUERY_RESULT, &panoramaTimeElapsed);
+		mPanoramaTime = panoramaTimeElapsed * 0.000001f;
+	}
+	mQueryFrame++;
+	mFrameIndex++;
+}
+
+// Everything the optical depth along the light depends on
+static bool ShadowParamsChanged(const CloudParams& a, const CloudParams& b)
+{
+	return a.radius != b.radius || a.cloudScale != b.cloudScale || a.cloudOffset != b.cloudOffset ||
+		a.densityMultiplier != b.densityMultiplier || a.densityThreshold != b.densityThreshold ||
+		a.lightDirection != b.lightDirection || a.layerContribution != b.layerContribution ||
+		a.useWeatherMap != b.useWeatherMap || a.weatherScale != b.weatherScale || a.precipitationDensity != b.precipitationDensity ||
+		a.shadowExtent != b.shadowExtent || a.shadowSteps != b.shadowSteps;
+}
 
-	uint64_t renderTimeElapsed = 0;
-	glGetQueryObjectui64v(mGpuQuery, GL_QUERY_RESULT, &renderTimeElapsed);
-	mRenderTime = renderTimeElapsed * 0.000001f;
+void CloudGenerator::UpdateCloudShadow()
+{
+	if (!mParams.useCloudShadow)
+		return;
+
+	// A fill that has started keeps its parameters until it is done, so a sun
+	// that moves every frame still gets a complete map every few frames
+	if (!mShadowUpdating) {
+		uint32_t weatherRevision = mWeatherMap->GetRevision();
+		if (mShadowValid && !mShadowDirty && weatherRevision == mShadowWeatherRevision && !ShadowParamsChanged(mParams, mShadowParams))
+			return;
+
+		mShadowParams = mParams;
+		mShadowNoiseScroll = mNoiseScroll;
+		mShadowWeatherRevision = weatherRevision;
+		mShadowDirty = false;
+		mShadowRow = 0;
+		mShadowUpdating = true;
+	}
+
+	// The first map is built in one go so the terrain never reads an empty one
+	uint32_t numRows = mShadowValid ? uint32_t(std::max(mParams.shadowRowsPerFrame, 1)) : mShadowMapSize;
+	numRows = std::min(numRows, mShadowMapSize - mShadowRow);
+
+	const CloudParams& params = mShadowParams;
+	uint32_t back = mShadowFront ^ 1;
+	mShadowProgram->use();
+	mShadowProgram->setTexture(0, mShadowTex[back]->handle, GL_WRITE_ONLY, GL_R32F);
+	mShadowProgram->setInt("uFirstRow", int(mShadowRow));
+	mShadowProgram->setInt("uNumRows", int(numRows));
+	mShadowProgram->setFloat("uShadowExtent", params.shadowExtent);
+	mShadowProgram->setInt("uShadowSteps", params.shadowSteps);
+
+	glm::vec2 radius = params.radius;
+	glm::vec3 cloudOffset = params.cloudOffset;
+	glm::vec3 lightDirection = params.lightDirection;
+	glm::vec4 layerContribution = params.layerContribution;
+	mShadowProgram->setVec2("uRadius", &radius[0]);
+	mShadowProgram->setFloat("uCloudScale", params.cloudScale);
+	mShadowProgram->setVec3("uCloudOffset", &cloudOffset[0]);
+	glm::vec3 noiseScroll{ mShadowNoiseScroll.x, 0.0f, mShadowNoiseScroll.y };
+	mShadowProgram->setVec3("uNoiseScroll", &noiseScroll[0]);
+	// The seam is where the volume holds it now, whichever scroll the fill started with
+	glm::vec2 evolveSeam = GetEvolveSeam();
+	mShadowProgram->setInt("uEvolveSeamBlend", int(mEvolveValid));
+	mShadowProgram->setVec2("uEvolveSeam", &evolveSeam[0]);
+	mShadowProgram->setFloat("uDensityMultiplier", params.densityMultiplier);
+	mShadowProgram->setFloat("uDensityThreshold", params.densityThreshold);
+	mShadowProgram->setVec3("uLightDirection", &lightDirection[0]);
+	mShadowProgram->setVec4("uLayerContribution", &layerContribution[0]);
+	mShadowProgram->setInt("uUseWeatherMap", int(params.useWeatherMap));
+	mShadowProgram->setFloat("uWeatherScale", params.weatherScale);
+	mShadowProgram->setFloat("uPrecipitationDensity", params.precipitationDensity);
+	mShadowProgram->setSampler("uNoiseTex1", 1, mTexture1->handle);
+	mShadowProgram->setSampler("uNoiseTex2", 2, mTexture2->handle);
+	mShadowProgram->setSampler("uWeatherTex", 3, mWeatherMap->GetTexture()->handle);
+
+	mShadowProgram->dispatch((mShadowMapSize + 15) / 16, (numRows + 15) / 16, 1);
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+	mShadowRow += numRows;
+	if (mShadowRow == mShadowMapSize) {
+		mShadowFront = back;
+		mShadowLightDirection = params.lightDirection;
+		mShadowFrontExtent = params.shadowExtent;
+		mShadowValid = true;
+		mShadowUpdating = false;
+	}
+}
+
+CloudShadowInfo CloudGenerator::GetCloudShadow() const
+{
+	CloudShadowInfo info;
+	if (!mParams.useCloudShadow || !mShadowValid)
+		return info;
+
+	info.texture = mShadowTex[mShadowFront]->handle;
+	info.lightDirection = glm::normalize(mShadowLightDirection);
+	info.extent = mShadowFrontExtent;
+	info.absorption = mParams.lightAbsorption.y;
+	info.strength = mParams.shadowStrength;
+	return info;
 }
 
 void CloudGenerator::Shutdown()
 {
 	mTexture1->destroy();
 	mTexture2->destroy();
+	mBlueNoiseTex->destroy();
 	mRayMarchProgram->destroy();
 	mQuadBuffer->destroy();
+	mRepeatSampler->destroy();
+	GLResources::release(GLResourceType::VertexArray, mQuadVAO);
+	mWeatherMap->Shutdown();
+	mPanoramaTex->destroy();
+	mMultiViewProgram->destroy();
+	GLResources::release(GLResourceType::Framebuffer, mMultiViewFBO);
+	mTransmittanceTex->destroy();
+	mSkyAmbientTex->destroy();
+	mShadowProgram->destroy();
+	for (auto& texture : mShadowTex)
+		texture->destroy();
+	if (mVirtualNoise)
+		mVirtualNoise->Shutdown();
+	mAuthoredVolume->Unload();
+	glDeleteQueries(2, mGpuQuery);
+	glDeleteQueries(2, mPanoramaQuery);
+}
+
+void CloudGenerator::SetNoiseParams(const NoiseParams* tex1Params, const NoiseParams* tex2Params)
+{
+	for (int i = 0; i < 4; ++i) {
+		if (memcmp(&mTex1Params[i], &tex1Params[i], sizeof(NoiseParams)) == 0) continue;
+		mTex1Params[i] = tex1Params[i];
+		mNoiseGenerator->Generate(&mTex1Params[i], mTexture1.get(), i);
+		if (mVirtualNoise)
+			mVirtualNoise->SetNoiseParams(mTex1Params);
+		mEvolveValid = false;
+		mShadowDirty = true;
+	}
+	for (int i = 0; i < 3; ++i) {
+		if (memcmp(&mTex2Params[i], &tex2Params[i], sizeof(NoiseParams)) == 0) continue;
+		mTex2Params[i] = tex2Params[i];
+		mNoiseGenerator->Generate(&mTex2Params[i], mTexture2.get(), i);
+		mShadowDirty = true;
+	}
+}
+
+void CloudGenerator::GetNoiseParams(NoiseParams* tex1Params, NoiseParams* tex2Params) const
+{
+	std::copy(mTex1Params, mTex1Params + 4, tex1Params);
+	std::copy(mTex2Params, mTex2Params + 3, tex2Params);
 }
+
+void CloudGenerator::ResetPanorama()
+{
+	mPanoramaFace = 0;
+	mPanoramaValid = false;
+}
+
+uint32_t CloudGenerator::GetPanoramaTexture() const
+{
+	return mPanoramaTex->handle;
+}
\ No newline at end of file
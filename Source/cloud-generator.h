@@ -2,27 +2,195 @@
 
 #include <memory>
 
-#include "noise-generator/noise-generator.h"
+#include "noise-generator/noise-params.h"
+#include "atmosphere.h"
 
 struct GLTexture;
 class GLProgram;
+class GLComputeProgram;
 struct GLBuffer;
+struct GLSampler;
 class Camera;
+class WeatherMap;
+class NoiseGenerator;
+class VirtualNoiseVolume;
+class SparseVolume;
+
+// Everything that changes the look or the cost of the clouds, kept together so
+// that whole parameter sets can be swapped in and out
+struct CloudParams {
+	glm::vec2 radius{ 1500.0f, 4000.0f };
+
+	float cloudScale = 1.0f;
+	glm::vec3 cloudOffset{ 0.0f };
+	float densityMultiplier = 0.157f;
+	float densityThreshold = 0.913f;
+	glm::vec3 lightDirection = glm::vec3(0.0f, 1.0f, 0.0f);
+	glm::vec4 lightColor = glm::vec4(1.0f, 1.0f, 1.0f, 200.0f);
+	glm::vec4 layerContribution = glm::vec4(1.0f, 0.625, 0.112, 0.938);
+	float phaseG = 0.5f;
+	glm::vec2 lightAbsorption{ 0.2f };
+	bool sugarPowder = true;
+
+	int raymarchSteps = 32;
+	// Steps through a slice of the blue noise per frame, off keeps the first slice
+	bool animateJitter = true;
+	int lightmarchSteps = 6;
+
+	bool useLod = true;
+	float lodBias = 0.0f;
+	float lodStepFactor = 0.25f;
+	float highFreqCutoff = 6000.0f;
+
+	bool useWeatherMap = true;
+	float weatherScale = 16000.0f;
+	float precipitationDensity = 1.0f;
+
+	bool usePanorama = true;
+	int panoramaFacesPerFrame = 1;
+	float farFieldDistance = 2500.0f;
+	float panoramaAmbient = 0.0f;
+
+	bool useAtmosphere = true;
+	float skyAmbientStrength = 1.0f;
+
+	bool useCloudShadow = true;
+	// Side of the square around the origin the shadow map covers, the terrain size
+	float shadowExtent = 1024.0f;
+	int shadowSteps = 32;
+	int shadowRowsPerFrame = 32;
+	float shadowStrength = 1.0f;
+
+	// Pages the first noise volume over a domain of virtualNoiseDomain^3 tiles
+	// instead of repeating the 128^3 one, the cloud shadow keeps the tiled volume
+	bool useVirtualNoise = false;
+	int virtualNoiseDomain = 16;
+	int virtualBricksPerFrame = 8;
+
+	// Carries the clouds along the wind and regenerates only the slabs of the first
+	// noise volume that scroll in, so the shapes keep changing as they drift. The
+	// window still tiles the sky, its edge is cross-faded over an eighth of a tile.
+	bool evolveClouds = false;
+	// Meters per second over xz
+	glm::vec2 windVelocity{ 20.0f, 5.0f };
+
+	// Authored sparse volume, added to the procedural density or replacing it.
+	// Neither the cloud shadow nor the CPU model see it.
+	bool useAuthoredVolume = false;
+	int authoredMode = 0;
+	float authoredDensity = 1.0f;
+	glm::vec3 authoredOffset{ 0.0f };
+	int authoredBricksPerFrame = 256;
+};
+
+// What the terrain needs to shade with the cloud shadow map, texture is 0 while there is none
+struct CloudShadowInfo {
+	uint32_t texture = 0;
+	// Direction the map was projected along
+	glm::vec3 lightDirection{ 0.0f, 1.0f, 0.0f };
+	float extent = 1.0f;
+	float absorption = 0.0f;
+	float strength = 0.0f;
+};
+
+// Camera of one view of a batch, the layer is the one of the target it is rendered into
+struct CloudView {
+	glm::mat4 invProjection;
+	glm::mat4 invView;
+	glm::vec3 position;
+	uint32_t layer;
+};
 
 class CloudGenerator
 {
 public:
-	CloudGenerator() = default;
+	CloudGenerator();
+
+	~CloudGenerator();
 
 	void Initialize();
 
+	// Noise settings of the two volumes, 4 entries for the first and 3 for the second
+	static void GetDefaultNoiseParams(NoiseParams* tex1Params, NoiseParams* tex2Params);
+
 	void AddUI();
 
 	void Render(Camera* camera, float dt, uint32_t depthTexture, uint32_t colorAttachment);
 
 	void Shutdown();
 
+	// Cube map of the clouds past the far field distance, rgb radiance and alpha
+	// transmittance. Mipmapped after every full cycle for use as environment light.
+	uint32_t GetPanoramaTexture() const;
+
+	// Top down optical depth of the clouds along the light over the terrain
+	CloudShadowInfo GetCloudShadow() const;
+
+	void SetParams(const CloudParams& params) { mParams = params; }
+	const CloudParams& GetParams() const { return mParams; }
+
+	// 4 and 3 entries like GetDefaultNoiseParams(), channels that differ are regenerated
+	void SetNoiseParams(const NoiseParams* tex1Params, const NoiseParams* tex2Params);
+	void GetNoiseParams(NoiseParams* tex1Params, NoiseParams* tex2Params) const;
+
+	// The LUTs are rebuilt on the next Render() when the parameters differ from the baked ones
+	void SetAtmosphereParams(const AtmosphereParams& params) { mAtmosphereParams = params; }
+	const AtmosphereParams& GetAtmosphereParams() const { return mAtmosphereParams; }
+
+	WeatherMap* GetWeatherMap() const { return mWeatherMap.get(); }
+
+	// Loads a .sbm sparse brick map as the authored volume, its bricks stream in over the next frames
+	bool LoadAuthoredVolume(const char* filename);
+	SparseVolume* GetAuthoredVolume() const { return mAuthoredVolume.get(); }
+
+	// Renders the clouds of every view into its layer of targetTexture (2D array
+	// or cube map, width x height) as rgb radiance and alpha transmittance, with
+	// the march starting at startDistance. Program and texture state is set up
+	// once and up to MAX_BATCH_VIEWS views are drawn per layered draw call.
+	void RenderViews(const CloudView* views, uint32_t numViews, uint32_t targetTexture, uint32_t width, uint32_t height, float startDistance = 0.0f);
+
+	// Gpu time of numViews cube face views rendered one by one with full setup
+	// each against one RenderViews() call, logged and shown in the UI
+	void BenchmarkMultiView(uint32_t numViews = 6);
+
+	static const uint32_t MAX_BATCH_VIEWS = 8;
+
+	// Forces the next Render() to rebuild the whole panorama around the camera
+	void ResetPanorama();
+
+	// Gpu time of the last finished Render() in ms, panorama update included. The
+	// queries are read a frame late so that rendering never waits on the gpu.
+	float GetRenderTime() const { return mRenderTime + mPanoramaTime; }
+
 private:
+	void SetupRaymarchProgram(GLProgram* program, glm::vec3 camPos, glm::mat4 invP, glm::mat4 invV, float viewportHeight);
+
+	void DrawQuad();
+
+	// Re-renders a few faces of the panorama each frame
+	void UpdatePanorama(const glm::vec3& center);
+
+	// Refills the back shadow map a few rows per frame once the parameters it
+	// depends on have changed, and swaps it to the front when it is complete
+	void UpdateCloudShadow();
+
+	// Rebuilds the atmosphere LUTs on the CPU when the parameters changed. The
+	// sun angle is an axis of the tables so moving the sun doesn't need a rebuild.
+	void UpdateAtmosphere();
+
+	// Creates or resizes the virtual noise volume and makes the bricks the last feedback asked for resident
+	void UpdateVirtualNoise();
+
+	// Scrolls the evolving noise window with the wind and regenerates what scrolled in
+	void UpdateEvolvingNoise(float dt);
+
+	// Generates texels [min, min + size) of the evolving domain into the texels of
+	// the first noise volume they wrap to
+	void GenerateNoiseWindow(const glm::ivec3& min, const glm::ivec3& size);
+
+	// Where the window starts within a tile over xz, the shaders blend across the seam the tiling leaves there
+	glm::vec2 GetEvolveSeam() const;
+
 	std::unique_ptr<GLTexture> mTexture1;
 	std::unique_ptr<GLTexture> mTexture2;
 	std::unique_ptr<GLTexture> mBlueNoiseTex;
@@ -31,24 +199,74 @@ private:
 	NoiseParams mTex2Params[3];
 
 	NoiseGenerator* mNoiseGenerator;
+	// Created the first time virtual noise is turned on
+	std::unique_ptr<VirtualNoiseVolume> mVirtualNoise;
+	std::unique_ptr<SparseVolume> mAuthoredVolume;
+
+	// While evolving the first noise volume is a toroidal window of a domain that is
+	// wider along the wind, texel L of the window is stored at L mod 128
+	glm::vec2 mNoiseScroll{ 0.0f };
+	glm::ivec3 mEvolveOrigin{ 0 };
+	bool mEvolveValid = false;
+	uint32_t mEvolveTexels = 0;
 	std::unique_ptr<GLProgram> mRayMarchProgram;
+	// Same shader built with MULTI_VIEW and a layered geometry shader
+	std::unique_ptr<GLProgram> mMultiViewProgram;
+	unsigned int mMultiViewFBO = 0;
+	float mSingleViewTime = 0.0f;
+	float mMultiViewTime = 0.0f;
+	uint32_t mBenchmarkViews = 0;
 
 	std::unique_ptr<GLBuffer> mQuadBuffer;
+	unsigned int mQuadVAO = 0;
+	std::unique_ptr<GLSampler> mRepeatSampler;
+
+	CloudParams mParams;
+
+	std::unique_ptr<WeatherMap> mWeatherMap;
 
-	float mCloudScale = 1.0f;
-	glm::vec3 mCloudOffset{ 0.0f };
-	float mDensityMultiplier = 0.157f;
-	float mDensityThreshold = 0.913f;
-	glm::vec3 mLightDirection = glm::vec3(0.0f, 1.0f, 0.0f);
-	glm::vec4 mLightColor = glm::vec4(1.0f, 1.0f, 1.0f, 200.0f);
-	glm::vec4 mLayerContribution = glm::vec4(1.0f, 0.625, 0.112, 0.938);
-	float mPhaseG = 0.5f;
-	glm::vec2 mLightAbsorption{ 0.2f };
-	bool mSugarPowder = true;
-
-	unsigned int mGpuQuery;
+	// Two of each so the previous frame's query is read while this one is in flight
+	unsigned int mGpuQuery[2];
+	bool mGpuQueryIssued[2] = { false, false };
+	uint32_t mQueryFrame = 0;
+	// Picks the blue noise slice of the frame
+	uint32_t mFrameIndex = 0;
 	float mRenderTime = 0.0f;
 
-	glm::vec2 mRadius{ 1500.0f, 4000.0f };
+	std::unique_ptr<GLTexture> mPanoramaTex;
+	unsigned int mPanoramaQuery[2];
+	bool mPanoramaQueryIssued[2] = { false, false };
+	float mPanoramaTime = 0.0f;
+	uint32_t mPanoramaSize = 128;
+	glm::vec3 mPanoramaCenter{ 0.0f };
+	int mPanoramaFace = 0;
+	bool mPanoramaValid = false;
+
+	// Terrain reads the front map while the back one is being filled
+	std::unique_ptr<GLComputeProgram> mShadowProgram;
+	std::unique_ptr<GLTexture> mShadowTex[2];
+	uint32_t mShadowMapSize = 256;
+	uint32_t mShadowFront = 0;
+	uint32_t mShadowRow = 0;
+	bool mShadowUpdating = false;
+	bool mShadowValid = false;
+	// Set when the noise volumes change, they aren't part of the params
+	bool mShadowDirty = true;
+	CloudParams mShadowParams;
+	glm::vec2 mShadowNoiseScroll{ 0.0f };
+	uint32_t mShadowWeatherRevision = 0;
+	// What the front map was filled with, mShadowParams already belongs to the back one during a fill
+	glm::vec3 mShadowLightDirection{ 0.0f, 1.0f, 0.0f };
+	float mShadowFrontExtent = 1.0f;
+
+	AtmosphereParams mAtmosphereParams;
+	AtmosphereParams mBakedAtmosphereParams;
+	bool mAtmosphereBaked = false;
+	AtmosphereLUT mTransmittanceLUT;
+	AtmosphereLUT mMultiScatteringLUT;
+	AtmosphereLUT mSkyAmbientLUT;
+	std::unique_ptr<GLTexture> mTransmittanceTex;
+	std::unique_ptr<GLTexture> mSkyAmbientTex;
+	float mAtmosphereBakeTime = 0.0f;
 
 };
\ No newline at end of file
@@ -0,0 +1,173 @@
+#include "cloud-model.h"
+
+#include "cpu-noise.h"
+#include "../thread-pool.h"
+
+#include <algorithm>
+
+using namespace simd;
+
+void CloudModel::Initialize(const NoiseParams* tex1Params, const NoiseParams* tex2Params, const WeatherParams& weatherParams, ThreadPool* pool)
+{
+	// Same sizes as the textures of the CloudGenerator
+	mNoise1.Resize(128, 128, 128);
+	CpuNoise::Generate(tex1Params, 4, mNoise1, pool);
+
+	mNoise2.Resize(32, 32, 32);
+	CpuNoise::Generate(tex2Params, 3, mNoise2, pool);
+
+	const uint32_t weatherSize = 256;
+	std::vector<uint8_t> weather;
+	WeatherMap::GenerateData(weatherParams, weatherSize, weather);
+	mWeather.Resize(weatherSize, weatherSize, 1);
+	for (uint32_t i = 0; i < weatherSize * weatherSize; ++i)
+		mWeather.data[i] = glm::vec4(weather[i * 4 + 0], weather[i * 4 + 1], weather[i * 4 + 2], weather[i * 4 + 3]) / 255.0f;
+}
+
+static float Remap(float val, float inMin, float inMax, float outMin, float outMax)
+{
+	return (val - inMin) / (inMax - inMin) * (outMax - outMin) + outMin;
+}
+
+static float DensityHeightGradient(float heightFraction, float cloudType)
+{
+	const glm::vec4 stratus(0.0f, 0.1f, 0.2f, 0.3f);
+	const glm::vec4 stratocumulus(0.02f, 0.2f, 0.48f, 0.625f);
+	const glm::vec4 cumulus(0.0f, 0.1625f, 0.88f, 0.98f);
+	glm::vec4 gradient = glm::mix(glm::mix(stratus, stratocumulus, glm::clamp(cloudType * 2.0f, 0.0f, 1.0f)),
+		cumulus, glm::clamp(cloudType * 2.0f - 1.0f, 0.0f, 1.0f));
+	return glm::smoothstep(gradient.x, gradient.y, heightFraction) - glm::smoothstep(gradient.z, gradient.w, heightFraction);
+}
+
+float CloudModel::SampleDensity(const CloudParams& params, const glm::vec3& p, float coverage) const
+{
+	float heightProfile = 1.0f;
+	float weatherDensity = 1.0f;
+	if (params.useWeatherMap) {
+		glm::vec4 weather = mWeather.Sample(glm::vec3(glm::vec2(p.x, p.z) / params.weatherScale + 0.5f, 0.0f));
+		if (weather.x <= 0.0f) return 0.0f;
+
+		float heightFraction = glm::clamp((glm::length(p) - params.radius.x) / (params.radius.y - params.radius.x), 0.0f, 1.0f);
+		heightProfile = DensityHeightGradient(heightFraction, weather.y);
+		if (heightProfile <= 0.0f) return 0.0f;
+
+		coverage = glm::mix(1.0f, coverage, weather.x);
+		weatherDensity = 1.0f + weather.z * params.precipitationDensity;
+	}
+
+	float noiseScale = 0.001f * params.cloudScale;
+	glm::vec3 q = p * noiseScale + params.cloudOffset;
+
+	glm::vec4 lowFreqNoise = mNoise1.Sample(q);
+	float lowFreqFBM = glm::dot(glm::vec3(lowFreqNoise.y, lowFreqNoise.z, lowFreqNoise.w),
+		glm::vec3(params.layerContribution.y, params.layerContribution.z, params.layerContribution.w));
+	float baseCloud = Remap(lowFreqNoise.x, -(1.0f - lowFreqFBM), 1.0f, 0.0f, 1.0f);
+
+	glm::vec3 highFreqNoise = glm::vec3(mNoise2.Sample(q * 0.4f));
+	float highFreqFBM = glm::dot(highFreqNoise, glm::vec3(params.layerContribution.y, params.layerContribution.z, params.layerContribution.w));
+
+	// The shader takes the height fraction of the noise space position, kept as is
+	float heightGradient = (q.y - params.radius.x) / (params.radius.y - params.radius.x);
+	float highFreqNoiseModifier = glm::mix(highFreqFBM, 1.0f - highFreqFBM, glm::clamp(heightGradient, 0.0f, 1.0f));
+
+	baseCloud = Remap(baseCloud, highFreqNoiseModifier * 0.2f, 1.0f, 0.0f, 1.0f);
+	baseCloud *= heightProfile;
+	return std::max(baseCloud - coverage, 0.0f) * params.densityMultiplier * weatherDensity;
+}
+
+static f32x8 SmoothStep(f32x8 e0, f32x8 e1, f32x8 x)
+{
+	f32x8 t = Clamp((x - e0) / (e1 - e0), f32x8(0.0f), f32x8(1.0f));
+	return t * t * (f32x8(3.0f) - f32x8(2.0f) * t);
+}
+
+static f32x8 DensityHeightGradient(f32x8 heightFraction, f32x8 cloudType)
+{
+	const float stratus[4] = { 0.0f, 0.1f, 0.2f, 0.3f };
+	const float stratocumulus[4] = { 0.02f, 0.2f, 0.48f, 0.625f };
+	const float cumulus[4] = { 0.0f, 0.1625f, 0.88f, 0.98f };
+
+	f32x8 t0 = Clamp(cloudType * f32x8(2.0f), f32x8(0.0f), f32x8(1.0f));
+	f32x8 t1 = Clamp(cloudType * f32x8(2.0f) - f32x8(1.0f), f32x8(0.0f), f32x8(1.0f));
+	f32x8 gradient[4];
+	for (int i = 0; i < 4; ++i)
+		gradient[i] = Mix(Mix(f32x8(stratus[i]), f32x8(stratocumulus[i]), t0), f32x8(cumulus[i]), t1);
+
+	return SmoothStep(gradient[0], gradient[1], heightFraction) - SmoothStep(gradient[2], gradient[3], heightFraction);
+}
+
+f32x8 CloudModel::SampleDensity(const CloudParams& params, const vec3x8& p, f32x8 coverage) const
+{
+	const f32x8 zero(0.0f);
+	const f32x8 one(1.0f);
+
+	f32x8 heightProfile = one;
+	f32x8 weatherDensity = one;
+	f32x8 valid = zero <= one;
+	if (params.useWeatherMap) {
+		f32x8 invScale(1.0f / params.weatherScale);
+		vec3x8 uv{ p.x * invScale + f32x8(0.5f), p.z * invScale + f32x8(0.5f), zero };
+		f32x8 weather[3];
+		mWeather.Sample(uv, weather, 3);
+
+		f32x8 heightFraction = Clamp((Sqrt(Dot(p, p)) - f32x8(params.radius.x)) / f32x8(params.radius.y - params.radius.x), zero, one);
+		heightProfile = DensityHeightGradient(heightFraction, weather[1]);
+
+		// Clear sky lanes, none of the 3D noise has to be fetched if all of them are
+		valid = (weather[0] > zero) & (heightProfile > zero);
+		if (!Any(valid)) return zero;
+
+		coverage = Mix(one, coverage, weather[0]);
+		weatherDensity = one + weather[2] * f32x8(params.precipitationDensity);
+	}
+
+	f32x8 noiseScale(0.001f * params.cloudScale);
+	vec3x8 q{ p.x * noiseScale + f32x8(params.cloudOffset.x),
+		p.y * noiseScale + f32x8(params.cloudOffset.y),
+		p.z * noiseScale + f32x8(params.cloudOffset.z) };
+
+	f32x8 layerG(params.layerContribution.y), layerB(params.layerContribution.z), layerA(params.layerContribution.w);
+
+	f32x8 lowFreqNoise[4];
+	mNoise1.Sample(q, lowFreqNoise, 4);
+	f32x8 lowFreqFBM = lowFreqNoise[1] * layerG + lowFreqNoise[2] * layerB + lowFreqNoise[3] * layerA;
+	// Remap(r, -(1 - fbm), 1, 0, 1)
+	f32x8 inMin = lowFreqFBM - one;
+	f32x8 baseCloud = (lowFreqNoise[0] - inMin) / (one - inMin);
+
+	f32x8 highFreqNoise[3];
+	mNoise2.Sample(q * f32x8(0.4f), highFreqNoise, 3);
+	f32x8 highFreqFBM = highFreqNoise[0] * layerG + highFreqNoise[1] * layerB + highFreqNoise[2] * layerA;
+
+	f32x8 heightGradient = (q.y - f32x8(params.radius.x)) / f32x8(params.radius.y - params.radius.x);
+	f32x8 highFreqNoiseModifier = Mix(highFreqFBM, one - highFreqFBM, Clamp(heightGradient, zero, one));
+
+	f32x8 modifier = highFreqNoiseModifier * f32x8(0.2f);
+	baseCloud = (baseCloud - modifier) / (one - modifier);
+	baseCloud = baseCloud * heightProfile;
+
+	f32x8 density = Max(baseCloud - coverage, zero) * f32x8(params.densityMultiplier) * weatherDensity;
+	return Select(valid, density, zero);
+}
+
+f32x8 CloudModel::LightMarch(const CloudParams& params, const vec3x8& p) const
+{
+	vec3x8 lightDir{ f32x8(params.lightDirection.x), f32x8(params.lightDirection.y), f32x8(params.lightDirection.z) };
+
+	// Far intersection with the outer sphere
+	f32x8 b = Dot(p, lightDir);
+	f32x8 c = Dot(p, p) - f32x8(params.radius.y * params.radius.y);
+	f32x8 tFar = Sqrt(Max(b * b - c, f32x8(0.0f))) - b;
+	f32x8 stepSize = Ceil(tFar) / f32x8(float(params.lightmarchSteps));
+
+	vec3x8 rayStep = lightDir * stepSize;
+	vec3x8 r = p;
+	f32x8 opticalDepth(0.0f);
+	f32x8 coverage(params.densityThreshold);
+	for (int i = 0; i < params.lightmarchSteps; ++i) {
+		r = r + rayStep;
+		opticalDepth = opticalDepth + SampleDensity(params, r, coverage);
+	}
+
+	return Max(Exp(-opticalDepth * f32x8(params.lightAbsorption.y) * stepSize), f32x8(0.1f));
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "../cloud-generator.h"
+#include "../weather-map.h"
+#include "volume.h"
+
+class ThreadPool;
+
+// CPU copy of the cloud density field raymarch.frag samples: the two noise
+// volumes, the weather map and SampleDensity(). Read only after Initialize()
+// so it can be shared by any number of threads.
+class CloudModel
+{
+public:
+	void Initialize(const NoiseParams* tex1Params, const NoiseParams* tex2Params, const WeatherParams& weatherParams, ThreadPool* pool);
+
+	// Mirrors SampleDensity() in raymarch.frag at LOD 0 (uUseLod = 0)
+	float SampleDensity(const CloudParams& params, const glm::vec3& p, float coverage) const;
+
+	simd::f32x8 SampleDensity(const CloudParams& params, const simd::vec3x8& p, simd::f32x8 coverage) const;
+
+	// Mirrors lightMarch() in raymarch.frag: transmittance towards the sun, floored at 0.1
+	simd::f32x8 LightMarch(const CloudParams& params, const simd::vec3x8& p) const;
+
+	const Volume& GetNoise1() const { return mNoise1; }
+	const Volume& GetNoise2() const { return mNoise2; }
+
+private:
+	Volume mNoise1;
+	Volume mNoise2;
+	// Weather texels as a single slice volume, rgb as in WeatherMap
+	Volume mWeather;
+};
\ No newline at end of file
@@ -0,0 +1,161 @@
+#include "cloud-query.h"
+
+#include "../logger.h"
+#include "../thread-pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+using namespace simd;
+
+CloudQuery::CloudQuery(const CloudModel* model, ThreadPool* pool) : mModel(model), mPool(pool)
+{
+}
+
+// Lanes past count repeat the last element so they evaluate something valid
+static vec3x8 LoadPoints(const glm::vec3* points, uint32_t count)
+{
+	alignas(32) float x[WIDTH], y[WIDTH], z[WIDTH];
+	for (uint32_t lane = 0; lane < WIDTH; ++lane) {
+		const glm::vec3& p = points[std::min(lane, count - 1)];
+		x[lane] = p.x, y[lane] = p.y, z[lane] = p.z;
+	}
+	return { f32x8::Load(x), f32x8::Load(y), f32x8::Load(z) };
+}
+
+static void LoadSegments(const CloudSegment* segments, uint32_t count, vec3x8& start, vec3x8& end)
+{
+	alignas(32) float sx[WIDTH], sy[WIDTH], sz[WIDTH], ex[WIDTH], ey[WIDTH], ez[WIDTH];
+	for (uint32_t lane = 0; lane < WIDTH; ++lane) {
+		const CloudSegment& s = segments[std::min(lane, count - 1)];
+		sx[lane] = s.start.x, sy[lane] = s.start.y, sz[lane] = s.start.z;
+		ex[lane] = s.end.x, ey[lane] = s.end.y, ez[lane] = s.end.z;
+	}
+	start = { f32x8::Load(sx), f32x8::Load(sy), f32x8::Load(sz) };
+	end = { f32x8::Load(ex), f32x8::Load(ey), f32x8::Load(ez) };
+}
+
+static void StoreLanes(f32x8 value, float* out, uint32_t count)
+{
+	if (count == WIDTH) {
+		value.Store(out);
+		return;
+	}
+	alignas(32) float lanes[WIDTH];
+	value.Store(lanes);
+	std::copy(lanes, lanes + count, out);
+}
+
+// fn(begin, end) handles the queries in [begin, end)
+template<typename Fn>
+CloudQueryStats CloudQuery::Run(uint32_t count, const Fn& fn) const
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	if (mPool == nullptr || count <= BATCH_SIZE) {
+		fn(0u, count);
+	}
+	else {
+		uint32_t numBatches = (count + BATCH_SIZE - 1) / BATCH_SIZE;
+		// ParallelFor makes the caller worker 0, two callers at once would share it
+		std::lock_guard<std::mutex> lock(mPoolMutex);
+		mPool->ParallelFor(numBatches, [&](uint32_t batch, uint32_t) {
+			uint32_t begin = batch * BATCH_SIZE;
+			fn(begin, std::min(begin + BATCH_SIZE, count));
+		});
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+
+	CloudQueryStats stats;
+	stats.seconds = std::chrono::duration<double>(end - start).count();
+	stats.numQueries = count;
+	stats.queriesPerSecond = stats.seconds > 0.0 ? double(count) / stats.seconds : 0.0;
+	return stats;
+}
+
+CloudQueryStats CloudQuery::SampleDensity(const CloudParams& params, const glm::vec3* points, uint32_t count, float* density) const
+{
+	return Run(count, [&](uint32_t begin, uint32_t end) {
+		f32x8 coverage(params.densityThreshold);
+		for (uint32_t i = begin; i < end; i += WIDTH) {
+			uint32_t numLanes = std::min<uint32_t>(WIDTH, end - i);
+			vec3x8 p = LoadPoints(points + i, numLanes);
+			StoreLanes(mModel->SampleDensity(params, p, coverage), density + i, numLanes);
+		}
+	});
+}
+
+CloudQueryStats CloudQuery::SunTransmittance(const CloudParams& params, const glm::vec3* points, uint32_t count, float* transmittance) const
+{
+	return Run(count, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; i += WIDTH) {
+			uint32_t numLanes = std::min<uint32_t>(WIDTH, end - i);
+			vec3x8 p = LoadPoints(points + i, numLanes);
+			StoreLanes(mModel->LightMarch(params, p), transmittance + i, numLanes);
+		}
+	});
+}
+
+CloudQueryStats CloudQuery::SegmentTransmittance(const CloudParams& params, const CloudSegment* segments, uint32_t count,
+	uint32_t numSteps, float* transmittance) const
+{
+	numSteps = std::max(numSteps, 1u);
+	return Run(count, [&](uint32_t begin, uint32_t end) {
+		f32x8 coverage(params.densityThreshold);
+		f32x8 invSteps(1.0f / float(numSteps));
+		for (uint32_t i = begin; i < end; i += WIDTH) {
+			uint32_t numLanes = std::min<uint32_t>(WIDTH, end - i);
+			vec3x8 start, stop;
+			LoadSegments(segments + i, numLanes, start, stop);
+
+			// Samples in the middle of each step
+			vec3x8 rayStep{ (stop.x - start.x) * invSteps, (stop.y - start.y) * invSteps, (stop.z - start.z) * invSteps };
+			f32x8 stepSize = Sqrt(Dot(rayStep, rayStep));
+			vec3x8 p = start + rayStep * f32x8(0.5f);
+			f32x8 opticalDepth(0.0f);
+			for (uint32_t step = 0; step < numSteps; ++step) {
+				opticalDepth = opticalDepth + mModel->SampleDensity(params, p, coverage);
+				p = p + rayStep;
+			}
+			StoreLanes(Exp(-opticalDepth * stepSize * f32x8(params.lightAbsorption.x)), transmittance + i, numLanes);
+		}
+	});
+}
+
+void CloudQuery::Benchmark(const CloudParams& params, uint32_t count) const
+{
+	// Points spread over the part of the shell above the weather map
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> horizontal(-params.radius.x * 0.9f, params.radius.x * 0.9f);
+	std::uniform_real_distribution<float> radius(params.radius.x, params.radius.y);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	std::vector<glm::vec3> points(count);
+	std::vector<CloudSegment> segments(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		float x = horizontal(rng), z = horizontal(rng), r = radius(rng);
+		points[i] = glm::vec3(x, std::sqrt(r * r - x * x - z * z), z);
+		glm::vec3 dir = glm::normalize(glm::vec3(unit(rng), unit(rng) * 0.2f, unit(rng)) + glm::vec3(0.0f, 0.0f, 1e-3f));
+		segments[i] = { points[i], points[i] + dir * 1000.0f };
+	}
+
+	std::vector<float> result(count);
+	auto report = [&](const char* name, const CloudQueryStats& stats) {
+		double sum = 0.0;
+		for (float value : result) sum += value;
+		char buffer[256];
+		snprintf(buffer, sizeof(buffer), "  %-22s %8.2fms  %8.3f Mqueries/s  mean %.4f", name, stats.seconds * 1000.0,
+			stats.queriesPerSecond * 1e-6, count > 0 ? sum / count : 0.0);
+		logger::Debug(buffer);
+	};
+
+	char buffer[256];
+	snprintf(buffer, sizeof(buffer), "Cloud query benchmark, %u queries, %u workers, %s", count,
+		mPool != nullptr ? mPool->GetNumWorkers() : 1u, SIMD_AVX2 ? "AVX2" : "scalar lanes");
+	logger::Debug(buffer);
+
+	// Warm up once, the second run is reported
+	SampleDensity(params, points.data(), count, result.data());
+	report("density", SampleDensity(params, points.data(), count, result.data()));
+	report("sun transmittance", SunTransmittance(params, points.data(), count, result.data()));
+	report("segment transmittance", SegmentTransmittance(params, segments.data(), count, 16, result.data()));
+}
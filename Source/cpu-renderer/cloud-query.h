@@ -0,0 +1,55 @@
+#pragma once
+
+#include "cloud-model.h"
+
+#include <mutex>
+
+class ThreadPool;
+
+struct CloudSegment {
+	glm::vec3 start;
+	glm::vec3 end;
+};
+
+struct CloudQueryStats {
+	double seconds = 0.0;
+	uint64_t numQueries = 0;
+	double queriesPerSecond = 0.0;
+};
+
+// Density and visibility lookups for code outside the renderer, e.g. a flight
+// model asking for the cloud at aircraft positions. Evaluates the CloudModel the
+// CPU renderer marches, 8 queries at a time, and splits large arrays into
+// batches for the thread pool. Any number of threads may query at once as the
+// model is read only; calls that go wide on the pool take turns.
+class CloudQuery
+{
+public:
+	// model has to outlive the query, without a pool everything runs on the calling thread
+	explicit CloudQuery(const CloudModel* model, ThreadPool* pool = nullptr);
+
+	// Density at every point, SampleDensity() of raymarch.frag with the density threshold as coverage
+	CloudQueryStats SampleDensity(const CloudParams& params, const glm::vec3* points, uint32_t count, float* density) const;
+
+	// Transmittance from every point towards the sun, lightMarch() of raymarch.frag with its 0.1 floor
+	CloudQueryStats SunTransmittance(const CloudParams& params, const glm::vec3* points, uint32_t count, float* transmittance) const;
+
+	// Line of sight transmittance from start to end of every segment, with numSteps
+	// density samples and the same extinction as the view march (lightAbsorption.x)
+	CloudQueryStats SegmentTransmittance(const CloudParams& params, const CloudSegment* segments, uint32_t count,
+		uint32_t numSteps, float* transmittance) const;
+
+	// Runs each query on count random points and segments inside the cloud shell and logs queries/sec
+	void Benchmark(const CloudParams& params, uint32_t count) const;
+
+	// Queries per pool task, arrays up to this size stay on the calling thread
+	static const uint32_t BATCH_SIZE = 1024;
+
+private:
+	template<typename Fn>
+	CloudQueryStats Run(uint32_t count, const Fn& fn) const;
+
+	const CloudModel* mModel;
+	ThreadPool* mPool;
+	mutable std::mutex mPoolMutex;
+};
@@ -0,0 +1,262 @@
+#include "cpu-cloud-renderer.h"
+#include "ray-packet.h"
+
+#include "../camera.h"
+#include "../logger.h"
+#include "../thread-pool.h"
+#include "../utils.h"
+#include "../blue-noise.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+using namespace simd;
+
+static const float PI = 3.141592f;
+
+// Clear color of the scene framebuffer the clouds are composited over
+static const glm::vec3 BACKGROUND_COLOR{ 0.5f, 0.7f, 1.0f };
+
+struct CpuCloudRenderer::FrameConstants {
+	const CloudParams* params;
+	const RayGenerator* rays;
+	glm::vec3 camPos;
+	uint32_t width;
+	uint32_t height;
+	glm::vec3 lightColor;
+	glm::vec3 skyAmbient;
+	float cosSunZenith;
+};
+
+void CpuCloudRenderer::Initialize(const NoiseParams* tex1Params, const NoiseParams* tex2Params, const WeatherParams& weatherParams, ThreadPool* pool)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	mCloudModel.Initialize(tex1Params, tex2Params, weatherParams, pool);
+
+	// Same slices and fallback as CloudGenerator::Initialize()
+	uint32_t width, height;
+	std::vector<uint8_t> noiseData;
+	if (BlueNoise::Load(BlueNoise::DEFAULT_DIRECTORY, width, height, noiseData) == 0)
+		BlueNoise::LoadSlice("Textures/BlueNoise64.png", width, height, noiseData);
+	if (!noiseData.empty()) {
+		mBlueNoiseWidth = width;
+		mBlueNoiseHeight = height;
+		mBlueNoise.resize(width * height);
+		for (uint32_t i = 0; i < width * height; ++i)
+			mBlueNoise[i] = noiseData[i] / 255.0f;
+	}
+
+	Atmosphere::ComputeTransmittanceLUT(mAtmosphereParams, mTransmittanceLUT);
+	AtmosphereLUT multiScatteringLUT;
+	Atmosphere::ComputeMultiScatteringLUT(mAtmosphereParams, mTransmittanceLUT, multiScatteringLUT);
+	Atmosphere::ComputeSkyAmbientLUT(mAtmosphereParams, mTransmittanceLUT, multiScatteringLUT, mSkyAmbientLUT);
+
+	auto end = std::chrono::high_resolution_clock::now();
+	char buffer[128];
+	snprintf(buffer, sizeof(buffer), "CPU cloud renderer initialized in %.2fs with %u workers",
+		std::chrono::duration<double>(end - start).count(), pool->GetNumWorkers());
+	logger::Debug(buffer);
+}
+
+// texelFetch of slice 0 at the pixel, repeating like raymarch.frag with uFrameIndex = 0
+float CpuCloudRenderer::SampleBlueNoise(uint32_t x, uint32_t y) const
+{
+	if (mBlueNoise.empty()) return 0.0f;
+	return mBlueNoise[(y % mBlueNoiseHeight) * mBlueNoiseWidth + x % mBlueNoiseWidth];
+}
+
+void CpuCloudRenderer::MarchPacket(const FrameConstants& frame, const vec3x8& rd, f32x8 tStart, f32x8 tEnd,
+	f32x8 noiseOffset, f32x8* radiance, f32x8& transmittance) const
+{
+	const CloudParams& params = *frame.params;
+	const f32x8 zero(0.0f);
+	const f32x8 one(1.0f);
+
+	f32x8 stepSize = Ceil(tEnd - tStart) / f32x8(float(params.raymarchSteps));
+	vec3x8 camPos{ f32x8(frame.camPos.x), f32x8(frame.camPos.y), f32x8(frame.camPos.z) };
+	vec3x8 p = camPos + rd * (tStart + noiseOffset * stepSize);
+
+	transmittance = one;
+	f32x8 energy[3] = { zero, zero, zero };
+	f32x8 ambientEnergy = zero;
+
+	// Henyey-Greenstein for cosTheta = dot(lightDir, -rd)
+	vec3x8 lightDir{ f32x8(params.lightDirection.x), f32x8(params.lightDirection.y), f32x8(params.lightDirection.z) };
+	f32x8 cosTheta = -Dot(lightDir, rd);
+	float g = params.phaseG;
+	f32x8 denom = f32x8(1.0f + g * g) - f32x8(2.0f * g) * cosTheta;
+	f32x8 phase = f32x8((1.0f - g * g) / (4.0f * PI)) / (denom * Sqrt(denom));
+
+	f32x8 tau = stepSize * f32x8(params.lightAbsorption.x);
+	vec3x8 rayStep = rd * stepSize;
+	f32x8 coverage(params.densityThreshold);
+
+	f32x8 active = tEnd > tStart;
+	for (int i = 0; i < params.raymarchSteps && Any(active); ++i) {
+		f32x8 density = mCloudModel.SampleDensity(params, p, coverage);
+		f32x8 hasDensity = (density > zero) & active;
+		if (Any(hasDensity)) {
+			f32x8 lightTransmittance = mCloudModel.LightMarch(params, p);
+
+			f32x8 inscattProb = stepSize * density;
+			if (params.sugarPowder)
+				inscattProb = one - Exp(-density * tau * f32x8(2.0f));
+
+			f32x8 contribution = lightTransmittance * phase * inscattProb * transmittance;
+
+			// Sun color at the altitude of each sample, per lane since the LUT is bilinear
+			f32x8 sunColor[3] = { one, one, one };
+			if (params.useAtmosphere) {
+				alignas(32) float px[8], py[8], pz[8], sun[3][8];
+				p.x.Store(px);
+				p.y.Store(py);
+				p.z.Store(pz);
+				int mask = Mask(hasDensity);
+				for (int lane = 0; lane < 8; ++lane) {
+					glm::vec3 color(1.0f);
+					if (mask & (1 << lane)) {
+						float altitude = glm::length(glm::vec3(px[lane], py[lane], pz[lane])) * 0.001f;
+						color = Atmosphere::GetSunTransmittance(mAtmosphereParams, mTransmittanceLUT, altitude, frame.cosSunZenith);
+					}
+					sun[0][lane] = color.x;
+					sun[1][lane] = color.y;
+					sun[2][lane] = color.z;
+				}
+				for (int c = 0; c < 3; ++c)
+					sunColor[c] = f32x8::Load(sun[c]);
+			}
+
+			for (int c = 0; c < 3; ++c)
+				energy[c] = Select(hasDensity, energy[c] + sunColor[c] * contribution, energy[c]);
+			ambientEnergy = Select(hasDensity, ambientEnergy + inscattProb * transmittance, ambientEnergy);
+			transmittance = Select(hasDensity, transmittance * Exp(-density * tau), transmittance);
+		}
+
+		active = active & (transmittance >= f32x8(0.001f));
+		p = p + rayStep;
+	}
+
+	for (int c = 0; c < 3; ++c) {
+		radiance[c] = energy[c] * f32x8(frame.lightColor[c]);
+		if (params.useAtmosphere)
+			radiance[c] = radiance[c] + ambientEnergy * f32x8(frame.skyAmbient[c]);
+	}
+}
+
+static uint8_t ToneMap(float c)
+{
+	c = c / (1.0f + c);
+	c = std::pow(c, 0.4545f);
+	return static_cast<uint8_t>(std::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+void CpuCloudRenderer::RenderTile(const FrameConstants& frame, uint32_t tileX, uint32_t tileY, std::vector<uint8_t>& image) const
+{
+	uint32_t x0 = tileX * TILE_SIZE;
+	uint32_t y0 = tileY * TILE_SIZE;
+	uint32_t x1 = std::min(x0 + TILE_SIZE, frame.width);
+	uint32_t y1 = std::min(y0 + TILE_SIZE, frame.height);
+
+	alignas(32) float offset[8];
+	alignas(32) float radiance[3][8], transmittance[8];
+
+	vec3x8 camPos = RayPackets::Broadcast(frame.camPos);
+	RayPacket packet;
+	for (uint32_t y = y0; y < y1; ++y) {
+		for (uint32_t x = x0; x < x1; x += WIDTH) {
+			uint32_t numLanes = std::min<uint32_t>(WIDTH, x1 - x);
+			frame.rays->GeneratePacket(x, y, packet);
+
+			f32x8 start, end;
+			RayPackets::IntersectShell(camPos, packet.direction, frame.params->radius, start, end);
+			// Lanes past the tile march nothing
+			start = Select(packet.active, start, f32x8(0.0f));
+			end = Select(packet.active, end, f32x8(-1.0f));
+
+			// Rows count from the bottom on the GPU
+			uint32_t fragY = frame.height - 1 - y;
+			for (uint32_t lane = 0; lane < WIDTH; ++lane)
+				offset[lane] = lane < numLanes ? SampleBlueNoise(x + lane, fragY) : 0.0f;
+
+			f32x8 packetRadiance[3], packetTransmittance;
+			MarchPacket(frame, packet.direction, start, end, f32x8::Load(offset), packetRadiance, packetTransmittance);
+
+			for (int c = 0; c < 3; ++c)
+				packetRadiance[c].Store(radiance[c]);
+			packetTransmittance.Store(transmittance);
+
+			for (uint32_t lane = 0; lane < numLanes; ++lane) {
+				uint8_t* pixel = &image[(size_t(y) * frame.width + x + lane) * 4];
+				for (int c = 0; c < 3; ++c)
+					pixel[c] = ToneMap(transmittance[lane] * BACKGROUND_COLOR[c] + radiance[c][lane]);
+				pixel[3] = 255;
+			}
+		}
+	}
+}
+
+CpuRenderStats CpuCloudRenderer::Render(const CloudParams& params, const Camera& camera, uint32_t width, uint32_t height, ThreadPool* pool, std::vector<uint8_t>& image)
+{
+	RayGenerator rays(camera, width, height);
+
+	FrameConstants frame;
+	frame.params = &params;
+	frame.rays = &rays;
+	frame.camPos = camera.GetPosition();
+	frame.width = width;
+	frame.height = height;
+	frame.lightColor = glm::vec3(params.lightColor) * params.lightColor.w;
+	frame.cosSunZenith = params.lightDirection.y;
+
+	// Fetched once per frame, the shader does it once per ray with the same inputs
+	float midAltitude = (params.radius.x + params.radius.y) * 0.0005f;
+	glm::vec3 skyAmbient = mSkyAmbientLUT.Sample(Atmosphere::SkyAmbientUV(mAtmosphereParams, midAltitude, params.lightDirection.y));
+	frame.skyAmbient = skyAmbient * params.skyAmbientStrength * frame.lightColor;
+
+	image.resize(size_t(width) * height * 4);
+
+	uint32_t numTilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+	uint32_t numTilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	pool->ParallelFor(numTilesX * numTilesY, [&](uint32_t tile, uint32_t) {
+		RenderTile(frame, tile % numTilesX, tile / numTilesX, image);
+	});
+	auto end = std::chrono::high_resolution_clock::now();
+
+	CpuRenderStats stats;
+	stats.seconds = std::chrono::duration<double>(end - start).count();
+	stats.numRays = uint64_t(width) * height;
+	stats.raysPerSecond = stats.seconds > 0.0 ? double(stats.numRays) / stats.seconds : 0.0;
+	return stats;
+}
+
+void CpuCloudRenderer::Benchmark(const CloudParams& params, const Camera& camera, uint32_t width, uint32_t height, uint32_t maxWorkers)
+{
+	std::vector<uint8_t> image;
+	char buffer[256];
+	snprintf(buffer, sizeof(buffer), "CPU renderer benchmark %ux%u, %s", width, height, SIMD_AVX2 ? "AVX2" : "scalar lanes");
+	logger::Debug(buffer);
+
+	// Powers of two and the full count
+	std::vector<uint32_t> workerCounts;
+	for (uint32_t n = 1; n < maxWorkers; n *= 2)
+		workerCounts.push_back(n);
+	workerCounts.push_back(std::max(maxWorkers, 1u));
+
+	double baseline = 0.0;
+	for (uint32_t numWorkers : workerCounts) {
+		ThreadPool pool(numWorkers);
+		// Warm up caches and the thread pool before timing
+		Render(params, camera, width, height, &pool, image);
+		CpuRenderStats stats = Render(params, camera, width, height, &pool, image);
+
+		if (numWorkers == 1) baseline = stats.raysPerSecond;
+		double speedup = baseline > 0.0 ? stats.raysPerSecond / baseline : 0.0;
+		snprintf(buffer, sizeof(buffer), "%3u workers: %8.1fms  %8.3f Mrays/s  speedup %5.2fx  efficiency %5.1f%%  steals %llu",
+			numWorkers, stats.seconds * 1000.0, stats.raysPerSecond * 1e-6, speedup, 100.0 * speedup / numWorkers,
+			static_cast<unsigned long long>(pool.GetStealCount()));
+		logger::Debug(buffer);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "cloud-model.h"
+#include "../atmosphere.h"
+
+#include <vector>
+
+class Camera;
+
+struct CpuRenderStats {
+	double seconds = 0.0;
+	uint64_t numRays = 0;
+	double raysPerSecond = 0.0;
+};
+
+// CPU version of the raymarch.frag composite pass for machines without a GPU.
+// The image is split into tiles that the thread pool hands out, and each tile
+// marches its rays in packets of 8 neighbouring pixels with the simd types.
+// There is no scene depth, so every pixel is treated as sky in front of the
+// clear color, and the panorama isn't used. The march is jittered by the first
+// blue noise slice like the GPU with Animate Jitter off.
+class CpuCloudRenderer
+{
+public:
+	void Initialize(const NoiseParams* tex1Params, const NoiseParams* tex2Params, const WeatherParams& weatherParams, ThreadPool* pool);
+
+	// Tonemapped RGBA8 image, first row is the top of the image
+	CpuRenderStats Render(const CloudParams& params, const Camera& camera, uint32_t width, uint32_t height, ThreadPool* pool, std::vector<uint8_t>& image);
+
+	// Renders the same frame with 1 to maxWorkers workers and logs rays/sec and the speedup over one
+	void Benchmark(const CloudParams& params, const Camera& camera, uint32_t width, uint32_t height, uint32_t maxWorkers);
+
+	const CloudModel& GetCloudModel() const { return mCloudModel; }
+
+	static const uint32_t TILE_SIZE = 16;
+
+private:
+	struct FrameConstants;
+
+	void RenderTile(const FrameConstants& frame, uint32_t tileX, uint32_t tileY, std::vector<uint8_t>& image) const;
+
+	// Marches 8 rays, returns the radiance in rgb and the transmittance
+	void MarchPacket(const FrameConstants& frame, const simd::vec3x8& rd, simd::f32x8 tStart, simd::f32x8 tEnd,
+		simd::f32x8 noiseOffset, simd::f32x8* radiance, simd::f32x8& transmittance) const;
+
+	// Fraction of a step, by pixel with y = 0 at the bottom like gl_FragCoord
+	float SampleBlueNoise(uint32_t x, uint32_t y) const;
+
+	CloudModel mCloudModel;
+
+	// First slice of the spatiotemporal blue noise
+	std::vector<float> mBlueNoise;
+	uint32_t mBlueNoiseWidth = 0;
+	uint32_t mBlueNoiseHeight = 0;
+
+	AtmosphereParams mAtmosphereParams;
+	AtmosphereLUT mTransmittanceLUT;
+	AtmosphereLUT mSkyAmbientLUT;
+};
\ No newline at end of file
@@ -0,0 +1,144 @@
+#include "cpu-noise.h"
+
+#include "volume.h"
+#include "../thread-pool.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace CpuNoise {
+
+	// Hash by David_Hoskins
+	static const glm::uvec3 UI3{ 1597334673U, 3812015801U, 2798796415U };
+	static const float UIF = 1.0f / float(0xffffffffU);
+
+	static glm::vec3 Hash33(const glm::vec3& p)
+	{
+		glm::uvec3 q = glm::uvec3(glm::ivec3(p)) * UI3;
+		q = glm::uvec3(q.x ^ q.y ^ q.z) * UI3;
+		return -1.0f + 2.0f * glm::vec3(q) * UIF;
+	}
+
+	// GLSL mod()
+	static glm::vec3 Mod(const glm::vec3& x, float y)
+	{
+		return x - y * glm::floor(x / y);
+	}
+
+	float Worley(const glm::vec3& uv, float freq)
+	{
+		glm::vec3 id = glm::floor(uv);
+		glm::vec3 p = uv - id;
+
+		float minDist = 10000.0f;
+		for (int x = -1; x <= 1; ++x) {
+			for (int y = -1; y <= 1; ++y) {
+				for (int z = -1; z <= 1; ++z) {
+					glm::vec3 offset(x, y, z);
+					glm::vec3 h = Hash33(Mod(id + offset, freq)) * 0.5f + 0.5f;
+					h += offset;
+					glm::vec3 d = p - h;
+					minDist = std::min(minDist, glm::dot(d, d));
+				}
+			}
+		}
+
+		// inverted worley noise
+		return 1.0f - minDist;
+	}
+
+	float GradientNoise(const glm::vec3& x, float freq)
+	{
+		glm::vec3 p = glm::floor(x);
+		glm::vec3 w = x - p;
+
+		// quintic interpolant
+		glm::vec3 u = w * w * w * (w * (w * 6.0f - 15.0f) + 10.0f);
+
+		glm::vec3 ga = Hash33(Mod(p + glm::vec3(0.0f, 0.0f, 0.0f), freq));
+		glm::vec3 gb = Hash33(Mod(p + glm::vec3(1.0f, 0.0f, 0.0f), freq));
+		glm::vec3 gc = Hash33(Mod(p + glm::vec3(0.0f, 1.0f, 0.0f), freq));
+		glm::vec3 gd = Hash33(Mod(p + glm::vec3(1.0f, 1.0f, 0.0f), freq));
+		glm::vec3 ge = Hash33(Mod(p + glm::vec3(0.0f, 0.0f, 1.0f), freq));
+		glm::vec3 gf = Hash33(Mod(p + glm::vec3(1.0f, 0.0f, 1.0f), freq));
+		glm::vec3 gg = Hash33(Mod(p + glm::vec3(0.0f, 1.0f, 1.0f), freq));
+		glm::vec3 gh = Hash33(Mod(p + glm::vec3(1.0f, 1.0f, 1.0f), freq));
+
+		float va = glm::dot(ga, w - glm::vec3(0.0f, 0.0f, 0.0f));
+		float vb = glm::dot(gb, w - glm::vec3(1.0f, 0.0f, 0.0f));
+		float vc = glm::dot(gc, w - glm::vec3(0.0f, 1.0f, 0.0f));
+		float vd = glm::dot(gd, w - glm::vec3(1.0f, 1.0f, 0.0f));
+		float ve = glm::dot(ge, w - glm::vec3(0.0f, 0.0f, 1.0f));
+		float vf = glm::dot(gf, w - glm::vec3(1.0f, 0.0f, 1.0f));
+		float vg = glm::dot(gg, w - glm::vec3(0.0f, 1.0f, 1.0f));
+		float vh = glm::dot(gh, w - glm::vec3(1.0f, 1.0f, 1.0f));
+
+		return va +
+			u.x * (vb - va) +
+			u.y * (vc - va) +
+			u.z * (ve - va) +
+			u.x * u.y * (va - vb - vc + vd) +
+			u.y * u.z * (va - vc - ve + vg) +
+			u.z * u.x * (va - vb - ve + vf) +
+			u.x * u.y * u.z * (-va + vb + vc - vd + ve - vf - vg + vh);
+	}
+
+	static float WorleyFbm(const glm::vec3& p, const NoiseParams& params)
+	{
+		float amplitude = params.amplitude;
+		float frequency = params.frequency * 4.0f;
+		float noise = 0.0f;
+		for (int i = 0; i < params.numOctaves; ++i) {
+			noise += amplitude * Worley(p * frequency, frequency);
+			frequency *= params.lacunarity;
+			amplitude *= params.persistence;
+		}
+		return noise;
+	}
+
+	// Matches PerlinWorleyNoise() in noise-fused.comp
+	static float PerlinWorleyFbm(const glm::vec3& p, const NoiseParams& params)
+	{
+		float frequency = params.frequency * 4.0f;
+
+		float G = std::exp2(-0.85f);
+		float amp = params.amplitude;
+		float freq = frequency;
+		float fbm = 0.0f;
+		for (int i = 0; i < params.numOctaves; ++i) {
+			fbm += amp * GradientNoise(p * freq, freq);
+			freq *= params.lacunarity;
+			amp *= G;
+		}
+
+		float worleyFbm = Worley(p * frequency, frequency) * 0.625f +
+			Worley(p * (frequency * 2.0f), frequency * 2.0f) * 0.25f +
+			Worley(p * (frequency * 4.0f), frequency * 4.0f) * 0.125f;
+
+		fbm = glm::mix(1.0f, fbm, 0.5f);
+		// remap(fbm, 0, 1, worleyFbm, 1)
+		return fbm * (1.0f - worleyFbm) + worleyFbm;
+	}
+
+	void Generate(const NoiseParams* params, int numChannels, Volume& volume, ThreadPool* pool)
+	{
+		glm::vec3 imageSize(volume.width, volume.height, volume.depth);
+		numChannels = std::min(numChannels, 4);
+
+		pool->ParallelFor(volume.depth, [&](uint32_t z, uint32_t) {
+			for (uint32_t y = 0; y < volume.height; ++y) {
+				for (uint32_t x = 0; x < volume.width; ++x) {
+					glm::vec4 color(0.0f);
+					for (int channel = 0; channel < numChannels; ++channel) {
+						glm::vec3 p = glm::vec3(x, y, z) / imageSize + params[channel].offset;
+						if (params[channel].noiseType == NoiseType::Perlin)
+							color[channel] = PerlinWorleyFbm(p, params[channel]);
+						else
+							color[channel] = WorleyFbm(p, params[channel]);
+					}
+					volume.At(x, y, z) = color;
+				}
+			}
+		});
+	}
+}
\ No newline at end of file
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "../noise-generator/noise-params.h"
+
+class ThreadPool;
+struct Volume;
+
+// CPU port of noise-fused.comp, same hash and fbm so the volumes match the
+// ones the NoiseGenerator builds up to float precision
+namespace CpuNoise {
+
+	// Fills the first numChannels channels of volume, params[i] is used for channel i
+	// and the rest are cleared to zero. Slices are spread over the pool.
+	void Generate(const NoiseParams* params, int numChannels, Volume& volume, ThreadPool* pool);
+
+	float Worley(const glm::vec3& uv, float freq);
+
+	float GradientNoise(const glm::vec3& x, float freq);
+}
\ No newline at end of file
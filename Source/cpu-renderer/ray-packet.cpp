@@ -0,0 +1,273 @@
+#include "ray-packet.h"
+
+#include "../camera.h"
+#include "../logger.h"
+
+#include <algorithm>
+#include <bitset>
+#include <chrono>
+#include <cmath>
+
+using namespace simd;
+
+// Lane index of every lane, added to the first pixel of a packet
+alignas(32) static const float LANES[WIDTH] = { 0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f };
+
+RayGenerator::RayGenerator(const Camera& camera, uint32_t width, uint32_t height) :
+	mOrigin(camera.GetPosition()), mWidth(width), mHeight(height)
+{
+	Initialize(camera.GetInvProjectionMatrix(), camera.GetInvViewMatrix());
+}
+
+RayGenerator::RayGenerator(const glm::mat4& invP, const glm::mat4& invV, const glm::vec3& origin, uint32_t width, uint32_t height) :
+	mOrigin(origin), mWidth(width), mHeight(height)
+{
+	Initialize(invP, invV);
+}
+
+void RayGenerator::Initialize(const glm::mat4& invP, const glm::mat4& invV)
+{
+	// GetRayDir() unprojects (ndc, -1, 1), replaces z and w of the view space point
+	// with -1 and 0 and transforms it by invV. Only x and y of the view point depend
+	// on the ndc, so the world direction is c + ndc.x * a + ndc.y * b.
+	glm::vec3 v0(invV[0]), v1(invV[1]), v2(invV[2]);
+	glm::vec3 a = invP[0][0] * v0 + invP[0][1] * v1;
+	glm::vec3 b = invP[1][0] * v0 + invP[1][1] * v1;
+	glm::vec3 c = (invP[3][0] - invP[2][0]) * v0 + (invP[3][1] - invP[2][1]) * v1 - v2;
+
+	// ndc.x = (x + 0.5) * 2 / width - 1, ndc.y = 1 - (y + 0.5) * 2 / height
+	float invWidth = 1.0f / float(mWidth);
+	float invHeight = 1.0f / float(mHeight);
+	mStepX = a * (2.0f * invWidth);
+	mStepY = b * (-2.0f * invHeight);
+	mBase = c + a * (invWidth - 1.0f) + b * (1.0f - invHeight);
+}
+
+glm::vec3 RayGenerator::GetDirection(uint32_t x, uint32_t y) const
+{
+	return glm::normalize(mBase + float(x) * mStepX + float(y) * mStepY);
+}
+
+void RayGenerator::GeneratePacket(uint32_t x, uint32_t y, RayPacket& packet) const
+{
+	f32x8 px = f32x8::Load(LANES) + f32x8(float(x));
+	f32x8 lastColumn(float(mWidth - 1));
+	packet.active = px <= lastColumn;
+	// Lanes past the edge repeat the last column so their direction stays valid
+	px = Min(px, lastColumn);
+	f32x8 py = f32x8(float(y));
+
+	vec3x8 dir{
+		Fma(px, f32x8(mStepX.x), Fma(py, f32x8(mStepY.x), f32x8(mBase.x))),
+		Fma(px, f32x8(mStepX.y), Fma(py, f32x8(mStepY.y), f32x8(mBase.y))),
+		Fma(px, f32x8(mStepX.z), Fma(py, f32x8(mStepY.z), f32x8(mBase.z))) };
+	packet.direction = dir * (f32x8(1.0f) / Sqrt(Dot(dir, dir)));
+	packet.x = x;
+	packet.y = y;
+}
+
+void RayGenerator::GenerateTile(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, std::vector<RayPacket>& packets) const
+{
+	uint32_t packetsPerRow = (x1 - x0 + WIDTH - 1) / WIDTH;
+	packets.resize(size_t(packetsPerRow) * (y1 - y0));
+
+	RayPacket* packet = packets.data();
+	for (uint32_t y = y0; y < y1; ++y) {
+		for (uint32_t x = x0; x < x1; x += WIDTH, ++packet) {
+			GeneratePacket(x, y, *packet);
+			// Tiles inside the image clip their last packet too
+			if (x + WIDTH > x1)
+				packet->active = packet->active & (f32x8::Load(LANES) < f32x8(float(x1 - x)));
+		}
+	}
+}
+
+/*****************************************************************************************************************************************/
+
+namespace RayPackets {
+
+	vec3x8 Broadcast(const glm::vec3& v)
+	{
+		return { f32x8(v.x), f32x8(v.y), f32x8(v.z) };
+	}
+
+	f32x8 IntersectBox(const vec3x8& origin, const vec3x8& invDirection, const glm::vec3& min, const glm::vec3& max, f32x8& tMin, f32x8& tMax)
+	{
+		f32x8 t0x = (f32x8(min.x) - origin.x) * invDirection.x;
+		f32x8 t1x = (f32x8(max.x) - origin.x) * invDirection.x;
+		f32x8 t0y = (f32x8(min.y) - origin.y) * invDirection.y;
+		f32x8 t1y = (f32x8(max.y) - origin.y) * invDirection.y;
+		f32x8 t0z = (f32x8(min.z) - origin.z) * invDirection.z;
+		f32x8 t1z = (f32x8(max.z) - origin.z) * invDirection.z;
+
+		tMin = Max(Max(Min(t0x, t1x), Min(t0y, t1y)), Min(t0z, t1z));
+		tMax = Min(Min(Max(t0x, t1x), Max(t0y, t1y)), Max(t0z, t1z));
+		return tMax >= tMin;
+	}
+
+	// Lanes that miss get -1 for both, as RaySphereIntersection() in raymarch.frag
+	static void IntersectSphere(f32x8 b, f32x8 originLengthSq, float radius, f32x8& tNear, f32x8& tFar)
+	{
+		f32x8 h = b * b - (originLengthSq - f32x8(radius * radius));
+		f32x8 hit = h >= f32x8(0.0f);
+		h = Sqrt(Max(h, f32x8(0.0f)));
+		tNear = Select(hit, -b - h, f32x8(-1.0f));
+		tFar = Select(hit, -b + h, f32x8(-1.0f));
+	}
+
+	void IntersectShell(const vec3x8& origin, const vec3x8& direction, const glm::vec2& radius, f32x8& tStart, f32x8& tEnd)
+	{
+		const f32x8 zero(0.0f);
+		f32x8 b = Dot(origin, direction);
+		f32x8 originLengthSq = Dot(origin, origin);
+
+		f32x8 innerNear, innerFar, outerNear, outerFar;
+		IntersectSphere(b, originLengthSq, radius.x, innerNear, innerFar);
+		IntersectSphere(b, originLengthSq, radius.y, outerNear, outerFar);
+
+		f32x8 inside = originLengthSq < f32x8(radius.x * radius.x);
+		f32x8 start = Select(inside, innerFar, Max(outerNear, zero));
+		f32x8 end = Select(inside, outerFar, Select(innerNear > zero, innerNear, outerFar));
+
+		f32x8 miss = outerFar < zero;
+		tStart = Select(miss, zero, start);
+		tEnd = Select(miss, f32x8(-1.0f), end);
+	}
+
+	static glm::vec2 RaySphereIntersection(const glm::vec3& ro, const glm::vec3& rd, float radius)
+	{
+		float b = glm::dot(ro, rd);
+		float c = glm::dot(ro, ro) - radius * radius;
+		float h = b * b - c;
+		if (h < 0.0f) return glm::vec2(-1.0f);
+		h = std::sqrt(h);
+		return glm::vec2(-b - h, -b + h);
+	}
+
+	glm::vec2 GetShellInterval(const glm::vec3& r0, const glm::vec3& rd, const glm::vec2& radius)
+	{
+		glm::vec2 tInner = RaySphereIntersection(r0, rd, radius.x);
+		glm::vec2 tOuter = RaySphereIntersection(r0, rd, radius.y);
+		if (tOuter.y < 0.0f) return glm::vec2(0.0f, -1.0f);
+
+		if (glm::length(r0) < radius.x)
+			return glm::vec2(tInner.y, tOuter.y);
+
+		float start = std::max(tOuter.x, 0.0f);
+		float end = tInner.x > 0.0f ? tInner.x : tOuter.y;
+		return glm::vec2(start, end);
+	}
+
+	// What both paths add up so the compiler can't drop the work, and a check that they agree
+	struct BenchmarkResult {
+		double seconds = 0.0;
+		uint64_t boxHits = 0;
+		uint64_t shellHits = 0;
+	};
+
+	static BenchmarkResult RunPerRay(const Camera& camera, uint32_t width, uint32_t height, const std::vector<glm::vec3>& boxes, const glm::vec2& radius)
+	{
+		BenchmarkResult result;
+		glm::mat4 P = camera.GetProjectionMatrix();
+		glm::mat4 V = camera.GetViewMatrix();
+		Ray ray;
+		ray.origin = camera.GetPosition();
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (uint32_t y = 0; y < height; ++y) {
+			for (uint32_t x = 0; x < width; ++x) {
+				glm::vec2 ndc{ (float(x) + 0.5f) / float(width) * 2.0f - 1.0f, 1.0f - (float(y) + 0.5f) / float(height) * 2.0f };
+				ray.direction = Utils::GetRayDir(P, V, ndc);
+				for (size_t i = 0; i < boxes.size(); i += 2) {
+					glm::vec2 t;
+					result.boxHits += Utils::RayBoxIntersection(ray, boxes[i], boxes[i + 1], t) ? 1 : 0;
+				}
+				glm::vec2 shell = GetShellInterval(ray.origin, ray.direction, radius);
+				result.shellHits += shell.y > shell.x ? 1 : 0;
+			}
+		}
+		result.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		return result;
+	}
+
+	static BenchmarkResult RunPackets(const Camera& camera, uint32_t width, uint32_t height, const std::vector<glm::vec3>& boxes, const glm::vec2& radius)
+	{
+		BenchmarkResult result;
+
+		auto start = std::chrono::high_resolution_clock::now();
+		RayGenerator generator(camera, width, height);
+		vec3x8 origin = Broadcast(generator.GetOrigin());
+		RayPacket packet;
+		for (uint32_t y = 0; y < height; ++y) {
+			for (uint32_t x = 0; x < width; x += WIDTH) {
+				generator.GeneratePacket(x, y, packet);
+				vec3x8 invDirection{ f32x8(1.0f) / packet.direction.x, f32x8(1.0f) / packet.direction.y, f32x8(1.0f) / packet.direction.z };
+				for (size_t i = 0; i < boxes.size(); i += 2) {
+					f32x8 tMin, tMax;
+					f32x8 hit = IntersectBox(origin, invDirection, boxes[i], boxes[i + 1], tMin, tMax) & packet.active;
+					result.boxHits += std::bitset<WIDTH>(Mask(hit)).count();
+				}
+				f32x8 tStart, tEnd;
+				IntersectShell(origin, packet.direction, radius, tStart, tEnd);
+				result.shellHits += std::bitset<WIDTH>(Mask((tEnd > tStart) & packet.active)).count();
+			}
+		}
+		result.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		return result;
+	}
+
+	void Benchmark(const Camera& camera, uint32_t width, uint32_t height, const glm::vec2& shellRadius)
+	{
+		// Min and max corners: a box around the cloud layer and a row of smaller ones in front of the camera
+		std::vector<glm::vec3> boxes = {
+			glm::vec3(-shellRadius.y, shellRadius.x * 0.5f, -shellRadius.y), glm::vec3(shellRadius.y),
+		};
+		glm::vec3 center = camera.GetPosition();
+		for (int i = -3; i <= 3; ++i) {
+			glm::vec3 offset(float(i) * 60.0f, -20.0f, 150.0f);
+			boxes.push_back(center + offset - glm::vec3(20.0f));
+			boxes.push_back(center + offset + glm::vec3(20.0f));
+		}
+
+		// Largest angle between the directions of both paths, in radians
+		RayGenerator generator(camera, width, height);
+		glm::mat4 P = camera.GetProjectionMatrix();
+		glm::mat4 V = camera.GetViewMatrix();
+		float maxError = 0.0f;
+		for (uint32_t y = 0; y < height; y += 7) {
+			for (uint32_t x = 0; x < width; x += 7) {
+				glm::vec2 ndc{ (float(x) + 0.5f) / float(width) * 2.0f - 1.0f, 1.0f - (float(y) + 0.5f) / float(height) * 2.0f };
+				float cosAngle = glm::dot(Utils::GetRayDir(P, V, ndc), generator.GetDirection(x, y));
+				maxError = std::max(maxError, std::acos(std::min(cosAngle, 1.0f)));
+			}
+		}
+
+		// Warm up, then keep the fastest of a few runs
+		const int NUM_RUNS = 5;
+		BenchmarkResult perRay = RunPerRay(camera, width, height, boxes, shellRadius);
+		BenchmarkResult packets = RunPackets(camera, width, height, boxes, shellRadius);
+		for (int i = 0; i < NUM_RUNS; ++i) {
+			BenchmarkResult a = RunPerRay(camera, width, height, boxes, shellRadius);
+			BenchmarkResult b = RunPackets(camera, width, height, boxes, shellRadius);
+			perRay.seconds = std::min(perRay.seconds, a.seconds);
+			packets.seconds = std::min(packets.seconds, b.seconds);
+		}
+
+		double numRays = double(width) * height;
+		char buffer[256];
+		snprintf(buffer, sizeof(buffer), "Ray benchmark %ux%u, %u boxes and the cloud shell, %s", width, height,
+			uint32_t(boxes.size() / 2), SIMD_AVX2 ? "AVX2" : "scalar lanes");
+		logger::Debug(buffer);
+		snprintf(buffer, sizeof(buffer), "  per ray: %8.2fms  %8.2f Mrays/s  box hits %llu  shell hits %llu",
+			perRay.seconds * 1000.0, numRays / perRay.seconds * 1e-6,
+			static_cast<unsigned long long>(perRay.boxHits), static_cast<unsigned long long>(perRay.shellHits));
+		logger::Debug(buffer);
+		snprintf(buffer, sizeof(buffer), "  packets: %8.2fms  %8.2f Mrays/s  box hits %llu  shell hits %llu",
+			packets.seconds * 1000.0, numRays / packets.seconds * 1e-6,
+			static_cast<unsigned long long>(packets.boxHits), static_cast<unsigned long long>(packets.shellHits));
+		logger::Debug(buffer);
+		snprintf(buffer, sizeof(buffer), "  speedup %.2fx, largest direction difference %.2e rad",
+			perRay.seconds / std::max(packets.seconds, 1e-9), maxError);
+		logger::Debug(buffer);
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "simd.h"
+#include "../glm-includes.h"
+#include "../utils.h"
+
+#include <vector>
+
+class Camera;
+
+// 8 rays in structure of arrays layout, one pixel per lane. Lanes past the
+// edge of the image are cleared in active and carry a valid direction.
+struct RayPacket {
+	simd::vec3x8 direction;
+	simd::f32x8 active;
+	uint32_t x;
+	uint32_t y;
+};
+
+// Turns pixels into world space rays with the cached inverse matrices of the
+// camera. The direction before normalization is linear in the pixel coordinate,
+// so a ray costs two multiply-adds per axis and a normalize instead of two
+// matrix products, and nothing is inverted per ray as Utils::GetRayDir does.
+class RayGenerator
+{
+public:
+	RayGenerator(const Camera& camera, uint32_t width, uint32_t height);
+
+	RayGenerator(const glm::mat4& invP, const glm::mat4& invV, const glm::vec3& origin, uint32_t width, uint32_t height);
+
+	// Pixel centers, y = 0 is the top row. Same direction as GetRayDir() for the pixel's ndc
+	glm::vec3 GetDirection(uint32_t x, uint32_t y) const;
+
+	// Pixels x .. x + 7 of row y
+	void GeneratePacket(uint32_t x, uint32_t y, RayPacket& packet) const;
+
+	// Row major packets of 8 pixels covering [x0, x1) x [y0, y1), packets is resized to fit
+	void GenerateTile(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, std::vector<RayPacket>& packets) const;
+
+	const glm::vec3& GetOrigin() const { return mOrigin; }
+
+private:
+	void Initialize(const glm::mat4& invP, const glm::mat4& invV);
+
+	glm::vec3 mOrigin;
+	// direction = mBase + x * mStepX + y * mStepY for pixel coordinates x and y
+	glm::vec3 mBase;
+	glm::vec3 mStepX;
+	glm::vec3 mStepY;
+	uint32_t mWidth;
+	uint32_t mHeight;
+};
+
+namespace RayPackets {
+
+	// Slab test for the whole packet, returns the mask of lanes that hit with
+	// tMax >= tMin. invDirection is 1 / direction, computed once per packet.
+	simd::f32x8 IntersectBox(const simd::vec3x8& origin, const simd::vec3x8& invDirection,
+		const glm::vec3& min, const glm::vec3& max, simd::f32x8& tMin, simd::f32x8& tMax);
+
+	// Same as GetShellInterval() in raymarch.frag, misses return start 0 and end -1
+	void IntersectShell(const simd::vec3x8& origin, const simd::vec3x8& direction, const glm::vec2& radius,
+		simd::f32x8& tStart, simd::f32x8& tEnd);
+
+	glm::vec2 GetShellInterval(const glm::vec3& origin, const glm::vec3& direction, const glm::vec2& radius);
+
+	simd::vec3x8 Broadcast(const glm::vec3& v);
+
+	// Generates and intersects a width x height image of rays with boxes and the
+	// cloud shell, once with GetRayDir() and RayBoxIntersection() per ray and once
+	// in packets, and logs the time of each and the largest difference
+	void Benchmark(const Camera& camera, uint32_t width, uint32_t height, const glm::vec2& shellRadius);
+}
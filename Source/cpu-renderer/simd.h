@@ -0,0 +1,184 @@
+#pragma once
+
+// 8 wide float and int vectors for the CPU renderer. Maps to AVX2 when the
+// compiler targets it (/arch:AVX2 or -mavx2 -mfma) and to plain arrays that the
+// compiler can still auto-vectorize otherwise. Comparisons return masks with all
+// bits of a lane set, as the AVX compare instructions do.
+
+#include <stdint.h>
+#include <cmath>
+
+#if defined(__AVX2__)
+#define SIMD_AVX2 1
+#include <immintrin.h>
+#else
+#define SIMD_AVX2 0
+#include <algorithm>
+#include <cstring>
+#endif
+
+namespace simd {
+
+	constexpr int WIDTH = 8;
+
+#if SIMD_AVX2
+
+	struct i32x8 {
+		__m256i v;
+
+		i32x8() = default;
+		explicit i32x8(__m256i x) : v(x) {}
+		i32x8(int32_t x) : v(_mm256_set1_epi32(x)) {}
+	};
+
+	inline i32x8 operator+(i32x8 a, i32x8 b) { return i32x8(_mm256_add_epi32(a.v, b.v)); }
+	inline i32x8 operator*(i32x8 a, i32x8 b) { return i32x8(_mm256_mullo_epi32(a.v, b.v)); }
+
+	struct f32x8 {
+		__m256 v;
+
+		f32x8() = default;
+		explicit f32x8(__m256 x) : v(x) {}
+		f32x8(float x) : v(_mm256_set1_ps(x)) {}
+
+		static f32x8 Load(const float* p) { return f32x8(_mm256_loadu_ps(p)); }
+		void Store(float* p) const { _mm256_storeu_ps(p, v); }
+		float operator[](int i) const { alignas(32) float x[8]; _mm256_store_ps(x, v); return x[i]; }
+	};
+
+	inline f32x8 operator+(f32x8 a, f32x8 b) { return f32x8(_mm256_add_ps(a.v, b.v)); }
+	inline f32x8 operator-(f32x8 a, f32x8 b) { return f32x8(_mm256_sub_ps(a.v, b.v)); }
+	inline f32x8 operator*(f32x8 a, f32x8 b) { return f32x8(_mm256_mul_ps(a.v, b.v)); }
+	inline f32x8 operator/(f32x8 a, f32x8 b) { return f32x8(_mm256_div_ps(a.v, b.v)); }
+	inline f32x8 operator-(f32x8 a) { return f32x8(_mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f))); }
+
+	inline f32x8 operator<(f32x8 a, f32x8 b) { return f32x8(_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)); }
+	inline f32x8 operator<=(f32x8 a, f32x8 b) { return f32x8(_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)); }
+	inline f32x8 operator>(f32x8 a, f32x8 b) { return f32x8(_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)); }
+	inline f32x8 operator>=(f32x8 a, f32x8 b) { return f32x8(_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ)); }
+	inline f32x8 operator&(f32x8 a, f32x8 b) { return f32x8(_mm256_and_ps(a.v, b.v)); }
+	inline f32x8 operator|(f32x8 a, f32x8 b) { return f32x8(_mm256_or_ps(a.v, b.v)); }
+
+	inline f32x8 Min(f32x8 a, f32x8 b) { return f32x8(_mm256_min_ps(a.v, b.v)); }
+	inline f32x8 Max(f32x8 a, f32x8 b) { return f32x8(_mm256_max_ps(a.v, b.v)); }
+	inline f32x8 Floor(f32x8 a) { return f32x8(_mm256_floor_ps(a.v)); }
+	inline f32x8 Ceil(f32x8 a) { return f32x8(_mm256_ceil_ps(a.v)); }
+	inline f32x8 Sqrt(f32x8 a) { return f32x8(_mm256_sqrt_ps(a.v)); }
+	inline f32x8 Fma(f32x8 a, f32x8 b, f32x8 c) { return f32x8(_mm256_fmadd_ps(a.v, b.v, c.v)); }
+
+	// mask ? a : b
+	inline f32x8 Select(f32x8 mask, f32x8 a, f32x8 b) { return f32x8(_mm256_blendv_ps(b.v, a.v, mask.v)); }
+	inline bool Any(f32x8 mask) { return _mm256_movemask_ps(mask.v) != 0; }
+	inline int Mask(f32x8 mask) { return _mm256_movemask_ps(mask.v); }
+
+	// Truncates towards zero like a C cast
+	inline i32x8 ToInt(f32x8 a) { return i32x8(_mm256_cvttps_epi32(a.v)); }
+
+	inline f32x8 Gather(const float* base, i32x8 index) { return f32x8(_mm256_i32gather_ps(base, index.v, 4)); }
+
+	// exp() for x <= 0 the way the march uses it, Cephes polynomial with a
+	// relative error around 1e-7, results under ~1e-38 flush to zero
+	inline f32x8 Exp(f32x8 x)
+	{
+		x = Max(x, f32x8(-87.3f));
+		x = Min(x, f32x8(88.3f));
+
+		f32x8 fx = Floor(Fma(x, f32x8(1.44269504088896341f), f32x8(0.5f)));
+		x = x - fx * f32x8(0.693359375f);
+		x = x + fx * f32x8(2.12194440e-4f);
+
+		f32x8 y = f32x8(1.9875691500e-4f);
+		y = Fma(y, x, f32x8(1.3981999507e-3f));
+		y = Fma(y, x, f32x8(8.3334519073e-3f));
+		y = Fma(y, x, f32x8(4.1665795894e-2f));
+		y = Fma(y, x, f32x8(1.6666665459e-1f));
+		y = Fma(y, x, f32x8(5.0000001201e-1f));
+		y = Fma(y, x * x, x + f32x8(1.0f));
+
+		__m256i e = _mm256_add_epi32(_mm256_cvttps_epi32(fx.v), _mm256_set1_epi32(127));
+		__m256 pow2n = _mm256_castsi256_ps(_mm256_slli_epi32(e, 23));
+		return y * f32x8(pow2n);
+	}
+
+#else
+
+	struct i32x8 {
+		int32_t v[8];
+
+		i32x8() = default;
+		i32x8(int32_t x) { for (int i = 0; i < 8; ++i) v[i] = x; }
+	};
+
+	inline i32x8 operator+(i32x8 a, i32x8 b) { i32x8 r; for (int i = 0; i < 8; ++i) r.v[i] = a.v[i] + b.v[i]; return r; }
+	inline i32x8 operator*(i32x8 a, i32x8 b) { i32x8 r; for (int i = 0; i < 8; ++i) r.v[i] = a.v[i] * b.v[i]; return r; }
+
+	struct f32x8 {
+		float v[8];
+
+		f32x8() = default;
+		f32x8(float x) { for (int i = 0; i < 8; ++i) v[i] = x; }
+
+		static f32x8 Load(const float* p) { f32x8 r; std::memcpy(r.v, p, sizeof(r.v)); return r; }
+		void Store(float* p) const { std::memcpy(p, v, sizeof(v)); }
+		float operator[](int i) const { return v[i]; }
+	};
+
+	template<typename Fn>
+	inline f32x8 Map(f32x8 a, f32x8 b, Fn fn) { f32x8 r; for (int i = 0; i < 8; ++i) r.v[i] = fn(a.v[i], b.v[i]); return r; }
+
+	template<typename Fn>
+	inline f32x8 Map(f32x8 a, Fn fn) { f32x8 r; for (int i = 0; i < 8; ++i) r.v[i] = fn(a.v[i]); return r; }
+
+	inline float MaskValue(bool b) { uint32_t bits = b ? 0xffffffffu : 0u; float f; std::memcpy(&f, &bits, 4); return f; }
+	inline bool MaskBit(float f) { uint32_t bits; std::memcpy(&bits, &f, 4); return (bits >> 31) != 0; }
+
+	inline f32x8 operator+(f32x8 a, f32x8 b) { return Map(a, b, [](float x, float y) { return x + y; }); }
+	inline f32x8 operator-(f32x8 a, f32x8 b) { return Map(a, b, [](float x, float y) { return x - y; }); }
+	inline f32x8 operator*(f32x8 a, f32x8 b) { return Map(a, b, [](float x, float y) { return x * y; }); }
+	inline f32x8 operator/(f32x8 a, f32x8 b) { return Map(a, b, [](float x, float y) { return x / y; }); }
+	inline f32x8 operator-(f32x8 a) { return Map(a, [](float x) { return -x; }); }
+
+	inline f32x8 operator<(f32x8 a, f32x8 b) { return Map(a, b, [](float x, float y) { return MaskValue(x < y); }); }
+	inline f32x8 operator<=(f32x8 a, f32x8 b) { return Map(a, b, [](float x, float y) { return MaskValue(x <= y); }); }
+	inline f32x8 operator>(f32x8 a, f32x8 b) { return Map(a, b, [](float x, float y) { return MaskValue(x > y); }); }
+	inline f32x8 operator>=(f32x8 a, f32x8 b) { return Map(a, b, [](float x, float y) { return MaskValue(x >= y); }); }
+	inline f32x8 operator&(f32x8 a, f32x8 b) { return Map(a, b, [](float x, float y) { return MaskValue(MaskBit(x) && MaskBit(y)); }); }
+	inline f32x8 operator|(f32x8 a, f32x8 b) { return Map(a, b, [](float x, float y) { return MaskValue(MaskBit(x) || MaskBit(y)); }); }
+
+	inline f32x8 Min(f32x8 a, f32x8 b) { return Map(a, b, [](float x, float y) { return y < x ? y : x; }); }
+	inline f32x8 Max(f32x8 a, f32x8 b) { return Map(a, b, [](float x, float y) { return y > x ? y : x; }); }
+	inline f32x8 Floor(f32x8 a) { return Map(a, [](float x) { return std::floor(x); }); }
+	inline f32x8 Ceil(f32x8 a) { return Map(a, [](float x) { return std::ceil(x); }); }
+	inline f32x8 Sqrt(f32x8 a) { return Map(a, [](float x) { return std::sqrt(x); }); }
+	inline f32x8 Fma(f32x8 a, f32x8 b, f32x8 c) { return a * b + c; }
+
+	inline f32x8 Select(f32x8 mask, f32x8 a, f32x8 b) { f32x8 r; for (int i = 0; i < 8; ++i) r.v[i] = MaskBit(mask.v[i]) ? a.v[i] : b.v[i]; return r; }
+	inline int Mask(f32x8 mask) { int m = 0; for (int i = 0; i < 8; ++i) m |= int(MaskBit(mask.v[i])) << i; return m; }
+	inline bool Any(f32x8 mask) { return Mask(mask) != 0; }
+
+	inline i32x8 ToInt(f32x8 a) { i32x8 r; for (int i = 0; i < 8; ++i) r.v[i] = int32_t(a.v[i]); return r; }
+
+	inline f32x8 Gather(const float* base, i32x8 index) { f32x8 r; for (int i = 0; i < 8; ++i) r.v[i] = base[index.v[i]]; return r; }
+
+	inline f32x8 Exp(f32x8 x) { return Map(x, [](float v) { return std::exp(v); }); }
+
+#endif
+
+	inline f32x8 Clamp(f32x8 x, f32x8 a, f32x8 b) { return Min(Max(x, a), b); }
+	inline f32x8 Mix(f32x8 a, f32x8 b, f32x8 t) { return a + (b - a) * t; }
+
+	// x - y * floor(x / y), GLSL mod()
+	inline f32x8 Mod(f32x8 x, f32x8 y) { return x - y * Floor(x / y); }
+
+	// 8 vectors in structure of arrays layout
+	struct vec3x8 {
+		f32x8 x, y, z;
+
+		vec3x8() = default;
+		vec3x8(f32x8 a, f32x8 b, f32x8 c) : x(a), y(b), z(c) {}
+	};
+
+	inline vec3x8 operator+(const vec3x8& a, const vec3x8& b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+	inline vec3x8 operator*(const vec3x8& a, f32x8 s) { return { a.x * s, a.y * s, a.z * s }; }
+	inline f32x8 Dot(const vec3x8& a, const vec3x8& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+}
\ No newline at end of file
@@ -0,0 +1,98 @@
+#include "volume.h"
+
+#include <cmath>
+
+using namespace simd;
+
+void Volume::Resize(uint32_t w, uint32_t h, uint32_t d)
+{
+	width = w;
+	height = h;
+	depth = d;
+	data.assign(size_t(w) * h * d, glm::vec4(0.0f));
+}
+
+static void WrapAxis(float u, uint32_t size, uint32_t& i0, uint32_t& i1, float& f)
+{
+	float x = u * float(size) - 0.5f;
+	float fl = std::floor(x);
+	f = x - fl;
+
+	int32_t i = static_cast<int32_t>(fl) % static_cast<int32_t>(size);
+	if (i < 0) i += size;
+	i0 = static_cast<uint32_t>(i);
+	i1 = i0 + 1 == size ? 0 : i0 + 1;
+}
+
+glm::vec4 Volume::Sample(const glm::vec3& uvw) const
+{
+	uint32_t x0, x1, y0, y1, z0, z1;
+	float fx, fy, fz;
+	WrapAxis(uvw.x, width, x0, x1, fx);
+	WrapAxis(uvw.y, height, y0, y1, fy);
+	WrapAxis(uvw.z, depth, z0, z1, fz);
+
+	glm::vec4 c00 = glm::mix(At(x0, y0, z0), At(x1, y0, z0), fx);
+	glm::vec4 c10 = glm::mix(At(x0, y1, z0), At(x1, y1, z0), fx);
+	glm::vec4 c01 = glm::mix(At(x0, y0, z1), At(x1, y0, z1), fx);
+	glm::vec4 c11 = glm::mix(At(x0, y1, z1), At(x1, y1, z1), fx);
+	return glm::mix(glm::mix(c00, c10, fy), glm::mix(c01, c11, fy), fz);
+}
+
+static void WrapAxis(f32x8 u, uint32_t size, i32x8& i0, i32x8& i1, f32x8& f)
+{
+	f32x8 fsize = f32x8(float(size));
+	f32x8 x = u * fsize - f32x8(0.5f);
+	f32x8 fl = Floor(x);
+	f = x - fl;
+
+	// Integers are exact in float, the select guards against mod rounding up to size
+	f32x8 w0 = Mod(fl, fsize);
+	w0 = Select(w0 >= fsize, f32x8(0.0f), w0);
+	f32x8 w1 = w0 + f32x8(1.0f);
+	w1 = Select(w1 >= fsize, f32x8(0.0f), w1);
+
+	i0 = ToInt(w0);
+	i1 = ToInt(w1);
+}
+
+void Volume::Sample(const vec3x8& uvw, f32x8* out, int numChannels) const
+{
+	i32x8 x[2], y[2], z[2];
+	f32x8 fx, fy, fz;
+	WrapAxis(uvw.x, width, x[0], x[1], fx);
+	WrapAxis(uvw.y, height, y[0], y[1], fy);
+	WrapAxis(uvw.z, depth, z[0], z[1], fz);
+
+	f32x8 one(1.0f);
+	f32x8 wx[2] = { one - fx, fx };
+	f32x8 wy[2] = { one - fy, fy };
+	f32x8 wz[2] = { one - fz, fz };
+
+	// Element offsets, 4 floats per voxel
+	i32x8 rowStride(int32_t(width * 4));
+	i32x8 sliceStride(int32_t(width * height * 4));
+	i32x8 four(4);
+	for (int i = 0; i < 2; ++i) {
+		x[i] = x[i] * four;
+		y[i] = y[i] * rowStride;
+		z[i] = z[i] * sliceStride;
+	}
+
+	for (int c = 0; c < numChannels; ++c)
+		out[c] = f32x8(0.0f);
+
+	const float* base = &data[0].x;
+	for (int k = 0; k < 2; ++k) {
+		for (int j = 0; j < 2; ++j) {
+			i32x8 rowOffset = z[k] + y[j];
+			f32x8 wyz = wy[j] * wz[k];
+			for (int i = 0; i < 2; ++i) {
+				i32x8 index = rowOffset + x[i];
+				f32x8 w = wx[i] * wyz;
+				for (int c = 0; c < numChannels; ++c)
+					out[c] = Fma(Gather(base + c, index), w, out[c]);
+			}
+		}
+	}
+}
\ No newline at end of file
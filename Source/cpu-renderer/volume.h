@@ -0,0 +1,26 @@
+#pragma once
+
+#include "../glm-includes.h"
+#include "simd.h"
+
+#include <vector>
+#include <stdint.h>
+
+// RGBA float volume sampled the way a GL_LINEAR / GL_REPEAT 3D texture is,
+// texel centers at (i + 0.5) / size
+struct Volume {
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t depth = 0;
+	std::vector<glm::vec4> data;
+
+	void Resize(uint32_t w, uint32_t h, uint32_t d);
+
+	glm::vec4& At(uint32_t x, uint32_t y, uint32_t z) { return data[(z * height + y) * width + x]; }
+	const glm::vec4& At(uint32_t x, uint32_t y, uint32_t z) const { return data[(z * height + y) * width + x]; }
+
+	glm::vec4 Sample(const glm::vec3& uvw) const;
+
+	// Trilinear sample of the first numChannels channels for 8 positions at once
+	void Sample(const simd::vec3x8& uvw, simd::f32x8* out, int numChannels) const;
+};
\ No newline at end of file
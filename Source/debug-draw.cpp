@@ -1,137 +1,165 @@
 #include "debug-draw.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <vector>
 
 namespace DebugDraw {
 
-	static GLBuffer gLineBuffer;
-	static uint32_t gLineBufferOffset = 0;
-	static Line* gLineBufferPtr = nullptr;
+	struct Box {
+		glm::vec3 min;
+		glm::vec3 max;
+		glm::vec3 color;
+	};
+
+	// Frames the cpu may run ahead of the gpu, each one writes its own region of the rings
+	static const uint32_t NUM_FRAMES = 3;
+	static const uint32_t INITIAL_CAPACITY = 1024;
+
+	// Instances of one primitive. The buffer holds NUM_FRAMES regions of capacity
+	// instances and stays mapped, the region of a frame is picked with the base instance.
+	struct InstanceRing {
+		GLuint buffer = 0;
+		GLuint vao = 0;
+		uint8_t* mapped = nullptr;
+		uint32_t capacity = 0;
+		uint32_t stride = 0;
+	};
+
+	static std::vector<Line> gLines;
+	static std::vector<Box> gBoxes;
+	static InstanceRing gLineRing;
+	static InstanceRing gBoxRing;
+	static GLsync gFences[NUM_FRAMES] = {};
+	static uint32_t gFrame = 0;
 	static GLProgram gLineProgram;
-	static const int MAX_LINE_COUNT = 100;
+	static GLProgram gBoxProgram;
+
+	static void AllocateRing(InstanceRing& ring, uint32_t capacity)
+	{
+		// The old buffer is released, not deleted, frames in flight may still read it
+		if (ring.buffer != 0) {
+			glUnmapNamedBuffer(ring.buffer);
+			GLResources::release(GLResourceType::Buffer, ring.buffer);
+		}
 
-	void Initialize() {
-		uint32_t bufferSize = MAX_LINE_COUNT * sizeof(Line);
-		gLineBuffer.init(nullptr, bufferSize, GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT | GL_MAP_WRITE_BIT);
+		ring.capacity = capacity;
+		GLbitfield flags = GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT | GL_MAP_WRITE_BIT;
+		GLsizeiptr size = GLsizeiptr(capacity) * ring.stride * NUM_FRAMES;
+		glCreateBuffers(1, &ring.buffer);
+		glNamedBufferStorage(ring.buffer, size, nullptr, flags);
+		GLResources::track(GLResourceType::Buffer, ring.buffer, uint64_t(size));
+		ring.mapped = reinterpret_cast<uint8_t*>(glMapNamedBufferRange(ring.buffer, 0, size, flags));
+		glVertexArrayVertexBuffer(ring.vao, 0, ring.buffer, 0, ring.stride);
+	}
 
-		GLShader vs("Shaders/line.vert");
-		GLShader fs("Shaders/line.frag");
-		gLineProgram.init(vs, fs);
+	// Per instance vec3 attributes packed back to back
+	static void InitializeRing(InstanceRing& ring, uint32_t stride, uint32_t numAttributes)
+	{
+		ring.stride = stride;
+		glCreateVertexArrays(1, &ring.vao);
+		GLResources::track(GLResourceType::VertexArray, ring.vao);
+		for (uint32_t i = 0; i < numAttributes; ++i) {
+			glEnableVertexArrayAttrib(ring.vao, i);
+			glVertexArrayAttribFormat(ring.vao, i, 3, GL_FLOAT, GL_FALSE, i * sizeof(glm::vec3));
+			glVertexArrayAttribBinding(ring.vao, i, 0);
+		}
+		glVertexArrayBindingDivisor(ring.vao, 0, 1);
+		AllocateRing(ring, INITIAL_CAPACITY);
 	}
 
-	void InitializeBufferPtr() {
-		if (gLineBufferPtr == nullptr) {
-			gLineBufferPtr = reinterpret_cast<Line*>(glMapNamedBuffer(gLineBuffer.handle, GL_WRITE_ONLY));
+	// Copies this frame's instances into its region, growing the ring when they don't fit.
+	// Returns the base instance of the region.
+	static uint32_t Upload(InstanceRing& ring, const void* data, uint32_t count)
+	{
+		if (count > ring.capacity) {
+			uint32_t capacity = ring.capacity;
+			while (capacity < count) capacity *= 2;
+			char buffer[128];
+			snprintf(buffer, sizeof(buffer), "DebugDraw: growing ring from %u to %u instances", ring.capacity, capacity);
+			logger::Debug(buffer);
+			AllocateRing(ring, capacity);
 		}
+		uint32_t baseInstance = gFrame * ring.capacity;
+		memcpy(ring.mapped + size_t(baseInstance) * ring.stride, data, size_t(count) * ring.stride);
+		return baseInstance;
 	}
 
-	void AddLine(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& color) {
-		InitializeBufferPtr();
+	void Initialize() {
+		GLResourceScope scope("Debug Draw");
+
+		InitializeRing(gLineRing, sizeof(Line), 4);
+		InitializeRing(gBoxRing, sizeof(Box), 3);
+
+		GLShader lineVS("Shaders/line.vert");
+		GLShader lineFS("Shaders/line.frag");
+		gLineProgram.init(lineVS, lineFS);
+
+		GLShader boxVS("Shaders/box.vert");
+		GLShader boxFS("Shaders/line.frag");
+		gBoxProgram.init(boxVS, boxFS);
+	}
 
-		Line* line = (gLineBufferPtr + gLineBufferOffset);
-		line->p0 = p0;
-		line->p1 = p1;
-		line->c0 = line->c1 = color;
-		gLineBufferOffset += 1;
+	void AddLine(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& color) {
+		gLines.push_back({ p0, color, p1, color });
 	}
 
 	void AddRect(const glm::vec3& min, const glm::vec3& max, const glm::vec3& color) {
-		InitializeBufferPtr();
-
-		Line* line = (gLineBufferPtr + gLineBufferOffset);
-
-		glm::vec3 size = max - min;
-		// Bottom
-		line->p0 = min;
-		line->p1 = { min.x + size.x, min.y, min.z };
-		line->c0 = line->c1 = color;
-		line++;
-
-		line->p0 = { min.x + size.x, min.y, min.z };
-		line->p1 = { min.x + size.x, min.y, min.z + size.z };
-		line->c0 = line->c1 = color;
-		line++;
-
-		line->p0 = { min.x + size.x, min.y, min.z + size.z }; 
-		line->p1 = { min.x, min.y, min.z + size.z };
-		line->c0 = line->c1 = color;
-		line++;
-
-		line->p0 = { min.x, min.y, min.z + size.z };
-		line->p1 = { min.x, min.y, min.z };
-		line->c0 = line->c1 = color;
-		line++;
-
-		// Top
-		line->p0 = { min.x, max.y, min.z };
-		line->p1 = { min.x + size.x, max.y, min.z };
-		line->c0 = line->c1 = color;
-		line++;
-
-		line->p0 = { min.x + size.x, max.y, min.z };
-		line->p1 = { min.x + size.x, max.y, min.z + size.z };
-		line->c0 = line->c1 = color;
-		line++;
-
-		line->p0 = { min.x + size.x, max.y, min.z + size.z };
-		line->p1 = { min.x, max.y, min.z + size.z };
-		line->c0 = line->c1 = color;
-		line++;
-
-		line->p0 = { min.x, max.y, min.z + size.z };
-		line->p1 = { min.x, max.y, min.z };
-		line->c0 = line->c1 = color;
-		line++;
-
-		line->p0 = { min.x, min.y, min.z };
-		line->p1 = { min.x, min.y + size.y, min.z };
-		line->c0 = line->c1 = color;
-		line++;
-
-		line->p0 = { min.x + size.x, min.y, min.z };
-		line->p1 = { min.x + size.x, min.y + size.y, min.z };
-		line->c0 = line->c1 = color;
-		line++;
-
-		line->p0 = { min.x + size.x, min.y, min.z + size.z };
-		line->p1 = { min.x + size.x, min.y + size.y, min.z + size.z };
-		line->c0 = line->c1 = color;
-		line++;
-
-		line->p0 = { min.x, min.y, min.z + size.z };
-		line->p1 = { min.x, min.y + size.y, min.z + size.z };
-		line->c0 = line->c1 = color;
-		line++;
-
-		gLineBufferOffset += 12;
+		gBoxes.push_back({ min, max, color });
 	}
 
 	void Render(glm::mat4 VP, glm::vec2 windowSize) {
-		if (gLineBufferOffset == 0) return;
-		glUnmapNamedBuffer(gLineBuffer.handle);
-		gLineBufferPtr = nullptr;
-
-		uint32_t numLine = gLineBufferOffset;
-		gLineBufferOffset = 0;
-
-		// Draw Line
-		gLineProgram.use();
-		gLineProgram.setMat4("VP", &VP[0][0]);
+		if (gLines.empty() && gBoxes.empty()) return;
+
+		// The region of this frame was last drawn NUM_FRAMES frames ago, wait until the gpu is done with it
+		GLsync& fence = gFences[gFrame];
+		if (fence != nullptr) {
+			GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+			while (status == GL_TIMEOUT_EXPIRED)
+				status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+			glDeleteSync(fence);
+			fence = nullptr;
+		}
 
 		glLineWidth(2.0f);
-		glBindBuffer(GL_ARRAY_BUFFER, gLineBuffer.handle);
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 6, 0);
-
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 6, (void*)(sizeof(float) * 3));
-
-		glDrawArrays(GL_LINES, 0, numLine * 2);
+		if (!gLines.empty()) {
+			uint32_t numLines = static_cast<uint32_t>(gLines.size());
+			uint32_t baseInstance = Upload(gLineRing, gLines.data(), numLines);
+			gLineProgram.use();
+			gLineProgram.setMat4("VP", &VP[0][0]);
+			GLState::bindVertexArray(gLineRing.vao);
+			glDrawArraysInstancedBaseInstance(GL_LINES, 0, 2, numLines, baseInstance);
+		}
 
+		if (!gBoxes.empty()) {
+			uint32_t numBoxes = static_cast<uint32_t>(gBoxes.size());
+			uint32_t baseInstance = Upload(gBoxRing, gBoxes.data(), numBoxes);
+			gBoxProgram.use();
+			gBoxProgram.setMat4("VP", &VP[0][0]);
+			GLState::bindVertexArray(gBoxRing.vao);
+			glDrawArraysInstancedBaseInstance(GL_LINES, 0, 24, numBoxes, baseInstance);
+		}
 		glLineWidth(1.0f);
+
+		fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		gFrame = (gFrame + 1) % NUM_FRAMES;
+		gLines.clear();
+		gBoxes.clear();
 	}
 
 	void Shutdown() {
-		gLineBuffer.destroy();
+		for (GLsync& fence : gFences) {
+			if (fence != nullptr) glDeleteSync(fence);
+			fence = nullptr;
+		}
+		for (InstanceRing* ring : { &gLineRing, &gBoxRing }) {
+			glUnmapNamedBuffer(ring->buffer);
+			GLResources::release(GLResourceType::Buffer, ring->buffer);
+			GLResources::release(GLResourceType::VertexArray, ring->vao);
+			*ring = InstanceRing{};
+		}
 		gLineProgram.destroy();
+		gBoxProgram.destroy();
 	}
 
-}
\ No newline at end of file
+}
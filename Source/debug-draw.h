@@ -11,11 +11,14 @@ struct Line {
 	glm::vec3 c1;
 };
 
+// Lines and boxes are collected during the frame and drawn instanced by Render(),
+// there is no limit on how many are added
 namespace DebugDraw {
 	void Initialize();
 
 	void AddLine(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& color = { 1.0f, 0.0f, 1.0f });
 
+	// Axis aligned box, drawn as its 12 edges from a single instance
 	void AddRect(const glm::vec3& min, const glm::vec3& max, const glm::vec3& color = { 1.0f, 0.0f, 1.0f });
 
 	void Render(glm::mat4 VP, glm::vec2 windowSize);
@@ -0,0 +1,55 @@
+#include "dynamic-resolution.h"
+
+#include "imgui-service.h"
+
+#include <algorithm>
+#include <cmath>
+
+float DynamicResolution::Update(float gpuTime)
+{
+	if (!mSettings.enabled) {
+		mScale = 1.0f;
+		mFilteredTime = 0.0f;
+		return mScale;
+	}
+
+	// Timings read before the first results are in come back as zero
+	if (gpuTime <= 0.0f)
+		return mScale;
+
+	mFilteredTime = mFilteredTime > 0.0f ? mFilteredTime + (gpuTime - mFilteredTime) * mSettings.smoothing : gpuTime;
+	if (++mFramesSinceChange < mSettings.cooldownFrames)
+		return mScale;
+
+	float desired = mScale * std::sqrt(mSettings.targetTime / mFilteredTime);
+	desired = std::clamp(desired, mSettings.minScale, mSettings.maxScale);
+
+	float step = std::max(mSettings.scaleStep, 0.01f);
+	float quantized = std::clamp(std::round(desired / step) * step, mSettings.minScale, mSettings.maxScale);
+	if (std::abs(quantized - mScale) >= step * 0.5f) {
+		// Predict the time at the new scale so the average doesn't drag the old one along
+		mFilteredTime *= (quantized * quantized) / (mScale * mScale);
+		mScale = quantized;
+		mFramesSinceChange = 0;
+	}
+	return mScale;
+}
+
+void DynamicResolution::GetRenderSize(uint32_t width, uint32_t height, uint32_t* renderWidth, uint32_t* renderHeight) const
+{
+	auto scaled = [this](uint32_t size) {
+		uint32_t s = uint32_t(std::lround(size * mScale / 8.0f)) * 8;
+		return std::max(s, 8u);
+	};
+	*renderWidth = scaled(width);
+	*renderHeight = scaled(height);
+}
+
+void DynamicResolution::AddUI()
+{
+	ImGui::Checkbox("Dynamic Resolution", &mSettings.enabled);
+	ImGui::DragFloat("Gpu Budget(ms)", &mSettings.targetTime, 0.1f, 1.0f, 100.0f);
+	ImGui::SliderFloat("Min Scale", &mSettings.minScale, 0.25f, 1.0f);
+	ImGui::SliderFloat("Max Scale", &mSettings.maxScale, mSettings.minScale, 2.0f);
+	ImGui::Text("Scale: %.2f, Filtered Gpu Time: %.2fms", mScale, mFilteredTime);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+
+struct DynamicResolutionSettings {
+	bool enabled = true;
+	// Gpu budget in ms for the passes that are rendered at the scaled resolution
+	float targetTime = 12.0f;
+	float minScale = 0.5f;
+	float maxScale = 1.0f;
+	// Scale changes in steps of this size so the targets aren't reallocated every frame
+	float scaleStep = 0.05f;
+	// Weight of the newest measurement in the running average
+	float smoothing = 0.15f;
+	// Frames to wait after a change, the timings lag a few frames behind
+	uint32_t cooldownFrames = 8;
+};
+
+// Picks the render scale from measured gpu time. The cost of the passes
+// grows with the pixel count, so the next scale is the current one times
+// sqrt(target / time), quantized and clamped to the bounds.
+class DynamicResolution
+{
+public:
+	// Feeds the latest gpu time in ms and returns the scale to render the next frame at
+	float Update(float gpuTime);
+
+	float GetScale() const { return mScale; }
+
+	// Render size for an output of width x height at the current scale, rounded to multiples of 8
+	void GetRenderSize(uint32_t width, uint32_t height, uint32_t* renderWidth, uint32_t* renderHeight) const;
+
+	DynamicResolutionSettings& GetSettings() { return mSettings; }
+
+	void AddUI();
+
+private:
+	DynamicResolutionSettings mSettings;
+	float mScale = 1.0f;
+	float mFilteredTime = 0.0f;
+	uint32_t mFramesSinceChange = 0;
+};
@@ -0,0 +1,410 @@
+#include "frame-graph.h"
+
+#include "imgui-service.h"
+#include "logger.h"
+
+#include <algorithm>
+
+static bool IsAttachment(ResourceUsage usage)
+{
+	return usage == ResourceUsage::ColorAttachment || usage == ResourceUsage::DepthAttachment;
+}
+
+// Barrier that makes image stores visible to the next use of the texture
+static GLbitfield GetBarrierBits(ResourceUsage usage)
+{
+	switch (usage) {
+	case ResourceUsage::Sampled: return GL_TEXTURE_FETCH_BARRIER_BIT;
+	case ResourceUsage::ImageLoad:
+	case ResourceUsage::ImageStore: return GL_SHADER_IMAGE_ACCESS_BARRIER_BIT;
+	case ResourceUsage::ColorAttachment:
+	case ResourceUsage::DepthAttachment: return GL_FRAMEBUFFER_BARRIER_BIT;
+	case ResourceUsage::Readback: return GL_TEXTURE_UPDATE_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT;
+	}
+	return 0;
+}
+
+static bool IsCompatible(const TextureCreateInfo& a, const TextureCreateInfo& b)
+{
+	return a.width == b.width && a.height == b.height && a.depth == b.depth && a.target == b.target &&
+		a.internalFormat == b.internalFormat && a.format == b.format && a.dataType == b.dataType &&
+		a.generateMipmap == b.generateMipmap && a.wrapType == b.wrapType &&
+		a.minFilterType == b.minFilterType && a.magFilterType == b.magFilterType;
+}
+
+/*****************************************************************************************************************************************/
+
+FrameGraphResource FrameGraphBuilder::CreateTexture(const std::string& name, const TextureCreateInfo& desc)
+{
+	FrameGraph::Resource resource;
+	resource.name = name;
+	resource.desc = desc;
+	mGraph->mResources.push_back(resource);
+	return static_cast<FrameGraphResource>(mGraph->mResources.size() - 1);
+}
+
+FrameGraphResource FrameGraphBuilder::Read(FrameGraphResource resource, ResourceUsage usage)
+{
+	assert(resource < mGraph->mResources.size());
+	mGraph->mPasses[mPass].reads.push_back({ resource, usage });
+	return resource;
+}
+
+FrameGraphResource FrameGraphBuilder::Write(FrameGraphResource resource, ResourceUsage usage)
+{
+	assert(resource < mGraph->mResources.size());
+	mGraph->mPasses[mPass].writes.push_back({ resource, usage });
+	mGraph->mResources[resource].writers.push_back(mPass);
+	return resource;
+}
+
+void FrameGraphBuilder::SetSideEffect()
+{
+	mGraph->mPasses[mPass].sideEffect = true;
+}
+
+/*****************************************************************************************************************************************/
+
+void FrameGraph::Reset()
+{
+	mResources.clear();
+	mPasses.clear();
+	mCompiled = false;
+}
+
+FrameGraphResource FrameGraph::ImportTexture(const std::string& name, uint32_t texture, const TextureCreateInfo& desc)
+{
+	Resource resource;
+	resource.name = name;
+	resource.desc = desc;
+	resource.imported = true;
+	resource.texture = texture;
+	mResources.push_back(resource);
+	return static_cast<FrameGraphResource>(mResources.size() - 1);
+}
+
+void FrameGraph::AddPass(const std::string& name, const SetupFn& setup, const ExecuteFn& execute)
+{
+	Pass pass;
+	pass.name = name;
+	pass.execute = execute;
+	mPasses.push_back(pass);
+
+	FrameGraphBuilder builder(this, static_cast<uint32_t>(mPasses.size() - 1));
+	setup(builder);
+}
+
+void FrameGraph::CullPasses()
+{
+	// A pass is needed while something reads one of its outputs, imported
+	// textures count as read by whoever owns them
+	for (Pass& pass : mPasses) {
+		pass.refCount = static_cast<uint32_t>(pass.writes.size()) + (pass.sideEffect ? 1 : 0);
+		pass.culled = false;
+		for (const ResourceAccess& access : pass.reads)
+			mResources[access.resource].refCount++;
+	}
+
+	std::vector<FrameGraphResource> unused;
+	for (FrameGraphResource i = 0; i < mResources.size(); ++i) {
+		if (mResources[i].imported)
+			mResources[i].refCount++;
+		if (mResources[i].refCount == 0)
+			unused.push_back(i);
+	}
+
+	// Passes that write nothing and aren't marked as having side effects never run
+	for (Pass& pass : mPasses) {
+		if (pass.refCount > 0) continue;
+		pass.culled = true;
+		for (const ResourceAccess& access : pass.reads) {
+			if (--mResources[access.resource].refCount == 0)
+				unused.push_back(access.resource);
+		}
+	}
+
+	while (!unused.empty()) {
+		Resource& resource = mResources[unused.back()];
+		unused.pop_back();
+
+		for (uint32_t writer : resource.writers) {
+			Pass& pass = mPasses[writer];
+			if (pass.refCount == 0 || --pass.refCount > 0)
+				continue;
+
+			pass.culled = true;
+			for (const ResourceAccess& access : pass.reads) {
+				if (--mResources[access.resource].refCount == 0)
+					unused.push_back(access.resource);
+			}
+		}
+	}
+}
+
+void FrameGraph::AllocateTransients()
+{
+	for (uint32_t p = 0; p < mPasses.size(); ++p) {
+		if (mPasses[p].culled) continue;
+		auto touch = [this, p](const ResourceAccess& access) {
+			Resource& resource = mResources[access.resource];
+			resource.firstUse = std::min(resource.firstUse, p);
+			resource.lastUse = std::max(resource.lastUse, p);
+		};
+		std::for_each(mPasses[p].reads.begin(), mPasses[p].reads.end(), touch);
+		std::for_each(mPasses[p].writes.begin(), mPasses[p].writes.end(), touch);
+	}
+
+	for (auto& pooled : mPool)
+		pooled->inUse = false;
+
+	// Walk the passes in order, taking textures from the pool when a transient
+	// is first used and giving them back after its last use
+	uint64_t inUseBytes = 0;
+	for (uint32_t p = 0; p < mPasses.size(); ++p) {
+		for (Resource& resource : mResources) {
+			if (resource.imported || resource.firstUse != p)
+				continue;
+
+			auto it = std::find_if(mPool.begin(), mPool.end(), [&resource](const std::unique_ptr<PooledTexture>& pooled) {
+				return !pooled->inUse && IsCompatible(pooled->desc, resource.desc);
+			});
+			if (it == mPool.end()) {
+				GLResourceScope scope("Frame Graph");
+				auto pooled = std::make_unique<PooledTexture>();
+				pooled->desc = resource.desc;
+				pooled->texture.init(&pooled->desc);
+				pooled->bytes = GetTextureBytes(resource.desc);
+				mPool.push_back(std::move(pooled));
+				it = mPool.end() - 1;
+			}
+
+			PooledTexture& pooled = **it;
+			pooled.inUse = true;
+			pooled.lastUsedFrame = mFrameIndex;
+			resource.pooled = static_cast<int32_t>(it - mPool.begin());
+			resource.texture = pooled.texture.handle;
+
+			inUseBytes += pooled.bytes;
+			mStats.numTransientTextures++;
+			mStats.unaliasedBytes += pooled.bytes;
+		}
+		mStats.peakBytes = std::max(mStats.peakBytes, inUseBytes);
+
+		for (Resource& resource : mResources) {
+			if (resource.pooled < 0 || resource.lastUse != p)
+				continue;
+			mPool[resource.pooled]->inUse = false;
+			inUseBytes -= mPool[resource.pooled]->bytes;
+		}
+	}
+}
+
+void FrameGraph::Compile()
+{
+	uint64_t previousPeak = mStats.peakBytes;
+	uint32_t previousTransients = mStats.numTransientTextures;
+
+	mStats = FrameGraphStats{};
+	mStats.numPasses = static_cast<uint32_t>(mPasses.size());
+
+	CullPasses();
+	mStats.numCulledPasses = static_cast<uint32_t>(std::count_if(mPasses.begin(), mPasses.end(), [](const Pass& pass) { return pass.culled; }));
+
+	AllocateTransients();
+
+	// Pool textures nobody has asked for in a while, e.g. after a resolution change
+	for (size_t i = 0; i < mPool.size();) {
+		PooledTexture& pooled = *mPool[i];
+		if (pooled.lastUsedFrame + POOL_KEEP_FRAMES >= mFrameIndex) {
+			++i;
+			continue;
+		}
+
+		ForgetTexture(pooled.texture.handle);
+		pooled.texture.destroy();
+		mPool.erase(mPool.begin() + i);
+	}
+
+	mStats.numPooledTextures = static_cast<uint32_t>(mPool.size());
+	for (auto& pooled : mPool)
+		mStats.pooledBytes += pooled->bytes;
+
+	if (mStats.peakBytes != previousPeak || mStats.numTransientTextures != previousTransients) {
+		char buffer[256];
+		snprintf(buffer, sizeof(buffer), "Frame graph: %u passes (%u culled), %u transient textures, peak %.1fMB (%.1fMB without aliasing)",
+			mStats.numPasses, mStats.numCulledPasses, mStats.numTransientTextures, mStats.peakBytes / (1024.0 * 1024.0), mStats.unaliasedBytes / (1024.0 * 1024.0));
+		logger::Debug(buffer);
+	}
+	mCompiled = true;
+}
+
+void FrameGraph::ForgetTexture(uint32_t handle)
+{
+	for (auto it = mFramebuffers.begin(); it != mFramebuffers.end();) {
+		if (std::find(it->first.begin(), it->first.end(), handle) != it->first.end()) {
+			GLResources::release(GLResourceType::Framebuffer, it->second);
+			it = mFramebuffers.erase(it);
+		}
+		else
+			++it;
+	}
+}
+
+void FrameGraph::BindFramebuffer(const Pass& pass)
+{
+	std::vector<uint32_t> key;
+	uint32_t depth = 0;
+	GLenum depthAttachment = GL_DEPTH_ATTACHMENT;
+	const TextureCreateInfo* size = nullptr;
+	for (const ResourceAccess& access : pass.writes) {
+		const Resource& resource = mResources[access.resource];
+		if (access.usage == ResourceUsage::ColorAttachment)
+			key.push_back(resource.texture);
+		else if (access.usage == ResourceUsage::DepthAttachment) {
+			depth = resource.texture;
+			if (resource.desc.format == GL_DEPTH_STENCIL)
+				depthAttachment = GL_DEPTH_STENCIL_ATTACHMENT;
+		}
+		else
+			continue;
+		size = &resource.desc;
+	}
+
+	if (size == nullptr) {
+		GLState::bindFramebuffer(0);
+		return;
+	}
+
+	// Depth goes last in the key so that it doesn't collide with a color only set
+	key.push_back(depth);
+	auto it = mFramebuffers.find(key);
+	if (it == mFramebuffers.end()) {
+		GLResourceScope scope("Frame Graph");
+		uint32_t fbo;
+		glCreateFramebuffers(1, &fbo);
+		GLResources::track(GLResourceType::Framebuffer, fbo);
+		std::vector<GLenum> drawBuffers;
+		for (size_t i = 0; i + 1 < key.size(); ++i) {
+			glNamedFramebufferTexture(fbo, GLenum(GL_COLOR_ATTACHMENT0 + i), key[i], 0);
+			drawBuffers.push_back(GLenum(GL_COLOR_ATTACHMENT0 + i));
+		}
+		if (depth != 0)
+			glNamedFramebufferTexture(fbo, depthAttachment, depth, 0);
+		if (drawBuffers.empty())
+			glNamedFramebufferDrawBuffer(fbo, GL_NONE);
+		else
+			glNamedFramebufferDrawBuffers(fbo, static_cast<GLsizei>(drawBuffers.size()), drawBuffers.data());
+
+		if (glCheckNamedFramebufferStatus(fbo, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			logger::Error("Incomplete framebuffer for pass " + pass.name);
+		it = mFramebuffers.emplace(key, fbo).first;
+	}
+
+	GLState::bindFramebuffer(it->second);
+	glViewport(0, 0, size->width, size->height);
+}
+
+void FrameGraph::Execute()
+{
+	assert(mCompiled);
+	mStats.numBarriers = 0;
+	mGpuTime = 0.0f;
+	uint32_t querySlot = uint32_t(mFrameIndex % QUERY_FRAMES);
+
+	for (Pass& pass : mPasses) {
+		if (pass.culled) continue;
+
+		// Timestamps instead of GL_TIME_ELAPSED, passes may time themselves inside
+		auto timerIt = mPassTimers.find(pass.name);
+		if (timerIt == mPassTimers.end()) {
+			PassTimer timer = {};
+			glGenQueries(QUERY_FRAMES * 2, &timer.queries[0][0]);
+			timerIt = mPassTimers.emplace(pass.name, timer).first;
+		}
+		PassTimer& timer = timerIt->second;
+		if (timer.issued[querySlot]) {
+			uint64_t start = 0, end = 0;
+			glGetQueryObjectui64v(timer.queries[querySlot][0], GL_QUERY_RESULT, &start);
+			glGetQueryObjectui64v(timer.queries[querySlot][1], GL_QUERY_RESULT, &end);
+			timer.time = float(end - start) * 0.000001f;
+		}
+		mGpuTime += timer.time;
+		glQueryCounter(timer.queries[querySlot][0], GL_TIMESTAMP);
+
+		// Only image stores need explicit synchronization, render target writes
+		// followed by sampling are ordered by the driver
+		GLbitfield barrier = 0;
+		for (const auto* accesses : { &pass.reads, &pass.writes }) {
+			for (const ResourceAccess& access : *accesses) {
+				Resource& resource = mResources[access.resource];
+				if (resource.incoherent) {
+					barrier |= GetBarrierBits(access.usage);
+					resource.incoherent = false;
+				}
+			}
+		}
+		if (barrier != 0) {
+			glMemoryBarrier(barrier);
+			mStats.numBarriers++;
+		}
+
+		bool hasAttachments = std::any_of(pass.writes.begin(), pass.writes.end(), [](const ResourceAccess& access) { return IsAttachment(access.usage); });
+		if (hasAttachments)
+			BindFramebuffer(pass);
+
+		pass.execute(*this);
+		glQueryCounter(timer.queries[querySlot][1], GL_TIMESTAMP);
+		timer.issued[querySlot] = true;
+
+		for (const ResourceAccess& access : pass.writes) {
+			if (access.usage == ResourceUsage::ImageStore)
+				mResources[access.resource].incoherent = true;
+		}
+	}
+
+	GLState::bindFramebuffer(0);
+	mFrameIndex++;
+}
+
+float FrameGraph::GetPassTime(const std::string& name) const
+{
+	auto it = mPassTimers.find(name);
+	return it != mPassTimers.end() ? it->second.time : 0.0f;
+}
+
+uint32_t FrameGraph::GetTexture(FrameGraphResource resource) const
+{
+	assert(resource < mResources.size());
+	return mResources[resource].texture;
+}
+
+void FrameGraph::AddUI()
+{
+	ImGui::Text("Passes: %u (%u culled), Barriers: %u", mStats.numPasses, mStats.numCulledPasses, mStats.numBarriers);
+	ImGui::Text("Transient Textures: %u in %u pooled", mStats.numTransientTextures, mStats.numPooledTextures);
+	ImGui::Text("Peak Memory: %.1fMB (%.1fMB without aliasing)", mStats.peakBytes / (1024.0 * 1024.0), mStats.unaliasedBytes / (1024.0 * 1024.0));
+	ImGui::Text("Pool Memory: %.1fMB", mStats.pooledBytes / (1024.0 * 1024.0));
+	ImGui::Text("Gpu Time: %.2fms", mGpuTime);
+	for (const Pass& pass : mPasses) {
+		if (pass.culled)
+			ImGui::BulletText("%s (culled)", pass.name.c_str());
+		else
+			ImGui::BulletText("%s: %.2fms", pass.name.c_str(), GetPassTime(pass.name));
+	}
+}
+
+void FrameGraph::Shutdown()
+{
+	for (auto& timer : mPassTimers)
+		glDeleteQueries(QUERY_FRAMES * 2, &timer.second.queries[0][0]);
+	mPassTimers.clear();
+
+	for (auto& framebuffer : mFramebuffers)
+		GLResources::release(GLResourceType::Framebuffer, framebuffer.second);
+	mFramebuffers.clear();
+
+	for (auto& pooled : mPool)
+		pooled->texture.destroy();
+	mPool.clear();
+	Reset();
+}
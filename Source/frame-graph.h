@@ -0,0 +1,178 @@
+#pragma once
+
+#include "gl-utils.h"
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Index of a texture in the graph of the current frame
+using FrameGraphResource = uint32_t;
+static const FrameGraphResource INVALID_RESOURCE = ~0u;
+
+// How a pass touches a texture, decides the framebuffer attachments and the barriers
+enum class ResourceUsage {
+	Sampled,
+	ImageLoad,
+	ColorAttachment,
+	DepthAttachment,
+	ImageStore,
+	Readback
+};
+
+class FrameGraph;
+
+// Handed to the setup callback of a pass to declare what it creates, reads and writes
+class FrameGraphBuilder
+{
+public:
+	// Transient texture that lives from the first to the last pass using it
+	FrameGraphResource CreateTexture(const std::string& name, const TextureCreateInfo& desc);
+
+	FrameGraphResource Read(FrameGraphResource resource, ResourceUsage usage = ResourceUsage::Sampled);
+
+	// Color attachments are bound in the order they are written
+	FrameGraphResource Write(FrameGraphResource resource, ResourceUsage usage = ResourceUsage::ColorAttachment);
+
+	// Keeps the pass even if none of its outputs are read, e.g. for passes that only write to the screen
+	void SetSideEffect();
+
+private:
+	friend class FrameGraph;
+	FrameGraphBuilder(FrameGraph* graph, uint32_t pass) : mGraph(graph), mPass(pass) {}
+
+	FrameGraph* mGraph;
+	uint32_t mPass;
+};
+
+struct FrameGraphStats {
+	uint32_t numPasses = 0;
+	uint32_t numCulledPasses = 0;
+	uint32_t numBarriers = 0;
+	uint32_t numTransientTextures = 0;
+	uint32_t numPooledTextures = 0;
+	// Largest sum of the pooled textures in use at the same time
+	uint64_t peakBytes = 0;
+	// What the transient textures would take with a texture each
+	uint64_t unaliasedBytes = 0;
+	// Everything the pool holds, including textures kept for later frames
+	uint64_t pooledBytes = 0;
+};
+
+// Rebuilt every frame: Reset(), import the persistent textures, add the passes,
+// Compile() and Execute(). Passes run in the order they are added. Compile()
+// culls passes whose outputs nobody reads, works out the lifetime of every
+// transient texture and hands out textures from a pool so that transients
+// whose lifetimes don't overlap share one (OpenGL has no placed resources, so
+// sharing the texture object is how the memory is aliased). Execute() binds a
+// framebuffer with the written attachments for each pass and issues
+// glMemoryBarrier only where a texture written by image stores is used next.
+class FrameGraph
+{
+public:
+	using SetupFn = std::function<void(FrameGraphBuilder& builder)>;
+	using ExecuteFn = std::function<void(const FrameGraph& graph)>;
+
+	void Reset();
+
+	// Texture owned outside of the graph, passes writing it are never culled
+	FrameGraphResource ImportTexture(const std::string& name, uint32_t texture, const TextureCreateInfo& desc);
+
+	// setup is called right away, execute during Execute() if the pass survives culling
+	void AddPass(const std::string& name, const SetupFn& setup, const ExecuteFn& execute);
+
+	void Compile();
+
+	void Execute();
+
+	// OpenGL handle of the texture, only valid inside the execute callbacks
+	uint32_t GetTexture(FrameGraphResource resource) const;
+
+	// Deletes the cached framebuffers that attach the texture. Imported textures
+	// have to be forgotten before they are destroyed, their name may be reused.
+	void ForgetTexture(uint32_t handle);
+
+	const FrameGraphStats& GetStats() const { return mStats; }
+
+	// Gpu time in ms of the named pass and of all passes that ran, from
+	// timestamps read QUERY_FRAMES frames late so they never stall
+	float GetPassTime(const std::string& name) const;
+	float GetGpuTime() const { return mGpuTime; }
+
+	static const uint32_t QUERY_FRAMES = 3;
+
+	void AddUI();
+
+	// Textures of the pool that haven't been used for this many frames are freed
+	static const uint32_t POOL_KEEP_FRAMES = 60;
+
+	void Shutdown();
+
+private:
+	friend class FrameGraphBuilder;
+
+	struct Resource {
+		std::string name;
+		TextureCreateInfo desc;
+		bool imported = false;
+		uint32_t texture = 0;
+		int32_t pooled = -1;
+		std::vector<uint32_t> writers;
+		uint32_t refCount = 0;
+		uint32_t firstUse = ~0u;
+		uint32_t lastUse = 0;
+		// Written by image stores and not synchronized yet
+		bool incoherent = false;
+	};
+
+	struct ResourceAccess {
+		FrameGraphResource resource;
+		ResourceUsage usage;
+	};
+
+	struct Pass {
+		std::string name;
+		ExecuteFn execute;
+		std::vector<ResourceAccess> reads;
+		std::vector<ResourceAccess> writes;
+		bool sideEffect = false;
+		uint32_t refCount = 0;
+		bool culled = false;
+	};
+
+	struct PassTimer {
+		uint32_t queries[QUERY_FRAMES][2];
+		bool issued[QUERY_FRAMES];
+		float time;
+	};
+
+	struct PooledTexture {
+		GLTexture texture;
+		TextureCreateInfo desc;
+		uint64_t bytes;
+		uint64_t lastUsedFrame;
+		bool inUse;
+	};
+
+	void CullPasses();
+
+	void AllocateTransients();
+
+	void BindFramebuffer(const Pass& pass);
+
+	std::vector<Resource> mResources;
+	std::vector<Pass> mPasses;
+
+	std::vector<std::unique_ptr<PooledTexture>> mPool;
+	// One framebuffer per set of attachments, kept across frames
+	std::map<std::vector<uint32_t>, uint32_t> mFramebuffers;
+
+	std::map<std::string, PassTimer> mPassTimers;
+	float mGpuTime = 0.0f;
+
+	uint64_t mFrameIndex = 0;
+	bool mCompiled = false;
+	FrameGraphStats mStats;
+};
@@ -5,6 +5,378 @@
 #include <fstream>
 #include <iostream>
 #include <optional>
+#include <algorithm>
+#include <deque>
+#include <unordered_map>
+
+/*****************************************************************************************************************************************/
+// State cache
+
+namespace GLState {
+
+	// ~0u is never a valid name, so nothing matches it and the next bind is issued
+	static const GLuint UNKNOWN = ~0u;
+	static const uint32_t MAX_CACHED_UNITS = 32;
+
+	struct BufferBinding {
+		GLenum target;
+		GLuint buffer;
+	};
+
+	static GLuint gProgram = UNKNOWN;
+	// Nothing is bound to any unit in a new context
+	static GLuint gTextures[MAX_CACHED_UNITS] = {};
+	static GLuint gSamplers[MAX_CACHED_UNITS] = {};
+	static std::vector<BufferBinding> gBuffers;
+	static GLuint gVertexArray = UNKNOWN;
+	static GLuint gFramebuffer = UNKNOWN;
+
+	static GLStateStats gFrameStats;
+	static GLStateStats gLastFrameStats;
+
+	// True when the call has to be made, counts it either way
+	static bool Update(GLuint& cached, GLuint value, GLStateCall call)
+	{
+		uint32_t index = uint32_t(call);
+		if (cached == value) {
+			gFrameStats.skipped[index]++;
+			return false;
+		}
+		cached = value;
+		gFrameStats.issued[index]++;
+		return true;
+	}
+
+	void useProgram(GLuint program)
+	{
+		if (Update(gProgram, program, GLStateCall::Program))
+			glUseProgram(program);
+	}
+
+	void bindTexture(uint32_t unit, GLuint texture)
+	{
+		if (unit >= MAX_CACHED_UNITS) {
+			gFrameStats.issued[uint32_t(GLStateCall::Texture)]++;
+			glBindTextureUnit(unit, texture);
+		}
+		else if (Update(gTextures[unit], texture, GLStateCall::Texture))
+			glBindTextureUnit(unit, texture);
+	}
+
+	void bindSampler(uint32_t unit, GLuint sampler)
+	{
+		if (unit >= MAX_CACHED_UNITS) {
+			gFrameStats.issued[uint32_t(GLStateCall::Sampler)]++;
+			glBindSampler(unit, sampler);
+		}
+		else if (Update(gSamplers[unit], sampler, GLStateCall::Sampler))
+			glBindSampler(unit, sampler);
+	}
+
+	static GLuint& GetBufferBinding(GLenum target)
+	{
+		auto it = std::find_if(gBuffers.begin(), gBuffers.end(), [target](const BufferBinding& binding) { return binding.target == target; });
+		if (it == gBuffers.end()) {
+			gBuffers.push_back({ target, UNKNOWN });
+			it = gBuffers.end() - 1;
+		}
+		return it->buffer;
+	}
+
+	void bindBuffer(GLenum target, GLuint buffer)
+	{
+		if (Update(GetBufferBinding(target), buffer, GLStateCall::Buffer))
+			glBindBuffer(target, buffer);
+	}
+
+	void bindBufferRange(GLenum target, uint32_t index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+	{
+		gFrameStats.issued[uint32_t(GLStateCall::Buffer)]++;
+		glBindBufferRange(target, index, buffer, offset, size);
+		GetBufferBinding(target) = buffer;
+	}
+
+	void bindVertexArray(GLuint vertexArray)
+	{
+		if (Update(gVertexArray, vertexArray, GLStateCall::VertexArray)) {
+			glBindVertexArray(vertexArray);
+			// The element buffer binding belongs to the vertex array
+			for (BufferBinding& binding : gBuffers) {
+				if (binding.target == GL_ELEMENT_ARRAY_BUFFER)
+					binding.buffer = UNKNOWN;
+			}
+		}
+	}
+
+	void bindFramebuffer(GLuint framebuffer)
+	{
+		if (Update(gFramebuffer, framebuffer, GLStateCall::Framebuffer))
+			glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	}
+
+	GLuint getFramebuffer()
+	{
+		if (gFramebuffer == UNKNOWN) {
+			GLint framebuffer = 0;
+			glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+			gFramebuffer = GLuint(framebuffer);
+		}
+		return gFramebuffer;
+	}
+
+	void forgetProgram(GLuint program)
+	{
+		if (gProgram == program) gProgram = UNKNOWN;
+	}
+
+	void forgetTexture(GLuint texture)
+	{
+		for (GLuint& bound : gTextures) {
+			if (bound == texture) bound = UNKNOWN;
+		}
+	}
+
+	void forgetSampler(GLuint sampler)
+	{
+		for (GLuint& bound : gSamplers) {
+			if (bound == sampler) bound = UNKNOWN;
+		}
+	}
+
+	void forgetBuffer(GLuint buffer)
+	{
+		for (BufferBinding& binding : gBuffers) {
+			if (binding.buffer == buffer) binding.buffer = UNKNOWN;
+		}
+	}
+
+	void forgetVertexArray(GLuint vertexArray)
+	{
+		if (gVertexArray == vertexArray) gVertexArray = UNKNOWN;
+	}
+
+	void forgetFramebuffer(GLuint framebuffer)
+	{
+		if (gFramebuffer == framebuffer) gFramebuffer = UNKNOWN;
+	}
+
+	void invalidate()
+	{
+		gProgram = UNKNOWN;
+		gBuffers.clear();
+		gVertexArray = UNKNOWN;
+		gFramebuffer = UNKNOWN;
+		invalidateTextures();
+	}
+
+	void invalidateTextures()
+	{
+		std::fill(std::begin(gTextures), std::end(gTextures), UNKNOWN);
+		std::fill(std::begin(gSamplers), std::end(gSamplers), UNKNOWN);
+	}
+
+	void endFrame()
+	{
+		gLastFrameStats = gFrameStats;
+		gFrameStats = GLStateStats{};
+	}
+
+	const GLStateStats& getStats()
+	{
+		return gLastFrameStats;
+	}
+
+	const char* getCallName(GLStateCall call)
+	{
+		static const char* names[] = { "Program", "Texture", "Sampler", "Buffer", "Vertex Array", "Framebuffer" };
+		return names[uint32_t(call)];
+	}
+}
+
+/*****************************************************************************************************************************************/
+// Resource registry
+
+namespace GLResources {
+
+	struct Entry {
+		GLResourceType type;
+		GLuint handle;
+		uint64_t bytes;
+		std::string category;
+	};
+
+	struct Released {
+		GLResourceType type;
+		GLuint handle;
+	};
+
+	struct PendingBatch {
+		GLsync fence;
+		std::vector<Released> objects;
+	};
+
+	static std::unordered_map<uint64_t, Entry> gLive;
+	static std::vector<Released> gReleased;
+	static std::deque<PendingBatch> gPending;
+	static std::vector<std::string> gCategories;
+
+	static uint64_t GetKey(GLResourceType type, GLuint handle)
+	{
+		return (uint64_t(type) << 32) | handle;
+	}
+
+	// The state cache forgets the name as GL unbinds it and may hand it out again
+	static void Delete(const Released& object)
+	{
+		GLuint handle = object.handle;
+		switch (object.type) {
+		case GLResourceType::Texture:
+			GLState::forgetTexture(handle);
+			glDeleteTextures(1, &handle);
+			break;
+		case GLResourceType::Buffer:
+			GLState::forgetBuffer(handle);
+			glDeleteBuffers(1, &handle);
+			break;
+		case GLResourceType::Framebuffer:
+			GLState::forgetFramebuffer(handle);
+			glDeleteFramebuffers(1, &handle);
+			break;
+		case GLResourceType::Program:
+			GLState::forgetProgram(handle);
+			glDeleteProgram(handle);
+			break;
+		case GLResourceType::Sampler:
+			GLState::forgetSampler(handle);
+			glDeleteSamplers(1, &handle);
+			break;
+		case GLResourceType::VertexArray:
+			GLState::forgetVertexArray(handle);
+			glDeleteVertexArrays(1, &handle);
+			break;
+		default:
+			break;
+		}
+	}
+
+	void track(GLResourceType type, GLuint handle, uint64_t bytes)
+	{
+		const char* category = gCategories.empty() ? "Other" : gCategories.back().c_str();
+		gLive[GetKey(type, handle)] = Entry{ type, handle, bytes, category };
+	}
+
+	void release(GLResourceType type, GLuint handle)
+	{
+		if (handle == 0) return;
+		auto it = gLive.find(GetKey(type, handle));
+		if (it == gLive.end()) {
+			char buffer[128];
+			snprintf(buffer, sizeof(buffer), "Released untracked or already released %s %u", getTypeName(type), handle);
+			logger::Warn(buffer);
+			return;
+		}
+		gLive.erase(it);
+		gReleased.push_back({ type, handle });
+	}
+
+	void endFrame()
+	{
+		if (!gReleased.empty()) {
+			gPending.push_back({ glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), std::move(gReleased) });
+			gReleased.clear();
+		}
+
+		// Batches finish in order, stop at the first one still in flight
+		while (!gPending.empty()) {
+			PendingBatch& batch = gPending.front();
+			GLenum status = glClientWaitSync(batch.fence, 0, 0);
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+				break;
+			for (const Released& object : batch.objects)
+				Delete(object);
+			glDeleteSync(batch.fence);
+			gPending.pop_front();
+		}
+	}
+
+	void flush()
+	{
+		glFinish();
+		for (PendingBatch& batch : gPending) {
+			for (const Released& object : batch.objects)
+				Delete(object);
+			glDeleteSync(batch.fence);
+		}
+		gPending.clear();
+		for (const Released& object : gReleased)
+			Delete(object);
+		gReleased.clear();
+	}
+
+	void pushCategory(const char* name)
+	{
+		gCategories.push_back(name);
+	}
+
+	void popCategory()
+	{
+		assert(!gCategories.empty());
+		gCategories.pop_back();
+	}
+
+	std::vector<GLResourceCategory> getCategories()
+	{
+		std::vector<GLResourceCategory> categories;
+		for (auto& live : gLive) {
+			const Entry& entry = live.second;
+			auto it = std::find_if(categories.begin(), categories.end(), [&](const GLResourceCategory& category) { return category.name == entry.category; });
+			if (it == categories.end()) {
+				categories.push_back({ entry.category });
+				it = categories.end() - 1;
+			}
+			it->count++;
+			it->bytes += entry.bytes;
+		}
+		std::sort(categories.begin(), categories.end(), [](const GLResourceCategory& a, const GLResourceCategory& b) {
+			return a.bytes != b.bytes ? a.bytes > b.bytes : a.name < b.name;
+		});
+		return categories;
+	}
+
+	uint64_t getTotalBytes()
+	{
+		uint64_t bytes = 0;
+		for (auto& live : gLive)
+			bytes += live.second.bytes;
+		return bytes;
+	}
+
+	uint32_t getPendingCount()
+	{
+		uint32_t count = static_cast<uint32_t>(gReleased.size());
+		for (const PendingBatch& batch : gPending)
+			count += static_cast<uint32_t>(batch.objects.size());
+		return count;
+	}
+
+	uint32_t reportLeaks()
+	{
+		for (auto& live : gLive) {
+			const Entry& entry = live.second;
+			char buffer[256];
+			snprintf(buffer, sizeof(buffer), "Leaked %s %u (%s, %.2fMB)", getTypeName(entry.type), entry.handle,
+				entry.category.c_str(), entry.bytes / (1024.0 * 1024.0));
+			logger::Warn(buffer);
+		}
+		return static_cast<uint32_t>(gLive.size());
+	}
+
+	const char* getTypeName(GLResourceType type)
+	{
+		static const char* names[] = { "texture", "buffer", "framebuffer", "program", "sampler", "vertex array" };
+		return names[uint32_t(type)];
+	}
+}
 
 /*****************************************************************************************************************************************/
 // Shader
@@ -58,6 +430,18 @@ GLShader::GLShader(const char* filename) :
 {
 }
 
+static std::string InsertDefines(std::string code, const std::string& defines)
+{
+	size_t versionEnd = code.find('\n', code.find("#version"));
+	code.insert(versionEnd == std::string::npos ? code.size() : versionEnd + 1, defines);
+	return code;
+}
+
+GLShader::GLShader(const char* filename, const std::string& defines) :
+	GLShader(GetShaderTypeFromFile(filename), InsertDefines(ReadShaderFile(filename).value(), defines).c_str())
+{
+}
+
 GLShader::GLShader(GLenum type, const char* shaderCode) :
 	type_(type),
 	handle_(glCreateShader(type_))
@@ -104,6 +488,7 @@ void GLProgram::init(GLShader a, GLShader b)
 	glLinkProgram(handle_);
 
 	printProgramInfoLog(handle_);
+	GLResources::track(GLResourceType::Program, handle_);
 }
 
 void GLProgram::init(GLShader a, GLShader b, GLShader c)
@@ -115,17 +500,31 @@ void GLProgram::init(GLShader a, GLShader b, GLShader c)
 	glLinkProgram(handle_);
 
 	printProgramInfoLog(handle_);
+	GLResources::track(GLResourceType::Program, handle_);
 }
 
 
 void GLProgram::setTexture(const std::string& name, int binding, unsigned int textureId, bool layered)
 {
+	// The unit takes the target of the texture, layered is kept for the callers
+	(void)layered;
 	setInt(name, binding);
-	glActiveTexture(GL_TEXTURE0 + binding);
-	if(layered)
-		glBindTexture(GL_TEXTURE_3D, textureId);
-	else
-		glBindTexture(GL_TEXTURE_2D, textureId);
+	GLState::bindTexture(binding, textureId);
+	GLState::bindSampler(binding, 0);
+}
+
+void GLProgram::setTexture(const std::string& name, int binding, unsigned int textureId, const GLSampler& sampler)
+{
+	setInt(name, binding);
+	GLState::bindTexture(binding, textureId);
+	GLState::bindSampler(binding, sampler.handle);
+}
+
+void GLProgram::setTextureCube(const std::string& name, int binding, unsigned int textureId)
+{
+	setInt(name, binding);
+	GLState::bindTexture(binding, textureId);
+	GLState::bindSampler(binding, 0);
 }
 
 void GLProgram::setInt(const std::string& name, int val)
@@ -153,11 +552,31 @@ void GLProgram::setVec4(const std::string& name, float* val)
 	glUniform4fv(glGetUniformLocation(handle_, name.c_str()), 1, val);
 }
 
+void GLProgram::setIVec3(const std::string& name, int* val)
+{
+	glUniform3iv(glGetUniformLocation(handle_, name.c_str()), 1, val);
+}
+
 void GLProgram::setMat4(const std::string& name, float* data)
 {
 	glUniformMatrix4fv(glGetUniformLocation(handle_, name.c_str()), 1, GL_FALSE, data);
 }
 
+void GLProgram::setIntArray(const std::string& name, int* val, int count)
+{
+	glUniform1iv(glGetUniformLocation(handle_, name.c_str()), count, val);
+}
+
+void GLProgram::setVec3Array(const std::string& name, float* val, int count)
+{
+	glUniform3fv(glGetUniformLocation(handle_, name.c_str()), count, val);
+}
+
+void GLProgram::setMat4Array(const std::string& name, float* data, int count)
+{
+	glUniformMatrix4fv(glGetUniformLocation(handle_, name.c_str()), count, GL_FALSE, data);
+}
+
 /*****************************************************************************************************************************************/
 
 void GLComputeProgram::init(GLShader shader)
@@ -167,6 +586,7 @@ void GLComputeProgram::init(GLShader shader)
 	glLinkProgram(handle_);
 
 	printProgramInfoLog(handle_);
+	GLResources::track(GLResourceType::Program, handle_);
 }
 
 void GLComputeProgram::setTexture(int binding, uint32_t textureId, GLenum access, GLenum format, bool layered)
@@ -174,6 +594,13 @@ void GLComputeProgram::setTexture(int binding, uint32_t textureId, GLenum access
 	glBindImageTexture(binding, textureId, 0, layered ? GL_TRUE : GL_FALSE, 0, access, format);
 }
 
+void GLComputeProgram::setSampler(const std::string& name, int binding, uint32_t textureId)
+{
+	setInt(name, binding);
+	GLState::bindTexture(binding, textureId);
+	GLState::bindSampler(binding, 0);
+}
+
 void GLComputeProgram::setVec2(const std::string& name, float* val) 
 {
 	glUniform2fv(glGetUniformLocation(handle_, name.c_str()), 1, val);
@@ -199,6 +626,11 @@ void GLComputeProgram::setVec4(const std::string& name, float* val)
 	glUniform4fv(glGetUniformLocation(handle_, name.c_str()), 1, val);
 }
 
+void GLComputeProgram::setIVec3(const std::string& name, int* val)
+{
+	glUniform3iv(glGetUniformLocation(handle_, name.c_str()), 1, val);
+}
+
 void GLComputeProgram::dispatch(uint32_t workGroupX, uint32_t workGroupY, uint32_t workGroupZ) const
 {
 	glDispatchCompute(workGroupX, workGroupY, workGroupZ);
@@ -208,44 +640,80 @@ void GLBuffer::init(void* data, uint32_t size, GLbitfield flags)
 {
 	glCreateBuffers(1, &handle);
 	glNamedBufferStorage(handle, size, data, flags);
+	GLResources::track(GLResourceType::Buffer, handle, size);
 }
 
 void GLFramebuffer::init(const std::vector<Attachment>& attachments, TextureCreateInfo* depthAttachmentInfo)
 {
-	glGenFramebuffers(1, &handle);
-	glBindFramebuffer(GL_FRAMEBUFFER, handle);
+	glCreateFramebuffers(1, &handle);
+	GLResources::track(GLResourceType::Framebuffer, handle);
 
 	this->attachments.resize(attachments.size());
+	std::vector<GLenum> drawBuffers(attachments.size());
 	for (auto& attachment : attachments) {
 		GLTexture texture;
 		texture.init(attachment.attachmentInfo);
 		this->attachments[attachment.index] = texture.handle;
-		glFramebufferTexture2D(GL_FRAMEBUFFER,
-			GL_COLOR_ATTACHMENT0 + attachment.index,
-			attachment.attachmentInfo->target,
-			texture.handle, 0);
+		drawBuffers[attachment.index] = GL_COLOR_ATTACHMENT0 + attachment.index;
+		glNamedFramebufferTexture(handle, GL_COLOR_ATTACHMENT0 + attachment.index, texture.handle, 0);
 	}
+	if (drawBuffers.empty())
+		glNamedFramebufferDrawBuffer(handle, GL_NONE);
+	else
+		glNamedFramebufferDrawBuffers(handle, static_cast<GLsizei>(drawBuffers.size()), drawBuffers.data());
 
+	depthAttachment = 0;
 	if (depthAttachmentInfo) {
 		GLTexture texture;
 		texture.init(depthAttachmentInfo);
 		depthAttachment = texture.handle;
-		glFramebufferTexture2D(GL_FRAMEBUFFER,
-			GL_DEPTH_STENCIL_ATTACHMENT,
-			GL_TEXTURE_2D,
-			texture.handle, 0);
+		GLenum attachmentPoint = depthAttachmentInfo->format == GL_DEPTH_STENCIL ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+		glNamedFramebufferTexture(handle, attachmentPoint, texture.handle, 0);
 	}
 
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	if (glCheckNamedFramebufferStatus(handle, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
 		logger::Error("ERROR::FRAMEBUFFER:: Framebuffer is not complete!");
+}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+void GLFramebuffer::destroy()
+{
+	// The attachments were created by init() and belong to the framebuffer
+	for (GLuint attachment : attachments)
+		GLResources::release(GLResourceType::Texture, attachment);
+	attachments.clear();
+	GLResources::release(GLResourceType::Texture, depthAttachment);
+	depthAttachment = 0;
+	GLResources::release(GLResourceType::Framebuffer, handle);
+}
 
+static uint32_t GetBytesPerTexel(GLuint internalFormat)
+{
+	switch (internalFormat) {
+	case GL_R8: return 1;
+	case GL_R16F: case GL_RG8: return 2;
+	case GL_RGBA8: case GL_RGBA8UI: case GL_R32F: case GL_RG16F: case GL_R11F_G11F_B10F:
+	case GL_DEPTH24_STENCIL8: case GL_DEPTH_COMPONENT24: case GL_DEPTH_COMPONENT32F: return 4;
+	case GL_RGBA16F: case GL_RG32F: return 8;
+	case GL_RGBA32F: return 16;
+	}
+	return 4;
 }
 
-void GLFramebuffer::destroy()
+uint64_t GetTextureBytes(const TextureCreateInfo& desc)
 {
-	glDeleteFramebuffers(1, &handle);
+	uint64_t faces = desc.target == GL_TEXTURE_CUBE_MAP ? 6 : 1;
+	bool mipDepth = desc.target == GL_TEXTURE_3D;
+	uint64_t width = desc.width, height = desc.height, depth = desc.depth;
+	uint64_t texels = 0;
+	for (;;) {
+		texels += width * height * depth;
+		if (!desc.generateMipmap || (width == 1 && height == 1 && (!mipDepth || depth == 1)))
+			break;
+		width = std::max<uint64_t>(width >> 1, 1);
+		height = std::max<uint64_t>(height >> 1, 1);
+		if (mipDepth) depth = std::max<uint64_t>(depth >> 1, 1);
+	}
+	return texels * faces * GetBytesPerTexel(desc.internalFormat);
 }
 
 void GLTexture::init(TextureCreateInfo* createInfo, void* data)
@@ -255,38 +723,58 @@ void GLTexture::init(TextureCreateInfo* createInfo, void* data)
 	depth = createInfo->depth;
 	internalFormat = createInfo->internalFormat;
 
+	levels = 1;
+	if (createInfo->generateMipmap) {
+		uint32_t maxDim = std::max(width, std::max(height, createInfo->target == GL_TEXTURE_3D ? depth : 1u));
+		while (maxDim >>= 1) levels++;
+	}
+
+	// Immutable storage with the whole mip chain up front, nothing gets bound
 	GLuint target = createInfo->target;
-	glGenTextures(1, &handle);
-	glBindTexture(target, handle);
+	glCreateTextures(target, 1, &handle);
+	GLResources::track(GLResourceType::Texture, handle, GetTextureBytes(*createInfo));
 
-	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, createInfo->minFilterType);
-	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, createInfo->magFilterType);
-	glTexParameteri(target, GL_TEXTURE_WRAP_S, createInfo->wrapType);
-	glTexParameteri(target, GL_TEXTURE_WRAP_T, createInfo->wrapType);
+	glTextureParameteri(handle, GL_TEXTURE_MIN_FILTER, createInfo->minFilterType);
+	glTextureParameteri(handle, GL_TEXTURE_MAG_FILTER, createInfo->magFilterType);
+	glTextureParameteri(handle, GL_TEXTURE_WRAP_S, createInfo->wrapType);
+	glTextureParameteri(handle, GL_TEXTURE_WRAP_T, createInfo->wrapType);
 
 	if (target == GL_TEXTURE_2D) {
-		glTexImage2D(target,
-			0,
-			createInfo->internalFormat,
-			createInfo->width,
-			createInfo->height,
-			0,
-			createInfo->format,
-			createInfo->dataType, data);
+		glTextureStorage2D(handle, levels, createInfo->internalFormat, width, height);
+		if (data)
+			glTextureSubImage2D(handle, 0, 0, 0, width, height, createInfo->format, createInfo->dataType, data);
+	}
+	else if (target == GL_TEXTURE_CUBE_MAP) {
+		glTextureParameteri(handle, GL_TEXTURE_WRAP_R, createInfo->wrapType);
+		glTextureStorage2D(handle, levels, createInfo->internalFormat, width, height);
+		// Cube faces are addressed as layers by the DSA upload, every face gets the same data
+		if (data) {
+			for (uint32_t face = 0; face < 6; ++face)
+				glTextureSubImage3D(handle, 0, 0, 0, face, width, height, 1, createInfo->format, createInfo->dataType, data);
+		}
 	}
 	else {
-		glTexParameteri(target, GL_TEXTURE_WRAP_R, createInfo->wrapType);
-		glTexImage3D(target,
-			0, 
-			createInfo->internalFormat,
-			createInfo->width,
-			createInfo->height,
-			createInfo->depth,
-			0,
-			createInfo->format,
-			createInfo->dataType,
-			data);
-	}
-	if (createInfo->generateMipmap)
-		glGenerateMipmap(target);
+		glTextureParameteri(handle, GL_TEXTURE_WRAP_R, createInfo->wrapType);
+		glTextureStorage3D(handle, levels, createInfo->internalFormat, width, height, depth);
+		if (data)
+			glTextureSubImage3D(handle, 0, 0, 0, 0, width, height, depth, createInfo->format, createInfo->dataType, data);
+	}
+	if (createInfo->generateMipmap && data)
+		glGenerateTextureMipmap(handle);
+}
+
+void GLSampler::init(GLenum minFilter, GLenum magFilter, GLenum wrap)
+{
+	glCreateSamplers(1, &handle);
+	GLResources::track(GLResourceType::Sampler, handle);
+	glSamplerParameteri(handle, GL_TEXTURE_MIN_FILTER, minFilter);
+	glSamplerParameteri(handle, GL_TEXTURE_MAG_FILTER, magFilter);
+	glSamplerParameteri(handle, GL_TEXTURE_WRAP_S, wrap);
+	glSamplerParameteri(handle, GL_TEXTURE_WRAP_T, wrap);
+	glSamplerParameteri(handle, GL_TEXTURE_WRAP_R, wrap);
+}
+
+void GLSampler::destroy()
+{
+	GLResources::release(GLResourceType::Sampler, handle);
 }
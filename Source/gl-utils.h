@@ -19,6 +19,127 @@ struct DrawElementsIndirectCommand {
 
 extern float gOGLVersion;
 
+/*************************************************************************************************************************************************/
+// State cache
+
+enum class GLStateCall {
+	Program,
+	Texture,
+	Sampler,
+	Buffer,
+	VertexArray,
+	Framebuffer,
+	Count
+};
+
+struct GLStateStats {
+	uint32_t issued[uint32_t(GLStateCall::Count)] = {};
+	uint32_t skipped[uint32_t(GLStateCall::Count)] = {};
+};
+
+// Shadow copy of what is bound so that binding the bound object again costs no
+// GL call. Binds of these kinds should go through here; code that binds behind
+// its back (ImGui, glBindTexture on the active unit) must call invalidate().
+// Deleted objects have to be forgotten as GL unbinds them and may reuse the name.
+namespace GLState {
+	void useProgram(GLuint program);
+
+	// glBindTextureUnit, one handle per unit whatever the target
+	void bindTexture(uint32_t unit, GLuint texture);
+
+	// 0 leaves sampling to the parameters of the texture
+	void bindSampler(uint32_t unit, GLuint sampler);
+
+	void bindBuffer(GLenum target, GLuint buffer);
+
+	// Indexed bindings aren't cached and always issued, the generic binding of target is updated as GL does
+	void bindBufferRange(GLenum target, uint32_t index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
+	void bindVertexArray(GLuint vertexArray);
+
+	// Draw and read framebuffer together
+	void bindFramebuffer(GLuint framebuffer);
+
+	GLuint getFramebuffer();
+
+	void forgetProgram(GLuint program);
+	void forgetTexture(GLuint texture);
+	void forgetSampler(GLuint sampler);
+	void forgetBuffer(GLuint buffer);
+	void forgetVertexArray(GLuint vertexArray);
+	void forgetFramebuffer(GLuint framebuffer);
+
+	// The next bind of every kind is issued
+	void invalidate();
+
+	void invalidateTextures();
+
+	// Moves the counters of this frame to getStats() and starts over
+	void endFrame();
+
+	const GLStateStats& getStats();
+
+	const char* getCallName(GLStateCall call);
+}
+
+/*************************************************************************************************************************************************/
+// Resource registry
+
+enum class GLResourceType {
+	Texture,
+	Buffer,
+	Framebuffer,
+	Program,
+	Sampler,
+	VertexArray,
+	Count
+};
+
+struct GLResourceCategory {
+	std::string name;
+	uint32_t count = 0;
+	uint64_t bytes = 0;
+};
+
+// Every live GL object with its size in bytes and the category that was current
+// when it was created. gl-utils tracks what it creates, raw objects made elsewhere
+// are tracked by hand. release() keeps an object alive until the fence placed by
+// the endFrame() of that frame has passed, so a resource can be dropped while
+// commands that use it are still in flight.
+namespace GLResources {
+	void track(GLResourceType type, GLuint handle, uint64_t bytes = 0);
+
+	void release(GLResourceType type, GLuint handle);
+
+	// Fences this frame's releases and deletes the objects the gpu is done with
+	void endFrame();
+
+	// Waits for the gpu and deletes everything released so far
+	void flush();
+
+	// Category of the objects tracked until the matching popCategory()
+	void pushCategory(const char* name);
+	void popCategory();
+
+	// Live objects grouped by category, largest first
+	std::vector<GLResourceCategory> getCategories();
+
+	uint64_t getTotalBytes();
+
+	// Released objects waiting on their fence
+	uint32_t getPendingCount();
+
+	// Logs every object still alive and returns how many there are, call after everything has been shut down
+	uint32_t reportLeaks();
+
+	const char* getTypeName(GLResourceType type);
+}
+
+struct GLResourceScope {
+	explicit GLResourceScope(const char* category) { GLResources::pushCategory(category); }
+	~GLResourceScope() { GLResources::popCategory(); }
+};
+
 /*************************************************************************************************************************************************/
 // Shader
 
@@ -28,6 +149,9 @@ public:
 
 	explicit GLShader(const char* filename);
 
+	// defines is inserted right after the #version line, e.g. "#define MULTI_VIEW\n"
+	GLShader(const char* filename, const std::string& defines);
+
 	GLShader(GLenum type, const char* shaderCode);
 
 	inline GLenum getType() { return type_; }
@@ -43,6 +167,20 @@ private:
 
 /*************************************************************************************************************************************************/
 
+// Filtering and wrapping shared by every texture bound with it, overrides the texture's own parameters
+struct GLSampler
+{
+	GLSampler() : handle(0) {}
+
+	void init(GLenum minFilter, GLenum magFilter, GLenum wrap);
+
+	void destroy();
+
+	GLuint handle;
+};
+
+/*************************************************************************************************************************************************/
+
 class GLProgram
 {
 public:
@@ -53,12 +191,16 @@ public:
 
 	void init(GLShader a, GLShader b, GLShader c);
 
-	void destroy() { glDeleteProgram(handle_); }
+	void destroy() { GLResources::release(GLResourceType::Program, handle_); }
 
-	void use() const { glUseProgram(handle_); }
+	void use() const { GLState::useProgram(handle_); }
 
 	void setTexture(const std::string& name, int binding, unsigned int textureId, bool layered = false);
 
+	void setTexture(const std::string& name, int binding, unsigned int textureId, const GLSampler& sampler);
+
+	void setTextureCube(const std::string& name, int binding, unsigned int textureId);
+
 	void setInt(const std::string& name, int val);
 
 	void setFloat(const std::string& name, float val);
@@ -69,8 +211,16 @@ public:
 
 	void setVec4(const std::string& name, float* val);
 
+	void setIVec3(const std::string& name, int* val);
+
 	void setMat4(const std::string& name, float* data);
 
+	void setIntArray(const std::string& name, int* val, int count);
+
+	void setVec3Array(const std::string& name, float* val, int count);
+
+	void setMat4Array(const std::string& name, float* data, int count);
+
 	GLint getAttribLocation(const std::string& name) {
 		return glGetAttribLocation(handle_, name.c_str());
 	}
@@ -92,6 +242,9 @@ public:
 
 	void setTexture(int binding, uint32_t textureId, GLenum access, GLenum format, bool layered = false);
 
+	// Binds textureId to a texture unit for a sampler uniform, any target
+	void setSampler(const std::string& name, int binding, uint32_t textureId);
+
 	void setInt(const std::string& name, int val);
 
 	void setFloat(const std::string& name, float val);
@@ -102,11 +255,13 @@ public:
 
 	void setVec4(const std::string& name, float* val);
 
+	void setIVec3(const std::string& name, int* val);
+
 	void dispatch(uint32_t workGroupX, uint32_t workGroupY, uint32_t workGroupZ) const;
 
-	void use() const { glUseProgram(handle_); }
+	void use() const { GLState::useProgram(handle_); }
 
-	void destroy() const { glDeleteProgram(handle_); }
+	void destroy() const { GLResources::release(GLResourceType::Program, handle_); }
 private:
 	GLuint       handle_;
 };
@@ -120,7 +275,7 @@ struct GLBuffer
 	void init(void* data, uint32_t size, GLbitfield flags);
 
 	void destroy() {
-		glDeleteBuffers(1, &handle);
+		GLResources::release(GLResourceType::Buffer, handle);
 	}
 
 	GLuint handle;
@@ -143,6 +298,9 @@ struct TextureCreateInfo {
 	GLuint magFilterType = GL_LINEAR;
 };
 
+// Size of the texture including its mip chain
+uint64_t GetTextureBytes(const TextureCreateInfo& desc);
+
 inline void InitializeDepthTexture(TextureCreateInfo* createInfo,
 	uint32_t width,
 	uint32_t height) {
@@ -155,16 +313,19 @@ inline void InitializeDepthTexture(TextureCreateInfo* createInfo,
 	createInfo->dataType = GL_UNSIGNED_INT_24_8;
 }
 
+// Immutable storage, levels is fixed at creation. The mip chain is only generated
+// when data is given, textures rendered to later build their own.
 struct GLTexture {
 	void init(TextureCreateInfo* createInfo, void* data = nullptr);
 	void destroy() {
-		glDeleteTextures(1, &handle);
+		GLResources::release(GLResourceType::Texture, handle);
 	}
 
 	GLuint handle;
 	uint32_t width;
 	uint32_t height;
 	uint32_t depth;
+	uint32_t levels;
 	GLuint internalFormat;
 };
 
@@ -178,11 +339,11 @@ struct GLFramebuffer {
 	void init(const std::vector<Attachment>& attachments, TextureCreateInfo* depthAttachment);
 
 	void bind() {
-		glBindFramebuffer(GL_FRAMEBUFFER, handle);
+		GLState::bindFramebuffer(handle);
 	}
 
 	void unbind() {
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		GLState::bindFramebuffer(0);
 	}
 
 	void setViewport(uint32_t width, uint32_t height) {
@@ -102,6 +102,9 @@ namespace ImGuiService {
 
 	// https://gist.github.com/AidanSun05/953f1048ffe5699800d2c92b88c36d9f
 	void BeginDraw3DTex(const ImDrawList* parent_list, const ImDrawCmd* cmd) {
+		// The backend binds its own program, texture and buffers between callbacks
+		GLState::invalidate();
+
 		GLProgram& program = gState.draw3DTextureProgram;
 		program.use();
 
@@ -195,7 +198,8 @@ namespace ImGuiService {
 		ImGui_ImplGlfw_InitForOpenGL(window, true);
 		ImGui_ImplOpenGL3_Init();
 
-		// Initialize 3D Texture related resources
+		// Initialize 3D Texture related resources, the backend's own objects aren't tracked
+		GLResourceScope scope("ImGui");
 		Initialize3DTextureProgram();
 
 		uint32_t dataSize = sizeof(Vertex) * 6 * MAX_RECT_COUNT;
@@ -247,6 +251,7 @@ namespace ImGuiService {
 			ImGui::RenderPlatformWindowsDefault();
 			glfwMakeContextCurrent(backup_current_context);
 		}
+		GLState::invalidate();
 		gState.textureData.clear();
 	}
 
@@ -4,11 +4,15 @@
 #include <string>
 #include <assert.h>
 #include <iostream>
+#include <mutex>
 
 namespace logger {
 	static std::vector<std::string> gLogs;
+	// Image writers log from the thread pool
+	static std::mutex gLogMutex;
 
 	static void AddLog(const std::string& logLevel, const std::string& message) {
+		std::lock_guard<std::mutex> lock(gLogMutex);
 		gLogs.emplace_back(std::string{"[" + logLevel+ "]: " + message});
 		std::cout << "[" << logLevel << "]: " << message << std::endl;
 	}
@@ -2,10 +2,21 @@
 #include "imgui-service.h"
 #include "logger.h"
 #include "cloud-generator.h"
+#include "noise-generator/noise-generator.h"
 #include "debug-draw.h"
 #include "utils.h"
 #include "terrain.h"
 #include "camera.h"
+#include "regression/regression-harness.h"
+#include "sequence/sequence-renderer.h"
+#include "cpu-renderer/cpu-cloud-renderer.h"
+#include "cpu-renderer/ray-packet.h"
+#include "cpu-renderer/cloud-query.h"
+#include "thread-pool.h"
+#include "frame-graph.h"
+#include "dynamic-resolution.h"
+#include "replay/input-recording.h"
+#include "blue-noise.h"
 
 #include <iostream>
 
@@ -29,14 +40,17 @@ WindowProps gWindowProps = {
 	nullptr, 1360, 769
 };
 
+// Internal render resolution, fixed for the offline modes and the window size
+// times the dynamic resolution scale in the main loop
 uint32_t gFBOWidth = 1920;
 uint32_t gFBOHeight = 1080;
 
+// The render targets follow the window size, they are resized at the start of the next frame
 static void on_window_resize(GLFWwindow* window, int width, int height) {
 	gWindowProps.width = std::max(width, 2);
 	gWindowProps.height = std::max(height, 2);
 
-	gCamera.SetAspect(float(width) / float(height));
+	gCamera.SetAspect(float(gWindowProps.width) / float(gWindowProps.height));
 }
 
 static void on_key_press(GLFWwindow* window, int key, int scancode, int action, int mods) {
@@ -80,35 +94,239 @@ MessageCallback(GLenum source,
 		type, severity, message);
 }
 
-void MoveCamera(float dt) {
-	if (gWindowProps.mouseDown)
-		gCamera.Rotate(gWindowProps.mDy, -gWindowProps.mDx, dt);
+// Camera controls of this frame, kept apart from MoveCamera so that they can be recorded and replayed
+static CameraInput PollCameraInput() {
+	auto isDown = [](int key) { return glfwGetKey(gWindowProps.window, key) != GLFW_RELEASE; };
+
+	CameraInput input;
+	input.mouseDx = gWindowProps.mDx;
+	input.mouseDy = gWindowProps.mDy;
+	if (gWindowProps.mouseDown) input.buttons |= CAMERA_BUTTON_ROTATE;
+	if (isDown(GLFW_KEY_W)) input.buttons |= CAMERA_BUTTON_FORWARD;
+	if (isDown(GLFW_KEY_S)) input.buttons |= CAMERA_BUTTON_BACKWARD;
+	if (isDown(GLFW_KEY_A)) input.buttons |= CAMERA_BUTTON_LEFT;
+	if (isDown(GLFW_KEY_D)) input.buttons |= CAMERA_BUTTON_RIGHT;
+	if (isDown(GLFW_KEY_1)) input.buttons |= CAMERA_BUTTON_UP;
+	if (isDown(GLFW_KEY_2)) input.buttons |= CAMERA_BUTTON_DOWN;
+	if (isDown(GLFW_KEY_LEFT_SHIFT)) input.buttons |= CAMERA_BUTTON_FAST;
+	return input;
+}
+
+void MoveCamera(const CameraInput& input, float dt) {
+	if (input.buttons & CAMERA_BUTTON_ROTATE)
+		gCamera.Rotate(input.mouseDy, -input.mouseDx, dt);
 
 	float walkSpeed = dt * 10.0f;
-	if (glfwGetKey(gWindowProps.window, GLFW_KEY_LEFT_SHIFT) != GLFW_RELEASE)
+	if (input.buttons & CAMERA_BUTTON_FAST)
 		walkSpeed *= 4.0f;
 
-	if (glfwGetKey(gWindowProps.window, GLFW_KEY_W) != GLFW_RELEASE)
+	if (input.buttons & CAMERA_BUTTON_FORWARD)
 		gCamera.Walk(-walkSpeed);
-	else if (glfwGetKey(gWindowProps.window, GLFW_KEY_S) != GLFW_RELEASE)
+	else if (input.buttons & CAMERA_BUTTON_BACKWARD)
 		gCamera.Walk(walkSpeed);
 
-	if (glfwGetKey(gWindowProps.window, GLFW_KEY_A) != GLFW_RELEASE)
+	if (input.buttons & CAMERA_BUTTON_LEFT)
 		gCamera.Strafe(-walkSpeed);
-	else if (glfwGetKey(gWindowProps.window, GLFW_KEY_D) != GLFW_RELEASE)
+	else if (input.buttons & CAMERA_BUTTON_RIGHT)
 		gCamera.Strafe(walkSpeed);
 
-	if (glfwGetKey(gWindowProps.window, GLFW_KEY_1) != GLFW_RELEASE)
+	if (input.buttons & CAMERA_BUTTON_UP)
 		gCamera.Lift(walkSpeed);
-	else if (glfwGetKey(gWindowProps.window, GLFW_KEY_2) != GLFW_RELEASE)
+	else if (input.buttons & CAMERA_BUTTON_DOWN)
 		gCamera.Lift(-walkSpeed);
 
 }
 
-int main() {
+struct CpuRenderOptions {
+	uint32_t width = 960;
+	uint32_t height = 540;
+	uint32_t numWorkers = std::thread::hardware_concurrency();
+	std::string output = "cpu-render.png";
+	bool benchmark = false;
+};
+
+// Renders the default view on the CPU only, no window or GL context is created
+static int RunCpuRender(const CpuRenderOptions& options) {
+	ThreadPool pool(options.numWorkers);
+
+	NoiseParams tex1Params[4], tex2Params[3];
+	CloudGenerator::GetDefaultNoiseParams(tex1Params, tex2Params);
+
+	CpuCloudRenderer renderer;
+	renderer.Initialize(tex1Params, tex2Params, WeatherParams{}, &pool);
+
+	Camera camera;
+	camera.SetAspect(float(options.width) / float(options.height));
+	camera.SetPosition(glm::vec3(0.0f, 30.0f, -100.0f));
+	camera.SetRotation(glm::vec3(-0.3f, 0.0f, 0.0f));
+	camera.Update(0.0f);
+
+	CloudParams params;
+	std::vector<uint8_t> image;
+	CpuRenderStats stats = renderer.Render(params, camera, options.width, options.height, &pool, image);
+
+	char buffer[256];
+	snprintf(buffer, sizeof(buffer), "CPU render %ux%u in %.1fms, %.3f Mrays/s", options.width, options.height, stats.seconds * 1000.0, stats.raysPerSecond * 1e-6);
+	logger::Debug(buffer);
+	if (!Utils::WriteImage(options.output.c_str(), options.width, options.height, 4, image.data()))
+		return 1;
+
+	if (options.benchmark)
+		renderer.Benchmark(params, camera, options.width, options.height, pool.GetNumWorkers());
+	return 0;
+}
+
+// Times ray generation and box and shell intersection per ray against the packet versions, no GL needed
+static int RunRayBenchmark(const CpuRenderOptions& options) {
+	Camera camera;
+	camera.SetAspect(float(options.width) / float(options.height));
+	camera.SetPosition(glm::vec3(0.0f, 30.0f, -100.0f));
+	camera.SetRotation(glm::vec3(-0.3f, 0.0f, 0.0f));
+	camera.Update(0.0f);
+
+	RayPackets::Benchmark(camera, options.width, options.height, CloudParams{}.radius);
+	return 0;
+}
+
+// Times a million density, sun and line of sight queries against the default clouds, no GL needed
+static int RunQueryBenchmark(const CpuRenderOptions& options) {
+	ThreadPool pool(options.numWorkers);
+
+	NoiseParams tex1Params[4], tex2Params[3];
+	CloudGenerator::GetDefaultNoiseParams(tex1Params, tex2Params);
+	CloudModel model;
+	model.Initialize(tex1Params, tex2Params, WeatherParams{}, &pool);
+
+	CloudQuery query(&model, &pool);
+	query.Benchmark(CloudParams{}, 1u << 20);
+	return 0;
+}
+
+// Builds the terrain heightfield the way Terrain::Initialize() does and times ray queries against it, no GL needed
+static int RunTerrainBenchmark(const CpuRenderOptions& options) {
+	int texWidth, texHeight, nChannel;
+	float* heightData = Utils::LoadImageFloat("Textures/terrain-height.png", &texWidth, &texHeight, &nChannel);
+	if (heightData == nullptr) return 1;
+
+	TerrainHeightfield heightfield;
+	heightfield.Initialize(heightData, texWidth, texHeight, 1024, 1024);
+	Utils::FreeImage(heightData);
+
+	ThreadPool pool(options.numWorkers);
+	heightfield.Benchmark(1u << 20, &pool);
+	return 0;
+}
+
+// Generates the spatiotemporal blue noise the raymarch jitters with and writes its slices, no GL needed
+static int RunBlueNoise(const BlueNoiseParams& params, const CpuRenderOptions& options, const std::string& directory) {
+	ThreadPool pool(options.numWorkers);
+	std::vector<uint8_t> noise = BlueNoise::Generate(params, &pool);
+	return BlueNoise::Save(directory, params.size, params.numSlices, noise) ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+
+	// --regression renders the golden image comparison without showing a window and exits
+	bool runRegression = false;
+	RegressionOptions regressionOptions;
+	// --cpu-render renders a sky image without a GPU and exits
+	bool runCpuRender = false;
+	CpuRenderOptions cpuRenderOptions;
+	// --ray-benchmark compares per ray and packet ray generation at --width x --height and exits
+	bool runRayBenchmark = false;
+	// --query-benchmark measures the CPU cloud query throughput on --threads workers and exits
+	bool runQueryBenchmark = false;
+	// --terrain-benchmark measures terrain ray queries on 1 and --threads workers and exits
+	bool runTerrainBenchmark = false;
+	// --sequence renders the camera path to numbered frames without presenting and exits
+	bool runSequence = false;
+	SequenceOptions sequenceOptions;
+	// --record writes the input, dt and parameter changes of the session, --replay plays
+	// one back and exits, writing a CSV of frame timings when --timing-log is given
+	std::string recordFile, replayFile, timingLogFile;
+	// --fixed-dt steps the camera and clouds by a constant time instead of the frame time
+	float fixedDt = 0.0f;
+	// --blue-noise writes --blue-noise-size^2 x --blue-noise-slices blue noise to --blue-noise-dir on --threads workers and exits
+	bool runBlueNoise = false;
+	BlueNoiseParams blueNoiseParams;
+	std::string blueNoiseDir = BlueNoise::DEFAULT_DIRECTORY;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--regression")
+			runRegression = true;
+		else if (arg == "--update-references")
+			regressionOptions.updateReferences = true;
+		else if (arg == "--cpu-render")
+			runCpuRender = true;
+		else if (arg == "--ray-benchmark")
+			runRayBenchmark = true;
+		else if (arg == "--query-benchmark")
+			runQueryBenchmark = true;
+		else if (arg == "--terrain-benchmark")
+			runTerrainBenchmark = true;
+		else if (arg == "--cpu-benchmark")
+			cpuRenderOptions.benchmark = true;
+		else if (arg == "--width" && hasValue)
+			cpuRenderOptions.width = std::max(std::atoi(argv[++i]), 1);
+		else if (arg == "--height" && hasValue)
+			cpuRenderOptions.height = std::max(std::atoi(argv[++i]), 1);
+		else if (arg == "--threads" && hasValue)
+			cpuRenderOptions.numWorkers = std::max(std::atoi(argv[++i]), 1);
+		else if (arg == "--output" && hasValue)
+			cpuRenderOptions.output = argv[++i];
+		else if (arg == "--sequence")
+			runSequence = true;
+		else if (arg == "--camera-path" && hasValue)
+			sequenceOptions.cameraPath = argv[++i];
+		else if (arg == "--sequence-dir" && hasValue)
+			sequenceOptions.outputDir = argv[++i];
+		else if (arg == "--frames" && hasValue)
+			sequenceOptions.numFrames = std::max(std::atoi(argv[++i]), 0);
+		else if (arg == "--fps" && hasValue)
+			sequenceOptions.frameRate = std::max(float(std::atof(argv[++i])), 1.0f);
+		else if (arg == "--exr")
+			sequenceOptions.format = SequenceFormat::EXR;
+		else if (arg == "--encode-threads" && hasValue)
+			sequenceOptions.numEncodeThreads = std::max(std::atoi(argv[++i]), 0);
+		else if (arg == "--record" && hasValue)
+			recordFile = argv[++i];
+		else if (arg == "--replay" && hasValue)
+			replayFile = argv[++i];
+		else if (arg == "--timing-log" && hasValue)
+			timingLogFile = argv[++i];
+		else if (arg == "--fixed-dt" && hasValue)
+			fixedDt = std::max(float(std::atof(argv[++i])), 0.0f);
+		else if (arg == "--blue-noise")
+			runBlueNoise = true;
+		else if (arg == "--blue-noise-size" && hasValue)
+			blueNoiseParams.size = std::max(std::atoi(argv[++i]), 4);
+		else if (arg == "--blue-noise-slices" && hasValue)
+			blueNoiseParams.numSlices = std::max(std::atoi(argv[++i]), 1);
+		else if (arg == "--blue-noise-dir" && hasValue)
+			blueNoiseDir = argv[++i];
+	}
+
+	if (runCpuRender)
+		return RunCpuRender(cpuRenderOptions);
+
+	if (runRayBenchmark)
+		return RunRayBenchmark(cpuRenderOptions);
+
+	if (runQueryBenchmark)
+		return RunQueryBenchmark(cpuRenderOptions);
+
+	if (runTerrainBenchmark)
+		return RunTerrainBenchmark(cpuRenderOptions);
+
+	if (runBlueNoise)
+		return RunBlueNoise(blueNoiseParams, cpuRenderOptions, blueNoiseDir);
 
 	if(!glfwInit()) return 1;
 
+	if (runRegression || runSequence)
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
 	GLFWwindow* window = glfwCreateWindow(gWindowProps.width, gWindowProps.height, "Hello OpenGL", 0, 0);
 	gWindowProps.window = window;
 
@@ -148,14 +366,33 @@ int main() {
     ImGuiService::Initialize(window);
 
 	TextureCreateInfo colorAttachment = {gFBOWidth, gFBOHeight};
-	GLFramebuffer cloudFBO;
-	cloudFBO.init({ Attachment{0, &colorAttachment} }, nullptr);
-
 	TextureCreateInfo depthAttachment;
 	InitializeDepthTexture(&depthAttachment, gFBOWidth, gFBOHeight);
 
-	GLFramebuffer mainFBO;
-	mainFBO.init({ Attachment{ 0, &colorAttachment }}, &depthAttachment);
+	// The final image outlives the frame (UI, readback), everything else is transient
+	GLTexture cloudColor;
+	{
+		GLResourceScope scope("Render Targets");
+		cloudColor.init(&colorAttachment);
+	}
+	FrameGraph frameGraph;
+
+	// Transient targets pick the new size up from the descriptions, the pool
+	// frees the old ones once they have gone unused for a while
+	auto resizeTargets = [&](uint32_t width, uint32_t height) {
+		if (width == gFBOWidth && height == gFBOHeight)
+			return;
+		gFBOWidth = colorAttachment.width = depthAttachment.width = width;
+		gFBOHeight = colorAttachment.height = depthAttachment.height = height;
+		// The cached framebuffer would keep the old texture alive and could match
+		// the new one if its name is reused
+		frameGraph.ForgetTexture(cloudColor.handle);
+		// Released rather than deleted, the frames in flight may still sample it
+		cloudColor.destroy();
+		GLResourceScope scope("Render Targets");
+		cloudColor.init(&colorAttachment);
+	};
+	DynamicResolution dynamicResolution;
 
 	DebugDraw::Initialize();
 	NoiseGenerator::GetInstance()->Initialize();
@@ -170,10 +407,101 @@ int main() {
 
 	gCamera.SetPosition(glm::vec3(0.0f, 30.0f, -100.0f));
 
+	auto renderScene = [&](Camera* camera, float dt) {
+		frameGraph.Reset();
+		FrameGraphResource cloudTarget = frameGraph.ImportTexture("Cloud Color", cloudColor.handle, colorAttachment);
+
+		FrameGraphResource sceneColor, sceneDepth;
+		frameGraph.AddPass("Scene", [&](FrameGraphBuilder& builder) {
+			sceneColor = builder.Write(builder.CreateTexture("Scene Color", colorAttachment));
+			sceneDepth = builder.Write(builder.CreateTexture("Scene Depth", depthAttachment), ResourceUsage::DepthAttachment);
+		}, [&](const FrameGraph& graph) {
+			glClearColor(0.5f, 0.7f, 1.0f, 1.0f);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			CloudShadowInfo cloudShadow = cloudGenerator->GetCloudShadow();
+			terrain.Render(camera, &cloudShadow);
+			glm::mat4 VP = camera->GetProjectionMatrix() * camera->GetViewMatrix();
+			DebugDraw::Render(VP, glm::vec2(gFBOWidth, gFBOHeight));
+		});
+
+		frameGraph.AddPass("Clouds", [&](FrameGraphBuilder& builder) {
+			builder.Read(sceneColor);
+			builder.Read(sceneDepth);
+			builder.Write(cloudTarget);
+		}, [&](const FrameGraph& graph) {
+			glClearColor(0.5f, 0.7f, 1.0f, 1.0f);
+			glClear(GL_COLOR_BUFFER_BIT);
+			cloudGenerator->Render(camera, dt, graph.GetTexture(sceneDepth), graph.GetTexture(sceneColor));
+		});
+
+		frameGraph.Compile();
+		frameGraph.Execute();
+	};
+
+	int exitCode = 0;
+	if (runRegression) {
+		auto render = [&](Camera* camera) {
+			renderScene(camera, 1.0f / 60.0f);
+			return cloudColor.handle;
+		};
+		int numFailed = Regression::Run(cloudGenerator.get(), render, gFBOWidth, gFBOHeight, regressionOptions);
+		exitCode = numFailed > 0 ? 1 : 0;
+		glfwSetWindowShouldClose(window, true);
+	}
+	else if (runSequence) {
+		auto render = [&](Camera* camera, float dt) {
+			renderScene(camera, dt);
+			return cloudColor.handle;
+		};
+		exitCode = Sequence::Run(cloudGenerator.get(), render, gFBOWidth, gFBOHeight, sequenceOptions);
+		glfwSetWindowShouldClose(window, true);
+	}
+
+	InputRecorder recorder;
+	InputReplay replay;
+	FrameTimingLog timingLog;
+	bool replaying = false;
+	if (!replayFile.empty() && replay.Load(replayFile)) {
+		replay.Start(&gCamera);
+		replaying = true;
+		// Same resolution every run, the scale would otherwise follow the gpu time
+		dynamicResolution.GetSettings().enabled = false;
+		if (!timingLogFile.empty())
+			timingLog.Open(timingLogFile, { "dt", "frame_ms", "gpu_ms", "scene_ms", "clouds_ms", "cloud_render_ms" });
+	}
+	else if (!recordFile.empty())
+		recorder.Begin(recordFile, gCamera);
+
 	while (!glfwWindowShouldClose(window)) {
 		glfwPollEvents();
 
-		MoveCamera(dt);
+		float frameTime = dt;
+		CameraInput input = PollCameraInput();
+		if (fixedDt > 0.0f)
+			dt = fixedDt;
+
+		// Parameters are captured and applied before rendering, so the recorded state is the one each frame rendered with
+		if (replaying) {
+			RecordedParams params;
+			bool paramsChanged = false;
+			if (replay.NextFrame(&dt, &input, &params, &paramsChanged)) {
+				if (paramsChanged)
+					params.Apply(cloudGenerator.get());
+			}
+			else {
+				logger::Debug("Replay finished after " + std::to_string(replay.GetNumFrames()) + " frames");
+				timingLog.Close();
+				glfwSetWindowShouldClose(window, true);
+				break;
+			}
+		}
+		else if (recorder.IsRecording()) {
+			RecordedParams params;
+			params.Capture(cloudGenerator.get());
+			recorder.RecordFrame(dt, input, params);
+		}
+
+		MoveCamera(input, dt);
 
 		gCamera.Update(dt);
 
@@ -181,28 +509,26 @@ int main() {
 
 		ImGuiService::RenderDockSpace();
 
-		mainFBO.bind();
-		mainFBO.setClearColor(0.5f, 0.7f, 1.0f, 1.0f);
-		mainFBO.setViewport(gFBOWidth, gFBOHeight);
-		mainFBO.clear(true);
-		terrain.Render(&gCamera);
-		glm::mat4 VP = gCamera.GetProjectionMatrix() * gCamera.GetViewMatrix();
-		DebugDraw::Render(VP, glm::vec2(gFBOWidth, gFBOHeight));
-		mainFBO.unbind();
-
-		cloudFBO.bind();
-		cloudFBO.setClearColor(0.5f, 0.7f, 1.0f, 1.0f);
-		cloudFBO.setViewport(gFBOWidth, gFBOHeight);
-		cloudFBO.clear(true);
-		cloudGenerator->Render(&gCamera, dt, mainFBO.depthAttachment, mainFBO.attachments[0]);
-		cloudFBO.unbind();
+		uint32_t renderWidth, renderHeight;
+		dynamicResolution.GetRenderSize(gWindowProps.width, gWindowProps.height, &renderWidth, &renderHeight);
+		resizeTargets(renderWidth, renderHeight);
+
+		renderScene(&gCamera, dt);
+		dynamicResolution.Update(frameGraph.GetGpuTime());
+
+		// Gpu times are read a few frames late, by the same number of frames in every run
+		if (replaying) {
+			timingLog.Write(replay.GetFrameIndex() - 1, { dt * 1000.0f, frameTime * 1000.0f, frameGraph.GetGpuTime(),
+				frameGraph.GetPassTime("Scene"), frameGraph.GetPassTime("Clouds"), cloudGenerator->GetRenderTime() });
+		}
 
 		ImGui::Begin("MainWindow");
 		ImVec2 dims = ImGui::GetContentRegionAvail();
 		ImVec2 pos = ImGui::GetCursorScreenPos();
 
+		// Stretched over the panel, the linear filter upscales from the render resolution
 		ImGui::GetWindowDrawList()->AddImage(
-			(ImTextureID)(uint64_t)cloudFBO.attachments[0],
+			(ImTextureID)(uint64_t)cloudColor.handle,
 			ImVec2(pos.x, pos.y),
 			ImVec2(pos.x + dims.x, pos.y + dims.y),
 			ImVec2(0, 1),
@@ -217,11 +543,35 @@ int main() {
 
 		ImGui::Begin("Options");
 		cloudGenerator->AddUI();
+		if (ImGui::CollapsingHeader("Frame Graph"))
+			frameGraph.AddUI();
+		if (ImGui::CollapsingHeader("Resolution")) {
+			ImGui::Text("Render: %ux%u, Output: %dx%d", gFBOWidth, gFBOHeight, gWindowProps.width, gWindowProps.height);
+			dynamicResolution.AddUI();
+		}
+		if (ImGui::CollapsingHeader("GL State")) {
+			// Counts of the previous frame, ImGui's own binds aren't tracked
+			const GLStateStats& stats = GLState::getStats();
+			uint32_t totalIssued = 0, totalSkipped = 0;
+			for (uint32_t i = 0; i < uint32_t(GLStateCall::Count); ++i) {
+				ImGui::Text("%-14s issued %4u, skipped %4u", GLState::getCallName(GLStateCall(i)), stats.issued[i], stats.skipped[i]);
+				totalIssued += stats.issued[i];
+				totalSkipped += stats.skipped[i];
+			}
+			ImGui::Text("%-14s issued %4u, skipped %4u", "Total", totalIssued, totalSkipped);
+		}
+		if (ImGui::CollapsingHeader("GPU Memory")) {
+			ImGui::Text("Total %.1fMB, %u objects waiting to be deleted", GLResources::getTotalBytes() / (1024.0 * 1024.0), GLResources::getPendingCount());
+			for (const GLResourceCategory& category : GLResources::getCategories())
+				ImGui::BulletText("%s: %.2fMB (%u objects)", category.name.c_str(), category.bytes / (1024.0 * 1024.0), category.count);
+		}
 		ImGui::End();
 
 		ImGuiService::Render(window);
 
 		glfwSwapBuffers(window);
+		GLState::endFrame();
+		GLResources::endFrame();
 
 		float endTime = (float)glfwGetTime();
 		dt = endTime - startTime;
@@ -230,13 +580,22 @@ int main() {
 		gWindowProps.mDx = 0.0f;
 		gWindowProps.mDy = 0.0f;
 	}
+	recorder.End();
+	timingLog.Close();
+	frameGraph.Shutdown();
+	cloudColor.destroy();
+	cloudGenerator->Shutdown();
 	terrain.Shutdown();
 	DebugDraw::Shutdown();
 	NoiseGenerator::GetInstance()->Shutdown();
     ImGuiService::Shutdown();
 
+	GLResources::flush();
+	if (uint32_t numLeaks = GLResources::reportLeaks())
+		logger::Warn("GPU objects alive at shutdown: " + std::to_string(numLeaks));
+
 	glfwDestroyWindow(window);
 	glfwTerminate();
 
-	return 0;
+	return exitCode;
 }
\ No newline at end of file
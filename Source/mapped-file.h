@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Read only view of a whole file. The file is memory mapped, so pages are only
+// read from disk when they are first touched and can be dropped again by the OS.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+
+	~MappedFile() { Close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	void operator=(const MappedFile&) = delete;
+
+	bool Open(const char* filename);
+
+	void Close();
+
+	bool IsOpen() const { return mData != nullptr; }
+
+	const uint8_t* GetData() const { return mData; }
+	size_t GetSize() const { return mSize; }
+
+private:
+	const uint8_t* mData = nullptr;
+	size_t mSize = 0;
+#ifdef _WIN32
+	void* mFile = nullptr;
+	void* mMapping = nullptr;
+#else
+	int mFile = -1;
+#endif
+};
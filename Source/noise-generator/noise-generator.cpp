@@ -2,9 +2,15 @@
 
 #include "../gl-utils.h"
 #include "../glm-includes.h"
+#include "../logger.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
 
 void NoiseGenerator::Initialize()
 {
+	GLResourceScope scope("Noise Generator");
 	{
 		GLShader shader("Shaders/worley.comp");
 		mWorleyShader3D = std::make_unique<GLComputeProgram>();
@@ -15,6 +21,21 @@ void NoiseGenerator::Initialize()
 		mPerlinShader3D = std::make_unique<GLComputeProgram>();
 		mPerlinShader3D->init(shader);
 	}
+	{
+		GLShader shader("Shaders/worley-shared.comp");
+		mWorleySharedShader3D = std::make_unique<GLComputeProgram>();
+		mWorleySharedShader3D->init(shader);
+	}
+	{
+		GLShader shader("Shaders/perlin-shared.comp");
+		mPerlinSharedShader3D = std::make_unique<GLComputeProgram>();
+		mPerlinSharedShader3D->init(shader);
+	}
+	{
+		GLShader shader("Shaders/noise-fused.comp");
+		mFusedShader3D = std::make_unique<GLComputeProgram>();
+		mFusedShader3D->init(shader);
+	}
 
 }
 
@@ -22,18 +43,183 @@ void NoiseGenerator::Generate(const NoiseParams* params, const GLTexture* textur
 {
 	switch (params->noiseType) {
 	case NoiseType::Worley:
-		Generate(params, texture, mWorleyShader3D, channel);
+		Generate(params, texture, mUseSharedKernels ? mWorleySharedShader3D : mWorleyShader3D, channel);
 		break;
 	case NoiseType::Perlin:
-		Generate(params, texture, mPerlinShader3D, channel);
+		Generate(params, texture, mUseSharedKernels ? mPerlinSharedShader3D : mPerlinShader3D, channel);
 		break;
 	}
 }
 
+void NoiseGenerator::GenerateBatch(const NoiseParams* params, int numChannels, const GLTexture* texture)
+{
+	assert(texture != nullptr);
+
+	NoiseRegion region;
+	region.size = glm::ivec3(texture->width, texture->height, texture->depth);
+	region.tileSize = glm::vec3(region.size);
+	GenerateRegion(params, numChannels, texture, region);
+	UpdateMipmaps(texture);
+}
+
+void NoiseGenerator::GenerateRegion(const NoiseParams* params, int numChannels, const GLTexture* texture, const NoiseRegion& region)
+{
+	assert(params != nullptr);
+	assert(texture != nullptr);
+	assert(numChannels > 0 && numChannels <= 4);
+
+	mFusedShader3D->use();
+
+	for (int channel = 0; channel < numChannels; ++channel) {
+		const NoiseParams& channelParams = params[channel];
+		std::string index = "[" + std::to_string(channel) + "]";
+
+		glm::vec4 amp_freq_lac_per{ channelParams.amplitude, channelParams.frequency, channelParams.lacunarity, channelParams.persistence };
+		glm::vec3 offset = channelParams.offset;
+		mFusedShader3D->setVec4("uAmp_Freq_Lac_Per" + index, &amp_freq_lac_per[0]);
+		mFusedShader3D->setVec3("uOffset" + index, &offset[0]);
+		mFusedShader3D->setInt("uNumOctaves" + index, channelParams.numOctaves);
+		mFusedShader3D->setInt("uNoiseType" + index, static_cast<int>(channelParams.noiseType));
+	}
+	mFusedShader3D->setInt("uNumChannels", numChannels);
+
+	glm::vec3 tileSize = region.tileSize;
+	glm::vec3 sampleOrigin = region.sampleOrigin;
+	glm::ivec3 outputOffset = region.outputOffset;
+	glm::ivec3 outputSize = region.size;
+	glm::vec3 periodScale = region.periodScale;
+	mFusedShader3D->setVec3("uImageSize", &tileSize[0]);
+	mFusedShader3D->setVec3("uSampleOrigin", &sampleOrigin[0]);
+	mFusedShader3D->setFloat("uTexelStep", region.texelStep);
+	mFusedShader3D->setIVec3("uOutputOffset", &outputOffset[0]);
+	mFusedShader3D->setIVec3("uOutputSize", &outputSize[0]);
+	mFusedShader3D->setVec3("uPeriodScale", &periodScale[0]);
+
+	mFusedShader3D->setTexture(0, texture->handle, GL_WRITE_ONLY, texture->internalFormat, true);
+
+	uint32_t workGroupX = (region.size.x + 7) / 8;
+	uint32_t workGroupY = (region.size.y + 7) / 8;
+	uint32_t workGroupZ = (region.size.z + 7) / 8;
+	glDispatchCompute(workGroupX, workGroupY, workGroupZ);
+
+	// Later per channel edits read the image back, sampling happens in the raymarcher
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+}
+
+template<typename Fn>
+static float MeasureGpuTime(GLuint query, Fn&& fn)
+{
+	glBeginQuery(GL_TIME_ELAPSED, query);
+	fn();
+	glEndQuery(GL_TIME_ELAPSED);
+
+	uint64_t timeElapsed = 0;
+	glGetQueryObjectui64v(query, GL_QUERY_RESULT, &timeElapsed);
+	return timeElapsed * 0.000001f;
+}
+
+void NoiseGenerator::Benchmark()
+{
+	TextureCreateInfo createInfo = {
+		128, 128, 128, GL_RGBA,
+		GL_RGBA32F,
+		GL_TEXTURE_3D,
+		GL_FLOAT
+	};
+	createInfo.wrapType = GL_REPEAT;
+
+	GLResourceScope scope("Benchmark");
+	GLTexture reference, optimized;
+	reference.init(&createInfo);
+	optimized.init(&createInfo);
+
+	GLuint query;
+	glGenQueries(1, &query);
+
+	const uint32_t numTexel = createInfo.width * createInfo.height * createInfo.depth;
+	const GLsizei dataSize = static_cast<GLsizei>(numTexel * sizeof(glm::vec4));
+	std::vector<glm::vec4> referenceData(numTexel);
+	std::vector<glm::vec4> optimizedData(numTexel);
+
+	struct Kernel {
+		const char* name;
+		NoiseType type;
+		std::unique_ptr<GLComputeProgram>& referenceShader;
+		std::unique_ptr<GLComputeProgram>& sharedShader;
+	};
+	Kernel kernels[] = {
+		{ "Worley", NoiseType::Worley, mWorleyShader3D, mWorleySharedShader3D },
+		{ "Perlin", NoiseType::Perlin, mPerlinShader3D, mPerlinSharedShader3D },
+	};
+
+	logger::Debug("Noise kernel benchmark (128^3, reference vs shared)");
+	for (Kernel& kernel : kernels) {
+		for (int octaves = 1; octaves <= 8; ++octaves) {
+			NoiseParams params = { 0.5f, 8.0f, 2.0f, 0.5f, octaves, glm::vec3(1.4f, 1.593f, 1.539f), kernel.type };
+
+			// Warm up so that the first dispatch doesn't pay for the driver compiling the shader
+			Generate(&params, &reference, kernel.referenceShader, 0);
+			Generate(&params, &optimized, kernel.sharedShader, 0);
+
+			float referenceTime = MeasureGpuTime(query, [&]() { Generate(&params, &reference, kernel.referenceShader, 0); });
+			float sharedTime = MeasureGpuTime(query, [&]() { Generate(&params, &optimized, kernel.sharedShader, 0); });
+
+			glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+			glGetTextureImage(reference.handle, 0, GL_RGBA, GL_FLOAT, dataSize, referenceData.data());
+			glGetTextureImage(optimized.handle, 0, GL_RGBA, GL_FLOAT, dataSize, optimizedData.data());
+
+			float maxError = 0.0f;
+			for (uint32_t i = 0; i < numTexel; ++i)
+				maxError = std::max(maxError, std::abs(referenceData[i].x - optimizedData[i].x));
+
+			char buffer[256];
+			snprintf(buffer, sizeof(buffer), "%s octaves: %d reference: %.3fms shared: %.3fms speedup: %.2fx max error: %g",
+				kernel.name, octaves, referenceTime, sharedTime, referenceTime / std::max(sharedTime, 1e-6f), maxError);
+			logger::Debug(buffer);
+		}
+	}
+
+	// Full volume as created at startup, four passes with read-modify-write vs one fused dispatch
+	NoiseParams channelParams[4] = {
+		{ 1.0f, 1.0f, 1.0f, 0.5f, 7, glm::vec3(0.4f, 0.6, 0.5), NoiseType::Perlin },
+		{ 0.5f, 4.0f, 2.0f, 0.5f, 2, glm::vec3(1.4f, 1.593f, 1.539f) },
+		{ 0.5f, 8.0f, 2.0f, 0.5f, 4, glm::vec3(2.8f, 2.99f, 2.48f) },
+		{ 0.5f, 8.0f, 2.0f, 0.5f, 6, glm::vec3(4.8f, 5.f, 5.43f) },
+	};
+	GenerateBatch(channelParams, 4, &optimized);
+	float perChannelTime = MeasureGpuTime(query, [&]() {
+		for (int channel = 0; channel < 4; ++channel)
+			Generate(&channelParams[channel], &reference, channel);
+	});
+	float batchTime = MeasureGpuTime(query, [&]() { GenerateBatch(channelParams, 4, &optimized); });
+
+	glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+	glGetTextureImage(reference.handle, 0, GL_RGBA, GL_FLOAT, dataSize, referenceData.data());
+	glGetTextureImage(optimized.handle, 0, GL_RGBA, GL_FLOAT, dataSize, optimizedData.data());
+
+	float maxError = 0.0f;
+	for (uint32_t i = 0; i < numTexel; ++i) {
+		glm::vec4 diff = glm::abs(referenceData[i] - optimizedData[i]);
+		maxError = std::max(maxError, std::max(std::max(diff.x, diff.y), std::max(diff.z, diff.w)));
+	}
+
+	char buffer[256];
+	snprintf(buffer, sizeof(buffer), "4 channels per channel: %.3fms batched: %.3fms max error: %g",
+		perChannelTime, batchTime, maxError);
+	logger::Debug(buffer);
+
+	glDeleteQueries(1, &query);
+	reference.destroy();
+	optimized.destroy();
+}
+
 void NoiseGenerator::Shutdown()
 {
 	mWorleyShader3D->destroy();
 	mPerlinShader3D->destroy();
+	mWorleySharedShader3D->destroy();
+	mPerlinSharedShader3D->destroy();
+	mFusedShader3D->destroy();
 }
 
 void NoiseGenerator::Generate(const NoiseParams* params, const GLTexture* texture, std::unique_ptr<GLComputeProgram>& shader, int channel)
@@ -65,5 +251,13 @@ void NoiseGenerator::Generate(const NoiseParams* params, const GLTexture* textur
 	uint32_t workGroupZ = (texture->depth + 7) / 8;
 	glDispatchCompute(workGroupX, workGroupY, workGroupZ);
 
-	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+	UpdateMipmaps(texture);
+}
+
+void NoiseGenerator::UpdateMipmaps(const GLTexture* texture)
+{
+	// Only level 0 is written by the kernels, the rest of the chain is filtered from it
+	if (texture->levels > 1)
+		glGenerateTextureMipmap(texture->handle);
 }
@@ -1,28 +1,25 @@
 #pragma once
 
-#include "../glm-includes.h"
+#include "noise-params.h"
 
 #include <memory>
 
-enum class NoiseType {
-	Perlin = 0,
-	Worley
-};
-
-struct NoiseParams {
-	float amplitude;
-	float frequency;
-	float lacunarity;
-	float persistence;
-	int numOctaves;
-
-	glm::vec3 offset;
-	NoiseType noiseType = NoiseType::Worley;
-};
-
 struct GLTexture;
 class GLComputeProgram;
 
+// Box of a larger noise volume written into part of a texture by GenerateRegion().
+// Positions are in texels of a volume with tileSize texels per unit of noise space.
+struct NoiseRegion {
+	// Texel the first output texel is evaluated at, and the spacing between output texels
+	glm::vec3 sampleOrigin{ 0.0f };
+	float texelStep = 1.0f;
+	glm::ivec3 outputOffset{ 0 };
+	glm::ivec3 size{ 0 };
+	glm::vec3 tileSize{ 128.0f };
+	// Noise repeats every periodScale units per axis instead of every unit
+	glm::vec3 periodScale{ 1.0f };
+};
+
 class NoiseGenerator {
 
 public:
@@ -40,6 +37,27 @@ public:
 	// 0 - red, 1 - green, 2 - blue, 3 - alpha
 	void Generate(const NoiseParams* params, const GLTexture* texture, int channel = 0);
 
+	// Generates the first numChannels channels of the texture in a single write-only
+	// dispatch, params[i] and its noise type are used for channel i. Channels past
+	// numChannels are cleared to zero.
+	void GenerateBatch(const NoiseParams* params, int numChannels, const GLTexture* texture);
+
+	// GenerateBatch() for region.size texels at region.outputOffset of level 0, the
+	// rest of the texture and the mip chain are left alone
+	void GenerateRegion(const NoiseParams* params, int numChannels, const GLTexture* texture, const NoiseRegion& region);
+
+	// Selects the kernels that cache the hashed lattice in shared memory,
+	// the reference kernels are kept around for validation and benchmarking
+	void SetUseSharedKernels(bool useSharedKernels) { mUseSharedKernels = useSharedKernels; }
+	bool GetUseSharedKernels() const { return mUseSharedKernels; }
+
+	// Times the reference and shared memory kernels for every noise type and
+	// octave count on a 128^3 volume, and logs the max difference between them
+	void Benchmark();
+
+	// Filters the mip chain from level 0 after it has been written by regions
+	void UpdateMipmaps(const GLTexture* texture);
+
 	void Shutdown();
 private:
 
@@ -49,5 +67,9 @@ private:
 
 	std::unique_ptr<GLComputeProgram> mWorleyShader3D;
 	std::unique_ptr<GLComputeProgram> mPerlinShader3D;
+	std::unique_ptr<GLComputeProgram> mWorleySharedShader3D;
+	std::unique_ptr<GLComputeProgram> mPerlinSharedShader3D;
+	std::unique_ptr<GLComputeProgram> mFusedShader3D;
+	bool mUseSharedKernels = true;
 };
 	
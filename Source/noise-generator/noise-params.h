@@ -0,0 +1,19 @@
+#pragma once
+
+#include "../glm-includes.h"
+
+enum class NoiseType {
+	Perlin = 0,
+	Worley
+};
+
+struct NoiseParams {
+	float amplitude;
+	float frequency;
+	float lacunarity;
+	float persistence;
+	int numOctaves;
+
+	glm::vec3 offset;
+	NoiseType noiseType = NoiseType::Worley;
+};
\ No newline at end of file
@@ -0,0 +1,378 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include "virtual-noise-volume.h"
+
+#include "noise-generator.h"
+#include "../gl-utils.h"
+#include "../imgui-service.h"
+#include "../logger.h"
+
+#include <cstdio>
+#include <cstring>
+#include <functional>
+
+// Rounded down to a power of two, the domain can't have more levels than the shader knows about
+static uint32_t ClampPeriodScale(uint32_t periodScale)
+{
+	const uint32_t maxPeriod = (VirtualNoiseVolume::BRICK_SIZE << (VirtualNoiseVolume::MAX_LEVELS - 1)) / VirtualNoiseVolume::TILE_SIZE;
+	uint32_t period = 1;
+	while (period * 2 <= std::min(periodScale, maxPeriod)) period *= 2;
+	return period;
+}
+
+VirtualNoiseVolume::VirtualNoiseVolume() = default;
+
+VirtualNoiseVolume::~VirtualNoiseVolume() = default;
+
+void VirtualNoiseVolume::Initialize(NoiseGenerator* noiseGenerator, const NoiseParams* params, uint32_t periodScale, const glm::uvec3& atlasSlots)
+{
+	GLResourceScope scope("Virtual Noise");
+	mNoiseGenerator = noiseGenerator;
+	std::copy(params, params + 4, mParams);
+
+	// Slot coordinates are stored in 8 bits of the indirection
+	mAtlasSlots = glm::clamp(atlasSlots, glm::uvec3(1), glm::uvec3(255));
+	mStats.numSlots = mAtlasSlots.x * mAtlasSlots.y * mAtlasSlots.z;
+	assert(mStats.numSlots > 1);
+
+	TextureCreateInfo atlasInfo = {
+		mAtlasSlots.x * SLOT_SIZE, mAtlasSlots.y * SLOT_SIZE, mAtlasSlots.z * SLOT_SIZE,
+		GL_RGBA, GL_RGBA16F, GL_TEXTURE_3D, GL_FLOAT
+	};
+	mAtlas = std::make_unique<GLTexture>();
+	mAtlas->init(&atlasInfo);
+	mStats.atlasBytes = GetTextureBytes(atlasInfo);
+
+	mPeriodScale = ClampPeriodScale(periodScale);
+	CreateIndirection();
+	Reset();
+}
+
+void VirtualNoiseVolume::SetNoiseParams(const NoiseParams* params)
+{
+	std::copy(params, params + 4, mParams);
+	Reset();
+}
+
+void VirtualNoiseVolume::SetPeriodScale(uint32_t periodScale)
+{
+	periodScale = ClampPeriodScale(periodScale);
+	if (periodScale == mPeriodScale) return;
+
+	GLResourceScope scope("Virtual Noise");
+	mPeriodScale = periodScale;
+	DestroyIndirection();
+	CreateIndirection();
+	Reset();
+}
+
+void VirtualNoiseVolume::CreateIndirection()
+{
+	mDomainBricks = mPeriodScale * TILE_SIZE / BRICK_SIZE;
+	mNumLevels = 1;
+	while ((mDomainBricks >> (mNumLevels - 1)) > 1) mNumLevels++;
+
+	// Every level of the chain is one range of brick ids, finest first
+	mTotalBricks = 0;
+	for (uint32_t level = 0; level < mNumLevels; ++level) {
+		uint32_t n = GetBricksPerAxis(level);
+		mLevelOffsets[level] = mTotalBricks;
+		mTotalBricks += n * n * n;
+	}
+
+	// Storage for the whole chain, every level is written brick by brick
+	TextureCreateInfo indirectionInfo = {
+		mDomainBricks, mDomainBricks, mDomainBricks,
+		GL_RGBA_INTEGER, GL_RGBA8UI, GL_TEXTURE_3D, GL_UNSIGNED_BYTE
+	};
+	indirectionInfo.generateMipmap = true;
+	indirectionInfo.minFilterType = GL_NEAREST_MIPMAP_NEAREST;
+	indirectionInfo.magFilterType = GL_NEAREST;
+	mIndirection = std::make_unique<GLTexture>();
+	mIndirection->init(&indirectionInfo);
+
+	GLint alignment = 256;
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	mFeedbackWords = (mTotalBricks + 31) / 32;
+	mFeedbackStride = GLsizeiptr((mFeedbackWords * sizeof(uint32_t) + alignment - 1) / alignment * alignment);
+
+	GLbitfield flags = GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT | GL_MAP_READ_BIT | GL_MAP_WRITE_BIT;
+	GLsizeiptr size = mFeedbackStride * NUM_FRAMES;
+	mFeedback = std::make_unique<GLBuffer>();
+	mFeedback->init(nullptr, uint32_t(size), flags);
+	mFeedbackMapped = reinterpret_cast<uint32_t*>(glMapNamedBufferRange(mFeedback->handle, 0, size, flags));
+	memset(mFeedbackMapped, 0, size_t(size));
+	mFeedbackFrame = 0;
+}
+
+void VirtualNoiseVolume::DestroyIndirection()
+{
+	for (GLsync& fence : mFences) {
+		if (fence != nullptr) glDeleteSync(fence);
+		fence = nullptr;
+	}
+	// Released, not deleted, frames in flight may still write the feedback
+	glUnmapNamedBuffer(mFeedback->handle);
+	mFeedback->destroy();
+	mFeedbackMapped = nullptr;
+	mIndirection->destroy();
+}
+
+void VirtualNoiseVolume::Reset()
+{
+	for (uint32_t level = 0; level < mNumLevels; ++level)
+		glClearTexImage(mIndirection->handle, level, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+
+	mResident.clear();
+	mLRU.clear();
+	mSlots.assign(mStats.numSlots, Slot{});
+	mFreeSlots.clear();
+	for (uint32_t slot = mStats.numSlots - 1; slot > 0; --slot)
+		mFreeSlots.push_back(slot);
+
+	// Slot 0 is pinned to the top level, it covers the whole domain and is what every sample falls back to
+	MakeResident(mLevelOffsets[mNumLevels - 1], 0);
+	mStats.residentBricks = uint32_t(mResident.size());
+}
+
+void VirtualNoiseVolume::DecodeBrick(uint32_t brick, uint32_t& level, uint32_t& x, uint32_t& y, uint32_t& z) const
+{
+	level = mNumLevels - 1;
+	while (level > 0 && brick < mLevelOffsets[level]) level--;
+
+	uint32_t n = GetBricksPerAxis(level);
+	uint32_t local = brick - mLevelOffsets[level];
+	x = local % n;
+	y = (local / n) % n;
+	z = local / (n * n);
+}
+
+glm::uvec3 VirtualNoiseVolume::GetSlotOrigin(uint32_t slot) const
+{
+	glm::uvec3 coord(slot % mAtlasSlots.x, (slot / mAtlasSlots.x) % mAtlasSlots.y, slot / (mAtlasSlots.x * mAtlasSlots.y));
+	return coord * SLOT_SIZE;
+}
+
+std::string VirtualNoiseVolume::GetBrickPath(uint32_t brick) const
+{
+	uint32_t level, x, y, z;
+	DecodeBrick(brick, level, x, y, z);
+	char buffer[64];
+	snprintf(buffer, sizeof(buffer), "/L%u_%u_%u_%u.brick", level, x, y, z);
+	return mBrickDirectory + buffer;
+}
+
+void VirtualNoiseVolume::WriteIndirection(uint32_t brick, uint32_t slot, bool resident)
+{
+	uint32_t level, x, y, z;
+	DecodeBrick(brick, level, x, y, z);
+	glm::uvec3 coord = GetSlotOrigin(slot) / SLOT_SIZE;
+	uint8_t entry[4] = { uint8_t(coord.x), uint8_t(coord.y), uint8_t(coord.z), uint8_t(resident ? 1 : 0) };
+	glTextureSubImage3D(mIndirection->handle, level, x, y, z, 1, 1, 1, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, entry);
+}
+
+bool VirtualNoiseVolume::AcquireSlot(uint32_t& slot)
+{
+	if (!mFreeSlots.empty()) {
+		slot = mFreeSlots.back();
+		mFreeSlots.pop_back();
+	}
+	else {
+		if (mLRU.empty()) return false;
+		slot = mLRU.back();
+		// Still wanted, evicting it would only trade one missing brick for another
+		if (mSlots[slot].lastUsed == mFrame) return false;
+
+		mLRU.pop_back();
+		mResident.erase(mSlots[slot].brick);
+		WriteIndirection(mSlots[slot].brick, slot, false);
+		mStats.evictedBricks++;
+	}
+
+	mLRU.push_front(slot);
+	mSlots[slot].lru = mLRU.begin();
+	mSlots[slot].lastUsed = mFrame;
+	return true;
+}
+
+void VirtualNoiseVolume::MakeResident(uint32_t brick, uint32_t slot)
+{
+	if (LoadBrick(brick, slot))
+		mStats.loadedBricks++;
+	else {
+		GenerateBrick(brick, slot);
+		mStats.generatedBricks++;
+	}
+	mSlots[slot].brick = brick;
+	mResident[brick] = slot;
+	WriteIndirection(brick, slot, true);
+}
+
+bool VirtualNoiseVolume::LoadBrick(uint32_t brick, uint32_t slot)
+{
+	if (mBrickDirectory.empty()) return false;
+
+	std::string path = GetBrickPath(brick);
+	FILE* file = fopen(path.c_str(), "rb");
+	if (file == nullptr) return false;
+
+	std::vector<uint16_t> data(SLOT_SIZE * SLOT_SIZE * SLOT_SIZE * 4);
+	size_t numRead = fread(data.data(), sizeof(uint16_t), data.size(), file);
+	fclose(file);
+	if (numRead != data.size()) {
+		logger::Warn("VirtualNoiseVolume: truncated brick " + path);
+		return false;
+	}
+
+	glm::uvec3 origin = GetSlotOrigin(slot);
+	glTextureSubImage3D(mAtlas->handle, 0, origin.x, origin.y, origin.z, SLOT_SIZE, SLOT_SIZE, SLOT_SIZE, GL_RGBA, GL_HALF_FLOAT, data.data());
+	return true;
+}
+
+void VirtualNoiseVolume::GenerateBrick(uint32_t brick, uint32_t slot)
+{
+	uint32_t level, x, y, z;
+	DecodeBrick(brick, level, x, y, z);
+
+	// Texel i of a level is centered on level 0 texel (i + 0.5) * step - 0.5, the
+	// first texel of the slot is the border one before the brick
+	float step = float(1u << level);
+	glm::vec3 firstTexel = glm::vec3(float(x), float(y), float(z)) * float(BRICK_SIZE) - 1.0f;
+
+	NoiseRegion region;
+	region.sampleOrigin = (firstTexel + 0.5f) * step - 0.5f;
+	region.texelStep = step;
+	region.outputOffset = glm::ivec3(GetSlotOrigin(slot));
+	region.size = glm::ivec3(SLOT_SIZE);
+	region.tileSize = glm::vec3(float(TILE_SIZE));
+	region.periodScale = glm::vec3(float(mPeriodScale));
+	mNoiseGenerator->GenerateRegion(mParams, 4, mAtlas.get(), region);
+}
+
+void VirtualNoiseVolume::Update(uint32_t maxBricks)
+{
+	mStats.generatedBricks = mStats.loadedBricks = mStats.evictedBricks = 0;
+
+	// The region was last written NUM_FRAMES frames ago, wait until the gpu is done with it
+	GLsync& fence = mFences[mFeedbackFrame];
+	uint32_t* bits = mFeedbackMapped + mFeedbackStride / sizeof(uint32_t) * mFeedbackFrame;
+	if (fence != nullptr) {
+		GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		while (status == GL_TIMEOUT_EXPIRED)
+			status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+		glDeleteSync(fence);
+		fence = nullptr;
+
+		// Wanted bricks that are resident move to the front, the rest are requests
+		mRequests.clear();
+		uint32_t numRequested = 0;
+		for (uint32_t word = 0; word < mFeedbackWords; ++word) {
+			uint32_t value = bits[word];
+			if (value == 0) continue;
+			bits[word] = 0;
+			for (uint32_t bit = 0; bit < 32; ++bit) {
+				uint32_t brick = word * 32 + bit;
+				if ((value & (1u << bit)) == 0 || brick >= mTotalBricks) continue;
+				numRequested++;
+
+				auto it = mResident.find(brick);
+				if (it == mResident.end()) {
+					mRequests.push_back(brick);
+					continue;
+				}
+				Slot& slot = mSlots[it->second];
+				slot.lastUsed = mFrame;
+				if (it->second != 0)
+					mLRU.splice(mLRU.begin(), mLRU, slot.lru);
+			}
+		}
+		mStats.requestedBricks = numRequested;
+		mStats.missingBricks = uint32_t(mRequests.size());
+
+		// Coarse levels are the fallback of every finer brick under them, they go first
+		std::sort(mRequests.begin(), mRequests.end(), std::greater<uint32_t>());
+		uint32_t numBricks = std::min(maxBricks, uint32_t(mRequests.size()));
+		for (uint32_t i = 0; i < numBricks; ++i) {
+			uint32_t slot;
+			if (!AcquireSlot(slot)) break;
+			MakeResident(mRequests[i], slot);
+		}
+		mStats.residentBricks = uint32_t(mResident.size());
+	}
+
+	GLState::bindBufferRange(GL_SHADER_STORAGE_BUFFER, FEEDBACK_BINDING, mFeedback->handle,
+		mFeedbackStride * mFeedbackFrame, GLsizeiptr(mFeedbackWords * sizeof(uint32_t)));
+}
+
+void VirtualNoiseVolume::EndFrame()
+{
+	// Shader writes have to reach the mapping before the fence signals
+	glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+	mFences[mFeedbackFrame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	mFeedbackFrame = (mFeedbackFrame + 1) % NUM_FRAMES;
+	mFrame++;
+}
+
+void VirtualNoiseVolume::Bind(GLProgram* program, int indirectionUnit, int atlasUnit) const
+{
+	program->setTexture("uNoiseIndirection", indirectionUnit, mIndirection->handle);
+	program->setTexture("uNoiseAtlas", atlasUnit, mAtlas->handle);
+	program->setInt("uVirtualDomainBricks", int(mDomainBricks));
+	program->setInt("uVirtualLevels", int(mNumLevels));
+	int levelOffsets[MAX_LEVELS];
+	for (uint32_t level = 0; level < MAX_LEVELS; ++level)
+		levelOffsets[level] = int(mLevelOffsets[level]);
+	program->setIntArray("uVirtualLevelOffset", levelOffsets, int(MAX_LEVELS));
+}
+
+uint32_t VirtualNoiseVolume::SaveResidentBricks() const
+{
+	if (mBrickDirectory.empty()) {
+		logger::Warn("VirtualNoiseVolume: no brick directory to save to");
+		return 0;
+	}
+
+	glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+	std::vector<uint16_t> data(SLOT_SIZE * SLOT_SIZE * SLOT_SIZE * 4);
+	GLsizei dataSize = GLsizei(data.size() * sizeof(uint16_t));
+	uint32_t numSaved = 0;
+	for (const auto& entry : mResident) {
+		glm::uvec3 origin = GetSlotOrigin(entry.second);
+		glGetTextureSubImage(mAtlas->handle, 0, origin.x, origin.y, origin.z, SLOT_SIZE, SLOT_SIZE, SLOT_SIZE,
+			GL_RGBA, GL_HALF_FLOAT, dataSize, data.data());
+
+		std::string path = GetBrickPath(entry.first);
+		FILE* file = fopen(path.c_str(), "wb");
+		if (file == nullptr) {
+			logger::Warn("VirtualNoiseVolume: failed to write " + path);
+			continue;
+		}
+		fwrite(data.data(), sizeof(uint16_t), data.size(), file);
+		fclose(file);
+		numSaved++;
+	}
+
+	char buffer[256];
+	snprintf(buffer, sizeof(buffer), "VirtualNoiseVolume: saved %u bricks to %s", numSaved, mBrickDirectory.c_str());
+	logger::Debug(buffer);
+	return numSaved;
+}
+
+void VirtualNoiseVolume::AddUI()
+{
+	ImGui::Text("Domain: %u^3 tiles, %u levels, %u bricks", mPeriodScale, mNumLevels, mTotalBricks);
+	ImGui::Text("Resident: %u / %u slots (%.1fMB)", mStats.residentBricks, mStats.numSlots, mStats.atlasBytes / (1024.0 * 1024.0));
+	ImGui::Text("Requested: %u Missing: %u", mStats.requestedBricks, mStats.missingBricks);
+	ImGui::Text("Generated: %u Loaded: %u Evicted: %u", mStats.generatedBricks, mStats.loadedBricks, mStats.evictedBricks);
+
+	static char directory[256] = "";
+	if (ImGui::InputText("Brick Directory", directory, sizeof(directory)))
+		SetBrickDirectory(directory);
+	if (ImGui::Button("Save Resident Bricks"))
+		SaveResidentBricks();
+}
+
+void VirtualNoiseVolume::Shutdown()
+{
+	DestroyIndirection();
+	mAtlas->destroy();
+}
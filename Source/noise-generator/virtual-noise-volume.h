@@ -0,0 +1,159 @@
+#pragma once
+
+#include "noise-params.h"
+
+#include <algorithm>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#include <glad/glad.h>
+
+struct GLTexture;
+struct GLBuffer;
+class GLProgram;
+class NoiseGenerator;
+
+struct VirtualNoiseStats {
+	uint32_t residentBricks = 0;
+	uint32_t numSlots = 0;
+	// Bricks the last read feedback asked for, and how many of them weren't resident
+	uint32_t requestedBricks = 0;
+	uint32_t missingBricks = 0;
+	uint32_t generatedBricks = 0;
+	uint32_t loadedBricks = 0;
+	uint32_t evictedBricks = 0;
+	uint64_t atlasBytes = 0;
+};
+
+// Paged copy of the low frequency cloud noise over a domain of periodScale^3
+// tiles, so the pattern repeats every periodScale units instead of every unit.
+// The volume and its mip levels are split into 32^3 bricks, each stored with a
+// one texel border in a slot of a fixed size atlas, and a mipmapped indirection
+// texture maps every brick to its slot. The raymarch sets a bit for every brick
+// it wants; the bits are read back a few frames late, missing bricks are made
+// resident a few per frame, from disk when there is a file for them or
+// generated otherwise, and the least recently wanted ones are evicted. Memory
+// stays at the atlas size whatever the domain.
+class VirtualNoiseVolume
+{
+public:
+	VirtualNoiseVolume();
+
+	~VirtualNoiseVolume();
+
+	// 4 params like the first noise volume, periodScale is rounded down to a power
+	// of two up to 32. The default atlas holds 256 bricks in 80MB of RGBA16F.
+	void Initialize(NoiseGenerator* noiseGenerator, const NoiseParams* params, uint32_t periodScale,
+		const glm::uvec3& atlasSlots = glm::uvec3(8, 8, 4));
+
+	// Drops every brick, they are regenerated as they are asked for
+	void SetNoiseParams(const NoiseParams* params);
+
+	// Recreates the indirection for another domain size and drops every brick
+	void SetPeriodScale(uint32_t periodScale);
+	uint32_t GetPeriodScale() const { return mPeriodScale; }
+
+	// Bricks are loaded from <directory>/L<level>_<x>_<y>_<z>.brick when the file exists,
+	// the files are trusted to match the noise params. Empty turns loading off.
+	void SetBrickDirectory(const std::string& directory) { mBrickDirectory = directory; }
+
+	// Reads the feedback of the frame that last used this frame's region, makes up
+	// to maxBricks missing bricks resident and binds the cleared region for the draws
+	void Update(uint32_t maxBricks);
+
+	// After the last draw that samples the volume this frame
+	void EndFrame();
+
+	// Textures and uniforms SampleVirtualNoise() of raymarch.frag reads
+	void Bind(GLProgram* program, int indirectionUnit, int atlasUnit) const;
+
+	// Reads every resident brick back and writes it to the brick directory
+	uint32_t SaveResidentBricks() const;
+
+	const VirtualNoiseStats& GetStats() const { return mStats; }
+
+	void AddUI();
+
+	void Shutdown();
+
+	static const uint32_t BRICK_SIZE = 32;
+	// Brick with a one texel border on each side so filtering never reads a neighbour slot
+	static const uint32_t SLOT_SIZE = BRICK_SIZE + 2;
+	static const uint32_t TILE_SIZE = 128;
+	// Matches MAX_VIRTUAL_LEVELS of raymarch.frag
+	static const uint32_t MAX_LEVELS = 8;
+	// Frames the cpu may run ahead of the gpu, each one writes its own feedback region
+	static const uint32_t NUM_FRAMES = 3;
+	// Binding of the feedback buffer in raymarch.frag
+	static const uint32_t FEEDBACK_BINDING = 0;
+
+private:
+	struct Slot {
+		uint32_t brick = 0;
+		uint32_t lastUsed = 0;
+		std::list<uint32_t>::iterator lru;
+	};
+
+	void CreateIndirection();
+
+	void DestroyIndirection();
+
+	// Clears the indirection and the LRU, then makes the single top level brick resident
+	void Reset();
+
+	uint32_t GetBricksPerAxis(uint32_t level) const { return std::max(mDomainBricks >> level, 1u); }
+
+	void DecodeBrick(uint32_t brick, uint32_t& level, uint32_t& x, uint32_t& y, uint32_t& z) const;
+
+	// Free slot or the least recently used one that the last feedback didn't ask
+	// for, moved to the front of the LRU. Returns false when every slot is still wanted.
+	bool AcquireSlot(uint32_t& slot);
+
+	void MakeResident(uint32_t brick, uint32_t slot);
+
+	// Loads the brick from the directory, false when there is no file
+	bool LoadBrick(uint32_t brick, uint32_t slot);
+
+	void GenerateBrick(uint32_t brick, uint32_t slot);
+
+	void WriteIndirection(uint32_t brick, uint32_t slot, bool resident);
+
+	glm::uvec3 GetSlotOrigin(uint32_t slot) const;
+
+	std::string GetBrickPath(uint32_t brick) const;
+
+	NoiseGenerator* mNoiseGenerator = nullptr;
+	NoiseParams mParams[4];
+
+	uint32_t mPeriodScale = 1;
+	uint32_t mDomainBricks = 0;
+	uint32_t mNumLevels = 0;
+	uint32_t mLevelOffsets[MAX_LEVELS] = {};
+	uint32_t mTotalBricks = 0;
+
+	std::unique_ptr<GLTexture> mIndirection;
+	std::unique_ptr<GLTexture> mAtlas;
+	glm::uvec3 mAtlasSlots{ 0 };
+
+	// NUM_FRAMES regions of one bit per brick, persistently mapped
+	std::unique_ptr<GLBuffer> mFeedback;
+	uint32_t* mFeedbackMapped = nullptr;
+	uint32_t mFeedbackWords = 0;
+	GLsizeiptr mFeedbackStride = 0;
+	GLsync mFences[NUM_FRAMES] = {};
+	uint32_t mFeedbackFrame = 0;
+	uint32_t mFrame = 0;
+
+	std::vector<Slot> mSlots;
+	std::vector<uint32_t> mFreeSlots;
+	// Most recently wanted at the front, the pinned top level brick isn't in it
+	std::list<uint32_t> mLRU;
+	std::unordered_map<uint32_t, uint32_t> mResident;
+	std::vector<uint32_t> mRequests;
+
+	std::string mBrickDirectory;
+	VirtualNoiseStats mStats;
+};
@@ -0,0 +1,101 @@
+#include "image-compare.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace ImageCompare {
+
+	static int ColorChannels(int nChannel)
+	{
+		return std::min(nChannel, 3);
+	}
+
+	static std::vector<float> ToLuminance(const uint8_t* image, int width, int height, int nChannel)
+	{
+		std::vector<float> luminance(width * height);
+		for (int i = 0; i < width * height; ++i) {
+			const uint8_t* pixel = image + i * nChannel;
+			if (nChannel < 3)
+				luminance[i] = float(pixel[0]);
+			else
+				luminance[i] = 0.2126f * pixel[0] + 0.7152f * pixel[1] + 0.0722f * pixel[2];
+		}
+		return luminance;
+	}
+
+	ImageErrorMetrics Compare(const uint8_t* reference, const uint8_t* image, int width, int height, int nChannel)
+	{
+		ImageErrorMetrics metrics;
+		metrics.rmse = ComputeRMSE(reference, image, width, height, nChannel);
+		metrics.psnr = ComputePSNR(metrics.rmse);
+		metrics.ssim = ComputeSSIM(reference, image, width, height, nChannel);
+		return metrics;
+	}
+
+	float ComputeRMSE(const uint8_t* reference, const uint8_t* image, int width, int height, int nChannel)
+	{
+		int numChannel = ColorChannels(nChannel);
+		double sum = 0.0;
+		for (int i = 0; i < width * height; ++i) {
+			for (int c = 0; c < numChannel; ++c) {
+				double d = (double(reference[i * nChannel + c]) - double(image[i * nChannel + c])) / 255.0;
+				sum += d * d;
+			}
+		}
+		return float(std::sqrt(sum / double(width * height * numChannel)));
+	}
+
+	float ComputePSNR(float rmse)
+	{
+		if (rmse <= 0.0f) return MAX_PSNR;
+		return std::min(-20.0f * std::log10(rmse), MAX_PSNR);
+	}
+
+	// Windowed SSIM (Wang et al. 2004) with 8x8 box windows every 4 pixels
+	// instead of the 11x11 gaussian, close enough to rank render modes
+	float ComputeSSIM(const uint8_t* reference, const uint8_t* image, int width, int height, int nChannel)
+	{
+		const int windowSize = 8;
+		const int stride = 4;
+		const double C1 = (0.01 * 255.0) * (0.01 * 255.0);
+		const double C2 = (0.03 * 255.0) * (0.03 * 255.0);
+
+		if (width < windowSize || height < windowSize)
+			return ComputeRMSE(reference, image, width, height, nChannel) == 0.0f ? 1.0f : 0.0f;
+
+		std::vector<float> x = ToLuminance(reference, width, height, nChannel);
+		std::vector<float> y = ToLuminance(image, width, height, nChannel);
+
+		double ssimSum = 0.0;
+		int numWindows = 0;
+		const double n = double(windowSize * windowSize);
+		for (int wy = 0; wy + windowSize <= height; wy += stride) {
+			for (int wx = 0; wx + windowSize <= width; wx += stride) {
+				double sumX = 0.0, sumY = 0.0, sumXX = 0.0, sumYY = 0.0, sumXY = 0.0;
+				for (int j = 0; j < windowSize; ++j) {
+					const float* rowX = &x[(wy + j) * width + wx];
+					const float* rowY = &y[(wy + j) * width + wx];
+					for (int i = 0; i < windowSize; ++i) {
+						sumX += rowX[i];
+						sumY += rowY[i];
+						sumXX += rowX[i] * rowX[i];
+						sumYY += rowY[i] * rowY[i];
+						sumXY += rowX[i] * rowY[i];
+					}
+				}
+
+				double muX = sumX / n;
+				double muY = sumY / n;
+				double varX = std::max(sumXX / n - muX * muX, 0.0);
+				double varY = std::max(sumYY / n - muY * muY, 0.0);
+				double covXY = sumXY / n - muX * muY;
+
+				ssimSum += ((2.0 * muX * muY + C1) * (2.0 * covXY + C2)) /
+					((muX * muX + muY * muY + C1) * (varX + varY + C2));
+				numWindows++;
+			}
+		}
+		return float(ssimSum / double(numWindows));
+	}
+}
\ No newline at end of file
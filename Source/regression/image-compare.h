@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+struct ImageErrorMetrics {
+	// Over all color channels in the [0, 1] range
+	float rmse = 0.0f;
+	// In dB, capped at MAX_PSNR for identical images
+	float psnr = 0.0f;
+	// Mean structural similarity of the luminance, 1 for identical images
+	float ssim = 1.0f;
+};
+
+namespace ImageCompare {
+
+	constexpr float MAX_PSNR = 100.0f;
+
+	// Both images are 8 bit with nChannel interleaved channels, only the first
+	// three (or one for grayscale) are compared
+	ImageErrorMetrics Compare(const uint8_t* reference, const uint8_t* image, int width, int height, int nChannel);
+
+	float ComputeRMSE(const uint8_t* reference, const uint8_t* image, int width, int height, int nChannel);
+
+	float ComputePSNR(float rmse);
+
+	float ComputeSSIM(const uint8_t* reference, const uint8_t* image, int width, int height, int nChannel);
+}
\ No newline at end of file
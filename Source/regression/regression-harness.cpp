@@ -0,0 +1,178 @@
+#include "regression-harness.h"
+
+#include "image-compare.h"
+#include "../gl-utils.h"
+#include "../camera.h"
+#include "../logger.h"
+#include "../utils.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+
+namespace Regression {
+
+	std::vector<RegressionView> GetDefaultViews()
+	{
+		return {
+			{ "horizon", glm::vec3(0.0f, 30.0f, -100.0f), glm::vec3(-0.05f, 0.0f, 0.0f), glm::normalize(glm::vec3(0.3f, 0.8f, 0.5f)) },
+			{ "zenith", glm::vec3(0.0f, 30.0f, -100.0f), glm::vec3(-1.4f, 0.3f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f) },
+			{ "low-sun", glm::vec3(200.0f, 120.0f, 300.0f), glm::vec3(-0.4f, 2.2f, 0.0f), glm::normalize(glm::vec3(-0.9f, 0.15f, 0.4f)) },
+		};
+	}
+
+	std::vector<RegressionMode> GetDefaultModes()
+	{
+		std::vector<RegressionMode> modes;
+
+		// Everything that trades quality for speed is turned off or maxed out
+		RegressionMode reference{ "reference", CloudParams{}, 0.0f, 0.0f };
+		reference.params.raymarchSteps = 256;
+		reference.params.lightmarchSteps = 16;
+		reference.params.useLod = false;
+		reference.params.usePanorama = false;
+		modes.push_back(reference);
+
+		modes.push_back({ "default", CloudParams{}, 28.0f, 0.90f });
+
+		RegressionMode lowSteps{ "low-steps", CloudParams{}, 24.0f, 0.85f };
+		lowSteps.params.raymarchSteps = 16;
+		lowSteps.params.lightmarchSteps = 4;
+		modes.push_back(lowSteps);
+
+		RegressionMode noPanorama{ "no-panorama", CloudParams{}, 30.0f, 0.93f };
+		noPanorama.params.usePanorama = false;
+		modes.push_back(noPanorama);
+
+		RegressionMode lodBias{ "lod-bias", CloudParams{}, 26.0f, 0.88f };
+		lodBias.params.lodBias = 1.0f;
+		modes.push_back(lodBias);
+
+		return modes;
+	}
+
+	// Read back as RGBA8 and flipped so that the first row is the top of the image
+	static void ReadPixels(uint32_t texture, uint32_t width, uint32_t height, std::vector<uint8_t>& pixels)
+	{
+		uint32_t rowSize = width * 4;
+		pixels.resize(rowSize * height);
+		glGetTextureImage(texture, 0, GL_RGBA, GL_UNSIGNED_BYTE, static_cast<GLsizei>(pixels.size()), pixels.data());
+
+		for (uint32_t y = 0; y < height / 2; ++y)
+			std::swap_ranges(pixels.begin() + y * rowSize, pixels.begin() + (y + 1) * rowSize, pixels.begin() + (height - 1 - y) * rowSize);
+	}
+
+	// Returns the average gpu time of the timed frames in ms
+	static float RenderView(CloudGenerator* cloudGenerator, const RegressionRenderFn& render, const RegressionView& view, const RegressionMode& mode,
+		const RegressionOptions& options, uint32_t width, uint32_t height, std::vector<uint8_t>& pixels)
+	{
+		CloudParams params = mode.params;
+		params.lightDirection = view.lightDirection;
+		// The same blue noise slice every frame, so the result doesn't depend on the frame count
+		params.animateJitter = false;
+		cloudGenerator->SetParams(params);
+		cloudGenerator->ResetPanorama();
+
+		Camera camera;
+		camera.SetAspect(float(width) / float(height));
+		camera.SetPosition(view.position);
+		camera.SetRotation(view.rotation);
+		camera.Update(0.0f);
+
+		uint32_t texture = 0;
+		for (int i = 0; i < options.warmupFrames; ++i)
+			texture = render(&camera);
+
+		float totalTime = 0.0f;
+		for (int i = 0; i < options.timedFrames; ++i) {
+			texture = render(&camera);
+			totalTime += cloudGenerator->GetRenderTime();
+		}
+
+		ReadPixels(texture, width, height, pixels);
+		return options.timedFrames > 0 ? totalTime / float(options.timedFrames) : 0.0f;
+	}
+
+	static bool LoadReference(const std::string& filename, uint32_t width, uint32_t height, std::vector<uint8_t>& pixels)
+	{
+		if (!std::filesystem::exists(filename))
+			return false;
+
+		int imageWidth, imageHeight, nChannel;
+		unsigned char* image = Utils::LoadImage(filename.c_str(), &imageWidth, &imageHeight, &nChannel);
+		if (image == nullptr)
+			return false;
+
+		bool valid = uint32_t(imageWidth) == width && uint32_t(imageHeight) == height && nChannel == 4;
+		if (valid)
+			pixels.assign(image, image + width * height * 4);
+		else
+			logger::Warn("Reference " + filename + " doesn't match the render size, rendering it again");
+		Utils::FreeImage(image);
+		return valid;
+	}
+
+	int Run(CloudGenerator* cloudGenerator, const RegressionRenderFn& render, uint32_t width, uint32_t height, const RegressionOptions& options)
+	{
+		std::vector<RegressionView> views = GetDefaultViews();
+		std::vector<RegressionMode> modes = GetDefaultModes();
+		CloudParams userParams = cloudGenerator->GetParams();
+
+		std::filesystem::path outputDir(options.outputDir);
+		std::filesystem::create_directories(outputDir / modes[0].name);
+
+		std::ofstream report(outputDir / "report.csv");
+		report << "mode,view,time_ms,rmse,psnr,ssim,min_psnr,min_ssim,passed\n";
+
+		std::vector<std::vector<uint8_t>> references(views.size());
+		char buffer[256];
+		for (size_t v = 0; v < views.size(); ++v) {
+			std::string filename = (outputDir / modes[0].name / (views[v].name + ".png")).string();
+			if (!options.updateReferences && LoadReference(filename, width, height, references[v])) {
+				logger::Debug("Loaded reference " + filename);
+				continue;
+			}
+
+			float time = RenderView(cloudGenerator, render, views[v], modes[0], options, width, height, references[v]);
+			Utils::WriteImage(filename.c_str(), width, height, 4, references[v].data());
+
+			snprintf(buffer, sizeof(buffer), "%-12s %-10s %8.2fms", modes[0].name.c_str(), views[v].name.c_str(), time);
+			logger::Debug(buffer);
+			report << modes[0].name << "," << views[v].name << "," << time << ",0,0,1,0,0,1\n";
+		}
+
+		int numFailed = 0;
+		std::vector<uint8_t> pixels;
+		for (size_t m = 1; m < modes.size(); ++m) {
+			const RegressionMode& mode = modes[m];
+			std::filesystem::create_directories(outputDir / mode.name);
+
+			for (size_t v = 0; v < views.size(); ++v) {
+				float time = RenderView(cloudGenerator, render, views[v], mode, options, width, height, pixels);
+				std::string filename = (outputDir / mode.name / (views[v].name + ".png")).string();
+				Utils::WriteImage(filename.c_str(), width, height, 4, pixels.data());
+
+				ImageErrorMetrics error = ImageCompare::Compare(references[v].data(), pixels.data(), width, height, 4);
+				bool passed = error.psnr >= mode.minPSNR && error.ssim >= mode.minSSIM;
+				if (!passed) numFailed++;
+
+				snprintf(buffer, sizeof(buffer), "%-12s %-10s %8.2fms  RMSE %.4f  PSNR %6.2fdB (>= %.1f)  SSIM %.4f (>= %.3f)  %s",
+					mode.name.c_str(), views[v].name.c_str(), time, error.rmse, error.psnr, mode.minPSNR, error.ssim, mode.minSSIM, passed ? "PASS" : "FAIL");
+				if (passed)
+					logger::Debug(buffer);
+				else
+					logger::Warn(buffer);
+
+				report << mode.name << "," << views[v].name << "," << time << "," << error.rmse << "," << error.psnr << "," << error.ssim << ","
+					<< mode.minPSNR << "," << mode.minSSIM << "," << int(passed) << "\n";
+			}
+		}
+
+		cloudGenerator->SetParams(userParams);
+		cloudGenerator->ResetPanorama();
+
+		snprintf(buffer, sizeof(buffer), "Regression finished, %d of %d comparisons failed", numFailed, int((modes.size() - 1) * views.size()));
+		logger::Debug(buffer);
+		return numFailed;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "../cloud-generator.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+class Camera;
+
+// Fixed camera pose and sun direction the modes are compared at
+struct RegressionView {
+	std::string name;
+	glm::vec3 position;
+	glm::vec3 rotation;
+	glm::vec3 lightDirection;
+};
+
+// Cloud parameter set under test and the error it is allowed to have against the reference
+struct RegressionMode {
+	std::string name;
+	CloudParams params;
+	float minPSNR;
+	float minSSIM;
+};
+
+struct RegressionOptions {
+	std::string outputDir = "Regression";
+	// Re-render the references even if they already exist on disk
+	bool updateReferences = false;
+	// Frames rendered before the timed ones, the first one builds the panorama
+	int warmupFrames = 2;
+	int timedFrames = 8;
+};
+
+// Renders the scene for the camera and returns the color texture holding the final image
+using RegressionRenderFn = std::function<uint32_t(Camera* camera)>;
+
+namespace Regression {
+
+	std::vector<RegressionView> GetDefaultViews();
+
+	// The first entry is the reference the others are compared against
+	std::vector<RegressionMode> GetDefaultModes();
+
+	// Renders every mode at every view, writes the images and report.csv to
+	// the output directory and returns the number of comparisons that failed
+	int Run(CloudGenerator* cloudGenerator, const RegressionRenderFn& render, uint32_t width, uint32_t height, const RegressionOptions& options);
+}
\ No newline at end of file
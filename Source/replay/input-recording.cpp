@@ -0,0 +1,206 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include "input-recording.h"
+
+#include "../camera.h"
+#include "../logger.h"
+
+#include <cstring>
+
+static const char RECORDING_MAGIC[4] = { 'C', 'R', 'E', 'C' };
+static const uint32_t RECORDING_VERSION = 1;
+
+// Header: magic, version, sizeof(RecordedParams), camera position and rotation.
+// Frame: flags, dt, mouse dx and dy, buttons, then RecordedParams when FRAME_HAS_PARAMS is set.
+static const uint8_t FRAME_HAS_PARAMS = 1;
+
+void RecordedParams::Capture(const CloudGenerator* cloudGenerator)
+{
+	// Frames are compared with memcmp, the padding has to be the same every time
+	memset(static_cast<void*>(this), 0, sizeof(*this));
+	cloud = cloudGenerator->GetParams();
+	cloudGenerator->GetNoiseParams(tex1, tex2);
+	atmosphere = cloudGenerator->GetAtmosphereParams();
+	weather = cloudGenerator->GetWeatherMap()->GetParams();
+}
+
+void RecordedParams::Apply(CloudGenerator* cloudGenerator) const
+{
+	cloudGenerator->SetParams(cloud);
+	cloudGenerator->SetNoiseParams(tex1, tex2);
+	cloudGenerator->SetAtmosphereParams(atmosphere);
+	WeatherMap* weatherMap = cloudGenerator->GetWeatherMap();
+	if (memcmp(&weatherMap->GetParams(), &weather, sizeof(WeatherParams)) != 0)
+		weatherMap->Generate(weather);
+}
+
+/*****************************************************************************************************************************************/
+
+bool InputRecorder::Begin(const std::string& filename, const Camera& camera)
+{
+	End();
+	mFile = fopen(filename.c_str(), "wb");
+	if (mFile == nullptr) {
+		logger::Warn("Failed to open recording: " + filename);
+		return false;
+	}
+
+	uint32_t paramsSize = sizeof(RecordedParams);
+	glm::vec3 position = camera.GetPosition();
+	glm::vec3 rotation = camera.GetRotation();
+	fwrite(RECORDING_MAGIC, sizeof(RECORDING_MAGIC), 1, mFile);
+	fwrite(&RECORDING_VERSION, sizeof(RECORDING_VERSION), 1, mFile);
+	fwrite(&paramsSize, sizeof(paramsSize), 1, mFile);
+	fwrite(&position, sizeof(position), 1, mFile);
+	fwrite(&rotation, sizeof(rotation), 1, mFile);
+
+	mHasParams = false;
+	mNumFrames = 0;
+	mFilename = filename;
+	logger::Debug("Recording input to " + filename);
+	return true;
+}
+
+void InputRecorder::RecordFrame(float dt, const CameraInput& input, const RecordedParams& params)
+{
+	if (mFile == nullptr) return;
+
+	// The first frame always carries the parameters so a replay starts from the same state
+	bool changed = !mHasParams || memcmp(&params, &mLastParams, sizeof(RecordedParams)) != 0;
+	uint8_t flags = changed ? FRAME_HAS_PARAMS : 0;
+	uint8_t buttons = static_cast<uint8_t>(input.buttons);
+	fwrite(&flags, sizeof(flags), 1, mFile);
+	fwrite(&dt, sizeof(dt), 1, mFile);
+	fwrite(&input.mouseDx, sizeof(input.mouseDx), 1, mFile);
+	fwrite(&input.mouseDy, sizeof(input.mouseDy), 1, mFile);
+	fwrite(&buttons, sizeof(buttons), 1, mFile);
+	if (changed) {
+		fwrite(&params, sizeof(params), 1, mFile);
+		mLastParams = params;
+		mHasParams = true;
+	}
+	mNumFrames++;
+}
+
+void InputRecorder::End()
+{
+	if (mFile == nullptr) return;
+	fclose(mFile);
+	mFile = nullptr;
+
+	char buffer[256];
+	snprintf(buffer, sizeof(buffer), "Recorded %u frames to %s", mNumFrames, mFilename.c_str());
+	logger::Debug(buffer);
+}
+
+/*****************************************************************************************************************************************/
+
+bool InputReplay::Load(const std::string& filename)
+{
+	FILE* file = fopen(filename.c_str(), "rb");
+	if (file == nullptr) {
+		logger::Warn("Failed to open recording: " + filename);
+		return false;
+	}
+
+	char magic[4];
+	uint32_t version = 0, paramsSize = 0;
+	bool valid = fread(magic, sizeof(magic), 1, file) == 1 && memcmp(magic, RECORDING_MAGIC, sizeof(magic)) == 0 &&
+		fread(&version, sizeof(version), 1, file) == 1 && version == RECORDING_VERSION &&
+		fread(&paramsSize, sizeof(paramsSize), 1, file) == 1 &&
+		fread(&mStartPosition, sizeof(mStartPosition), 1, file) == 1 &&
+		fread(&mStartRotation, sizeof(mStartRotation), 1, file) == 1;
+	if (!valid) {
+		logger::Warn("Not a recording: " + filename);
+		fclose(file);
+		return false;
+	}
+	// The parameters are stored raw, a build with a different layout can't read them
+	if (paramsSize != sizeof(RecordedParams)) {
+		logger::Warn("Recording was made with different parameters: " + filename);
+		fclose(file);
+		return false;
+	}
+
+	mFrames.clear();
+	mParams.clear();
+	mFrame = 0;
+	for (;;) {
+		uint8_t flags, buttons;
+		Frame frame;
+		if (fread(&flags, sizeof(flags), 1, file) != 1 ||
+			fread(&frame.dt, sizeof(frame.dt), 1, file) != 1 ||
+			fread(&frame.input.mouseDx, sizeof(frame.input.mouseDx), 1, file) != 1 ||
+			fread(&frame.input.mouseDy, sizeof(frame.input.mouseDy), 1, file) != 1 ||
+			fread(&buttons, sizeof(buttons), 1, file) != 1)
+			break;
+		frame.input.buttons = buttons;
+		frame.params = -1;
+		if (flags & FRAME_HAS_PARAMS) {
+			RecordedParams params;
+			if (fread(&params, sizeof(params), 1, file) != 1)
+				break;
+			frame.params = static_cast<int32_t>(mParams.size());
+			mParams.push_back(params);
+		}
+		mFrames.push_back(frame);
+	}
+	fclose(file);
+
+	char buffer[256];
+	snprintf(buffer, sizeof(buffer), "Loaded recording %s: %u frames, %u parameter changes", filename.c_str(), GetNumFrames(), uint32_t(mParams.size()));
+	logger::Debug(buffer);
+	return !mFrames.empty();
+}
+
+void InputReplay::Start(Camera* camera)
+{
+	mFrame = 0;
+	camera->SetPosition(mStartPosition);
+	camera->SetRotation(mStartRotation);
+}
+
+bool InputReplay::NextFrame(float* dt, CameraInput* input, RecordedParams* params, bool* paramsChanged)
+{
+	if (mFrame >= mFrames.size()) return false;
+
+	const Frame& frame = mFrames[mFrame++];
+	*dt = frame.dt;
+	*input = frame.input;
+	*paramsChanged = frame.params >= 0;
+	if (*paramsChanged)
+		*params = mParams[frame.params];
+	return true;
+}
+
+/*****************************************************************************************************************************************/
+
+bool FrameTimingLog::Open(const std::string& filename, const std::vector<std::string>& columns)
+{
+	Close();
+	mFile = fopen(filename.c_str(), "w");
+	if (mFile == nullptr) {
+		logger::Warn("Failed to open timing log: " + filename);
+		return false;
+	}
+	fprintf(mFile, "frame");
+	for (const std::string& column : columns)
+		fprintf(mFile, ",%s", column.c_str());
+	fprintf(mFile, "\n");
+	return true;
+}
+
+void FrameTimingLog::Write(uint32_t frame, const std::vector<float>& values)
+{
+	if (mFile == nullptr) return;
+	fprintf(mFile, "%u", frame);
+	for (float value : values)
+		fprintf(mFile, ",%.4f", value);
+	fprintf(mFile, "\n");
+}
+
+void FrameTimingLog::Close()
+{
+	if (mFile == nullptr) return;
+	fclose(mFile);
+	mFile = nullptr;
+}
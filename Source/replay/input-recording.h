@@ -0,0 +1,113 @@
+#pragma once
+
+#include "../cloud-generator.h"
+#include "../weather-map.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+class Camera;
+
+enum CameraButton : uint32_t {
+	CAMERA_BUTTON_ROTATE = 1 << 0,
+	CAMERA_BUTTON_FORWARD = 1 << 1,
+	CAMERA_BUTTON_BACKWARD = 1 << 2,
+	CAMERA_BUTTON_LEFT = 1 << 3,
+	CAMERA_BUTTON_RIGHT = 1 << 4,
+	CAMERA_BUTTON_UP = 1 << 5,
+	CAMERA_BUTTON_DOWN = 1 << 6,
+	CAMERA_BUTTON_FAST = 1 << 7
+};
+
+// Camera controls of one frame, sampled from the window or read back from a recording
+struct CameraInput {
+	float mouseDx = 0.0f;
+	float mouseDy = 0.0f;
+	uint32_t buttons = 0;
+};
+
+// Everything the UI can change that affects what a frame renders or costs
+struct RecordedParams {
+	CloudParams cloud;
+	NoiseParams tex1[4];
+	NoiseParams tex2[3];
+	AtmosphereParams atmosphere;
+	WeatherParams weather;
+
+	void Capture(const CloudGenerator* cloudGenerator);
+
+	void Apply(CloudGenerator* cloudGenerator) const;
+};
+
+// Writes the camera start, the input and dt of every frame and the parameters
+// whenever they change to a binary file. Frames are 14 bytes unless the
+// parameters changed, which adds a full RecordedParams.
+class InputRecorder
+{
+public:
+	bool Begin(const std::string& filename, const Camera& camera);
+
+	void RecordFrame(float dt, const CameraInput& input, const RecordedParams& params);
+
+	void End();
+
+	bool IsRecording() const { return mFile != nullptr; }
+
+	~InputRecorder() { End(); }
+
+private:
+	FILE* mFile = nullptr;
+	RecordedParams mLastParams;
+	bool mHasParams = false;
+	uint32_t mNumFrames = 0;
+	std::string mFilename;
+};
+
+// Plays a recording back. The whole file is read up front and every frame steps
+// by its recorded dt, so the camera path and parameter changes don't depend on
+// how fast the replaying machine runs.
+class InputReplay
+{
+public:
+	bool Load(const std::string& filename);
+
+	// Puts the camera where the recording started
+	void Start(Camera* camera);
+
+	// False once every frame has been played. params is only set, and true
+	// returned in paramsChanged, on frames where the recording changed them.
+	bool NextFrame(float* dt, CameraInput* input, RecordedParams* params, bool* paramsChanged);
+
+	uint32_t GetFrameIndex() const { return mFrame; }
+	uint32_t GetNumFrames() const { return static_cast<uint32_t>(mFrames.size()); }
+
+private:
+	struct Frame {
+		float dt;
+		CameraInput input;
+		int32_t params;
+	};
+
+	glm::vec3 mStartPosition{ 0.0f };
+	glm::vec3 mStartRotation{ 0.0f };
+	std::vector<Frame> mFrames;
+	std::vector<RecordedParams> mParams;
+	uint32_t mFrame = 0;
+};
+
+// One CSV row of timings per replayed frame, so that runs of two builds can be diffed frame by frame
+class FrameTimingLog
+{
+public:
+	bool Open(const std::string& filename, const std::vector<std::string>& columns);
+
+	void Write(uint32_t frame, const std::vector<float>& values);
+
+	void Close();
+
+	~FrameTimingLog() { Close(); }
+
+private:
+	FILE* mFile = nullptr;
+};
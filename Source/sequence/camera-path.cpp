@@ -0,0 +1,84 @@
+#include "camera-path.h"
+
+#include "../logger.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+void CameraPath::AddKey(const CameraKey& key)
+{
+	auto it = std::upper_bound(mKeys.begin(), mKeys.end(), key.time, [](float time, const CameraKey& k) { return time < k.time; });
+	mKeys.insert(it, key);
+}
+
+bool CameraPath::Load(const std::string& filename)
+{
+	std::ifstream file(filename);
+	if (!file) {
+		logger::Warn("Failed to open camera path: " + filename);
+		return false;
+	}
+
+	mKeys.clear();
+	std::string line;
+	while (std::getline(file, line)) {
+		line = line.substr(0, line.find('#'));
+		std::istringstream stream(line);
+		CameraKey key;
+		if (stream >> key.time >> key.position.x >> key.position.y >> key.position.z >> key.rotation.x >> key.rotation.y >> key.rotation.z)
+			AddKey(key);
+	}
+
+	if (mKeys.empty()) {
+		logger::Warn("Camera path has no keys: " + filename);
+		return false;
+	}
+	return true;
+}
+
+static glm::vec3 CatmullRom(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3, float t)
+{
+	float t2 = t * t;
+	float t3 = t2 * t;
+	return 0.5f * ((2.0f * p1) + (p2 - p0) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 + (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+}
+
+void CameraPath::Evaluate(float time, glm::vec3& position, glm::vec3& rotation) const
+{
+	if (mKeys.empty()) {
+		position = rotation = glm::vec3(0.0f);
+		return;
+	}
+
+	if (time <= mKeys.front().time || mKeys.size() == 1) {
+		position = mKeys.front().position;
+		rotation = mKeys.front().rotation;
+		return;
+	}
+	if (time >= mKeys.back().time) {
+		position = mKeys.back().position;
+		rotation = mKeys.back().rotation;
+		return;
+	}
+
+	// Segment [i1, i2] contains time, the outer keys are repeated at the ends
+	size_t i2 = std::upper_bound(mKeys.begin(), mKeys.end(), time, [](float t, const CameraKey& k) { return t < k.time; }) - mKeys.begin();
+	size_t i1 = i2 - 1;
+	size_t i0 = i1 > 0 ? i1 - 1 : i1;
+	size_t i3 = std::min(i2 + 1, mKeys.size() - 1);
+
+	float t = (time - mKeys[i1].time) / std::max(mKeys[i2].time - mKeys[i1].time, 1e-6f);
+	position = CatmullRom(mKeys[i0].position, mKeys[i1].position, mKeys[i2].position, mKeys[i3].position, t);
+	rotation = CatmullRom(mKeys[i0].rotation, mKeys[i1].rotation, mKeys[i2].rotation, mKeys[i3].rotation, t);
+}
+
+CameraPath CameraPath::GetDefault()
+{
+	CameraPath path;
+	path.AddKey({ 0.0f, glm::vec3(0.0f, 30.0f, -100.0f), glm::vec3(-0.05f, 0.0f, 0.0f) });
+	path.AddKey({ 3.0f, glm::vec3(150.0f, 400.0f, 600.0f), glm::vec3(-0.3f, 0.6f, 0.0f) });
+	path.AddKey({ 6.0f, glm::vec3(600.0f, 1600.0f, 1400.0f), glm::vec3(-0.1f, 1.4f, 0.0f) });
+	path.AddKey({ 8.0f, glm::vec3(1200.0f, 2600.0f, 1800.0f), glm::vec3(0.2f, 2.2f, 0.0f) });
+	return path;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "../glm-includes.h"
+
+#include <string>
+#include <vector>
+
+// Camera pose at a point in time, rotation is (pitch, yaw, roll) like Camera::SetRotation
+struct CameraKey {
+	float time;
+	glm::vec3 position;
+	glm::vec3 rotation;
+};
+
+// Keyframed fly-through, evaluated with a Catmull-Rom spline through the keys
+class CameraPath
+{
+public:
+	void AddKey(const CameraKey& key);
+
+	// Text file with one "time px py pz pitch yaw roll" key per line, '#' starts a comment
+	bool Load(const std::string& filename);
+
+	// Clamped to the first and last key outside of the path
+	void Evaluate(float time, glm::vec3& position, glm::vec3& rotation) const;
+
+	float GetDuration() const { return mKeys.empty() ? 0.0f : mKeys.back().time; }
+
+	bool IsEmpty() const { return mKeys.empty(); }
+
+	// Climbs through the cloud layer while turning towards the sun
+	static CameraPath GetDefault();
+
+private:
+	std::vector<CameraKey> mKeys;
+};
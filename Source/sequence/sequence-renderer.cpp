@@ -0,0 +1,195 @@
+#include "sequence-renderer.h"
+
+#include "camera-path.h"
+#include "../cloud-generator.h"
+#include "../gl-utils.h"
+#include "../camera.h"
+#include "../logger.h"
+#include "../utils.h"
+#include "../thread-pool.h"
+
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <memory>
+
+namespace Sequence {
+
+	struct ReadbackSlot {
+		GLuint buffer = 0;
+		void* mapped = nullptr;
+		GLsync fence = nullptr;
+		uint32_t frame = 0;
+		// Set while an encoder thread reads from mapped
+		std::atomic<bool> encoding{ false };
+	};
+
+	struct SequenceStats {
+		double fenceWaitTime = 0.0;
+		double encoderWaitTime = 0.0;
+		uint32_t fenceStalls = 0;
+		uint32_t encoderStalls = 0;
+		std::atomic<uint32_t> numFailed{ 0 };
+	};
+
+	static std::string GetFrameFilename(const std::filesystem::path& outputDir, uint32_t frame, SequenceFormat format)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "frame_%05u.%s", frame, format == SequenceFormat::EXR ? "exr" : "png");
+		return (outputDir / name).string();
+	}
+
+	// Hands the slot to an encoder thread, the fence has to have signalled
+	static void Encode(ReadbackSlot& slot, ThreadPool& pool, const std::filesystem::path& outputDir, uint32_t width, uint32_t height,
+		SequenceFormat format, SequenceStats& stats)
+	{
+		glDeleteSync(slot.fence);
+		slot.fence = nullptr;
+		slot.encoding.store(true);
+
+		std::string filename = GetFrameFilename(outputDir, slot.frame, format);
+		pool.Submit([&slot, &stats, filename, width, height, format](uint32_t) {
+			bool written = format == SequenceFormat::EXR ?
+				Utils::WriteImageEXR(filename.c_str(), width, height, static_cast<const uint16_t*>(slot.mapped), true) :
+				Utils::WriteImage(filename.c_str(), width, height, 4, slot.mapped, true);
+			if (!written)
+				stats.numFailed.fetch_add(1);
+			slot.encoding.store(false, std::memory_order_release);
+		});
+	}
+
+	// Hands every slot whose copy has finished to the encoders, oldest first. With
+	// wait set the oldest in flight copy is waited for even if it isn't done yet.
+	static void RetireReadbacks(std::vector<std::unique_ptr<ReadbackSlot>>& slots, uint32_t nextFrame, bool wait, ThreadPool& pool,
+		const std::filesystem::path& outputDir, uint32_t width, uint32_t height, SequenceFormat format, SequenceStats& stats)
+	{
+		uint32_t numSlots = static_cast<uint32_t>(slots.size());
+		for (uint32_t frame = nextFrame > numSlots ? nextFrame - numSlots : 0; frame < nextFrame; ++frame) {
+			ReadbackSlot& slot = *slots[frame % numSlots];
+			if (slot.fence == nullptr || slot.frame != frame)
+				continue;
+
+			GLenum result = glClientWaitSync(slot.fence, 0, 0);
+			if (result == GL_TIMEOUT_EXPIRED && wait) {
+				double start = glfwGetTime();
+				result = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(10) * 1000000000);
+				stats.fenceWaitTime += glfwGetTime() - start;
+				stats.fenceStalls++;
+			}
+
+			// Copies finish in order, nothing after an unfinished one is done either
+			if (result == GL_TIMEOUT_EXPIRED || result == GL_WAIT_FAILED)
+				return;
+			Encode(slot, pool, outputDir, width, height, format, stats);
+			wait = false;
+		}
+	}
+
+	int Run(CloudGenerator* cloudGenerator, const SequenceRenderFn& render, uint32_t width, uint32_t height, const SequenceOptions& options)
+	{
+		CameraPath path;
+		if (options.cameraPath.empty() || !path.Load(options.cameraPath))
+			path = CameraPath::GetDefault();
+
+		float dt = 1.0f / options.frameRate;
+		uint32_t numFrames = options.numFrames > 0 ? options.numFrames : uint32_t(path.GetDuration() * options.frameRate) + 1;
+
+		std::filesystem::path outputDir(options.outputDir);
+		std::filesystem::create_directories(outputDir);
+
+		// EXR keeps the frames as half floats, the driver converts while copying
+		bool exr = options.format == SequenceFormat::EXR;
+		GLenum dataType = exr ? GL_HALF_FLOAT : GL_UNSIGNED_BYTE;
+		GLsizei frameSize = GLsizei(width) * height * 4 * (exr ? sizeof(uint16_t) : sizeof(uint8_t));
+
+		// Mapped once for the whole run, the encoders read straight out of the buffers
+		uint32_t numSlots = std::max(options.numReadbackBuffers, 1u);
+		std::vector<std::unique_ptr<ReadbackSlot>> slots(numSlots);
+		GLResources::pushCategory("Readback");
+		for (auto& slot : slots) {
+			slot = std::make_unique<ReadbackSlot>();
+			GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glCreateBuffers(1, &slot->buffer);
+			glNamedBufferStorage(slot->buffer, frameSize, nullptr, flags);
+			slot->mapped = glMapNamedBufferRange(slot->buffer, 0, frameSize, flags);
+			GLResources::track(GLResourceType::Buffer, slot->buffer, frameSize);
+		}
+		GLResources::popCategory();
+
+		// The calling thread is worker 0 and only renders
+		ThreadPool pool(options.numEncodeThreads + 1);
+		SequenceStats stats;
+
+		Camera camera;
+		camera.SetAspect(float(width) / float(height));
+
+		char buffer[256];
+		snprintf(buffer, sizeof(buffer), "Rendering %u frames at %ux%u to %s, %u readback buffers, %u encoder threads",
+			numFrames, width, height, outputDir.string().c_str(), numSlots, options.numEncodeThreads);
+		logger::Debug(buffer);
+
+		double gpuTime = 0.0;
+		double startTime = glfwGetTime();
+		for (uint32_t frame = 0; frame < numFrames; ++frame) {
+			ReadbackSlot& slot = *slots[frame % numSlots];
+
+			// Ring is full, the copy from numSlots frames ago has to finish first
+			while (slot.fence != nullptr)
+				RetireReadbacks(slots, frame, true, pool, outputDir, width, height, options.format, stats);
+
+			if (slot.encoding.load(std::memory_order_acquire)) {
+				double start = glfwGetTime();
+				while (slot.encoding.load(std::memory_order_acquire))
+					std::this_thread::yield();
+				stats.encoderWaitTime += glfwGetTime() - start;
+				stats.encoderStalls++;
+			}
+
+			glm::vec3 position, rotation;
+			path.Evaluate(frame * dt, position, rotation);
+			camera.SetPosition(position);
+			camera.SetRotation(rotation);
+			camera.Update(0.0f);
+
+			uint32_t texture = render(&camera, dt);
+			gpuTime += cloudGenerator->GetRenderTime();
+
+			GLState::bindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+			glGetTextureImage(texture, 0, GL_RGBA, dataType, frameSize, nullptr);
+			GLState::bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			slot.frame = frame;
+			glFlush();
+
+			RetireReadbacks(slots, frame + 1, false, pool, outputDir, width, height, options.format, stats);
+		}
+
+		double renderTime = glfwGetTime() - startTime;
+		while (std::any_of(slots.begin(), slots.end(), [](const auto& s) { return s->fence != nullptr; }))
+			RetireReadbacks(slots, numFrames, true, pool, outputDir, width, height, options.format, stats);
+		pool.Wait();
+		double totalTime = glfwGetTime() - startTime;
+
+		for (auto& slot : slots) {
+			glUnmapNamedBuffer(slot->buffer);
+			GLResources::release(GLResourceType::Buffer, slot->buffer);
+		}
+
+		// GetRenderTime() lags a frame behind, close enough over a whole sequence
+		snprintf(buffer, sizeof(buffer), "Sequence done: %u frames in %.2fs (%.2f fps), render loop %.2fs, cloud gpu time %.2fs",
+			numFrames, totalTime, numFrames / totalTime, renderTime, gpuTime * 0.001);
+		logger::Debug(buffer);
+		snprintf(buffer, sizeof(buffer), "Readback stalls %u (%.1fms), encoder stalls %u (%.1fms)",
+			stats.fenceStalls, stats.fenceWaitTime * 1000.0, stats.encoderStalls, stats.encoderWaitTime * 1000.0);
+		logger::Debug(buffer);
+
+		uint32_t numFailed = stats.numFailed.load();
+		if (numFailed > 0) {
+			snprintf(buffer, sizeof(buffer), "%u frames failed to write", numFailed);
+			logger::Warn(buffer);
+		}
+		return numFailed > 0 ? 1 : 0;
+	}
+}
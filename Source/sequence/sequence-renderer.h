@@ -0,0 +1,41 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <thread>
+#include <stdint.h>
+
+class Camera;
+class CloudGenerator;
+
+enum class SequenceFormat {
+	PNG,
+	EXR
+};
+
+struct SequenceOptions {
+	std::string outputDir = "Sequence";
+	// Keyframe file for CameraPath::Load, the default path is used when empty
+	std::string cameraPath;
+	SequenceFormat format = SequenceFormat::PNG;
+	// 0 renders the whole path
+	uint32_t numFrames = 0;
+	float frameRate = 30.0f;
+	// Frames in flight between the render and the cpu seeing the pixels
+	uint32_t numReadbackBuffers = 4;
+	uint32_t numEncodeThreads = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+};
+
+// Renders the scene for the camera and returns the color texture holding the final image
+using SequenceRenderFn = std::function<uint32_t(Camera* camera, float dt)>;
+
+namespace Sequence {
+
+	// Renders the camera path to numbered frames in the output directory without
+	// presenting. The images are copied into a ring of persistently mapped pixel
+	// buffers and fenced, and a frame is only handed to the encoder threads once
+	// its fence has signalled, so neither the gpu nor the render loop waits on
+	// readback or file I/O unless the ring is full. Returns 0 when every frame was written.
+	int Run(CloudGenerator* cloudGenerator, const SequenceRenderFn& render, uint32_t width, uint32_t height, const SequenceOptions& options);
+}
@@ -0,0 +1,297 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include "sparse-volume.h"
+
+#include "gl-utils.h"
+#include "imgui-service.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+static const uint32_t PAGE_SIZE = SparseVolume::CELL_BRICKS * SparseVolume::CELL_BRICKS * SparseVolume::CELL_BRICKS;
+// Voxels per axis, keeps the voxel and cell math of the loader and the shader inside int
+static const uint64_t MAX_GRID_VOXELS = 1u << 16;
+// Top level cells and pages together, 256MB of table
+static const uint64_t MAX_TABLE_ENTRIES = 1u << 26;
+
+static uint32_t GetIndex(const glm::ivec3& p, const glm::ivec3& size)
+{
+	return uint32_t((p.z * size.y + p.y) * size.x + p.x);
+}
+
+SparseVolume::SparseVolume() = default;
+
+SparseVolume::~SparseVolume() = default;
+
+bool SparseVolume::Load(const char* filename)
+{
+	Unload();
+
+	auto fail = [&](const char* reason) {
+		logger::Error(std::string("SparseVolume: ") + filename + ": " + reason);
+		mFile.Close();
+		mTable.clear();
+		return false;
+	};
+
+	if (!mFile.Open(filename))
+		return fail("can't open the file");
+	if (mFile.GetSize() < sizeof(SbmHeader))
+		return fail("truncated header");
+	memcpy(&mHeader, mFile.GetData(), sizeof(SbmHeader));
+	if (memcmp(mHeader.magic, "SBM1", 4) != 0 || mHeader.version != 1)
+		return fail("not a version 1 sparse brick map");
+	if (mHeader.brickSize == 0 || mHeader.brickSize > 64 || mHeader.gridSize[0] == 0 || mHeader.gridSize[1] == 0 || mHeader.gridSize[2] == 0)
+		return fail("bad brick or grid size");
+	for (int axis = 0; axis < 3; ++axis) {
+		if (uint64_t(mHeader.gridSize[axis]) * mHeader.brickSize > MAX_GRID_VOXELS)
+			return fail("grid too large");
+	}
+
+	uint64_t numBricks = mHeader.numBricks;
+	uint64_t brickVoxels = uint64_t(mHeader.brickSize) * mHeader.brickSize * mHeader.brickSize;
+	uint64_t expectedSize = sizeof(SbmHeader) + numBricks * 3 * sizeof(uint32_t) + numBricks * brickVoxels * sizeof(float);
+	if (mFile.GetSize() < expectedSize)
+		return fail("truncated brick data");
+
+	const uint8_t* data = mFile.GetData();
+	mCoords = reinterpret_cast<const uint32_t*>(data + sizeof(SbmHeader));
+	mDensity = reinterpret_cast<const float*>(data + sizeof(SbmHeader) + numBricks * 3 * sizeof(uint32_t));
+
+	// Roughly cubic atlas with a slot per brick, the 3D texture size limits the brick count
+	GLint maxTextureSize = 2048;
+	glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &maxTextureSize);
+	mSlotSize = mHeader.brickSize + 2;
+	uint32_t numSlots = std::max(mHeader.numBricks, 1u);
+	uint32_t side = uint32_t(std::ceil(std::cbrt(double(numSlots))));
+	mAtlasSlots = glm::uvec3(side, side, (numSlots + side * side - 1) / (side * side));
+	if (side * mSlotSize > uint32_t(maxTextureSize))
+		return fail("too many bricks for the atlas");
+
+	// Pages are only added for cells that have a brick, at most one per brick
+	mGridSize = glm::ivec3(mHeader.gridSize[0], mHeader.gridSize[1], mHeader.gridSize[2]);
+	mCellGrid = (mGridSize + int(CELL_BRICKS) - 1) / int(CELL_BRICKS);
+	uint64_t cellCount = uint64_t(mCellGrid.x) * uint64_t(mCellGrid.y) * uint64_t(mCellGrid.z);
+	if (cellCount + std::min(cellCount, numBricks) * PAGE_SIZE > MAX_TABLE_ENTRIES)
+		return fail("brick table too large");
+	uint32_t numCells = uint32_t(cellCount);
+	mTable.assign(numCells, 0u);
+	for (uint32_t i = 0; i < mHeader.numBricks; ++i) {
+		const uint32_t* coord = mCoords + i * 3;
+		if (coord[0] >= mHeader.gridSize[0] || coord[1] >= mHeader.gridSize[1] || coord[2] >= mHeader.gridSize[2])
+			return fail("brick outside of the grid");
+
+		glm::ivec3 brick(coord[0], coord[1], coord[2]);
+		glm::ivec3 cell = brick / int(CELL_BRICKS);
+		uint32_t cellIndex = GetIndex(cell, mCellGrid);
+		if (mTable[cellIndex] == 0) {
+			mTable[cellIndex] = uint32_t(mTable.size() - numCells) / PAGE_SIZE + 1;
+			mTable.insert(mTable.end(), PAGE_SIZE, EMPTY_SLOT);
+		}
+
+		uint32_t& entry = mTable[numCells + (mTable[cellIndex] - 1) * PAGE_SIZE + GetIndex(brick - cell * int(CELL_BRICKS), glm::ivec3(CELL_BRICKS))];
+		if (entry != EMPTY_SLOT)
+			return fail("duplicate brick");
+		entry = i;
+	}
+
+	GLResourceScope scope("Authored Volume");
+	TextureCreateInfo atlasInfo = {
+		mAtlasSlots.x * mSlotSize, mAtlasSlots.y * mSlotSize, mAtlasSlots.z * mSlotSize,
+		GL_RED, GL_R16F, GL_TEXTURE_3D, GL_FLOAT
+	};
+	mAtlas = std::make_unique<GLTexture>();
+	mAtlas->init(&atlasInfo);
+	// Bricks that haven't been streamed yet read as empty
+	glClearTexImage(mAtlas->handle, 0, GL_RED, GL_FLOAT, nullptr);
+
+	uint32_t tableBytes = uint32_t(mTable.size() * sizeof(uint32_t));
+	mTableBuffer = std::make_unique<GLBuffer>();
+	mTableBuffer->init(mTable.data(), tableBytes, 0);
+
+	mSlotData.resize(size_t(mSlotSize) * mSlotSize * mSlotSize);
+	mFilename = filename;
+
+	mStats = SparseVolumeStats{};
+	mStats.numBricks = mHeader.numBricks;
+	mStats.numCells = numCells;
+	mStats.occupiedCells = uint32_t(mTable.size() - numCells) / PAGE_SIZE;
+	mStats.atlasBytes = GetTextureBytes(atlasInfo);
+	mStats.tableBytes = tableBytes;
+	mStats.fileBytes = mFile.GetSize();
+
+	char buffer[512];
+	snprintf(buffer, sizeof(buffer), "SparseVolume: %s, %u bricks of %u^3 in a %dx%dx%d grid, %u of %u cells occupied",
+		filename, mHeader.numBricks, mHeader.brickSize, mGridSize.x, mGridSize.y, mGridSize.z, mStats.occupiedCells, numCells);
+	logger::Debug(buffer);
+	return true;
+}
+
+uint32_t SparseVolume::FindSlot(const glm::ivec3& brick) const
+{
+	glm::ivec3 cell = brick / int(CELL_BRICKS);
+	uint32_t page = mTable[GetIndex(cell, mCellGrid)];
+	if (page == 0) return EMPTY_SLOT;
+	uint32_t numCells = uint32_t(mCellGrid.x * mCellGrid.y * mCellGrid.z);
+	return mTable[numCells + (page - 1) * PAGE_SIZE + GetIndex(brick - cell * int(CELL_BRICKS), glm::ivec3(CELL_BRICKS))];
+}
+
+float SparseVolume::GetVoxel(const glm::ivec3& voxel) const
+{
+	const int brickSize = int(mHeader.brickSize);
+	glm::ivec3 numVoxels = mGridSize * brickSize;
+	if (voxel.x < 0 || voxel.y < 0 || voxel.z < 0 || voxel.x >= numVoxels.x || voxel.y >= numVoxels.y || voxel.z >= numVoxels.z)
+		return 0.0f;
+
+	glm::ivec3 brick = voxel / brickSize;
+	uint32_t slot = FindSlot(brick);
+	if (slot == EMPTY_SLOT) return 0.0f;
+
+	const float* density = mDensity + size_t(slot) * brickSize * brickSize * brickSize;
+	return density[GetIndex(voxel - brick * brickSize, glm::ivec3(brickSize))];
+}
+
+void SparseVolume::UploadBrick(uint32_t slot)
+{
+	const int brickSize = int(mHeader.brickSize);
+	const int slotSize = int(mSlotSize);
+	const uint32_t* coord = mCoords + slot * 3;
+	glm::ivec3 brickOrigin = glm::ivec3(coord[0], coord[1], coord[2]) * brickSize;
+	const float* density = mDensity + size_t(slot) * brickSize * brickSize * brickSize;
+
+	// The apron comes from the neighbours so that filtering across bricks is seamless
+	for (int z = 0; z < slotSize; ++z) {
+		for (int y = 0; y < slotSize; ++y) {
+			for (int x = 0; x < slotSize; ++x) {
+				glm::ivec3 local(x - 1, y - 1, z - 1);
+				bool inside = local.x >= 0 && local.y >= 0 && local.z >= 0 && local.x < brickSize && local.y < brickSize && local.z < brickSize;
+				float value = inside ? density[GetIndex(local, glm::ivec3(brickSize))] : GetVoxel(brickOrigin + local);
+				mSlotData[GetIndex(glm::ivec3(x, y, z), glm::ivec3(slotSize))] = value;
+			}
+		}
+	}
+
+	glm::uvec3 slotCoord(slot % mAtlasSlots.x, (slot / mAtlasSlots.x) % mAtlasSlots.y, slot / (mAtlasSlots.x * mAtlasSlots.y));
+	glm::uvec3 origin = slotCoord * mSlotSize;
+	glTextureSubImage3D(mAtlas->handle, 0, origin.x, origin.y, origin.z, slotSize, slotSize, slotSize, GL_RED, GL_FLOAT, mSlotData.data());
+}
+
+void SparseVolume::Update(uint32_t maxBricks)
+{
+	if (!mFile.IsOpen()) return;
+
+	uint32_t end = std::min(mStats.uploadedBricks + maxBricks, mStats.numBricks);
+	for (; mStats.uploadedBricks < end; ++mStats.uploadedBricks)
+		UploadBrick(mStats.uploadedBricks);
+
+	if (IsComplete()) {
+		mFile.Close();
+		mCoords = nullptr;
+		mDensity = nullptr;
+		logger::Debug("SparseVolume: " + mFilename + " streamed");
+	}
+}
+
+bool SparseVolume::WriteDense(const char* filename, const float* density, const glm::uvec3& size, uint32_t brickSize,
+	const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+	assert(brickSize > 0);
+	glm::uvec3 gridSize = (size + brickSize - 1u) / brickSize;
+
+	SbmHeader header = {};
+	memcpy(header.magic, "SBM1", 4);
+	header.version = 1;
+	header.brickSize = brickSize;
+	for (int i = 0; i < 3; ++i) {
+		header.gridSize[i] = gridSize[i];
+		header.boundsMin[i] = boundsMin[i];
+		// The grid is padded to whole bricks, the bounds grow with it
+		header.boundsMax[i] = boundsMin[i] + (boundsMax[i] - boundsMin[i]) * float(gridSize[i] * brickSize) / float(size[i]);
+	}
+
+	// Bricks without any density are left out
+	std::vector<uint32_t> coords;
+	std::vector<float> bricks;
+	std::vector<float> brick(size_t(brickSize) * brickSize * brickSize);
+	for (uint32_t bz = 0; bz < gridSize.z; ++bz) {
+		for (uint32_t by = 0; by < gridSize.y; ++by) {
+			for (uint32_t bx = 0; bx < gridSize.x; ++bx) {
+				bool occupied = false;
+				float* out = brick.data();
+				for (uint32_t z = bz * brickSize; z < (bz + 1) * brickSize; ++z) {
+					for (uint32_t y = by * brickSize; y < (by + 1) * brickSize; ++y) {
+						for (uint32_t x = bx * brickSize; x < (bx + 1) * brickSize; ++x) {
+							float value = x < size.x && y < size.y && z < size.z ? density[(size_t(z) * size.y + y) * size.x + x] : 0.0f;
+							occupied |= value > 0.0f;
+							*out++ = value;
+						}
+					}
+				}
+				if (!occupied) continue;
+				coords.insert(coords.end(), { bx, by, bz });
+				bricks.insert(bricks.end(), brick.begin(), brick.end());
+			}
+		}
+	}
+	header.numBricks = uint32_t(coords.size() / 3);
+
+	FILE* file = fopen(filename, "wb");
+	if (file == nullptr) {
+		logger::Error(std::string("SparseVolume: can't write ") + filename);
+		return false;
+	}
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(coords.data(), sizeof(uint32_t), coords.size(), file);
+	fwrite(bricks.data(), sizeof(float), bricks.size(), file);
+	fclose(file);
+	return true;
+}
+
+void SparseVolume::Bind(GLProgram* program, int atlasUnit, const glm::vec3& offset) const
+{
+	glm::vec3 boundsMin = glm::vec3(mHeader.boundsMin[0], mHeader.boundsMin[1], mHeader.boundsMin[2]) + offset;
+	glm::vec3 boundsMax = glm::vec3(mHeader.boundsMax[0], mHeader.boundsMax[1], mHeader.boundsMax[2]) + offset;
+	glm::ivec3 gridSize = mGridSize;
+	glm::ivec3 cellGrid = mCellGrid;
+	glm::ivec3 atlasSlots = glm::ivec3(mAtlasSlots);
+
+	program->setTexture("uAuthoredAtlas", atlasUnit, mAtlas->handle);
+	program->setVec3("uAuthoredMin", &boundsMin[0]);
+	program->setVec3("uAuthoredMax", &boundsMax[0]);
+	program->setIVec3("uAuthoredGrid", &gridSize[0]);
+	program->setIVec3("uAuthoredCellGrid", &cellGrid[0]);
+	program->setIVec3("uAuthoredAtlasSlots", &atlasSlots[0]);
+	program->setInt("uAuthoredBrickSize", int(mHeader.brickSize));
+	GLState::bindBufferRange(GL_SHADER_STORAGE_BUFFER, TABLE_BINDING, mTableBuffer->handle, 0, GLsizeiptr(mStats.tableBytes));
+}
+
+void SparseVolume::AddUI()
+{
+	if (!IsLoaded()) {
+		ImGui::Text("No volume loaded");
+		return;
+	}
+	ImGui::Text("%s", mFilename.c_str());
+	ImGui::Text("Bricks: %u / %u streamed (%u^3 voxels)", mStats.uploadedBricks, mStats.numBricks, mHeader.brickSize);
+	ImGui::Text("Cells: %u / %u occupied", mStats.occupiedCells, mStats.numCells);
+	ImGui::Text("Atlas: %.1fMB Table: %.1fKB", mStats.atlasBytes / (1024.0 * 1024.0), mStats.tableBytes / 1024.0);
+}
+
+void SparseVolume::Unload()
+{
+	mFile.Close();
+	mCoords = nullptr;
+	mDensity = nullptr;
+	mTable.clear();
+	if (mAtlas) {
+		mAtlas->destroy();
+		mAtlas.reset();
+	}
+	if (mTableBuffer) {
+		mTableBuffer->destroy();
+		mTableBuffer.reset();
+	}
+	mStats = SparseVolumeStats{};
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "glm-includes.h"
+#include "mapped-file.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+struct GLTexture;
+struct GLBuffer;
+class GLProgram;
+
+// .sbm sparse brick map, little endian:
+//   SbmHeader
+//   numBricks x uint32_t[3]           brick coordinates, in the order of the data
+//   numBricks x brickSize^3 float     density of every brick, x fastest
+// Bricks that aren't listed are empty. Voxel v of the gridSize * brickSize
+// voxels per axis is centered at (v + 0.5) / voxels of the world space bounds.
+struct SbmHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t brickSize;
+	uint32_t gridSize[3];
+	uint32_t numBricks;
+	float boundsMin[3];
+	float boundsMax[3];
+};
+
+struct SparseVolumeStats {
+	uint32_t numBricks = 0;
+	uint32_t uploadedBricks = 0;
+	uint32_t occupiedCells = 0;
+	uint32_t numCells = 0;
+	uint64_t atlasBytes = 0;
+	uint64_t tableBytes = 0;
+	uint64_t fileBytes = 0;
+};
+
+// Authored density volume for the raymarch. Only the bricks in the file are
+// stored, each with a one texel apron from its neighbours in a slot of an R16F
+// atlas. A top level grid of 4^3 brick cells points occupied cells at a page of
+// 64 slot indices, so empty space costs one entry per cell. The file stays
+// memory mapped while the bricks stream into the atlas a few per frame; bricks
+// that haven't arrived yet read as empty.
+class SparseVolume
+{
+public:
+	SparseVolume();
+
+	~SparseVolume();
+
+	// Maps the file, validates it and builds the tables, the bricks are uploaded by Update()
+	bool Load(const char* filename);
+
+	// Uploads up to maxBricks more bricks and closes the file after the last one
+	void Update(uint32_t maxBricks);
+
+	// Splits a dense grid of size voxels into bricks and writes the ones with any density
+	static bool WriteDense(const char* filename, const float* density, const glm::uvec3& size, uint32_t brickSize,
+		const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+
+	bool IsLoaded() const { return mAtlas != nullptr; }
+	bool IsComplete() const { return mStats.uploadedBricks == mStats.numBricks; }
+
+	// Atlas, brick table and the uniforms SampleAuthoredDensity() of raymarch.frag reads, offset moves the bounds
+	void Bind(GLProgram* program, int atlasUnit, const glm::vec3& offset) const;
+
+	const SparseVolumeStats& GetStats() const { return mStats; }
+
+	void AddUI();
+
+	void Unload();
+
+	// Bricks per side of a top level cell
+	static const uint32_t CELL_BRICKS = 4;
+	static const uint32_t EMPTY_SLOT = 0xffffffffu;
+	// Binding of the brick table in raymarch.frag
+	static const uint32_t TABLE_BINDING = 1;
+
+private:
+	// Slot of the brick, EMPTY_SLOT when it isn't in the file. Slots are in file order.
+	uint32_t FindSlot(const glm::ivec3& brick) const;
+
+	// Density of a voxel read from the mapped bricks, 0 outside of them
+	float GetVoxel(const glm::ivec3& voxel) const;
+
+	void UploadBrick(uint32_t slot);
+
+	MappedFile mFile;
+	SbmHeader mHeader = {};
+	const uint32_t* mCoords = nullptr;
+	const float* mDensity = nullptr;
+
+	glm::ivec3 mGridSize{ 0 };
+	glm::ivec3 mCellGrid{ 0 };
+	glm::uvec3 mAtlasSlots{ 0 };
+	uint32_t mSlotSize = 0;
+
+	// Top level cells, 0 for empty or 1 + page, followed by the pages of 64 slots
+	std::vector<uint32_t> mTable;
+	std::vector<float> mSlotData;
+
+	std::unique_ptr<GLTexture> mAtlas;
+	std::unique_ptr<GLBuffer> mTableBuffer;
+
+	std::string mFilename;
+	SparseVolumeStats mStats;
+};
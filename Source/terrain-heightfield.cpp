@@ -0,0 +1,288 @@
+#include "terrain-heightfield.h"
+
+#include "logger.h"
+#include "thread-pool.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <random>
+
+// Same scale as SampleHeight() in terrain.vert
+static const float HEIGHT_SCALE = 256.0f;
+
+// GL_LINEAR with GL_CLAMP_TO_EDGE, texel centers at (i + 0.5) / size
+static float SampleBilinear(const float* data, uint32_t width, uint32_t height, float u, float v)
+{
+	float x = u * width - 0.5f;
+	float y = v * height - 0.5f;
+	float fx = std::floor(x), fy = std::floor(y);
+	float tx = x - fx, ty = y - fy;
+
+	auto clampX = [width](int i) { return uint32_t(std::clamp(i, 0, int(width) - 1)); };
+	auto clampY = [height](int i) { return uint32_t(std::clamp(i, 0, int(height) - 1)); };
+	uint32_t x0 = clampX(int(fx)), x1 = clampX(int(fx) + 1);
+	uint32_t y0 = clampY(int(fy)), y1 = clampY(int(fy) + 1);
+
+	float a = glm::mix(data[y0 * width + x0], data[y0 * width + x1], tx);
+	float b = glm::mix(data[y1 * width + x0], data[y1 * width + x1], tx);
+	return glm::mix(a, b, ty);
+}
+
+void TerrainHeightfield::Initialize(const float* heightData, uint32_t texWidth, uint32_t texHeight, uint32_t meshWidth, uint32_t meshHeight)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	mWidth = meshWidth;
+	mHeight = meshHeight;
+	mTilesX = (meshWidth + TILE_SIZE - 1) / TILE_SIZE;
+	uint32_t tilesZ = (meshHeight + TILE_SIZE - 1) / TILE_SIZE;
+	mHeights.assign(size_t(mTilesX) * tilesZ * TILE_SIZE * TILE_SIZE, 0.0f);
+
+	// terrain.vert samples at position / terrain size
+	mMinHeight = FLT_MAX;
+	for (uint32_t z = 0; z < meshHeight; ++z) {
+		for (uint32_t x = 0; x < meshWidth; ++x) {
+			float h = SampleBilinear(heightData, texWidth, texHeight, float(x) / float(meshWidth), float(z) / float(meshHeight)) * HEIGHT_SCALE;
+			uint32_t tile = (z / TILE_SIZE) * mTilesX + x / TILE_SIZE;
+			mHeights[size_t(tile) * TILE_SIZE * TILE_SIZE + (z % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE] = h;
+			mMinHeight = std::min(mMinHeight, h);
+		}
+	}
+
+	uint32_t numCellsX = std::max(meshWidth, 2u) - 1;
+	uint32_t numCellsZ = std::max(meshHeight, 2u) - 1;
+	mGridSize = 1;
+	while (mGridSize < std::max(numCellsX, numCellsZ)) mGridSize *= 2;
+
+	mMaxMips.clear();
+	mMaxMips.emplace_back(size_t(mGridSize) * mGridSize, -FLT_MAX);
+	std::vector<float>& cells = mMaxMips.back();
+	for (uint32_t z = 0; z < numCellsZ; ++z) {
+		for (uint32_t x = 0; x < numCellsX; ++x) {
+			cells[z * mGridSize + x] = std::max(std::max(GetVertexHeight(x, z), GetVertexHeight(x + 1, z)),
+				std::max(GetVertexHeight(x, z + 1), GetVertexHeight(x + 1, z + 1)));
+		}
+	}
+
+	for (uint32_t size = mGridSize / 2; size > 0; size /= 2) {
+		const std::vector<float>& below = mMaxMips.back();
+		std::vector<float> level(size_t(size) * size);
+		for (uint32_t z = 0; z < size; ++z) {
+			for (uint32_t x = 0; x < size; ++x) {
+				const float* row0 = &below[(z * 2) * (size * 2) + x * 2];
+				const float* row1 = row0 + size * 2;
+				level[z * size + x] = std::max(std::max(row0[0], row0[1]), std::max(row1[0], row1[1]));
+			}
+		}
+		mMaxMips.push_back(std::move(level));
+	}
+
+	auto end = std::chrono::high_resolution_clock::now();
+	char buffer[128];
+	snprintf(buffer, sizeof(buffer), "Terrain heightfield %ux%u with %u quadtree levels built in %.1fms",
+		meshWidth, meshHeight, uint32_t(mMaxMips.size()), std::chrono::duration<double>(end - start).count() * 1000.0);
+	logger::Debug(buffer);
+}
+
+float TerrainHeightfield::GetVertexHeight(uint32_t x, uint32_t z) const
+{
+	uint32_t tile = (z / TILE_SIZE) * mTilesX + x / TILE_SIZE;
+	return mHeights[size_t(tile) * TILE_SIZE * TILE_SIZE + (z % TILE_SIZE) * TILE_SIZE + x % TILE_SIZE];
+}
+
+float TerrainHeightfield::GetHeight(float x, float z) const
+{
+	if (mHeights.empty()) return 0.0f;
+
+	// World to grid, Terrain::Render() translates by -size / 2
+	float gx = std::clamp(x + mWidth * 0.5f, 0.0f, float(mWidth - 1));
+	float gz = std::clamp(z + mHeight * 0.5f, 0.0f, float(mHeight - 1));
+	uint32_t cx = std::min(uint32_t(gx), std::max(mWidth, 2u) - 2);
+	uint32_t cz = std::min(uint32_t(gz), std::max(mHeight, 2u) - 2);
+	float fx = gx - cx, fz = gz - cz;
+
+	// The diagonal of a cell runs from (0, 1) to (1, 0)
+	float h1 = GetVertexHeight(cx + 1, cz);
+	float h2 = GetVertexHeight(cx, cz + 1);
+	if (fx + fz <= 1.0f) {
+		float h0 = GetVertexHeight(cx, cz);
+		return h0 + fx * (h1 - h0) + fz * (h2 - h0);
+	}
+	float h3 = GetVertexHeight(cx + 1, cz + 1);
+	return h3 + (1.0f - fx) * (h2 - h3) + (1.0f - fz) * (h1 - h3);
+}
+
+// Two sided Moller-Trumbore
+static bool RayTriangle(const glm::vec3& origin, const glm::vec3& direction, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, float& t)
+{
+	glm::vec3 e1 = v1 - v0;
+	glm::vec3 e2 = v2 - v0;
+	glm::vec3 p = glm::cross(direction, e2);
+	float det = glm::dot(e1, p);
+	if (std::abs(det) < 1e-12f) return false;
+
+	float invDet = 1.0f / det;
+	glm::vec3 s = origin - v0;
+	float u = glm::dot(s, p) * invDet;
+	if (u < 0.0f || u > 1.0f) return false;
+
+	glm::vec3 q = glm::cross(s, e1);
+	float v = glm::dot(direction, q) * invDet;
+	if (v < 0.0f || u + v > 1.0f) return false;
+
+	t = glm::dot(e2, q) * invDet;
+	return t >= 0.0f;
+}
+
+bool TerrainHeightfield::IntersectCell(const glm::vec3& origin, const glm::vec3& direction, uint32_t x, uint32_t z, float& t) const
+{
+	glm::vec3 p0(float(x), GetVertexHeight(x, z), float(z));
+	glm::vec3 p1(float(x + 1), GetVertexHeight(x + 1, z), float(z));
+	glm::vec3 p2(float(x), GetVertexHeight(x, z + 1), float(z + 1));
+	glm::vec3 p3(float(x + 1), GetVertexHeight(x + 1, z + 1), float(z + 1));
+
+	float tA, tB;
+	bool hitA = RayTriangle(origin, direction, p2, p1, p0, tA);
+	bool hitB = RayTriangle(origin, direction, p2, p3, p1, tB);
+	if (!hitA && !hitB) return false;
+	t = hitA && hitB ? std::min(tA, tB) : (hitA ? tA : tB);
+	return true;
+}
+
+static bool RayBox(const glm::vec3& origin, const glm::vec3& invDirection, const glm::vec3& min, const glm::vec3& max, float tMax)
+{
+	glm::vec3 t0 = (min - origin) * invDirection;
+	glm::vec3 t1 = (max - origin) * invDirection;
+	glm::vec3 tNear = glm::min(t0, t1);
+	glm::vec3 tFar = glm::max(t0, t1);
+	float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+	float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+	return enter <= exit;
+}
+
+bool TerrainHeightfield::Intersect(const Ray& ray, float tMax, TerrainHit& hit) const
+{
+	hit = TerrainHit{};
+	if (mMaxMips.empty()) return false;
+
+	glm::vec3 origin = ray.origin + glm::vec3(mWidth * 0.5f, 0.0f, mHeight * 0.5f);
+	const glm::vec3& direction = ray.direction;
+	glm::vec3 invDirection = 1.0f / direction;
+	float maxX = float(mWidth - 1), maxZ = float(mHeight - 1);
+
+	struct Node {
+		uint32_t level;
+		uint32_t x;
+		uint32_t z;
+	};
+	// Every level pops one node and pushes four
+	Node stack[96];
+	int top = 0;
+	stack[top++] = { uint32_t(mMaxMips.size() - 1), 0, 0 };
+
+	// Children are pushed far to near so the nearest one is visited first
+	uint32_t nearX = direction.x >= 0.0f ? 0 : 1;
+	uint32_t nearZ = direction.z >= 0.0f ? 0 : 1;
+
+	float best = tMax;
+	while (top > 0) {
+		Node node = stack[--top];
+		uint32_t levelSize = mGridSize >> node.level;
+		float maxHeight = mMaxMips[node.level][node.z * levelSize + node.x];
+		if (maxHeight == -FLT_MAX) continue;
+
+		float size = float(1u << node.level);
+		glm::vec3 boxMin(node.x * size, mMinHeight, node.z * size);
+		glm::vec3 boxMax(std::min(boxMin.x + size, maxX), maxHeight, std::min(boxMin.z + size, maxZ));
+		if (!RayBox(origin, invDirection, boxMin, boxMax, best)) continue;
+
+		if (node.level == 0) {
+			float t;
+			if (IntersectCell(origin, direction, node.x, node.z, t) && t <= best) {
+				best = t;
+				hit.hit = true;
+			}
+			continue;
+		}
+
+		uint32_t level = node.level - 1;
+		uint32_t x = node.x * 2, z = node.z * 2;
+		stack[top++] = { level, x + 1 - nearX, z + 1 - nearZ };
+		stack[top++] = { level, x + nearX, z + 1 - nearZ };
+		stack[top++] = { level, x + 1 - nearX, z + nearZ };
+		stack[top++] = { level, x + nearX, z + nearZ };
+	}
+
+	if (hit.hit) {
+		hit.t = best;
+		hit.position = ray.origin + ray.direction * best;
+	}
+	return hit.hit;
+}
+
+void TerrainHeightfield::Intersect(const Ray* rays, uint32_t count, float tMax, TerrainHit* hits, ThreadPool* pool) const
+{
+	if (pool == nullptr || count <= BATCH_SIZE) {
+		for (uint32_t i = 0; i < count; ++i)
+			Intersect(rays[i], tMax, hits[i]);
+		return;
+	}
+
+	uint32_t numBatches = (count + BATCH_SIZE - 1) / BATCH_SIZE;
+	pool->ParallelFor(numBatches, [&](uint32_t batch, uint32_t) {
+		uint32_t end = std::min((batch + 1) * BATCH_SIZE, count);
+		for (uint32_t i = batch * BATCH_SIZE; i < end; ++i)
+			Intersect(rays[i], tMax, hits[i]);
+	});
+}
+
+bool TerrainHeightfield::IsVisible(const glm::vec3& a, const glm::vec3& b) const
+{
+	// The direction isn't normalized, t = 1 is b. Endpoints lying on the surface don't block.
+	TerrainHit hit;
+	return !Intersect(Ray{ a, b - a }, 1.0f - 1e-4f, hit);
+}
+
+void TerrainHeightfield::Benchmark(uint32_t count, ThreadPool* pool) const
+{
+	// Rays from above the terrain looking down at anything from 6 to 90 degrees, grazing ones are the slow case
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> horizontal(-mWidth * 0.5f, mWidth * 0.5f);
+	std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+	std::uniform_real_distribution<float> down(0.1f, 1.0f);
+	std::vector<Ray> rays(count);
+	for (Ray& ray : rays) {
+		float x = horizontal(rng), z = horizontal(rng), a = angle(rng), y = down(rng);
+		float r = std::sqrt(1.0f - y * y);
+		ray.origin = glm::vec3(x, HEIGHT_SCALE + 20.0f, z);
+		ray.direction = glm::vec3(std::cos(a) * r, -y, std::sin(a) * r);
+	}
+	std::vector<TerrainHit> hits(count);
+
+	char buffer[256];
+	snprintf(buffer, sizeof(buffer), "Terrain ray benchmark, %u rays", count);
+	logger::Debug(buffer);
+
+	std::vector<ThreadPool*> pools = { nullptr };
+	if (pool != nullptr && pool->GetNumWorkers() > 1) pools.push_back(pool);
+	for (ThreadPool* p : pools) {
+		auto start = std::chrono::high_resolution_clock::now();
+		Intersect(rays.data(), count, FLT_MAX, hits.data(), p);
+		double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+		uint32_t numHits = uint32_t(std::count_if(hits.begin(), hits.end(), [](const TerrainHit& hit) { return hit.hit; }));
+		snprintf(buffer, sizeof(buffer), "  %2u workers: %8.2fms  %8.3f Mqueries/s  %u hits",
+			p != nullptr ? p->GetNumWorkers() : 1u, seconds * 1000.0, seconds > 0.0 ? count / seconds * 1e-6 : 0.0, numHits);
+		logger::Debug(buffer);
+	}
+
+	// The surface at the hit points should be where the rays ended
+	float maxError = 0.0f;
+	for (const TerrainHit& hit : hits) {
+		if (hit.hit)
+			maxError = std::max(maxError, std::abs(GetHeight(hit.position.x, hit.position.z) - hit.position.y));
+	}
+	snprintf(buffer, sizeof(buffer), "  largest height difference at the hits %.2e", maxError);
+	logger::Debug(buffer);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "glm-includes.h"
+#include "utils.h"
+
+#include <vector>
+#include <stdint.h>
+
+class ThreadPool;
+
+struct TerrainHit {
+	bool hit = false;
+	float t = 0.0f;
+	glm::vec3 position{ 0.0f };
+};
+
+// CPU copy of the terrain surface for picking, line of sight and collision.
+// Heights are taken at the mesh vertices the way terrain.vert samples the
+// height map (bilinear, * 256) and the surface is the same triangle grid,
+// centered on the origin like the model matrix of Terrain::Render(). Heights are
+// stored in 8x8 vertex tiles, and a max-mip quadtree over the grid cells lets a
+// ray skip every node it passes above.
+class TerrainHeightfield
+{
+public:
+	// heightData is the float image uploaded to the height texture, one channel
+	void Initialize(const float* heightData, uint32_t texWidth, uint32_t texHeight, uint32_t meshWidth, uint32_t meshHeight);
+
+	// Height of the surface at a world position, clamped to the edge outside the terrain
+	float GetHeight(float x, float z) const;
+
+	// Closest hit in [0, tMax], ray.direction doesn't have to be normalized
+	bool Intersect(const Ray& ray, float tMax, TerrainHit& hit) const;
+
+	// Intersect() for every ray, spread over the pool in batches when one is given
+	void Intersect(const Ray* rays, uint32_t count, float tMax, TerrainHit* hits, ThreadPool* pool = nullptr) const;
+
+	// True when the segment from a to b doesn't pass through the terrain
+	bool IsVisible(const glm::vec3& a, const glm::vec3& b) const;
+
+	// Casts count random rays from above the terrain on 1 and on every worker of pool and logs queries/sec
+	void Benchmark(uint32_t count, ThreadPool* pool) const;
+
+	bool IsEmpty() const { return mHeights.empty(); }
+
+	static const uint32_t TILE_SIZE = 8;
+	static const uint32_t BATCH_SIZE = 256;
+
+private:
+	float GetVertexHeight(uint32_t x, uint32_t z) const;
+
+	// Both triangles of a grid cell, as indexed in Terrain::Initialize()
+	bool IntersectCell(const glm::vec3& origin, const glm::vec3& direction, uint32_t x, uint32_t z, float& t) const;
+
+	uint32_t mWidth = 0;
+	uint32_t mHeight = 0;
+	uint32_t mTilesX = 0;
+	std::vector<float> mHeights;
+
+	// Level 0 holds the highest corner of every cell of a power of two grid,
+	// cells past the terrain are -FLT_MAX. Each level above halves the grid.
+	std::vector<std::vector<float>> mMaxMips;
+	uint32_t mGridSize = 0;
+	float mMinHeight = 0.0f;
+};
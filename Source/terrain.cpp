@@ -3,9 +3,11 @@
 #include "gl-utils.h"
 #include "utils.h"
 #include "camera.h"
+#include "cloud-generator.h"
 
 void Terrain::Initialize(uint32_t width, uint32_t height)
 {
+	GLResourceScope scope("Terrain");
 	mWidth = width;
 	mHeight = height;
 
@@ -39,7 +41,14 @@ void Terrain::Initialize(uint32_t width, uint32_t height)
 	mIBO->init(indices.data(), static_cast<uint32_t>(indices.size() * sizeof(uint32_t)), 0);
 	mNumIndices = static_cast<uint32_t>(indices.size());
 
-	glGenVertexArrays(1, &mVAO);
+	// Attribute layout and index buffer are recorded once, Render() only binds the VAO
+	glCreateVertexArrays(1, &mVAO);
+	GLResources::track(GLResourceType::VertexArray, mVAO);
+	glVertexArrayVertexBuffer(mVAO, 0, mVBO->handle, 0, sizeof(glm::vec2));
+	glVertexArrayElementBuffer(mVAO, mIBO->handle);
+	glEnableVertexArrayAttrib(mVAO, 0);
+	glVertexArrayAttribFormat(mVAO, 0, 2, GL_FLOAT, GL_FALSE, 0);
+	glVertexArrayAttribBinding(mVAO, 0, 0);
 	
 	GLShader vs("Shaders/terrain.vert");
 	GLShader fs("Shaders/terrain.frag");
@@ -53,6 +62,7 @@ void Terrain::Initialize(uint32_t width, uint32_t height)
 		TextureCreateInfo createInfo = { (uint32_t)texWidth, (uint32_t)texHeight, 1, GL_RED, GL_R16F, GL_TEXTURE_2D, GL_FLOAT };
 		mHeightTexture = std::make_unique<GLTexture>();
 		mHeightTexture->init(&createInfo, heightData);
+		mHeightfield.Initialize(heightData, texWidth, texHeight, width, height);
 		Utils::FreeImage(heightData);
 	}
 	{
@@ -65,7 +75,7 @@ void Terrain::Initialize(uint32_t width, uint32_t height)
 	}
 }
 
-void Terrain::Render(Camera* camera)
+void Terrain::Render(Camera* camera, const CloudShadowInfo* cloudShadow)
 {
 	glm::mat4 M = glm::translate(glm::mat4(1.0f), -glm::vec3(mWidth * 0.5f, 0.0f, mHeight * 0.5f));
 	glm::mat4 VP = camera->GetProjectionMatrix() * camera->GetViewMatrix() * M;
@@ -73,17 +83,23 @@ void Terrain::Render(Camera* camera)
 	mProgram->setTexture("uHeightMap", 0, mHeightTexture->handle);
 	mProgram->setTexture("uDiffuseMap", 1, mDiffuseTexture->handle);
 	mProgram->setMat4("uVP", &VP[0][0]);
+	mProgram->setMat4("uModel", &M[0][0]);
+
+	bool useCloudShadow = cloudShadow != nullptr && cloudShadow->texture != 0;
+	glm::vec3 lightDirection = useCloudShadow ? cloudShadow->lightDirection : glm::normalize(glm::vec3(0.1f, 0.5f, 0.1f));
+	mProgram->setVec3("uLightDirection", &lightDirection[0]);
+	mProgram->setInt("uUseCloudShadow", int(useCloudShadow));
+	if (useCloudShadow) {
+		mProgram->setTexture("uCloudShadowMap", 2, cloudShadow->texture);
+		mProgram->setFloat("uCloudShadowExtent", cloudShadow->extent);
+		mProgram->setFloat("uCloudShadowAbsorption", cloudShadow->absorption);
+		mProgram->setFloat("uCloudShadowStrength", cloudShadow->strength);
+	}
 
 	glm::vec2 invSize{ 1.0f / float(mWidth), 1.0f / float(mHeight) };
 	mProgram->setVec2("uInvTerrainSize", &invSize[0]);
 
-	glBindVertexArray(mVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, mVBO->handle);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIBO->handle);
-
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), 0);
-
+	GLState::bindVertexArray(mVAO);
 	glDrawElements(GL_TRIANGLES, mNumIndices, GL_UNSIGNED_INT, 0);
 }
 
@@ -93,5 +109,6 @@ void Terrain::Shutdown()
 	mDiffuseTexture->destroy();
 	mVBO->destroy();
 	mIBO->destroy();
+	GLResources::release(GLResourceType::VertexArray, mVAO);
 	mProgram->destroy();
 }
@@ -3,22 +3,28 @@
 #include <memory>
 
 #include "glm-includes.h"
+#include "terrain-heightfield.h"
 
 struct GLBuffer;
 class GLProgram;
 class GLComputeProgram;
 struct GLTexture;
 class Camera;
+struct CloudShadowInfo;
 
 class Terrain {
 
 public:
 	void Initialize(uint32_t width, uint32_t height);
 
-	void Render(Camera* camera);
+	// Lit by the shadow's light direction and darkened by the cloud shadow map when one is given
+	void Render(Camera* camera, const CloudShadowInfo* cloudShadow = nullptr);
 
 	void Shutdown();
 
+	// CPU copy of the rendered surface, in world space
+	const TerrainHeightfield& GetHeightfield() const { return mHeightfield; }
+
 private:
 	std::unique_ptr<GLBuffer> mVBO;
 	std::unique_ptr<GLBuffer> mIBO;
@@ -28,6 +34,8 @@ private:
 	std::unique_ptr<GLTexture> mHeightTexture;
 	std::unique_ptr<GLTexture> mDiffuseTexture;
 
+	TerrainHeightfield mHeightfield;
+
 	uint32_t mWidth, mHeight;
 	uint32_t mNumIndices;
 };
\ No newline at end of file
@@ -0,0 +1,144 @@
+#include "thread-pool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(uint32_t numWorkers)
+{
+	numWorkers = std::max(numWorkers, 1u);
+	for (uint32_t i = 0; i < numWorkers; ++i)
+		mQueues.push_back(std::make_unique<WorkQueue>());
+
+	// Queue 0 belongs to the calling thread
+	for (uint32_t i = 1; i < numWorkers; ++i)
+		mThreads.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mWakeMutex);
+		mRunning = false;
+	}
+	mWakeCondition.notify_all();
+
+	for (auto& thread : mThreads)
+		thread.join();
+}
+
+void ThreadPool::ParallelFor(uint32_t count, const std::function<void(uint32_t index, uint32_t worker)>& fn)
+{
+	if (count == 0) return;
+
+	std::atomic<uint32_t> remaining{ count };
+	uint32_t numWorkers = GetNumWorkers();
+
+	// Counted before they are queued so the counter can't wrap when a worker pops one early
+	{
+		std::lock_guard<std::mutex> lock(mWakeMutex);
+		mQueuedTasks.fetch_add(count);
+	}
+
+	// Contiguous ranges per queue keep neighbouring tiles on the same thread until stealing kicks in
+	for (uint32_t w = 0; w < numWorkers; ++w) {
+		uint32_t begin = uint32_t(uint64_t(count) * w / numWorkers);
+		uint32_t end = uint32_t(uint64_t(count) * (w + 1) / numWorkers);
+
+		std::lock_guard<std::mutex> lock(mQueues[w]->mutex);
+		for (uint32_t i = begin; i < end; ++i) {
+			mQueues[w]->tasks.emplace_back([&fn, &remaining, i](uint32_t worker) {
+				fn(i, worker);
+				remaining.fetch_sub(1, std::memory_order_release);
+			});
+		}
+	}
+
+	mWakeCondition.notify_all();
+
+	Task task;
+	while (remaining.load(std::memory_order_acquire) > 0) {
+		if (PopTask(0, task))
+			task(0);
+		else
+			std::this_thread::yield();
+	}
+}
+
+void ThreadPool::Submit(std::function<void(uint32_t worker)> fn)
+{
+	uint32_t numWorkers = GetNumWorkers();
+	if (numWorkers == 1) {
+		fn(0);
+		return;
+	}
+
+	mPendingSubmitted.fetch_add(1);
+	{
+		std::lock_guard<std::mutex> lock(mWakeMutex);
+		mQueuedTasks.fetch_add(1);
+	}
+
+	// Round robin over the worker threads, queue 0 is left to the caller
+	uint32_t w = 1 + mNextSubmitQueue++ % (numWorkers - 1);
+	{
+		std::lock_guard<std::mutex> lock(mQueues[w]->mutex);
+		mQueues[w]->tasks.emplace_back([this, fn = std::move(fn)](uint32_t worker) {
+			fn(worker);
+			mPendingSubmitted.fetch_sub(1, std::memory_order_release);
+		});
+	}
+	mWakeCondition.notify_one();
+}
+
+void ThreadPool::Wait()
+{
+	Task task;
+	while (mPendingSubmitted.load(std::memory_order_acquire) > 0) {
+		if (PopTask(0, task))
+			task(0);
+		else
+			std::this_thread::yield();
+	}
+}
+
+bool ThreadPool::PopTask(uint32_t worker, Task& task)
+{
+	{
+		WorkQueue& queue = *mQueues[worker];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (!queue.tasks.empty()) {
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+			mQueuedTasks.fetch_sub(1);
+			return true;
+		}
+	}
+
+	uint32_t numWorkers = GetNumWorkers();
+	for (uint32_t i = 1; i < numWorkers; ++i) {
+		WorkQueue& victim = *mQueues[(worker + i) % numWorkers];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.tasks.empty()) {
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			mQueuedTasks.fetch_sub(1);
+			mStealCount.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+	return false;
+}
+
+void ThreadPool::WorkerLoop(uint32_t worker)
+{
+	Task task;
+	while (true) {
+		if (PopTask(worker, task)) {
+			task(worker);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(mWakeMutex);
+		mWakeCondition.wait(lock, [this] { return !mRunning || mQueuedTasks.load() > 0; });
+		if (!mRunning) return;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+// Fixed set of worker threads with one task queue per worker. Workers pop from
+// the back of their own queue and steal from the front of the others when it
+// runs dry, so uneven tasks (tiles with and without clouds) even out.
+class ThreadPool
+{
+public:
+	// numWorkers includes the calling thread, which helps out while it waits
+	explicit ThreadPool(uint32_t numWorkers = std::thread::hardware_concurrency());
+
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	void operator=(const ThreadPool&) = delete;
+
+	// Runs fn(index, worker) for every index in [0, count) and returns once all of
+	// them are done. worker is in [0, GetNumWorkers()) and can index per thread
+	// scratch data. Must not be called from inside a task.
+	void ParallelFor(uint32_t count, const std::function<void(uint32_t index, uint32_t worker)>& fn);
+
+	// Queues fn on one of the worker threads and returns right away. The calling
+	// thread doesn't pick these up on its own, only while it is in Wait() or
+	// ParallelFor(). With a single worker fn runs before Submit() returns.
+	void Submit(std::function<void(uint32_t worker)> fn);
+
+	// Blocks until every submitted task has finished, helping with the work meanwhile
+	void Wait();
+
+	// Submitted tasks that haven't finished yet
+	uint32_t GetPendingCount() const { return mPendingSubmitted.load(); }
+
+	uint32_t GetNumWorkers() const { return static_cast<uint32_t>(mQueues.size()); }
+
+	// Number of tasks that were run by another worker than the one they were queued on
+	uint64_t GetStealCount() const { return mStealCount.load(); }
+
+private:
+	using Task = std::function<void(uint32_t worker)>;
+
+	struct WorkQueue {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	bool PopTask(uint32_t worker, Task& task);
+
+	void WorkerLoop(uint32_t worker);
+
+	std::vector<std::unique_ptr<WorkQueue>> mQueues;
+	std::vector<std::thread> mThreads;
+
+	std::mutex mWakeMutex;
+	std::condition_variable mWakeCondition;
+	std::atomic<uint32_t> mQueuedTasks{ 0 };
+	std::atomic<uint64_t> mStealCount{ 0 };
+	std::atomic<uint32_t> mPendingSubmitted{ 0 };
+	uint32_t mNextSubmitQueue = 0;
+	bool mRunning = true;
+};
\ No newline at end of file
@@ -2,8 +2,13 @@
 
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
 
 #include <algorithm>
+#include <cstring>
+#include <vector>
+#include <stdio.h>
 
 #include "logger.h"
 
@@ -70,4 +75,115 @@ namespace Utils {
         stbi_image_free(buffer);
     }
 
+    bool WriteImage(const char* filename, int width, int height, int nChannel, const void* data, bool flipVertically)
+    {
+        // A negative stride from the last row writes the rows in reverse
+        int stride = width * nChannel;
+        const unsigned char* pixels = static_cast<const unsigned char*>(data);
+        if (flipVertically) {
+            pixels += size_t(height - 1) * stride;
+            stride = -stride;
+        }
+
+        int result = stbi_write_png(filename, width, height, nChannel, pixels, stride);
+        if (result == 0) {
+            logger::Warn("Failed to write image: " + std::string(filename));
+            return false;
+        }
+        return true;
+    }
+
+    template <typename T>
+    static void Append(std::vector<uint8_t>& out, T value)
+    {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+
+    static void AppendAttribute(std::vector<uint8_t>& out, const char* name, const char* type, const std::vector<uint8_t>& value)
+    {
+        out.insert(out.end(), name, name + strlen(name) + 1);
+        out.insert(out.end(), type, type + strlen(type) + 1);
+        Append<int32_t>(out, static_cast<int32_t>(value.size()));
+        out.insert(out.end(), value.begin(), value.end());
+    }
+
+    bool WriteImageEXR(const char* filename, int width, int height, const uint16_t* data, bool flipVertically)
+    {
+        // Single part scanline file, little endian as the format requires
+        std::vector<uint8_t> header;
+        Append<uint32_t>(header, 20000630);
+        Append<uint32_t>(header, 2);
+
+        // Channels are stored in alphabetical order, 1 = HALF
+        const char channelNames[4] = { 'A', 'B', 'G', 'R' };
+        const int channelIndex[4] = { 3, 2, 1, 0 };
+        std::vector<uint8_t> value;
+        for (char name : channelNames) {
+            value.push_back(uint8_t(name));
+            value.push_back(0);
+            Append<int32_t>(value, 1);
+            Append<uint32_t>(value, 0);
+            Append<int32_t>(value, 1);
+            Append<int32_t>(value, 1);
+        }
+        value.push_back(0);
+        AppendAttribute(header, "channels", "chlist", value);
+
+        AppendAttribute(header, "compression", "compression", { 0 });
+
+        value.clear();
+        Append<int32_t>(value, 0);
+        Append<int32_t>(value, 0);
+        Append<int32_t>(value, width - 1);
+        Append<int32_t>(value, height - 1);
+        AppendAttribute(header, "dataWindow", "box2i", value);
+        AppendAttribute(header, "displayWindow", "box2i", value);
+
+        AppendAttribute(header, "lineOrder", "lineOrder", { 0 });
+
+        value.clear();
+        Append<float>(value, 1.0f);
+        AppendAttribute(header, "pixelAspectRatio", "float", value);
+        AppendAttribute(header, "screenWindowWidth", "float", value);
+
+        value.clear();
+        Append<float>(value, 0.0f);
+        Append<float>(value, 0.0f);
+        AppendAttribute(header, "screenWindowCenter", "v2f", value);
+        header.push_back(0);
+
+        // Offset table, then one block per scanline with the channels planar
+        uint32_t lineSize = uint32_t(width) * 4 * sizeof(uint16_t);
+        uint64_t firstLine = header.size() + uint64_t(height) * sizeof(uint64_t);
+        for (int y = 0; y < height; ++y)
+            Append<uint64_t>(header, firstLine + uint64_t(y) * (lineSize + 8));
+
+        FILE* file = fopen(filename, "wb");
+        if (file == nullptr) {
+            logger::Warn("Failed to write image: " + std::string(filename));
+            return false;
+        }
+
+        bool success = fwrite(header.data(), 1, header.size(), file) == header.size();
+        std::vector<uint8_t> line;
+        line.reserve(lineSize + 8);
+        for (int y = 0; y < height && success; ++y) {
+            const uint16_t* row = data + size_t(flipVertically ? height - 1 - y : y) * width * 4;
+            line.clear();
+            Append<int32_t>(line, y);
+            Append<int32_t>(line, static_cast<int32_t>(lineSize));
+            for (int c : channelIndex) {
+                for (int x = 0; x < width; ++x)
+                    Append<uint16_t>(line, row[x * 4 + c]);
+            }
+            success = fwrite(line.data(), 1, line.size(), file) == line.size();
+        }
+        fclose(file);
+
+        if (!success)
+            logger::Warn("Failed to write image: " + std::string(filename));
+        return success;
+    }
+
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 
 #include "glm-includes.h"
 
+#include <stdint.h>
+
 struct Ray {
 	glm::vec3 origin;
 	glm::vec3 direction;
@@ -11,6 +13,7 @@ namespace Utils {
 
 	bool RayBoxIntersection(const Ray& ray, const glm::vec3& min, const glm::vec3& max, glm::vec2& t);
 
+	// Inverts both matrices on every call, use RayGenerator for more than a handful of rays
 	glm::vec3 GetRayDir(const glm::mat4& P, const glm::mat4& V, const glm::vec2& mouseCoord);
 
 	unsigned char* LoadImage(const char* filename, int* width, int* height, int* nChannel);
@@ -18,4 +21,10 @@ namespace Utils {
 	float* LoadImageFloat(const char* filename, int* width, int* height, int* nChannel);
 
 	void FreeImage(void* buffer);
+
+	// Png, flipVertically takes the rows bottom up as OpenGL reads them back
+	bool WriteImage(const char* filename, int width, int height, int nChannel, const void* data, bool flipVertically = false);
+
+	// Uncompressed half float RGBA OpenEXR, data is interleaved RGBA halfs
+	bool WriteImageEXR(const char* filename, int width, int height, const uint16_t* data, bool flipVertically = false);
 }
\ No newline at end of file
@@ -0,0 +1,184 @@
+#include "weather-map.h"
+
+#include "gl-utils.h"
+#include "glm-includes.h"
+#include "imgui-service.h"
+#include "logger.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cmath>
+
+static uint32_t Hash(uint32_t x, uint32_t y, uint32_t seed)
+{
+	uint32_t h = x * 374761393u + y * 668265263u + seed * 2246822519u;
+	h = (h ^ (h >> 13)) * 1274126177u;
+	return h ^ (h >> 16);
+}
+
+static float HashToFloat(uint32_t h)
+{
+	return float(h & 0xffffff) / float(0xffffff);
+}
+
+// Value noise that wraps every period cells
+static float TileableValueNoise(float x, float y, int period, uint32_t seed)
+{
+	int x0 = int(std::floor(x));
+	int y0 = int(std::floor(y));
+	float fx = x - float(x0);
+	float fy = y - float(y0);
+
+	auto wrap = [period](int v) { return uint32_t(((v % period) + period) % period); };
+	float v00 = HashToFloat(Hash(wrap(x0), wrap(y0), seed));
+	float v10 = HashToFloat(Hash(wrap(x0 + 1), wrap(y0), seed));
+	float v01 = HashToFloat(Hash(wrap(x0), wrap(y0 + 1), seed));
+	float v11 = HashToFloat(Hash(wrap(x0 + 1), wrap(y0 + 1), seed));
+
+	float ux = fx * fx * (3.0f - 2.0f * fx);
+	float uy = fy * fy * (3.0f - 2.0f * fy);
+	return glm::mix(glm::mix(v00, v10, ux), glm::mix(v01, v11, ux), uy);
+}
+
+// u, v in [0, 1), result in [0, 1]
+static float TileableFbm(float u, float v, int frequency, int numOctaves, uint32_t seed)
+{
+	float noise = 0.0f;
+	float amplitude = 0.5f;
+	float totalAmplitude = 0.0f;
+	for (int i = 0; i < numOctaves; ++i) {
+		noise += amplitude * TileableValueNoise(u * frequency, v * frequency, frequency, seed + i);
+		totalAmplitude += amplitude;
+		frequency *= 2;
+		amplitude *= 0.5f;
+	}
+	return noise / totalAmplitude;
+}
+
+static uint8_t ToUnorm8(float v)
+{
+	return static_cast<uint8_t>(std::clamp(v, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+void WeatherMap::Initialize(uint32_t size)
+{
+	mSize = size;
+	Generate(mParams);
+	Upload(size);
+}
+
+void WeatherMap::Generate(const WeatherParams& params)
+{
+	mParams = params;
+	if (mSize == 0) mSize = 256;
+
+	GenerateData(params, mSize, mData);
+
+	if (mTexture)
+		Upload(mSize);
+}
+
+void WeatherMap::GenerateData(const WeatherParams& params, uint32_t size, std::vector<uint8_t>& data)
+{
+	data.resize(size * size * 4);
+
+	for (uint32_t y = 0; y < size; ++y) {
+		for (uint32_t x = 0; x < size; ++x) {
+			float u = float(x) / float(size);
+			float v = float(y) / float(size);
+
+			// Anything below the coverage threshold is clear sky
+			float coverageNoise = TileableFbm(u, v, params.coverageFrequency, params.numOctaves, params.seed);
+			float threshold = 1.0f - params.coverage;
+			float coverage = std::max(coverageNoise - threshold, 0.0f) / std::max(1.0f - threshold, 1e-3f);
+			coverage = std::min(coverage * 2.0f, 1.0f);
+
+			float type = TileableFbm(u, v, params.typeFrequency, 2, params.seed + 101);
+			type = glm::smoothstep(0.3f, 0.7f, type);
+
+			// Rain falls from the thick cores of the taller clouds
+			float precipitation = glm::smoothstep(0.5f, 1.0f, coverage) * type * params.precipitation;
+
+			uint8_t* texel = &data[(y * size + x) * 4];
+			texel[0] = ToUnorm8(coverage);
+			texel[1] = ToUnorm8(type);
+			texel[2] = ToUnorm8(precipitation);
+			texel[3] = 255;
+		}
+	}
+}
+
+bool WeatherMap::Load(const char* filename)
+{
+	int width, height, nChannel;
+	unsigned char* image = Utils::LoadImage(filename, &width, &height, &nChannel);
+	if (image == nullptr)
+		return false;
+
+	if (width != height || nChannel < 3) {
+		logger::Warn("Weather map must be a square RGB(A) image: " + std::string(filename));
+		Utils::FreeImage(image);
+		return false;
+	}
+
+	uint32_t size = static_cast<uint32_t>(width);
+	mData.resize(size * size * 4);
+	for (uint32_t i = 0; i < size * size; ++i) {
+		mData[i * 4 + 0] = image[i * nChannel + 0];
+		mData[i * 4 + 1] = image[i * nChannel + 1];
+		mData[i * 4 + 2] = image[i * nChannel + 2];
+		mData[i * 4 + 3] = 255;
+	}
+	Utils::FreeImage(image);
+
+	Upload(size);
+	return true;
+}
+
+void WeatherMap::Upload(uint32_t size)
+{
+	if (mTexture && mSize != size) {
+		mTexture->destroy();
+		mTexture.reset();
+	}
+	mSize = size;
+	mRevision++;
+
+	if (!mTexture) {
+		GLResourceScope scope("Weather Map");
+		TextureCreateInfo createInfo = { size, size, 1, GL_RGBA, GL_RGBA8, GL_TEXTURE_2D, GL_UNSIGNED_BYTE };
+		createInfo.wrapType = GL_REPEAT;
+		mTexture = std::make_unique<GLTexture>();
+		mTexture->init(&createInfo, mData.data());
+		return;
+	}
+	glTextureSubImage2D(mTexture->handle, 0, 0, 0, size, size, GL_RGBA, GL_UNSIGNED_BYTE, mData.data());
+}
+
+void WeatherMap::AddUI()
+{
+	WeatherParams params = mParams;
+	bool changed = ImGui::SliderFloat("Coverage", &params.coverage, 0.0f, 1.0f);
+	changed |= ImGui::SliderInt("Coverage Frequency", &params.coverageFrequency, 1, 16);
+	changed |= ImGui::SliderInt("Type Frequency", &params.typeFrequency, 1, 16);
+	changed |= ImGui::SliderInt("Weather Octaves", &params.numOctaves, 1, 8);
+	changed |= ImGui::SliderFloat("Precipitation", &params.precipitation, 0.0f, 1.0f);
+	int seed = static_cast<int>(params.seed);
+	changed |= ImGui::DragInt("Seed", &seed);
+	params.seed = static_cast<uint32_t>(seed);
+	if (changed)
+		Generate(params);
+
+	static char path[256] = "Textures/weather.png";
+	ImGui::InputText("Path", path, sizeof(path));
+	if (ImGui::Button("Load Weather Map"))
+		Load(path);
+
+	ImGui::Image((ImTextureID)(uint64_t)mTexture->handle, ImVec2{ 128, 128 });
+}
+
+void WeatherMap::Shutdown()
+{
+	if (mTexture)
+		mTexture->destroy();
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <stdint.h>
+
+struct GLTexture;
+
+struct WeatherParams {
+	// Fraction of the sky covered by clouds
+	float coverage = 0.45f;
+	// Number of coverage cells across the map, kept integral so the map tiles
+	int coverageFrequency = 4;
+	int typeFrequency = 2;
+	int numOctaves = 5;
+	float precipitation = 0.35f;
+	uint32_t seed = 1337;
+};
+
+// 2D weather texture over the cloud domain
+// R - coverage, G - cloud type (0 stratus, 0.5 stratocumulus, 1 cumulus), B - precipitation
+class WeatherMap
+{
+public:
+	void Initialize(uint32_t size);
+
+	// Procedural weather generated on the CPU
+	void Generate(const WeatherParams& params);
+
+	// RGBA8 texels of the procedural weather, doesn't touch OpenGL
+	static void GenerateData(const WeatherParams& params, uint32_t size, std::vector<uint8_t>& data);
+
+	// Loads an RGB(A) image with the channel layout above
+	bool Load(const char* filename);
+
+	void AddUI();
+
+	GLTexture* GetTexture() const { return mTexture.get(); }
+
+	const WeatherParams& GetParams() const { return mParams; }
+
+	// Bumped whenever the texture contents change, for caches built from the map
+	uint32_t GetRevision() const { return mRevision; }
+
+	void Shutdown();
+
+private:
+	void Upload(uint32_t size);
+
+	std::unique_ptr<GLTexture> mTexture;
+	std::vector<uint8_t> mData;
+	uint32_t mSize = 0;
+	uint32_t mRevision = 0;
+
+	WeatherParams mParams;
+};